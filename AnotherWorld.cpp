@@ -2,12 +2,26 @@
 //
 
 #include <chrono>
+#include <thread>
+#include <atomic>
 
 #include "windowsx.h"
 #include "framework.h"
+#include <timeapi.h>
+#include <mmsystem.h>
+#include <shellapi.h>
 #include "AnotherWorld.h"
 
 #include "another-world/virtual-machine.hpp"
+#include "another-world/asset-pack.hpp"
+#include "another-world/presenter.hpp"
+#include "another-world/frame-pacer.hpp"
+#include "another-world/triple-buffer.hpp"
+#include "another-world/rewind.hpp"
+#include "another-world/input-log.hpp"
+#include "another-world/logger.hpp"
+
+#pragma comment(lib, "winmm.lib")
 
 using namespace another_world;
 
@@ -24,12 +38,49 @@ BITMAPINFO bmpInfo;
 LPBYTE pbmpRender;
 HBITMAP bmpRender;
 RECT rcView;
+HDC backDC;                                     // back buffer the view is rendered into,
+HBITMAP backBitmap;                             // recreated when the window is resized
+HBITMAP backBitmapOld;
+LPBYTE pbackPixels;
+int32_t backPitch;
 HFONT hFont;
-uint8_t screen[320 * 200 / 2];
-uint8_t palette[16][3];
+Presenter presenter(HostFormat::XRGB32);
 uint8_t pixelSize;
 std::chrono::steady_clock::time_point start;
-uint8_t keys;
+
+// a finished frame as published by the VM thread
+struct Frame {
+  uint8_t screen[VRAM_SIZE];                    // the visible page
+  uint16_t palette[16];                         // palette in the palette resource format
+  uint8_t pages[4][VRAM_SIZE];                  // all four pages for the debug thumbnails
+  uint32_t ticks;
+};
+
+TripleBuffer<Frame> frames;
+uint16_t palette[16];                           // owned by the vm thread
+bool palette_changed = false;                   // owned by the vm thread
+uint16_t presented_palette[16];                 // owned by the ui thread
+
+// key state is written by the ui thread and sampled once per frame by the
+// vm thread
+enum Keys : uint8_t { KEY_UP = 0x01, KEY_DOWN = 0x02, KEY_LEFT = 0x04, KEY_RIGHT = 0x08, KEY_ACTION = 0x10, KEY_REWIND = 0x20, KEY_FAST_FORWARD = 0x40 };
+std::atomic<uint8_t> keys;
+std::atomic<bool> vm_running;
+
+// while fast forwarding (tab held) only every nth frame is shown
+constexpr uint32_t FAST_FORWARD_PRESENT_INTERVAL = 8;
+
+// audio is mixed on the vm thread and played by a separate audio thread
+// which drains the mixer's ring in blocks of AUDIO_BLOCK samples
+constexpr uint32_t AUDIO_BLOCK = 882;           // 20ms at 44100Hz
+constexpr uint8_t AUDIO_BLOCK_COUNT = 3;
+
+// a session can be recorded with --record <file> and played back with
+// --replay <file>, the log is owned by the vm thread once it starts
+enum class InputMode { LIVE, RECORD, REPLAY };
+InputMode input_mode = InputMode::LIVE;
+std::wstring input_log_path;
+InputLog input_log;
 
 
 uint32_t now() {
@@ -37,33 +88,25 @@ uint32_t now() {
   return (uint32_t)elapsed.count();
 }
 
-// from Erik Aronesty's response on https://stackoverflow.com/a/8098080
-std::string string_format(const std::string fmt, va_list ap) {
-  int size = ((int)fmt.size()) * 2 + 50;   // Use a rubric appropriate for your code
-  std::string str;
-  //va_list ap;
-  while (1) {     // Maximum two passes on a POSIX system...
-    str.resize(size);
-    //va_start(ap, fmt);
-    int n = vsnprintf((char*)str.data(), size, fmt.c_str(), ap);
-    //va_end(ap);
-    if (n > -1 && n < size) {  // Everything worked
-      str.resize(n);
-      return str;
-    }
-    if (n > -1)  // Needed size returned
-      size = n + 1;   // For null char
-    else
-      size *= 2;      // Guess at a larger size (OS specific)
-  }
-  return str;
-}
-
 VirtualMachine vm;
 
+// everything the vm logs goes to vm.awlog as binary records, the logfmt
+// tool turns it back into text (see logger.hpp)
+Logger logger;
+
+#ifdef AW_TRACE
+// frame phase timings, reported to the log and written to trace.json on
+// exit (see trace.hpp)
+Trace trace;
+#endif
+
 // Forward declarations of functions included in this code module:
+void                VmThread();
+void                AudioThread();
 ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
+bool                ReadInputLog(const std::wstring&, InputLog&);
+bool                WriteInputLog(const std::wstring&, const InputLog&);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    About(HWND, UINT, WPARAM, LPARAM);
 
@@ -75,7 +118,18 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     UNREFERENCED_PARAMETER(hPrevInstance);
     UNREFERENCED_PARAMETER(lpCmdLine);
 
-    // TODO: Place code here.
+    int argc;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    for (int i = 1; argv && i + 1 < argc; i++) {
+      if (wcscmp(argv[i], L"--record") == 0) {
+        input_mode = InputMode::RECORD;
+        input_log_path = argv[++i];
+      } else if (wcscmp(argv[i], L"--replay") == 0) {
+        input_mode = InputMode::REPLAY;
+        input_log_path = argv[++i];
+      }
+    }
+    LocalFree(argv);
 
     // Initialize global strings
     LoadStringW(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
@@ -98,16 +152,16 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     
     bmpInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     bmpInfo.bmiHeader.biWidth = 320;
-    bmpInfo.bmiHeader.biHeight = 200;
+    bmpInfo.bmiHeader.biHeight = -200; // top-down to match the vram layout
     bmpInfo.bmiHeader.biPlanes = 1;
-    bmpInfo.bmiHeader.biBitCount = 24;
+    bmpInfo.bmiHeader.biBitCount = 32;
     bmpInfo.bmiHeader.biCompression = BI_RGB;
     bmpRender = CreateDIBSection(NULL, &bmpInfo, DIB_RGB_COLORS, (void**)&pbmpRender, NULL, 0);
 
 
     
 
-    another_world::read_file = [](std::string filename, uint32_t offset, uint32_t length, char* buffer) {     
+    vm.engine.read_file = [](void* user, std::string filename, uint32_t offset, uint32_t length, char* buffer) {     
       filename = "c:\\another-world-data\\" + filename;
       std::wstring wfilename(filename.begin(), filename.end());
       HANDLE fh = CreateFile(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -118,7 +172,40 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
       return result && bytes_read == length;
     };
 
-    another_world::write_file = [](std::string filename, uint32_t length, char* buffer) {
+    vm.engine.file_size = [](void* user, std::string filename) {
+      filename = "c:\\another-world-data\\" + filename;
+      std::wstring wfilename(filename.begin(), filename.end());
+      WIN32_FILE_ATTRIBUTE_DATA attributes;
+      if (!GetFileAttributesEx(wfilename.c_str(), GetFileExInfoStandard, &attributes)) {
+        return uint32_t(0);
+      }
+      return uint32_t(attributes.nFileSizeLow);
+    };
+
+    vm.engine.map_file = [](void* user, std::string filename, uint32_t* size) -> const uint8_t* {
+      filename = "c:\\another-world-data\\" + filename;
+      std::wstring wfilename(filename.begin(), filename.end());
+      HANDLE fh = CreateFile(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (fh == INVALID_HANDLE_VALUE) {
+        return nullptr;
+      }
+
+      // the view keeps the mapping alive once the handles are closed
+      *size = GetFileSize(fh, NULL);
+      HANDLE mapping = *size ? CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+      void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+      if (mapping) {
+        CloseHandle(mapping);
+      }
+      CloseHandle(fh);
+      return (const uint8_t*)data;
+    };
+
+    vm.engine.unmap_file = [](void* user, const uint8_t* data, uint32_t size) {
+      UnmapViewOfFile(data);
+    };
+
+    vm.engine.write_file = [](void* user, std::string filename, uint32_t length, char* buffer) {
       filename = "c:\\another-world-data\\" + filename;
       std::wstring wfilename(filename.begin(), filename.end());
       HANDLE fh = CreateFile(wfilename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -131,40 +218,38 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     
     
     
-    another_world::debug = [](const char *fmt, ...) {
-      uint32_t last_debug_flush_ms = 0;
-
-      va_list args;     
+    logger.open("vm.awlog");
+    vm.engine.debug = [](void* user, const char *fmt, ...) {
+      va_list args;
       va_start(args, fmt);
-      std::string line = string_format(fmt, args) + "\n";
+      logger.vlog(fmt, args);
       va_end(args);
-    
-      std::wstring filename = L"vm.log";
-      HANDLE log_file_handle = CreateFile(filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-      WriteFile(log_file_handle, line.c_str(), line.length(), NULL, NULL);
-      CloseHandle(log_file_handle);
- 
     };
 
-    another_world::update_screen = [](uint8_t *buffer) {
-      memcpy(screen, buffer, 320 * 200 / 2);
+    vm.engine.update_screen = [](void* user, uint8_t *buffer) {
+      // called on the vm thread, snapshot the page and palette into our
+      // half of the triple buffer and hand it over to the ui thread
+      Frame& frame = frames.write_buffer();
+      memcpy(frame.screen, buffer, VRAM_SIZE);
+      memcpy(frame.palette, palette, sizeof(palette));
+      for (uint8_t i = 0; i < 4; i++) {
+        memcpy(frame.pages[i], vm.engine.vram[i], VRAM_SIZE);
+      }
+      frame.ticks = vm.ticks;
+      frames.publish();
+
+      palette_changed = false;
+      InvalidateRect(hWnd, NULL, FALSE);
     };
 
-    another_world::set_palette = [](uint16_t* p) {
-      // sixten palette entries in the format 0x0RGB
-      for (uint8_t i = 0; i < 16; i++) {
-        uint16_t color = p[i];
-
-        uint8_t r = (color & 0b0000000000001111) >> 0;
-        uint8_t g = (color & 0b1111000000000000) >> 12;
-        uint8_t b = (color & 0b0000111100000000) >> 8;
-        palette[i][0] = (r << 4) | r;
-        palette[i][1] = (g << 4) | g;
-        palette[i][2] = (b << 4) | b; 
-      }
+    vm.engine.set_palette = [](void* user, uint16_t* p) {
+      // called on the vm thread, the palette is published along with the
+      // next frame
+      memcpy(palette, p, sizeof(palette));
+      palette_changed = true;
     };
     /*
-    another_world::debug_display_update = []() {
+    vm.engine.debug_display_update = [](void* user) {
       InvalidateRect(hWnd, NULL, FALSE);
       UpdateWindow(hWnd);
 
@@ -172,49 +257,301 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
 
 
+#ifdef AW_TRACE
+    vm.engine.trace = &trace;
+    trace.name_thread("ui");
+#endif
+
+    // resources come ready to use from the asset pack when there is one
+    // (see the pack tool), otherwise they're unpacked from the banks
+    vm.engine.pack = AssetPack::open(vm.engine);
     vm.init();
 
-    // initialise the first chapter
-    vm.initialise_chapter(16001);
+    if (input_mode == InputMode::REPLAY && !ReadInputLog(input_log_path, input_log)) {
+      vm.engine.debug(vm.engine.user, "unable to replay '%S', it isn't a recording that starts from a chapter", input_log_path.c_str());
+      input_mode = InputMode::LIVE;
+    }
+
+    // initialise the first chapter (or the one the recording starts from)
+    vm.initialise_chapter(input_mode == InputMode::REPLAY ? input_log.chapter : 16001);
     
     start = std::chrono::steady_clock::now();
 
-    uint32_t last_frame_clock = now();
+    // the vm runs on its own thread and hands finished frames over to
+    // the ui thread through the triple buffer
+    vm_running = true;
+    std::thread vm_thread(VmThread);
+    std::thread audio_thread(AudioThread);
 
-    while (true) {
-      // if there is a message to process then do it
-      if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-        if (WM_QUIT == msg.message) {
-          break;
-        }
+    while (GetMessage(&msg, nullptr, 0, 0)) {
+      if (!TranslateAccelerator(msg.hwnd, hAccelTable, &msg))
+      {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+      }
+    }
 
-        if (!TranslateAccelerator(msg.hwnd, hAccelTable, &msg))
-        {
-          TranslateMessage(&msg);
-          DispatchMessage(&msg);
+    vm_running = false;
+    vm_thread.join();
+    audio_thread.join();
+
+    logger.log("logger: %llu records, %llu waits for space, %llu cut short", (unsigned long long)logger.records.load(),
+      (unsigned long long)logger.waits.load(), (unsigned long long)logger.truncated.load());
+    logger.close();
+
+    return (int) msg.wParam;
+}
+
+
+
+//
+//  FUNCTION: VmThread()
+//
+//  PURPOSE: Runs the virtual machine at the pace it asks for
+//
+void VmThread()
+{
+  // sleep between frames rather than busy waiting, raising the timer
+  // resolution keeps those sleeps accurate to around a millisecond
+  timeBeginPeriod(1);
+
+  FramePacer pacer;
+  Rewind rewind;
+  uint32_t replay_frame = 0;
+
+  // fast forward statistics, reported each time the key is released
+  uint32_t fast_forward_start = 0;
+  uint32_t fast_forward_frames = 0;
+  uint64_t fast_forward_ticks = 0;
+
+#ifdef AW_TRACE
+  trace.name_thread("vm");
+#endif
+
+  Input live;
+  auto run_frame = [&]() {
+    AW_TRACE_SCOPE(vm.engine.trace, FRAME);
+
+    if (input_mode == InputMode::REPLAY && replay_frame < input_log.frames()) {
+      vm.engine.input = input_log.frame(replay_frame++);
+    } else {
+      vm.engine.input = live;
+    }
+
+    if (input_mode == InputMode::RECORD) {
+      input_log.record(vm.engine.input);
+    }
+
+    vm.execute_threads();
+
+    // once the recording runs out check we ended up where it did and
+    // hand control back to the keyboard
+    if (input_mode == InputMode::REPLAY && replay_frame == input_log.frames()) {
+      vm.flush_pages();
+      bool matched = frame_hash(vm) == input_log.final_hash;
+      vm.engine.debug(vm.engine.user, "replay of %u frames %s", replay_frame, matched ? "matched" : "DIVERGED from the recording");
+      input_mode = InputMode::LIVE;
+    }
+  };
+
+  while (vm_running) {
+    uint8_t k = keys;
+    bool fast_forward = (k & KEY_FAST_FORWARD) && !(k & KEY_REWIND);
+
+    if (!fast_forward && vm.fast_forward) {
+      // back to normal speed, the pacer would otherwise try to catch up
+      // with all the time spent fast forwarding
+      vm.set_fast_forward(false);
+      pacer.reset();
+
+      uint32_t elapsed = now() - fast_forward_start;
+      vm.engine.debug(vm.engine.user, "fast forward: %u frames, %.1fx real time", fast_forward_frames,
+        elapsed ? fast_forward_ticks * 20.0 / elapsed : 0.0);
+    }
+
+    // wait for as many 20ms ticks as the game asked for in the pause
+    // register, this may ask for extra frames if we're catching up.
+    // fast forward ignores the pause register altogether
+    uint32_t count = fast_forward ? 0 : pacer.wait(vm.registers[0xff]);
+
+    // sample the keyboard once per frame
+    k = keys;
+    live.up      = (k & KEY_UP) != 0;
+    live.down    = (k & KEY_DOWN) != 0;
+    live.left    = (k & KEY_LEFT) != 0;
+    live.right   = (k & KEY_RIGHT) != 0;
+    live.action  = (k & KEY_ACTION) != 0;
+
+    uint32_t frame_start = now();
+    if (fast_forward) {
+      if (!vm.fast_forward) {
+        vm.set_fast_forward(true, FAST_FORWARD_PRESENT_INTERVAL);
+        fast_forward_start = frame_start;
+        fast_forward_frames = 0;
+        fast_forward_ticks = 0;
+      }
+
+      // run flat out for about a display refresh before looking at the
+      // keyboard again, rewind history is only kept once per batch
+      uint32_t batch_frames = 0;
+      do {
+        run_frame();
+        batch_frames++;
+        fast_forward_frames++;
+        fast_forward_ticks += vm.registers[0xff] > 0 ? vm.registers[0xff] : 0;
+      } while (now() - frame_start < 16);
+
+      vm.flush_pages();
+
+      AW_TRACE_SCOPE(vm.engine.trace, REWIND);
+      rewind.capture(vm, batch_frames);
+    } else if ((k & KEY_REWIND) && input_mode != InputMode::REPLAY) {
+      // step back through the history one frame at a time while the
+      // rewind key is held, a recording forgets the frames undone (a whole
+      // batch of them for history captured while fast forwarding)
+      if (uint32_t undone = rewind.rewind(vm, 1)) {
+        if (input_mode == InputMode::RECORD) {
+          input_log.truncate(input_log.frames() > undone ? input_log.frames() - undone : 0);
         }
+        vm.engine.update_screen(vm.engine.user, vm.visible_vram);
+      }
+    } else {
+      while (count--) {
+        run_frame();
+
+        AW_TRACE_SCOPE(vm.engine.trace, REWIND);
+        rewind.capture(vm);
       }
-     
-      uint32_t clock = now();
-
-      // aim for 50 frames per second
-      uint16_t pause_ms = 20 * vm.registers[0xff];
-     // pause_ms = 0;
-      if(clock - last_frame_clock > pause_ms) {
-        uint32_t frame_start = now();
-        
-        
-        vm.execute_threads();
-        //debug("Frame took %dms", now() - frame_start);
-        last_frame_clock = clock;
-        InvalidateRect(hWnd, NULL, FALSE);
-      }      
     }
 
-    return (int) msg.wParam;
+    // a palette change (or fade step) without a new frame still needs
+    // to reach the screen
+    if (palette_changed) {
+      vm.engine.update_screen(vm.engine.user, vm.visible_vram);
+    }
+  }
+
+  timeEndPeriod(1);
+
+  if (vm.engine.debug) {
+    vm.engine.debug(vm.engine.user, "%s", pacer.report().c_str());
+    vm.engine.debug(vm.engine.user, "frames dropped: %u, repeated: %u", frames.dropped_frames(), frames.repeated_frames());
+    vm.engine.debug(vm.engine.user, "rewind %s", rewind.report().c_str());
+  }
+
+#ifdef AW_TRACE
+  vm.engine.debug(vm.engine.user, "frame phases: %s", trace.report().c_str());
+
+  std::string json = trace.chrome_json();
+  HANDLE trace_file = CreateFile(L"trace.json", GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  DWORD bytes_written = 0;
+  WriteFile(trace_file, json.c_str(), DWORD(json.length()), &bytes_written, NULL);
+  CloseHandle(trace_file);
+#endif
+
+  if (input_mode == InputMode::RECORD) {
+    vm.flush_pages();
+    input_log.final_hash = frame_hash(vm);
+    WriteInputLog(input_log_path, input_log);
+  }
+}
+
+//
+//  FUNCTION: ReadInputLog(const std::wstring&, InputLog&)
+//
+//  PURPOSE: Loads a recording made with --record
+//
+bool ReadInputLog(const std::wstring& path, InputLog& log)
+{
+  HANDLE fh = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fh == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  std::vector<uint8_t> data(GetFileSize(fh, NULL));
+  DWORD bytes_read = 0;
+  BOOL result = ReadFile(fh, data.data(), (DWORD)data.size(), &bytes_read, NULL);
+  CloseHandle(fh);
+
+  // the window has no way to load a snapshot, so only recordings that
+  // start from a chapter can be replayed here (see the tools' run command)
+  return result && bytes_read == data.size() && log.decode(data.data(), (uint32_t)data.size()) &&
+    log.chapter != InputLog::FROM_SNAPSHOT;
 }
 
+//
+//  FUNCTION: WriteInputLog(const std::wstring&, const InputLog&)
+//
+//  PURPOSE: Saves the session recorded with --record
+//
+bool WriteInputLog(const std::wstring& path, const InputLog& log)
+{
+  std::vector<uint8_t> data = log.encode();
+  HANDLE fh = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fh == INVALID_HANDLE_VALUE) {
+    return false;
+  }
 
+  DWORD bytes_written = 0;
+  BOOL result = WriteFile(fh, data.data(), (DWORD)data.size(), &bytes_written, NULL);
+  CloseHandle(fh);
+  return result && bytes_written == data.size();
+}
+
+//
+//  FUNCTION: AudioThread()
+//
+//  PURPOSE: Plays the output of the vm's mixer through the wave mapper
+//
+void AudioThread()
+{
+  WAVEFORMATEX format = { 0 };
+  format.wFormatTag = WAVE_FORMAT_PCM;
+  format.nChannels = 1;
+  format.nSamplesPerSec = vm.mixer.sample_rate;
+  format.wBitsPerSample = 16;
+  format.nBlockAlign = format.nChannels * format.wBitsPerSample / 8;
+  format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+
+  // the driver signals the event each time it finishes with a block
+  HANDLE block_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HWAVEOUT wave_out;
+  if (waveOutOpen(&wave_out, WAVE_MAPPER, &format, (DWORD_PTR)block_done, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+    CloseHandle(block_done);
+    return;
+  }
+
+  static int16_t samples[AUDIO_BLOCK_COUNT][AUDIO_BLOCK];
+  WAVEHDR headers[AUDIO_BLOCK_COUNT] = { 0 };
+
+  // start with every block queued as silence, from then on each block is
+  // refilled from the mixer as soon as the driver hands it back
+  for (uint8_t i = 0; i < AUDIO_BLOCK_COUNT; i++) {
+    memset(samples[i], 0, sizeof(samples[i]));
+    headers[i].lpData = (LPSTR)samples[i];
+    headers[i].dwBufferLength = sizeof(samples[i]);
+    waveOutPrepareHeader(wave_out, &headers[i], sizeof(WAVEHDR));
+    waveOutWrite(wave_out, &headers[i], sizeof(WAVEHDR));
+  }
+
+  while (vm_running) {
+    WaitForSingleObject(block_done, 100);
+
+    for (uint8_t i = 0; i < AUDIO_BLOCK_COUNT; i++) {
+      if (headers[i].dwFlags & WHDR_DONE) {
+        vm.mixer.consume(samples[i], AUDIO_BLOCK);
+        waveOutWrite(wave_out, &headers[i], sizeof(WAVEHDR));
+      }
+    }
+  }
+
+  waveOutReset(wave_out);
+  for (uint8_t i = 0; i < AUDIO_BLOCK_COUNT; i++) {
+    waveOutUnprepareHeader(wave_out, &headers[i], sizeof(WAVEHDR));
+  }
+  waveOutClose(wave_out);
+  CloseHandle(block_done);
+}
 
 //
 //  FUNCTION: MyRegisterClass()
@@ -270,29 +607,47 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
    return TRUE;
 }
 
-void vram_to_bmp(LPBYTE pd, uint8_t* ps) {
-  for (uint16_t y = 0; y < 200; y++) {
-    uint8_t* ppd = &pd[(199 - y) * 320 * 3];
-
-    for (uint16_t x = 0; x < 320; x += 2) {
-      uint8_t p = *ps;
-      uint8_t p1 = p >> 4;
-      uint8_t p2 = p & 0x0f;
-
-      *ppd++ = palette[p1][2];
-      *ppd++ = palette[p1][1];
-      *ppd++ = palette[p1][0];
-
-      *ppd++ = palette[p2][2];
-      *ppd++ = palette[p2][1];
-      *ppd++ = palette[p2][0];
-
-      ps++;
-    }
+//
+//  FUNCTION: ResizeBackBuffer(HWND, uint16_t, uint16_t)
+//
+//  PURPOSE: (Re)creates the 32-bit back buffer that frames are presented into
+//
+void ResizeBackBuffer(HWND hWnd, uint16_t width, uint16_t height)
+{
+  if (backDC) {
+    SelectObject(backDC, backBitmapOld);
+    DeleteObject(backBitmap);
+    DeleteDC(backDC);
+    backDC = NULL;
   }
-}
 
+  if (width == 0 || height == 0) {
+    return;
+  }
 
+  BITMAPINFO backInfo = {};
+  backInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  backInfo.bmiHeader.biWidth = width;
+  backInfo.bmiHeader.biHeight = -height; // top-down
+  backInfo.bmiHeader.biPlanes = 1;
+  backInfo.bmiHeader.biBitCount = 32;
+  backInfo.bmiHeader.biCompression = BI_RGB;
+
+  HDC hdc = GetDC(hWnd);
+  backDC = CreateCompatibleDC(hdc);
+  ReleaseDC(hWnd, hdc);
+
+  backBitmap = CreateDIBSection(backDC, &backInfo, DIB_RGB_COLORS, (void**)&pbackPixels, NULL, 0);
+  backBitmapOld = (HBITMAP)SelectObject(backDC, backBitmap);
+  backPitch = width * 4;
+
+  // the border around the view never changes so only needs filling once
+  RECT rcBack;
+  SetRect(&rcBack, 0, 0, width, height);
+  HBRUSH backgroundBrush = CreateSolidBrush(RGB(30, 40, 50));
+  FillRect(backDC, &rcBack, backgroundBrush);
+  DeleteObject(backgroundBrush);
+}
 
 //
 //  FUNCTION: WndProc(HWND, UINT, WPARAM, LPARAM)
@@ -338,92 +693,93 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
       // scale and centre the view rectangle
       SetRect(&rcView, 0, 0, rcSurface.right * pixelSize, rcSurface.bottom * pixelSize);
       OffsetRect(&rcView, (width - rcView.right) / 2, (height - rcView.bottom) / 2);
+
+      ResizeBackBuffer(hWnd, width, height);
     }break;
 
     case WM_KEYDOWN:
     {
       switch (wParam) {
-        case VK_UP:     { input.up      = true; break; }
-        case VK_DOWN:   { input.down    = true; break; }
-        case VK_LEFT:   { input.left    = true; break; }
-        case VK_RIGHT:  { input.right   = true; break; }
-        case VK_SPACE:  { input.action  = true; break; }
+        case VK_UP:     { keys |= KEY_UP;     break; }
+        case VK_DOWN:   { keys |= KEY_DOWN;   break; }
+        case VK_LEFT:   { keys |= KEY_LEFT;   break; }
+        case VK_RIGHT:  { keys |= KEY_RIGHT;  break; }
+        case VK_SPACE:  { keys |= KEY_ACTION; break; }
+        case VK_BACK:   { keys |= KEY_REWIND; break; }
+        case VK_TAB:    { keys |= KEY_FAST_FORWARD; break; }
       }
     }break;
     case WM_KEYUP:
     {
       switch (wParam) {
-        case VK_UP:     { input.up      = false; break; }
-        case VK_DOWN:   { input.down    = false; break; }
-        case VK_LEFT:   { input.left    = false; break; }
-        case VK_RIGHT:  { input.right   = false; break; }
-        case VK_SPACE:  { input.action  = false; break; }
+        case VK_UP:     { keys &= uint8_t(~KEY_UP);     break; }
+        case VK_DOWN:   { keys &= uint8_t(~KEY_DOWN);   break; }
+        case VK_LEFT:   { keys &= uint8_t(~KEY_LEFT);   break; }
+        case VK_RIGHT:  { keys &= uint8_t(~KEY_RIGHT);  break; }
+        case VK_SPACE:  { keys &= uint8_t(~KEY_ACTION); break; }
+        case VK_BACK:   { keys &= uint8_t(~KEY_REWIND); break; }
+        case VK_TAB:    { keys &= uint8_t(~KEY_FAST_FORWARD); break; }
       }
     }break;
     case WM_PAINT:
         {
+          AW_TRACE_SCOPE(vm.engine.trace, DISPLAY);
+
           PAINTSTRUCT ps;
           HDC hdc = BeginPaint(hWnd, &ps);
 
           RECT rcClient;
           GetClientRect(hWnd, &rcClient);
 
-          // setup a back buffer device context to render into
-          HDC drawDC = CreateCompatibleDC(hdc);
-          HBITMAP bmpDraw = CreateCompatibleBitmap(hdc, rcClient.right - rcClient.left, rcClient.bottom - rcClient.top);
-          HBITMAP hbmOld = (HBITMAP)SelectObject(drawDC, bmpDraw);
-         
-          HBRUSH backgroundBrush = CreateSolidBrush(RGB(30, 40, 50));
-          FillRect(drawDC, &rcClient, backgroundBrush);
+          // pick up the newest complete frame from the vm thread, if there
+          // isn't one we repaint the last frame again
+          frames.acquire();
+          const Frame& frame = frames.read_buffer();
 
-          if (bmpRender) {
-            uint16_t thumb_width = (rcView.right - rcView.left) / 4;
-            uint16_t thumb_height = (rcView.bottom - rcView.top) / 4;
-
-            RECT rcThumb;
-            SetRect(&rcThumb, rcView.left, rcView.bottom - thumb_height, rcView.left + thumb_width, rcView.bottom);
-            InflateRect(&rcThumb, -10, -10);
+          if (memcmp(presented_palette, frame.palette, sizeof(presented_palette)) != 0) {
+            memcpy(presented_palette, frame.palette, sizeof(presented_palette));
+            presenter.set_palette(presented_palette);
+          }
 
-            vram_to_bmp(pbmpRender, screen); // background
-            StretchDIBits(drawDC, rcView.left, rcView.top, rcView.right - rcView.left, rcView.bottom - rcView.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
-            
-            vram_to_bmp(pbmpRender, vram0); // screen
-            StretchDIBits(drawDC, rcThumb.left, rcThumb.top, rcThumb.right - rcThumb.left, rcThumb.bottom - rcThumb.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
+          if (backDC && pixelSize) {
+            // make sure GDI has finished with the DIB before we write to it
+            GdiFlush();
 
-            rcThumb.left += thumb_width; rcThumb.right += thumb_width;
+            // convert and scale the visible page straight into the back buffer
+            LPBYTE pView = pbackPixels + rcView.top * backPitch + rcView.left * 4;
+            presenter.present_scaled(frame.screen, pView, backPitch, pixelSize);
 
-            vram_to_bmp(pbmpRender, vram1); // screen
-            StretchDIBits(drawDC, rcThumb.left, rcThumb.top, rcThumb.right - rcThumb.left, rcThumb.bottom - rcThumb.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
+            if (bmpRender) {
+              uint16_t thumb_width = (rcView.right - rcView.left) / 4;
+              uint16_t thumb_height = (rcView.bottom - rcView.top) / 4;
 
-            rcThumb.left += thumb_width; rcThumb.right += thumb_width;
+              RECT rcThumb;
+              SetRect(&rcThumb, rcView.left, rcView.bottom - thumb_height, rcView.left + thumb_width, rcView.bottom);
+              InflateRect(&rcThumb, -10, -10);
 
-            vram_to_bmp(pbmpRender, vram2); // screen
-            StretchDIBits(drawDC, rcThumb.left, rcThumb.top, rcThumb.right - rcThumb.left, rcThumb.bottom - rcThumb.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
+              for (auto page : frame.pages) {
+                presenter.present(page, pbmpRender, 320 * 4); // debug thumbnail
+                StretchDIBits(backDC, rcThumb.left, rcThumb.top, rcThumb.right - rcThumb.left, rcThumb.bottom - rcThumb.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
 
-            rcThumb.left += thumb_width; rcThumb.right += thumb_width;
+                rcThumb.left += thumb_width; rcThumb.right += thumb_width;
+              }
+            }
 
-            vram_to_bmp(pbmpRender, vram3); // screen
-            StretchDIBits(drawDC, rcThumb.left, rcThumb.top, rcThumb.right - rcThumb.left, rcThumb.bottom - rcThumb.top, 0, 0, 320, 200, pbmpRender, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
-            
+            BitBlt(hdc, rcClient.left, rcClient.top, rcClient.right - rcClient.left, rcClient.bottom - rcClient.top, backDC, 0, 0, SRCCOPY);
           }
 
-          BitBlt(hdc, rcClient.left, rcClient.top, rcClient.right - rcClient.left, rcClient.bottom - rcClient.top, drawDC, 0, 0, SRCCOPY);
-
-          std::wstring tick_count = std::to_wstring(vm.ticks);
+          std::wstring status = std::to_wstring(frame.ticks) +
+            L"  dropped: " + std::to_wstring(frames.dropped_frames()) +
+            L"  repeated: " + std::to_wstring(frames.repeated_frames());
 
           SelectFont(hdc, hFont);
-          DrawText(hdc, tick_count.c_str(), -1, &rcClient, DT_TOP | DT_LEFT);
-
-          SelectObject(drawDC, hbmOld);
-          DeleteDC(drawDC);
-          DeleteObject(bmpDraw);
-          DeleteObject(backgroundBrush);
-
+          DrawText(hdc, status.c_str(), -1, &rcClient, DT_TOP | DT_LEFT);
 
-            EndPaint(hWnd, &ps);
+          EndPaint(hWnd, &ps);
         }
         break;
     case WM_DESTROY:
+        ResizeBackBuffer(hWnd, 0, 0);
         PostQuitMessage(0);
         break;
     default:
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "asset-pack.hpp"
+#include "byte-killer-packer.hpp"
+#include "lz.hpp"
+
+namespace another_world {
+
+  constexpr char     PACK_MAGIC[4] = { 'A', 'W', 'P', 'K' };
+  constexpr uint16_t PACK_VERSION = 2;
+  constexpr uint32_t HEADER_SIZE = 64;
+  constexpr uint32_t INDEX_ENTRY_SIZE = 32;
+  constexpr uint32_t PLANAR_IMAGE_SIZE = 320 * 200 / 2;
+
+#ifdef AW_FRAMEBUFFER_CHUNKY
+  constexpr uint8_t FRAMEBUFFER_FORMAT = 1;
+#else
+  constexpr uint8_t FRAMEBUFFER_FORMAT = 0;
+#endif
+
+  static uint16_t read_u16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+  static uint32_t read_u32(const uint8_t* p) { return read_u16(p) | (uint32_t(read_u16(p + 2)) << 16); }
+  static uint64_t read_u64(const uint8_t* p) { return read_u32(p) | (uint64_t(read_u32(p + 4)) << 32); }
+
+  static void write_u16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+  static void write_u32(uint8_t* p, uint32_t v) { write_u16(p, uint16_t(v)); write_u16(p + 2, uint16_t(v >> 16)); }
+  static void write_u64(uint8_t* p, uint64_t v) { write_u32(p, uint32_t(v)); write_u32(p + 4, uint32_t(v >> 32)); }
+
+  static uint32_t align(uint32_t offset) {
+    return (offset + AssetPack::ALIGNMENT - 1) & ~(AssetPack::ALIGNMENT - 1);
+  }
+
+  uint64_t AssetPack::checksum(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ p[i]) * 0x100000001b3;
+    }
+    return hash;
+  }
+
+  uint64_t AssetPack::definitions_checksum(const ResourceTable& resources) {
+    uint64_t hash = checksum(nullptr, 0);
+    for (uint16_t id = 0; id < resources.size(); id++) {
+      uint8_t record[12];
+      record[0] = uint8_t(resources.types[id]);
+      record[1] = resources.bank_ids[id];
+      write_u32(record + 2, resources.bank_offsets[id]);
+      write_u16(record + 6, resources.packed_sizes[id]);
+      write_u16(record + 8, resources.sizes[id]);
+      write_u16(record + 10, 0);
+      hash = checksum(record, sizeof(record), hash);
+    }
+    return hash;
+  }
+
+  std::shared_ptr<AssetPack> AssetPack::open(const Engine& engine, const std::string& filename) {
+    std::shared_ptr<AssetPack> pack(new AssetPack());
+
+    // map the pack if the host can, otherwise read it in whole
+    if (engine.map_file) {
+      pack->data = engine.map_file(engine.user, filename, &pack->size);
+      if (pack->data) {
+        pack->user = engine.user;
+        pack->unmap_file = engine.unmap_file;
+      }
+    }
+    if (!pack->data && engine.file_size) {
+      pack->size = engine.file_size(engine.user, filename);
+      pack->contents.resize(pack->size);
+      if (pack->size == 0 || !engine.read_file(engine.user, filename, 0, pack->size, (char*)pack->contents.data())) {
+        return nullptr;
+      }
+      pack->data = pack->contents.data();
+    }
+    if (!pack->data || pack->size < HEADER_SIZE) {
+      return nullptr;
+    }
+
+    const uint8_t* header = pack->data;
+    if (memcmp(header, PACK_MAGIC, 4) != 0 || read_u16(header + 4) != PACK_VERSION || header[6] != FRAMEBUFFER_FORMAT) {
+      return nullptr;
+    }
+
+    uint32_t count = read_u32(header + 8);
+    uint32_t index_offset = read_u32(header + 12);
+    if (count > 0xffff || read_u32(header + 16) != pack->size || index_offset < HEADER_SIZE ||
+      index_offset > pack->size || (pack->size - index_offset) / INDEX_ENTRY_SIZE < count) {
+      return nullptr;
+    }
+
+    const uint8_t* index = pack->data + index_offset;
+    if (checksum(index, count * INDEX_ENTRY_SIZE) != read_u64(header + 24)) {
+      return nullptr;
+    }
+    pack->definitions = read_u64(header + 32);
+
+    pack->entry_count = uint16_t(count);
+    pack->entries.reset(new Entry[count]);
+    for (uint32_t id = 0; id < count; id++) {
+      const uint8_t* p = index + id * INDEX_ENTRY_SIZE;
+      Entry& entry = pack->entries[id];
+      entry.offset = read_u32(p);
+      entry.length = read_u32(p + 4);
+      entry.definition.type = Resource::Type(p[8]);
+      entry.definition.bank_id = p[9];
+      entry.definition.packed_size = read_u16(p + 10);
+      entry.definition.bank_offset = read_u32(p + 12);
+      entry.definition.size = read_u16(p + 16);
+      entry.codec = Codec(p[18]);
+      entry.stored = read_u32(p + 20);
+      entry.checksum = read_u64(p + 24);
+
+      // anything that doesn't lie within the pack, or is in a form we
+      // don't know, is left to the banks
+      if (entry.offset != 0 && (entry.offset % ALIGNMENT != 0 || entry.offset > pack->size || pack->size - entry.offset < entry.stored ||
+        entry.codec > Codec::BYTE_KILLER || (entry.codec == Codec::RAW && entry.stored != entry.length))) {
+        entry.offset = 0;
+      }
+    }
+
+    return pack;
+  }
+
+  AssetPack::~AssetPack() {
+    if (unmap_file) {
+      unmap_file(user, data, size);
+    }
+  }
+
+  Resource AssetPack::definition(uint16_t id) const {
+    return entries[id].definition;
+  }
+
+  const char* AssetPack::codec_name(Codec codec) {
+    static const char* names[] = { "raw", "lz", "bytekiller" };
+    return codec <= Codec::BYTE_KILLER ? names[uint8_t(codec)] : "?";
+  }
+
+  const uint8_t* AssetPack::checked(uint16_t id) {
+    if (id >= entry_count || entries[id].offset == 0) {
+      return nullptr;
+    }
+
+    // checked the first time it's needed, if several threads get here at
+    // once they all check it and all agree
+    Entry& entry = entries[id];
+    uint8_t status = entry.status.load(std::memory_order_acquire);
+    if (status == 0) {
+      status = checksum(data + entry.offset, entry.stored) == entry.checksum ? 1 : 2;
+      entry.status.store(status, std::memory_order_release);
+    }
+
+    return status == 1 ? data + entry.offset : nullptr;
+  }
+
+  const uint8_t* AssetPack::get(uint16_t id) {
+    const uint8_t* stored = checked(id);
+    return stored && entries[id].codec == Codec::RAW ? stored : nullptr;
+  }
+
+  // decodes `stored_size` bytes of `type` data stored with `codec` into
+  // exactly `length` bytes at `destination`
+  static bool decode(AssetPack::Codec codec, Resource::Type type, const uint8_t* stored, uint32_t stored_size, uint8_t* destination,
+    uint32_t length) {
+    switch (codec) {
+      case AssetPack::Codec::RAW: {
+        if (stored_size != length) {
+          return false;
+        }
+        memcpy(destination, stored, length);
+        return true;
+      }
+
+      case AssetPack::Codec::LZ: {
+        return lz::decode(stored, stored_size, destination, length) == stored_size;
+      }
+
+      case AssetPack::Codec::BYTE_KILLER: {
+        // unpacked straight out of the pack, images to bitplanes that are
+        // converted after
+        ByteKiller bk;
+        bool image = type == Resource::Type::IMAGE;
+        uint32_t unpacked_size = image ? PLANAR_IMAGE_SIZE : length;
+        if (stored_size > unpacked_size || (image && length != VRAM_SIZE) ||
+          bk.unpacked_size(stored, stored_size) != unpacked_size) {
+          return false;
+        }
+
+        std::vector<uint8_t> planar(image ? unpacked_size : 0);
+        uint8_t* buffer = image ? planar.data() : destination;
+        if (!bk.unpack(stored, stored_size, buffer, unpacked_size)) {
+          return false;
+        }
+        if (image) {
+          Framebuffer::from_planar(destination, buffer);
+        }
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool AssetPack::unpack(uint16_t id, uint8_t* destination) {
+    const uint8_t* stored = checked(id);
+    if (!stored) {
+      return false;
+    }
+
+    const Entry& entry = entries[id];
+    return decode(entry.codec, entry.definition.type, stored, entry.stored, destination, entry.length);
+  }
+
+  // reads resource `id` out of its bank into `packed` and unpacks it into
+  // `unpacked`, returns false if it can't be read or fails ByteKiller's
+  // checksum
+  static bool read_resource(Engine& engine, uint16_t id, std::vector<uint8_t>& packed, std::vector<uint8_t>& unpacked) {
+    static const char hex[] = "0123456789abcdef";
+
+    uint16_t packed_size = engine.resources.packed_sizes[id];
+    uint16_t size = engine.resources.sizes[id];
+
+    packed.assign(packed_size, 0);
+    std::string bank_filename = std::string("bank0") + hex[engine.resources.bank_ids[id] & 0x0f];
+    if (!engine.read_file(engine.user, bank_filename, engine.resources.bank_offsets[id], packed_size, (char*)packed.data())) {
+      return false;
+    }
+
+    unpacked.assign(size, 0);
+    if (packed_size != size) {
+      ByteKiller bk;
+      if (!bk.unpack(packed.data(), packed_size, unpacked.data(), size)) {
+        return false;
+      }
+    }
+    else {
+      memcpy(unpacked.data(), packed.data(), size);
+    }
+
+    return true;
+  }
+
+  // mean time to decode `stored` over enough runs to be measurable
+  static double time_decode(AssetPack::Codec codec, Resource::Type type, const std::vector<uint8_t>& stored, uint32_t length) {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<uint8_t> destination(length);
+    uint32_t runs = 0;
+    clock::time_point start = clock::now();
+    clock::duration elapsed;
+    do {
+      decode(codec, type, stored.data(), uint32_t(stored.size()), destination.data(), length);
+      runs++;
+      elapsed = clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(2));
+
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / runs;
+  }
+
+  std::vector<uint8_t> build_asset_pack(Engine& engine, const PackOptions& options, std::vector<PackedResource>* report) {
+    using Codec = AssetPack::Codec;
+
+    uint16_t count = engine.resources.size();
+    uint32_t index_offset = HEADER_SIZE;
+
+    std::vector<uint8_t> pack(align(index_offset + count * INDEX_ENTRY_SIZE), 0);
+    std::vector<uint8_t> packed, ready;
+    for (uint16_t id = 0; id < count; id++) {
+      uint8_t* entry = &pack[index_offset + id * INDEX_ENTRY_SIZE];
+      Resource definition = engine.resources.definition(id);
+      entry[8] = uint8_t(definition.type);
+      entry[9] = definition.bank_id;
+      write_u16(entry + 10, definition.packed_size);
+      write_u32(entry + 12, definition.bank_offset);
+      write_u16(entry + 16, definition.size);
+
+      if (definition.size == 0 || !read_resource(engine, id, packed, ready)) {
+        continue;
+      }
+
+      // ByteKiller takes images as bitplanes, whichever of the banks' and
+      // a fresh packing is smaller
+      std::vector<uint8_t> byte_killer = byte_killer_pack(ready.data(), uint32_t(ready.size()));
+      if (definition.packed_size != definition.size && (byte_killer.empty() || packed.size() <= byte_killer.size())) {
+        byte_killer.swap(packed);
+      }
+
+      // images are stored ready to be copied straight into a page
+      bool image = definition.type == Resource::Type::IMAGE;
+      if (image) {
+        if (ready.size() != PLANAR_IMAGE_SIZE) {
+          continue;
+        }
+        std::vector<uint8_t> page(VRAM_SIZE);
+        Framebuffer::from_planar(page.data(), ready.data());
+        ready.swap(page);
+      }
+      uint32_t length = uint32_t(ready.size());
+
+      // every encoding that's possible, raw is read in place so costs
+      // nothing to decode
+      std::vector<uint8_t> encodings[3];
+      encodings[uint8_t(Codec::RAW)] = ready;
+      lz::encode(ready.data(), length, encodings[uint8_t(Codec::LZ)]);
+      encodings[uint8_t(Codec::BYTE_KILLER)].swap(byte_killer);
+
+      PackedResource result = { id, definition.type, length, Codec::RAW, {}, {} };
+      for (Codec codec : { Codec::RAW, Codec::LZ, Codec::BYTE_KILLER }) {
+        std::vector<uint8_t>& encoded = encodings[uint8_t(codec)];
+        if (encoded.empty()) {
+          continue;
+        }
+
+        // make sure it comes back as it went in before considering it
+        std::vector<uint8_t> check(length);
+        if (codec != Codec::RAW && (!decode(codec, definition.type, encoded.data(), uint32_t(encoded.size()), check.data(), length) ||
+          check != ready)) {
+          encoded.clear();
+          continue;
+        }
+
+        result.sizes[uint8_t(codec)] = uint32_t(encoded.size());
+        result.decode_ns[uint8_t(codec)] = codec == Codec::RAW ? 0 : time_decode(codec, definition.type, encoded, length);
+
+        // MB/s is bytes per microsecond
+        double speed = result.decode_ns[uint8_t(codec)] > 0 ? length * 1000.0 / result.decode_ns[uint8_t(codec)] : HUGE_VAL;
+        if (speed >= options.min_speed && encoded.size() < result.sizes[uint8_t(result.codec)]) {
+          result.codec = codec;
+        }
+      }
+
+      const std::vector<uint8_t>& stored = encodings[uint8_t(result.codec)];
+      uint32_t offset = uint32_t(pack.size());
+      pack.insert(pack.end(), stored.begin(), stored.end());
+      pack.resize(align(uint32_t(pack.size())), 0);
+
+      entry = &pack[index_offset + id * INDEX_ENTRY_SIZE];
+      write_u32(entry, offset);
+      write_u32(entry + 4, length);
+      entry[18] = uint8_t(result.codec);
+      write_u32(entry + 20, uint32_t(stored.size()));
+      write_u64(entry + 24, AssetPack::checksum(stored.data(), stored.size()));
+
+      if (report) {
+        report->push_back(result);
+      }
+    }
+
+    memcpy(&pack[0], PACK_MAGIC, 4);
+    write_u16(&pack[4], PACK_VERSION);
+    pack[6] = FRAMEBUFFER_FORMAT;
+    write_u32(&pack[8], count);
+    write_u32(&pack[12], index_offset);
+    write_u32(&pack[16], uint32_t(pack.size()));
+    write_u64(&pack[24], AssetPack::checksum(&pack[index_offset], count * INDEX_ENTRY_SIZE));
+    write_u64(&pack[32], AssetPack::definitions_checksum(engine.resources));
+
+    return pack;
+  }
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "virtual-machine.hpp"
+
+/*
+  pre-baked asset packs
+
+  starting a chapter from the original data means reading memlist.bin,
+  then reading each resource out of the bank files and unpacking it with
+  ByteKiller, and images then have to be shuffled from bitplanes into the
+  framebuffer format. a pack is made once, offline, by build_asset_pack()
+  (see the pack tool) and holds every resource already unpacked and every
+  image already in the framebuffer format, so resources can be used where
+  they lie in the pack with no decoding at all.
+
+  that costs disk space, so each resource can instead be stored
+  compressed with whichever codec suits it:
+
+    RAW         as it's used, read in place
+    LZ          lz.hpp, decodes at several GB/s
+    BYTE_KILLER the banks' format, the resource's original packed bytes
+                or byte_killer_pack()'s if they're smaller. the smallest
+                but the slowest by far to decode (images decode to
+                bitplanes and are converted after)
+
+  build_asset_pack() times decoding each resource with each codec and
+  picks the smallest encoding that decodes at least as fast as asked
+  (see PackOptions). compressed resources are decoded into the heap (or
+  page 0, or a ResourceStore) where the banks would have been unpacked.
+
+  the host maps the pack into memory with its map_file callback, or if it
+  has none the pack is read in whole. resources in the pack are read only
+  and shared by every engine using it, like a ResourceStore's.
+
+  a pack is laid out little endian as:
+
+    header   : 64 bytes, "AWPK", version (16-bit), framebuffer format
+               (8-bit, 1 if chunky), reserved (8-bit), resource count
+               (32-bit), index offset (32-bit), file size (32-bit),
+               reserved (32-bit), index checksum (64-bit), checksum of
+               the resource definitions it was made from (64-bit), then
+               zeros
+    index    : 32 bytes per resource, its offset in the pack (32-bit,
+               zero if it isn't in the pack), length once decoded
+               (32-bit), type, bank id (8-bit each), packed size (16-bit),
+               bank offset (32-bit), unpacked size (16-bit), codec
+               (8-bit), reserved (8-bit), length in the pack (32-bit),
+               checksum of what's in the pack (64-bit)
+    data     : the resources, each starting on a 64 byte boundary
+
+  checksums are 64-bit FNV-1a. the header and index are checked when the
+  pack is opened and each resource the first time it's needed, anything
+  missing from the pack or that fails its checksum is loaded from the
+  banks as usual. a pack made with a different framebuffer format, or
+  from a memlist.bin that doesn't match the one alongside it, isn't used
+  at all. with no memlist.bin the resource definitions are taken from
+  the pack.
+
+  palettes are stored as they are in the banks, big endian 0x0RGB
+  colours. the vm fades between palettes in that format and hands the
+  host 0x0RGB colours anyway, so there's nothing to convert ahead of time.
+*/
+
+namespace another_world {
+
+  struct AssetPack {
+    static constexpr const char* FILENAME = "another-world.awpk";
+    static constexpr uint32_t ALIGNMENT = 64;
+
+    enum class Codec : uint8_t { RAW = 0, LZ = 1, BYTE_KILLER = 2 };
+    static const char* codec_name(Codec codec);
+
+    // 64-bit FNV-1a, as used for the pack's checksums
+    static uint64_t checksum(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325);
+
+    // checksum of every resource's definition, identifies the memlist.bin
+    // a pack was made from
+    static uint64_t definitions_checksum(const ResourceTable& resources);
+
+    // opens the pack `filename` through `engine`'s file callbacks, nullptr
+    // if there isn't one or it's damaged or made for another framebuffer
+    // format
+    static std::shared_ptr<AssetPack> open(const Engine& engine, const std::string& filename = FILENAME);
+
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+    ~AssetPack();
+
+    uint64_t definitions = 0;               // definitions_checksum() of the data the pack was made from
+
+    uint16_t count() const { return entry_count; }
+    Resource definition(uint16_t id) const;
+
+    // contents of resource `id` if it's stored RAW, nullptr if it isn't in
+    // the pack, is compressed or fails its checksum. IMAGE resources are
+    // VRAM_SIZE bytes in the framebuffer format. safe to call from any
+    // number of threads
+    const uint8_t* get(uint16_t id);
+
+    // decodes resource `id` into `destination`, which must have room for
+    // its length once decoded (the resource's size, VRAM_SIZE for images).
+    // false if it isn't in the pack, fails its checksum or won't decode.
+    // safe to call from any number of threads
+    bool unpack(uint16_t id, uint8_t* destination);
+
+  private:
+    AssetPack() = default;
+
+    struct Entry {
+      uint32_t offset;
+      uint32_t length;                    // once decoded
+      uint32_t stored;                    // in the pack
+      Codec codec;
+      Resource definition;
+      uint64_t checksum;
+      std::atomic<uint8_t> status{ 0 };   // 0 unchecked, 1 good, 2 bad
+    };
+
+    // the entry's data once its checksum has been checked, nullptr if it
+    // isn't in the pack or doesn't match
+    const uint8_t* checked(uint16_t id);
+
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+    std::vector<uint8_t> contents;          // the pack when it couldn't be mapped
+    std::unique_ptr<Entry[]> entries;
+    uint16_t entry_count = 0;
+
+    // how to release the mapping
+    void* user = nullptr;
+    void (*unmap_file)(void* user, const uint8_t* data, uint32_t size) = nullptr;
+  };
+
+  struct PackOptions {
+    // slowest decoding (in MB/s of decoded data) to accept, the smallest
+    // encoding of each resource that decodes at least this fast is used.
+    // zero always takes the smallest, the default keeps everything RAW
+    double min_speed = HUGE_VAL;
+  };
+
+  // how a resource was stored, for reporting
+  struct PackedResource {
+    uint16_t id;
+    Resource::Type type;
+    uint32_t length;                  // once decoded
+    AssetPack::Codec codec;           // the one chosen
+    uint32_t sizes[3];                // in the pack with each codec (zero if it isn't possible)
+    double decode_ns[3];              // to decode with each codec
+  };
+
+  // builds a pack from the original data `engine` reads (it must have
+  // called init_resources()). resources that can't be read or unpacked are
+  // left out, the rest are added to `report` if given
+  std::vector<uint8_t> build_asset_pack(Engine& engine, const PackOptions& options = PackOptions(),
+    std::vector<PackedResource>* report = nullptr);
+
+}
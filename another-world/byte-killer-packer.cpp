@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "byte-killer-packer.hpp"
+
+namespace another_world {
+
+  // the format's limits, see ByteKiller::command()
+  constexpr uint32_t WINDOW = 4095;             // 12-bit offsets
+  constexpr uint32_t MAX_REPEAT = 256;
+  constexpr uint32_t MAX_LITERALS = 264;
+  constexpr uint32_t NO_PATH = UINT32_MAX;
+
+  // command costs in bits, including any literal bytes
+  constexpr uint32_t REPEAT_2_BITS = 2 + 8;
+  constexpr uint32_t REPEAT_3_BITS = 3 + 9;
+  constexpr uint32_t REPEAT_4_BITS = 3 + 10;
+  constexpr uint32_t REPEAT_BITS = 3 + 8 + 12;
+
+  static uint32_t literal_bits(uint32_t count) {
+    return count <= 8 ? 2 + 3 + count * 8 : 3 + 8 + count * 8;
+  }
+
+  // what can be repeated at a position, each offset is the nearest one
+  // with a match long enough for that form of the command and zero if
+  // there isn't one in its range
+  struct Matches {
+    uint16_t longest = 0;
+    uint16_t longest_offset = 0;
+    uint16_t offset2 = 0;       // within 255
+    uint16_t offset3 = 0;       // within 511
+    uint16_t offset4 = 0;       // within 1023
+  };
+
+  // one step of the parse, the command that encodes the data from a
+  // position onwards
+  struct Step {
+    enum class Kind : uint8_t { LITERALS, REPEAT_2, REPEAT_3, REPEAT_4, REPEAT } kind;
+    uint16_t count;
+    uint16_t offset;
+  };
+
+  // smallest value (and the position holding it) over a range of
+  // positions, for the parse to find the cheapest place a command of
+  // fixed cost can end without trying every length
+  struct MinimumTree {
+    uint32_t leaves;
+    std::vector<uint64_t> nodes;      // value << 32 | position
+
+    MinimumTree(uint32_t size) {
+      for (leaves = 1; leaves < size; leaves <<= 1);
+      nodes.assign(leaves * 2, UINT64_MAX);
+    }
+
+    void set(uint32_t position, uint32_t value) {
+      uint32_t node = leaves + position;
+      nodes[node] = (uint64_t(value) << 32) | position;
+      for (node >>= 1; node; node >>= 1) {
+        nodes[node] = std::min(nodes[node * 2], nodes[node * 2 + 1]);
+      }
+    }
+
+    // over positions `start` to `end` (exclusive)
+    uint64_t minimum(uint32_t start, uint32_t end) const {
+      uint64_t result = UINT64_MAX;
+      for (start += leaves, end += leaves; start < end; start >>= 1, end >>= 1) {
+        if (start & 1) {
+          result = std::min(result, nodes[start++]);
+        }
+        if (end & 1) {
+          result = std::min(result, nodes[--end]);
+        }
+      }
+      return result;
+    }
+  };
+
+  static void find_matches(const std::vector<uint8_t>& data, const std::vector<int32_t>& previous, uint32_t start, uint32_t end,
+    std::vector<Matches>& matches) {
+    uint32_t size = uint32_t(data.size());
+    for (uint32_t i = start; i < end; i++) {
+      Matches& found = matches[i];
+      uint32_t limit = std::min(MAX_REPEAT, size - i);
+
+      // candidates come nearest first, so the first long enough for each
+      // form of the command is the one it can use
+      for (int32_t candidate = previous[i]; candidate >= 0 && i - uint32_t(candidate) <= WINDOW; candidate = previous[candidate]) {
+        uint32_t offset = i - uint32_t(candidate);
+        uint32_t length = 2;
+        while (length < limit && data[candidate + length] == data[i + length]) {
+          length++;
+        }
+
+        if (!found.offset2 && offset <= 255) {
+          found.offset2 = uint16_t(offset);
+        }
+        if (!found.offset3 && length >= 3 && offset <= 511) {
+          found.offset3 = uint16_t(offset);
+        }
+        if (!found.offset4 && length >= 4 && offset <= 1023) {
+          found.offset4 = uint16_t(offset);
+        }
+        if (length > found.longest) {
+          found.longest = uint16_t(length);
+          found.longest_offset = uint16_t(offset);
+        }
+
+        // nothing further back can do better
+        if (found.longest == limit && (found.offset4 || offset > 1023)) {
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<uint8_t> byte_killer_pack(const uint8_t* source, uint32_t size, uint32_t threads) {
+    if (size < 2) {
+      return std::vector<uint8_t>();
+    }
+
+    // the data is unpacked from its end to its start, working on it
+    // reversed makes that front to back with repeats copying from earlier
+    // bytes as in any LZ77 format
+    std::vector<uint8_t> data(source, source + size);
+    std::reverse(data.begin(), data.end());
+
+    // chains of earlier positions starting with the same two bytes
+    std::vector<int32_t> head(0x10000, -1);
+    std::vector<int32_t> previous(size, -1);
+    for (uint32_t i = 0; i + 1 < size; i++) {
+      uint32_t key = data[i] | (data[i + 1] << 8);
+      previous[i] = head[key];
+      head[key] = int32_t(i);
+    }
+
+    // searching the whole window is most of the work, the positions are
+    // handed out to the threads in blocks
+    std::vector<Matches> matches(size);
+    constexpr uint32_t BLOCK = 1024;
+    uint32_t blocks = (size + BLOCK - 1) / BLOCK;
+    threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, blocks);
+
+    std::atomic<uint32_t> next_block{ 0 };
+    auto work = [&]() {
+      for (uint32_t block = next_block++; block < blocks; block = next_block++) {
+        find_matches(data, previous, block * BLOCK, std::min(size - 1, (block + 1) * BLOCK), matches);
+      }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < threads; i++) {
+      workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    // cost[i] is the fewest bits that encode everything from position i
+    // on. in place the stream occupies the start of the buffer, the bits
+    // still to be read are in whole words at the very start of it (the
+    // partly read word is already in the bit buffer), so a byte written
+    // at `address` with `remaining` bits to go is safe if
+    //
+    //   4 * (remaining / 32) <= address
+    //
+    // lower costs only make that easier to meet, so keeping the cheapest
+    // safe way on from each position gives the cheapest safe parse
+    std::vector<uint32_t> cost(size + 1, NO_PATH);
+    std::vector<Step> steps(size);
+    cost[size] = 0;
+
+    auto repeat_safe = [&](uint32_t next) {
+      return 4 * (cost[next] / 32) <= size - next;
+    };
+
+    // literal bytes are each written as soon as they're read, every byte
+    // needs checking but the check repeats every four bytes
+    auto literals_safe = [&](uint32_t next, uint32_t count) {
+      for (uint32_t m = 0; m < count && m < 4; m++) {
+        if (4 * ((cost[next] + 8 * m) / 32) > size - next + m) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    // the long forms of the commands cost the same (or eight bits a byte
+    // more) whatever their length, so rather than trying every length the
+    // cheapest safe place to end is looked up among the positions
+    // they can reach
+    MinimumTree repeat_ends(size + 1), literal_ends(size + 1);
+    auto finished = [&](uint32_t i) {
+      if (repeat_safe(i)) {
+        repeat_ends.set(i, cost[i]);
+      }
+      if (literals_safe(i, 4)) {
+        literal_ends.set(i, cost[i] + 8 * i);
+      }
+    };
+    finished(size);
+
+    for (uint32_t i = size; i-- > 0;) {
+      auto consider = [&](uint32_t count, uint32_t bits, Step step) {
+        uint32_t next = i + count;
+        if (cost[next] != NO_PATH && cost[next] + bits < cost[i]) {
+          bool safe = step.kind == Step::Kind::LITERALS ? literals_safe(next, count) : repeat_safe(next);
+          if (safe) {
+            cost[i] = cost[next] + bits;
+            steps[i] = step;
+          }
+        }
+      };
+
+      uint32_t left = size - i;
+      for (uint32_t count = 1; count <= 8 && count <= left; count++) {
+        consider(count, literal_bits(count), { Step::Kind::LITERALS, uint16_t(count), 0 });
+      }
+      if (left >= 9) {
+        uint64_t best = literal_ends.minimum(i + 9, i + std::min(left, MAX_LITERALS) + 1);
+        if (best != UINT64_MAX) {
+          uint32_t count = uint32_t(best) - i;
+          consider(count, literal_bits(count), { Step::Kind::LITERALS, uint16_t(count), 0 });
+        }
+      }
+
+      const Matches& found = matches[i];
+      if (found.offset2) {
+        consider(2, REPEAT_2_BITS, { Step::Kind::REPEAT_2, 2, found.offset2 });
+      }
+      if (found.offset3) {
+        consider(3, REPEAT_3_BITS, { Step::Kind::REPEAT_3, 3, found.offset3 });
+      }
+      if (found.offset4) {
+        consider(4, REPEAT_4_BITS, { Step::Kind::REPEAT_4, 4, found.offset4 });
+      }
+      if (found.longest >= 2) {
+        uint64_t best = repeat_ends.minimum(i + 2, i + found.longest + 1);
+        if (best != UINT64_MAX) {
+          uint32_t count = uint32_t(best) - i;
+          consider(count, REPEAT_BITS, { Step::Kind::REPEAT, uint16_t(count), found.longest_offset });
+        }
+      }
+
+      if (cost[i] != NO_PATH) {
+        finished(i);
+      }
+    }
+
+    // the first word read holds whatever doesn't fill a whole word under
+    // a marker bit, every word after it is full
+    uint32_t total = cost[0];
+    if (total == NO_PATH) {
+      return std::vector<uint8_t>();
+    }
+
+    uint32_t first = total % 32;
+    uint32_t word_count = 1 + total / 32;
+    uint32_t packed_size = word_count * 4 + 8;
+    if (packed_size >= size) {
+      return std::vector<uint8_t>();
+    }
+
+    std::vector<uint32_t> words(word_count, 0);
+    words[0] = 1u << first;
+    uint32_t bit = 0;
+    auto put = [&](uint32_t value, uint32_t count) {
+      // values are read most significant bit first, each word from its
+      // least significant bit up
+      while (count--) {
+        uint32_t word = bit < first ? 0 : 1 + (bit - first) / 32;
+        uint32_t shift = bit < first ? bit : (bit - first) % 32;
+        words[word] |= ((value >> count) & 1) << shift;
+        bit++;
+      }
+    };
+
+    for (uint32_t i = 0; i < size; i += steps[i].count) {
+      const Step& step = steps[i];
+      switch (step.kind) {
+        case Step::Kind::LITERALS: {
+          if (step.count <= 8) {
+            put(0b00, 2);
+            put(step.count - 1, 3);
+          }
+          else {
+            put(0b111, 3);
+            put(step.count - 9, 8);
+          }
+          for (uint32_t k = 0; k < step.count; k++) {
+            put(data[i + k], 8);
+          }
+          break;
+        }
+        case Step::Kind::REPEAT_2: put(0b01, 2); put(step.offset, 8); break;
+        case Step::Kind::REPEAT_3: put(0b100, 3); put(step.offset, 9); break;
+        case Step::Kind::REPEAT_4: put(0b101, 3); put(step.offset, 10); break;
+        case Step::Kind::REPEAT: put(0b110, 3); put(step.count - 1, 8); put(step.offset, 12); break;
+      }
+    }
+
+    // the words are stored big endian from the end backwards, then the crc
+    // that every word xors to zero with and the unpacked size
+    std::vector<uint8_t> packed(packed_size);
+    auto write_uint32_bigendian = [&packed](uint32_t offset, uint32_t value) {
+      packed[offset + 0] = uint8_t(value >> 24);
+      packed[offset + 1] = uint8_t(value >> 16);
+      packed[offset + 2] = uint8_t(value >> 8);
+      packed[offset + 3] = uint8_t(value);
+    };
+
+    uint32_t crc = 0;
+    for (uint32_t k = 0; k < word_count; k++) {
+      write_uint32_bigendian(packed_size - 12 - k * 4, words[k]);
+      crc ^= words[k];
+    }
+    write_uint32_bigendian(packed_size - 8, crc);
+    write_uint32_bigendian(packed_size - 4, size);
+
+    return packed;
+  }
+
+}
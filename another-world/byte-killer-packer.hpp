@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+  packs data into the ByteKiller format the banks are stored in
+
+  the output is the same stream ByteKiller::unpack() reads (see
+  byte-killer.hpp): the commands and literal bytes as a bit stream in
+  32-bit big endian words read from the end backwards, followed by the crc
+  word and the unpacked size. it can be written back into a bank and
+  loaded by the original game or this engine.
+
+  the commands are chosen by optimal parsing rather than greedily: for
+  every position the shortest match at each offset range the format can
+  express is found (the full 4095 byte window is searched, split across
+  threads), then the cheapest sequence of commands in bits is found by
+  working back from the end of the data.
+
+  the engine (like the original game) unpacks in place, with the stream
+  read into the start of the buffer the data unpacks into. that only
+  works if no byte is written over stream words that are still to be
+  read, so the parse is constrained to commands that keep it safe. data
+  that can't be packed smaller than it is under that constraint is left
+  unpacked, as the banks do for such resources.
+*/
+
+namespace another_world {
+
+  // packs `size` bytes at `data`, the match finding is spread over
+  // `threads` threads (zero for one per core). returns an empty vector if
+  // the data doesn't get any smaller
+  std::vector<uint8_t> byte_killer_pack(const uint8_t* data, uint32_t size, uint32_t threads = 0);
+
+}
@@ -3,18 +3,29 @@
 #include <stdint.h>
 
 struct ByteKiller {
+  enum class Status { RUNNING, DONE, FAILED };
+
   private:
   uint32_t bit_stream;
   uint32_t crc;
-  uint8_t *ps;
-  uint8_t *pd;
 
-  uint16_t read_uint16_bigendian(const void* p) {
+  // the stream and the buffer it unpacks into are both worked through from
+  // the end, `ps` and `pd` count the bytes of each still to go so the next
+  // word read ends at source + ps and the next byte written is at
+  // destination + pd - 1
+  const uint8_t *source;
+  uint8_t *destination;
+  uint32_t ps;
+  uint32_t pd;
+  uint32_t size;
+  bool failed;
+
+  static uint16_t read_uint16_bigendian(const void* p) {
     const uint8_t* b = (const uint8_t*)p;
     return (b[0] << 8) | b[1];
   }
 
-  uint32_t read_uint32_bigendian(const void* p) {
+  static uint32_t read_uint32_bigendian(const void* p) {
     const uint8_t* b = (const uint8_t*)p;
     return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
   }
@@ -25,7 +36,12 @@ struct ByteKiller {
     if(bit_stream == 0b1) {
       // the final bit tells us we're at the end of this block
       // so we need to load in the next block
-      bit_stream = read_uint32_bigendian(ps); ps -= 4;
+      if(ps < 4) {
+        failed = true;
+        return false;
+      }
+      ps -= 4;
+      bit_stream = read_uint32_bigendian(source + ps);
       crc ^= bit_stream;
 
       // grab the low command bit and shift the stream
@@ -34,7 +50,7 @@ struct ByteKiller {
 
       // set the high bit so we detect the next time we run out
       // of command bits
-      bit_stream |= 0x80000000;    
+      bit_stream |= 0x80000000;
     }else{
       // grab the low command bit and shift the stream
       result = bit_stream & 0b1;
@@ -50,134 +66,193 @@ struct ByteKiller {
     while(bit_count--) {
       value <<= 1;
       value |= get_stream_bit() ? 0b1 : 0b0;
-    }  
+    }
 
     return value;
   }
 
   void copy(uint16_t count) {
+    if(count > pd) {
+      failed = true;
+      return;
+    }
+
     while(count--) {
-      *pd = get_value(8);
       pd--;
+      destination[pd] = uint8_t(get_value(8));
     }
   }
 
   void repeat_from_offset(uint16_t count, uint16_t offset) {
+    // the bytes repeated must already have been unpacked
+    if(count > pd || offset > size - pd) {
+      failed = true;
+      return;
+    }
+
     while(count--) {
-      *pd = *(pd + offset);
       pd--;
+      destination[pd] = destination[pd + offset];
+    }
+  }
+
+  // unpacks the next command from the stream
+  void command() {
+    // the stream is composed of a mixture of commands and data
+    // the commands are variable length encoded (either two or three
+    // bits) and tell the unpacker what to do with the following data
+    //
+    // all commands boil down to two options; either copy bytes from
+    // the bitstream (copy() method) or copy bytes from the unpacked
+    // buffer at the specified offset (repeat_from_offset())
+    bool b0 = get_stream_bit();
+    if(b0) {
+      bool b1 = get_stream_bit();
+      bool b2 = get_stream_bit();
+
+      if(b1 && b2) {
+        // 111 xxxxxxxx
+        // copy between 9 and 264 (xxx + 9) bytes from bitstream to destination
+        uint16_t count = get_value(8) + 9;
+        copy(count);
+      }
+
+      if(b1 && !b2) {
+        // 110 xxxxxxxx oooooooooooo
+        // repeat between 1 and 256 bytes from destination + offset to destination
+        uint16_t count = get_value(8) + 1;
+        uint16_t offset = get_value(12);
+        repeat_from_offset(count, offset);
+      }
+
+      if(!b1 && b2) {
+        // 101 oooooooooo
+        // repeat 4 bytes from from destination + offset to destination
+        uint16_t count = 4;
+        uint16_t offset = get_value(10);
+        repeat_from_offset(count, offset);
+      }
+
+      if(!b1 && !b2) {
+        // 100 ooooooooo
+        // repeat 3 bytes from from destination + offset to destination
+        uint16_t count = 3;
+        uint16_t offset = get_value(9);
+        repeat_from_offset(count, offset);
+      }
+    }
+
+    if(!b0) {
+      bool b1 = get_stream_bit();
+
+      if(b1) {
+        // 11 oooooooo
+        // repeat 2 bytes from from destination + offset to destination
+        uint16_t offset = get_value(8);
+        repeat_from_offset(2, offset);
+      }
+
+      if(!b1) {
+        // 00 xxx
+        // copy between 1 and 8 (xxx + 1) bytes from bitstream to destination
+        uint16_t count = get_value(3) + 1;
+        copy(count);
+      }
     }
   }
 
   public:
   ByteKiller() {}
 
-  uint32_t unpacked_size(uint8_t* buffer, uint32_t packed_size) {
-    ps = buffer + packed_size - 4;
-    return read_uint32_bigendian(ps);
+  // the size `packed_size` bytes of packed data unpack to, stored in the
+  // last four bytes of the stream
+  uint32_t unpacked_size(const uint8_t* buffer, uint32_t packed_size) {
+    return packed_size < 4 ? 0 : read_uint32_bigendian(buffer + packed_size - 4);
   }
 
-  bool unpack(uint8_t *buffer, uint32_t packed_size) {
-    // the data is unpacked from end to start using two pointers
-    // the source pointer `ps` and destination pointer `pd`
-    // because the packed data is smaller than the unpacked data
-    // it can be unpacked inline in the same buffer without any risk
-    // over the destination pointer overruning the source pointer.
-    // effectively both pointers "race" to the start of the buffer
-    // meeting there once the unpacking is complete.
-
-    // source pointer starts by pointing at the last 32-bit word of 
-    // the packed resource data
-    ps = buffer + packed_size - 4;
+  // starts unpacking `source_size` bytes of packed data at `source` into
+  // `destination`, nothing is read beyond the source or written beyond
+  // `destination_size` bytes of the destination. returns false if the
+  // stream is too short to be valid or unpacks to more than there's room
+  // for. the source and destination may be the same buffer (as unpack()
+  // does) as long as it's big enough for the unpacked data
+  bool begin(const uint8_t* source, uint32_t source_size, uint8_t* destination, uint32_t destination_size) {
+    this->source = source;
+    this->destination = destination;
+    failed = false;
 
     // the last 32-bits of the source data contain a 32-bit unsigned
-    // integer which tells us the unpacked size of the data
-    uint32_t unpacked_size = read_uint32_bigendian(ps); ps -= 4;
-
-    // destination pointer starts by pointing at the last byte of
-    // the unpacked resource memory area
-    pd = buffer + unpacked_size - 1;
+    // integer which tells us the unpacked size of the data, it's
+    // preceded by the crc and the first block of command bits
+    if(source_size < 12) {
+      return false;
+    }
+    size = read_uint32_bigendian(source + source_size - 4);
+    if(size > destination_size) {
+      return false;
+    }
+    pd = size;
 
-    // crc is only used to confirm file loaded correctly, it can be 
+    // crc is only used to confirm file loaded correctly, it can be
     // ignored with regard to the actual unpacking of the data
-    crc = read_uint32_bigendian(ps); ps -= 4;
+    crc = read_uint32_bigendian(source + source_size - 8);
 
     // high bit is always set in `command` when read from the file, as
     // the `command` bits are shifted off one by one it needs the high
     // bit set to detect when the final shift occurs and to then
     // fetch the next command
-    bit_stream = read_uint32_bigendian(ps); ps -= 4;
+    ps = source_size - 12;
+    bit_stream = read_uint32_bigendian(source + ps);
     crc ^= bit_stream;
 
-    // the stream is composed of a mixture of commands and data
-    // the commands are variable length encoded (either two or three 
-    // bits) and tell the unpacker what to do with the following data
-    //
-    // all commands boil down to two options; either copy bytes from
-    // the bitstream (copy() method) or copy bytes from the unpacked 
-    // buffer at the specified offset (repeat_from_offset())
-    do { 
-      bool b0 = get_stream_bit(); 
-      if(b0) {
-        bool b1 = get_stream_bit();
-        bool b2 = get_stream_bit();
-        
-        if(b1 && b2) {
-          // 111 xxxxxxxx
-          // copy between 9 and 275 (xxx + 9) bytes from bitstream to destination
-          uint16_t count = get_value(8) + 9;
-          copy(count);
-        }
-        
-        if(b1 && !b2) {
-          // 110 xxxxxxxx oooooooooooo
-          // repeat between 2 and 256 bytes from destination + offset to destination
-          uint16_t count = get_value(8) + 1;
-          uint16_t offset = get_value(12);
-          repeat_from_offset(count, offset);
-        }
-        
-        if(!b1 && b2) {
-          // 101 oooooooooo
-          // repeat 4 bytes from from destination + offset to destination
-          uint16_t count = 4;
-          uint16_t offset = get_value(10);
-          repeat_from_offset(count, offset);
-        } 
-      
-        if(!b1 && !b2) {
-          // 100 ooooooooo
-          // repeat 3 bytes from from destination + offset to destination
-          uint16_t count = 3;
-          uint16_t offset = get_value(9);
-          repeat_from_offset(count, offset);
-        }      
-      } 
-      
-      if(!b0) {
-        bool b1 = get_stream_bit();
-
-        if(b1) {
-          // 11 oooooooo
-          // repeat 2 bytes from from destination + offset to destination
-          uint16_t offset = get_value(8);
-          repeat_from_offset(2, offset);
-        }
-        
-        if(!b1) {
-          // 00 xxx
-          // copy between 2 and 8 (xxx + 1) bytes from bitstream to destination
-          uint16_t count = get_value(3) + 1;
-          copy(count);
-        }
-      }
+    return true;
+  }
+
+  // unpacks commands until at least `budget` more bytes have been written
+  // or the data is complete. the unpacked data fills the destination from
+  // the end, the last remaining() bytes of it are final once this returns.
+  // DONE is only returned if the stream's crc checks out
+  Status step(uint32_t budget) {
+    if(failed) {
+      return Status::FAILED;
+    }
 
-      if (pd - buffer < 100) {
-        static int a = 0;
-        a++;
+    // every command writes at least one byte so this always ends
+    uint32_t target = budget < pd ? pd - budget : 0;
+    while(pd > target) {
+      command();
+      if(failed) {
+        return Status::FAILED;
       }
-    } while((pd - buffer) != -1); // until we reach the end of the bitstream
+    }
 
-    return crc == 0;
+    if(pd > 0) {
+      return Status::RUNNING;
+    }
+    return crc == 0 ? Status::DONE : Status::FAILED;
+  }
+
+  // bytes of the destination still to be unpacked
+  uint32_t remaining() const {
+    return pd;
+  }
+
+  // unpacks `source_size` bytes at `source` into `destination` in one go
+  bool unpack(const uint8_t* source, uint32_t source_size, uint8_t* destination, uint32_t destination_size) {
+    return begin(source, source_size, destination, destination_size) && step(UINT32_MAX) == Status::DONE;
+  }
+
+  bool unpack(uint8_t *buffer, uint32_t packed_size) {
+    // the data is unpacked from end to start using two pointers
+    // the source pointer `ps` and destination pointer `pd`
+    // because the packed data is smaller than the unpacked data
+    // it can be unpacked inline in the same buffer without any risk
+    // over the destination pointer overruning the source pointer.
+    // effectively both pointers "race" to the start of the buffer
+    // meeting there once the unpacking is complete.
+    //
+    // the buffer must be big enough for the unpacked data, which the
+    // stream can't tell us
+    return unpack(buffer, packed_size, buffer, unpacked_size(buffer, packed_size));
   }
-};
\ No newline at end of file
+};
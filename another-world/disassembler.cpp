@@ -0,0 +1,535 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "disassembler.hpp"
+#include "virtual-machine.hpp"
+
+namespace another_world {
+
+  // reads operands the way VirtualMachine::fetch_byte() and fetch_word()
+  // do, noting if the instruction runs past the end of the code
+  struct Decoder {
+    const uint8_t* code;
+    uint32_t size;
+    uint32_t position;
+    bool truncated = false;
+
+    uint8_t byte() {
+      if (position >= size) {
+        truncated = true;
+        position++;
+        return 0;
+      }
+      return code[position++];
+    }
+
+    uint16_t word() {
+      uint16_t high = byte();
+      return uint16_t(high << 8 | byte());
+    }
+  };
+
+  static void add_operand(Instruction& instruction, Operand::Kind kind, int32_t value) {
+    Operand& operand = instruction.operands[instruction.operand_count++];
+    operand.kind = kind;
+    operand.value = value;
+  }
+
+  const char* Instruction::mnemonic() const {
+    if (opcode <= 0x1a) {
+      return opcode_names[opcode].c_str();
+    }
+    return opcode < 0x40 ? "----" : (opcode < 0x80 ? "plyl" : "plys");
+  }
+
+  bool decode_instruction(const uint8_t* code, uint32_t size, uint16_t address, Instruction& instruction) {
+    instruction = Instruction();
+    instruction.address = address;
+
+    Decoder d{ code, size, address };
+    uint8_t opcode = d.byte();
+    instruction.opcode = opcode;
+
+    using Kind = Operand::Kind;
+    using Flow = Instruction::Flow;
+
+    if (opcode & 0x80) {
+      // polygon, short format: the high bits of the offset are in the
+      // opcode and a y past 199 carries over into x
+      uint32_t offset = (((opcode & 0x7f) << 8) | d.byte()) * 2;
+      int16_t x = d.byte();
+      int16_t y = d.byte();
+      if (y > 199) {
+        x += y - 199;
+        y = 199;
+      }
+      add_operand(instruction, Kind::BACKGROUND_SHAPE, int32_t(offset));
+      add_operand(instruction, Kind::IMMEDIATE, x);
+      add_operand(instruction, Kind::IMMEDIATE, y);
+      add_operand(instruction, Kind::IMMEDIATE, 64);
+    } else if (opcode & 0x40) {
+      // polygon, long format: each pair of bits in the opcode picks where
+      // x, y and the zoom come from
+      uint32_t offset = d.word() * 2;
+
+      int32_t coordinate[2];
+      Kind coordinate_kind[2];
+      for (uint8_t i = 0; i < 2; i++) {
+        uint8_t bits = (opcode >> (4 - i * 2)) & 0b11;
+        coordinate_kind[i] = bits == 0b01 ? Kind::REGISTER : Kind::IMMEDIATE;
+        switch (bits) {
+          case 0b00: coordinate[i] = int16_t(d.word()); break;
+          case 0b01: coordinate[i] = d.byte(); break;
+          case 0b10: coordinate[i] = d.byte(); break;
+          default:   coordinate[i] = d.byte() + 256; break;
+        }
+      }
+
+      Kind shape = Kind::BACKGROUND_SHAPE;
+      Operand zoom{ Kind::IMMEDIATE, 64 };
+      switch (opcode & 0b11) {
+        case 0b01: zoom = { Kind::REGISTER, d.byte() }; break;
+        case 0b10: zoom = { Kind::IMMEDIATE, d.byte() }; break;
+        case 0b11: shape = Kind::CHARACTER_SHAPE; break;
+        default: break;
+      }
+
+      add_operand(instruction, shape, int32_t(offset));
+      add_operand(instruction, coordinate_kind[0], coordinate[0]);
+      add_operand(instruction, coordinate_kind[1], coordinate[1]);
+      add_operand(instruction, zoom.kind, zoom.value);
+    } else {
+      switch (opcode) {
+        case 0x00: case 0x03: case 0x14: case 0x15: case 0x16: case 0x17:
+          // movi, addi, andi, ori, shli, shri  d0, #1234
+          add_operand(instruction, Kind::REGISTER, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, int16_t(d.word()));
+          break;
+
+        case 0x01: case 0x02: case 0x13:
+          // mov, add, sub  d0, d1
+          add_operand(instruction, Kind::REGISTER, d.byte());
+          add_operand(instruction, Kind::REGISTER, d.byte());
+          break;
+
+        case 0x04: case 0x07:
+          // call, jmp  #1234
+          instruction.target = d.word();
+          instruction.flow = opcode == 0x04 ? Flow::CALL : Flow::JUMP;
+          add_operand(instruction, Kind::ADDRESS, instruction.target);
+          break;
+
+        case 0x05:
+          instruction.flow = Flow::RETURN;
+          break;
+
+        case 0x06:
+          instruction.flow = Flow::YIELD;
+          break;
+
+        case 0x08:
+          // svec  #12, #1234
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          instruction.target = d.word();
+          add_operand(instruction, Kind::ADDRESS, instruction.target);
+          break;
+
+        case 0x09:
+          // djnz  d0, #1234
+          add_operand(instruction, Kind::REGISTER, d.byte());
+          instruction.target = d.word();
+          instruction.flow = Flow::BRANCH;
+          add_operand(instruction, Kind::ADDRESS, instruction.target);
+          break;
+
+        case 0x0a: {
+          // cjmp  #12, d0, d1 or #1234, #1234
+          uint8_t t = d.byte();
+          add_operand(instruction, Kind::CONDITION, t & 0b111);
+          add_operand(instruction, Kind::REGISTER, d.byte());
+          uint8_t b = d.byte();
+          if (t & 0x80) {
+            add_operand(instruction, Kind::REGISTER, b);
+          } else if (t & 0x40) {
+            add_operand(instruction, Kind::IMMEDIATE, int16_t(b << 8 | d.byte()));
+          } else {
+            add_operand(instruction, Kind::IMMEDIATE, b);
+          }
+          instruction.target = d.word();
+          instruction.flow = Flow::BRANCH;
+          add_operand(instruction, Kind::ADDRESS, instruction.target);
+          break;
+        }
+
+        case 0x0b: case 0x0e: case 0x0f:
+          // pal, vclr, vcpy  #12, #12
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          break;
+
+        case 0x0c:
+          // ???  #12, #12, #12 (first thread, last thread, lock/unlock/kill)
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          break;
+
+        case 0x0d: case 0x10:
+          // setws, vshw  #12
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          break;
+
+        case 0x11:
+          instruction.flow = Flow::KILL;
+          break;
+
+        case 0x12: case 0x18:
+          // text, snd  #1234, #12, #12, #12
+          add_operand(instruction, Kind::IMMEDIATE, d.word());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          break;
+
+        case 0x19:
+          // load  #1234
+          add_operand(instruction, Kind::IMMEDIATE, d.word());
+          break;
+
+        case 0x1a:
+          // music  #1234, #1234, #12
+          add_operand(instruction, Kind::IMMEDIATE, d.word());
+          add_operand(instruction, Kind::IMMEDIATE, d.word());
+          add_operand(instruction, Kind::IMMEDIATE, d.byte());
+          break;
+
+        default:
+          // unused, the vm skips over the opcode
+          instruction.valid = false;
+          break;
+      }
+    }
+
+    instruction.size = uint8_t(d.position - address);
+    return !d.truncated;
+  }
+
+  static std::string format_operand(const Operand& operand) {
+    char text[32];
+    switch (operand.kind) {
+      case Operand::Kind::REGISTER:         snprintf(text, sizeof(text), "r%02x", operand.value); break;
+      case Operand::Kind::IMMEDIATE:        snprintf(text, sizeof(text), "#%d", operand.value); break;
+      case Operand::Kind::ADDRESS:          snprintf(text, sizeof(text), "@%04x", operand.value); break;
+      case Operand::Kind::BACKGROUND_SHAPE: snprintf(text, sizeof(text), "bg:%04x", operand.value); break;
+      case Operand::Kind::CHARACTER_SHAPE:  snprintf(text, sizeof(text), "chr:%04x", operand.value); break;
+      default:                              text[0] = 0; break;
+    }
+    return text;
+  }
+
+  std::string format_instruction(const Instruction& instruction) {
+    char text[64];
+    snprintf(text, sizeof(text), "%-6s", instruction.mnemonic());
+    std::string output = text;
+
+    if (instruction.opcode == 0x0a && instruction.operand_count == 4) {
+      static const char* conditions[8] = { "==", "!=", ">", ">=", "<", "<=", "never", "never" };
+      output += format_operand(instruction.operands[1]) + " " + conditions[instruction.operands[0].value & 0b111] + " " +
+        format_operand(instruction.operands[2]) + ", " + format_operand(instruction.operands[3]);
+      return output;
+    }
+
+    for (uint8_t i = 0; i < instruction.operand_count; i++) {
+      output += (i ? ", " : "") + format_operand(instruction.operands[i]);
+    }
+
+    // trailing spaces from the mnemonic padding
+    output.erase(output.find_last_not_of(' ') + 1);
+    return output;
+  }
+
+  const Instruction* CodeAnalysis::instruction(uint16_t address) const {
+    auto found = instructions.find(address);
+    return found != instructions.end() ? &found->second : nullptr;
+  }
+
+  const BasicBlock* CodeAnalysis::block(uint16_t address) const {
+    auto found = blocks.upper_bound(address);
+    if (found == blocks.begin()) {
+      return nullptr;
+    }
+    --found;
+    return address < found->second.end ? &found->second : nullptr;
+  }
+
+  std::vector<const Instruction*> CodeAnalysis::block_instructions(const BasicBlock& block) const {
+    std::vector<const Instruction*> list;
+    for (const Instruction* i = instruction(block.start); i; i = instruction(i->next())) {
+      list.push_back(i);
+      if (i->next() >= block.end || i->next() <= i->address) {
+        break;
+      }
+    }
+    return list;
+  }
+
+  CodeAnalysis analyse_code(const uint8_t* code, uint32_t size) {
+    using Flow = Instruction::Flow;
+    using Edge = BasicBlock::Edge;
+
+    CodeAnalysis analysis;
+    analysis.size = size;
+
+    char message[128];
+    auto problem = [&analysis](uint16_t address, const char* text, bool warning = false) {
+      analysis.problems.push_back({ address, text, warning });
+    };
+
+    // addresses where a block has to start: entry points, jump, branch and
+    // call targets, and wherever control lands after a block ending
+    // instruction
+    std::set<uint16_t> leaders;
+
+    // follow control flow from the entry points, svecs found on the way
+    // add more of them
+    std::vector<uint16_t> pending;
+    auto reach = [&](uint16_t from, uint32_t address, const char* what) {
+      if (address >= size) {
+        snprintf(message, sizeof(message), "%s @%04x is past the end of the code (%u bytes)", what, address, size);
+        problem(from, message);
+        return false;
+      }
+      pending.push_back(uint16_t(address));
+      return true;
+    };
+
+    analysis.entries[0].insert(0);
+    if (size > 0) {
+      pending.push_back(0);
+      leaders.insert(0);
+    } else {
+      problem(0, "the code is empty");
+    }
+
+    while (!pending.empty()) {
+      uint16_t address = pending.back();
+      pending.pop_back();
+
+      if (analysis.instructions.count(address)) {
+        continue;
+      }
+
+      Instruction instruction;
+      bool complete = decode_instruction(code, size, address, instruction);
+      if (!complete) {
+        snprintf(message, sizeof(message), "%s runs past the end of the code", instruction.mnemonic());
+        problem(address, message);
+      }
+      analysis.instructions[address] = instruction;
+
+      if (!instruction.valid) {
+        snprintf(message, sizeof(message), "unused opcode %02x (the vm skips it)", instruction.opcode);
+        problem(address, message, true);
+      }
+
+      if (instruction.opcode == 0x08) {
+        // svec starts a thread at its target from the next frame
+        uint8_t thread = uint8_t(instruction.operands[0].value);
+        if (thread >= THREAD_COUNT) {
+          snprintf(message, sizeof(message), "svec of thread %u, there are only %u threads", thread, THREAD_COUNT);
+          problem(address, message);
+        }
+        if (reach(address, instruction.target, "svec target")) {
+          if (thread < THREAD_COUNT) {
+            analysis.entries[instruction.target].insert(thread);
+          }
+          leaders.insert(instruction.target);
+        }
+      }
+
+      if (instruction.opcode == 0x0c) {
+        uint8_t first = uint8_t(instruction.operands[0].value);
+        uint8_t last = uint8_t(instruction.operands[1].value);
+        if (last >= THREAD_COUNT) {
+          snprintf(message, sizeof(message), "thread range %u - %u isn't within the %u threads", first, last, THREAD_COUNT);
+          problem(address, message);
+        } else if (first > last) {
+          snprintf(message, sizeof(message), "thread range %u - %u is empty", first, last);
+          problem(address, message, true);
+        }
+      }
+
+      bool jumps = instruction.flow == Flow::JUMP || instruction.flow == Flow::BRANCH || instruction.flow == Flow::CALL;
+      if (jumps && reach(address, instruction.target, instruction.flow == Flow::CALL ? "call to" : "jump to")) {
+        leaders.insert(instruction.target);
+        if (instruction.flow == Flow::CALL) {
+          analysis.subroutines.insert(instruction.target);
+        }
+      }
+
+      // calls return to the next instruction and brk carries on from it
+      // next frame
+      bool continues = instruction.flow != Flow::JUMP && instruction.flow != Flow::RETURN && instruction.flow != Flow::KILL;
+      if (continues && complete && reach(address, instruction.next(), "execution carries on to")) {
+        if (instruction.ends_block()) {
+          leaders.insert(instruction.next());
+        }
+      }
+    }
+
+    // reachable instructions that overlap mean something jumps into the
+    // middle of another instruction
+    const Instruction* previous = nullptr;
+    for (auto& entry : analysis.instructions) {
+      const Instruction& instruction = entry.second;
+      if (previous && instruction.address < previous->next()) {
+        snprintf(message, sizeof(message), "control reaches the middle of the %s at @%04x", previous->mnemonic(), previous->address);
+        problem(instruction.address, message, true);
+      }
+      previous = &instruction;
+    }
+
+    // split into blocks, a block runs until an instruction that ends it, a
+    // gap in the reachable code or the start of another block
+    BasicBlock* current = nullptr;
+    for (auto& entry : analysis.instructions) {
+      const Instruction& instruction = entry.second;
+
+      if (!current || current->end != instruction.address || leaders.count(instruction.address)) {
+        current = &analysis.blocks[instruction.address];
+        current->start = instruction.address;
+      }
+      current->end = instruction.next();
+
+      auto next = analysis.instructions.find(instruction.next());
+      bool next_leads = next == analysis.instructions.end() || leaders.count(instruction.next());
+      if (!instruction.ends_block() && !next_leads) {
+        continue;
+      }
+
+      // the block ends here
+      auto edge = [&](uint32_t to, Edge::Kind kind) {
+        if (to < size && analysis.instructions.count(uint16_t(to))) {
+          current->successors.push_back({ uint16_t(to), kind });
+        }
+      };
+
+      switch (instruction.flow) {
+        case Flow::NEXT:   edge(instruction.next(), Edge::Kind::FALL); break;
+        case Flow::JUMP:   edge(instruction.target, Edge::Kind::JUMP); break;
+        case Flow::BRANCH: edge(instruction.target, Edge::Kind::TAKEN); edge(instruction.next(), Edge::Kind::FALL); break;
+        case Flow::CALL:   edge(instruction.target, Edge::Kind::CALL); edge(instruction.next(), Edge::Kind::FALL); break;
+        case Flow::YIELD:  edge(instruction.next(), Edge::Kind::RESUME); break;
+        default: break;
+      }
+      current = nullptr;
+    }
+
+    // an edge into the middle of a block (only possible when instructions
+    // overlap) is left out
+    for (auto& entry : analysis.blocks) {
+      auto& successors = entry.second.successors;
+      successors.erase(std::remove_if(successors.begin(), successors.end(), [&analysis](const Edge& e) {
+        return !analysis.blocks.count(e.to);
+      }), successors.end());
+      for (auto& successor : successors) {
+        analysis.blocks[successor.to].predecessors.push_back(entry.first);
+      }
+    }
+
+    std::stable_sort(analysis.problems.begin(), analysis.problems.end(), [](const CodeAnalysis::Problem& a, const CodeAnalysis::Problem& b) {
+      return a.address < b.address;
+    });
+
+    return analysis;
+  }
+
+  std::string CodeAnalysis::listing(const uint8_t* code) const {
+    std::string output;
+    char line[256];
+
+    auto problem = problems.begin();
+    for (auto& entry : blocks) {
+      const BasicBlock& block = entry.second;
+
+      output += "\n";
+      auto threads = entries.find(block.start);
+      if (threads != entries.end()) {
+        output += "; thread entry:";
+        for (auto thread : threads->second) {
+          snprintf(line, sizeof(line), " %u", thread);
+          output += line;
+        }
+        output += "\n";
+      }
+      if (subroutines.count(block.start)) {
+        output += "; subroutine\n";
+      }
+      snprintf(line, sizeof(line), "block_%04x:", block.start);
+      output += line;
+      if (!block.predecessors.empty()) {
+        output += "    ; from";
+        for (auto from : block.predecessors) {
+          snprintf(line, sizeof(line), " %04x", from);
+          output += line;
+        }
+      }
+      output += "\n";
+
+      for (const Instruction* i : block_instructions(block)) {
+        const Instruction& instruction = *i;
+
+        std::string bytes;
+        if (code) {
+          for (uint8_t b = 0; b < instruction.size && instruction.address + b < size; b++) {
+            snprintf(line, sizeof(line), "%02x ", code[instruction.address + b]);
+            bytes += line;
+          }
+        }
+
+        snprintf(line, sizeof(line), "  %04x  %-24s%s\n", instruction.address, bytes.c_str(), format_instruction(instruction).c_str());
+        output += line;
+
+        for (; problem != problems.end() && problem->address <= instruction.address; ++problem) {
+          output += std::string("        ; ") + (problem->warning ? "warning: " : "problem: ") + problem->message + "\n";
+        }
+      }
+    }
+
+    for (; problem != problems.end(); ++problem) {
+      snprintf(line, sizeof(line), "; %s at %04x: %s\n", problem->warning ? "warning" : "problem", problem->address, problem->message.c_str());
+      output += line;
+    }
+
+    return output;
+  }
+
+  std::string CodeAnalysis::dot() const {
+    static const char* edge_styles[] = { "", " [label=\"jmp\"]", " [label=\"taken\"]", " [label=\"call\", style=dashed]", " [label=\"next frame\", style=dotted]" };
+
+    std::string output = "digraph code {\n  node [shape=box, fontname=monospace];\n";
+    char line[256];
+
+    for (auto& entry : blocks) {
+      const BasicBlock& block = entry.second;
+
+      std::string label;
+      for (const Instruction* i : block_instructions(block)) {
+        snprintf(line, sizeof(line), "%04x  %s\\l", i->address, format_instruction(*i).c_str());
+        label += line;
+      }
+
+      snprintf(line, sizeof(line), "  b%04x [label=\"", block.start);
+      output += line + label + (entries.count(block.start) ? "\", penwidth=2];\n" : "\"];\n");
+
+      for (auto& successor : block.successors) {
+        snprintf(line, sizeof(line), "  b%04x -> b%04x%s;\n", block.start, successor.to, edge_styles[int(successor.kind)]);
+        output += line;
+      }
+    }
+
+    output += "}\n";
+    return output;
+  }
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+  static analysis of bytecode resources
+
+  decode_instruction() decodes one instruction the same way
+  execute_threads() does, without running it. analyse_code() follows
+  control flow from every thread entry point in a code resource (address
+  zero, where initialise_chapter() starts thread 0, and the target of
+  every svec) to find the instructions that can actually run, splits
+  them into basic blocks and links those into a control flow graph. data
+  that is never reached isn't decoded, so it can't be mistaken for code.
+
+  anything that would make the interpreter misbehave is reported as a
+  problem rather than stopping the analysis: jumps outside the resource,
+  instructions cut off by the end of the resource, code running off the
+  end and thread ids that don't exist. jumps into the middle of an
+  instruction and the unused opcodes (0x1b - 0x3f, which the vm skips
+  over) are suspicious but harmless, they're reported as warnings.
+
+  the analysis only depends on the code resource, so it can be done once
+  per chapter and shared by anything built on top of it.
+*/
+
+namespace another_world {
+
+  struct Operand {
+    enum class Kind : uint8_t {
+      NONE,
+      REGISTER,         // register index
+      IMMEDIATE,        // value in the bytecode
+      ADDRESS,          // bytecode address
+      CONDITION,        // cjmp comparison (0 ==, 1 !=, 2 >, 3 >=, 4 <, 5 <=, otherwise never)
+      BACKGROUND_SHAPE, // byte offset into the chapter's background polygon data
+      CHARACTER_SHAPE   // byte offset into the chapter's character polygon data
+    };
+
+    Kind kind = Kind::NONE;
+    int32_t value = 0;
+  };
+
+  struct Instruction {
+    // how control leaves the instruction
+    enum class Flow : uint8_t {
+      NEXT,       // on to the next instruction
+      JUMP,       // to `target` (jmp)
+      BRANCH,     // to `target` or on to the next instruction (djnz, cjmp)
+      CALL,       // to `target`, returning to the next instruction (call)
+      RETURN,     // to the address on top of the call stack (ret)
+      YIELD,      // to the next thread, this one carries on from the next instruction next frame (brk)
+      KILL        // to the next thread, this one stops (kill)
+    };
+
+    static constexpr uint8_t MAX_OPERANDS = 4;
+
+    uint16_t address = 0;
+    uint8_t opcode = 0;
+    uint8_t size = 0;             // in bytes, including the opcode
+    Flow flow = Flow::NEXT;
+    bool valid = true;            // false for the unused opcodes
+    uint16_t target = 0;          // jmp, djnz, cjmp and call destination, svec thread address
+
+    uint8_t operand_count = 0;
+    Operand operands[MAX_OPERANDS];
+
+    const char* mnemonic() const;
+
+    // the address control can carry on to after this instruction
+    uint16_t next() const { return uint16_t(address + size); }
+    bool ends_block() const { return flow != Flow::NEXT; }
+  };
+
+  // decode the instruction at `address` in `code` (`size` bytes long),
+  // returns false if it's cut off by the end of the code
+  bool decode_instruction(const uint8_t* code, uint32_t size, uint16_t address, Instruction& instruction);
+
+  // e.g. "cjmp  r3c >= #12, @0123"
+  std::string format_instruction(const Instruction& instruction);
+
+  struct BasicBlock {
+    struct Edge {
+      enum class Kind : uint8_t {
+        FALL,       // on to the next block
+        JUMP,       // jmp
+        TAKEN,      // djnz or cjmp taken
+        CALL,       // into a subroutine (control comes back to the FALL edge)
+        RESUME      // after a brk, next frame
+      };
+
+      uint16_t to;
+      Kind kind;
+    };
+
+    uint16_t start = 0;
+    uint16_t end = 0;                       // just past the last instruction
+    std::vector<Edge> successors;
+    std::vector<uint16_t> predecessors;     // starts of the blocks with an edge to this one
+  };
+
+  struct CodeAnalysis {
+    struct Problem {
+      uint16_t address;
+      std::string message;
+      bool warning;       // the interpreter copes with it (unused opcodes, overlapping instructions)
+    };
+
+    uint32_t size = 0;                                // of the code resource
+
+    std::map<uint16_t, Instruction> instructions;     // everything reachable from an entry point
+    std::map<uint16_t, BasicBlock> blocks;
+    std::map<uint16_t, std::set<uint8_t>> entries;    // thread entry points and the threads started at each
+    std::set<uint16_t> subroutines;                   // call targets
+    std::vector<Problem> problems;
+
+    // the instruction starting at `address`, nullptr if no reachable
+    // instruction starts there
+    const Instruction* instruction(uint16_t address) const;
+
+    // the block containing `address`, nullptr if it isn't reachable code
+    const BasicBlock* block(uint16_t address) const;
+
+    // the instructions making up `block` in order
+    std::vector<const Instruction*> block_instructions(const BasicBlock& block) const;
+
+    // every reachable instruction grouped into blocks, with entry points,
+    // subroutines and problems marked. with `code` each line also shows
+    // the instruction's bytes
+    std::string listing(const uint8_t* code = nullptr) const;
+
+    // the control flow graph in graphviz dot format
+    std::string dot() const;
+  };
+
+  CodeAnalysis analyse_code(const uint8_t* code, uint32_t size);
+
+}
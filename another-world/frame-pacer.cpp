@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include "frame-pacer.hpp"
+
+namespace another_world {
+
+  void FramePacer::reset() {
+    started = false;
+  }
+
+  uint32_t FramePacer::wait(int16_t pause) {
+    clock::time_point now = clock::now();
+
+    if (!started) {
+      started = true;
+      deadline = now;
+      frames++;
+      return 1;
+    }
+
+    // a pause of zero (or a nonsense negative value) means run the next
+    // frame straight away
+    clock::duration duration = std::chrono::microseconds(TICK_US * std::max<int16_t>(pause, 0));
+    deadline += duration;
+
+    if (now < deadline) {
+      // sleep through most of the wait, the OS scheduler is only accurate
+      // to a millisecond or so (often far worse) so spin for the rest
+      if (deadline - now > spin) {
+        std::this_thread::sleep_until(deadline - spin);
+      }
+
+      while ((now = clock::now()) < deadline) {
+        std::this_thread::yield();
+      }
+
+      record(now - deadline);
+      frames++;
+      return 1;
+    }
+
+    record(now - deadline);
+    frames++;
+
+    if (duration == clock::duration::zero()) {
+      deadline = now;
+      return 1;
+    }
+
+    // how many whole frames have we missed?
+    uint32_t missed = uint32_t((now - deadline) / duration);
+
+    if (missed == 0) {
+      // late, but within a frame - keep the original schedule so we
+      // recover the lost time over the next few frames
+      return 1;
+    }
+
+    // either run the missed frames back to back (up to a limit) or drop
+    // them, anything we don't catch up on is dropped and the schedule
+    // restarts from now
+    uint32_t extra = 0;
+    if (policy == DropPolicy::CATCH_UP) {
+      extra = std::min<uint32_t>(missed, max_catch_up);
+      caught_up_frames += extra;
+      frames += extra;
+      deadline += duration * extra;
+      missed -= extra;
+    }
+
+    if (missed > 0) {
+      dropped_frames += missed;
+      deadline = now;
+    }
+
+    return 1 + extra;
+  }
+
+  void FramePacer::record(clock::duration lateness) {
+    uint32_t us = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(lateness).count());
+    worst_lateness_us = std::max(worst_lateness_us, us);
+    histogram[std::min<uint32_t>(us / BUCKET_US, BUCKET_COUNT - 1)]++;
+  }
+
+  std::string FramePacer::report() const {
+    std::string result;
+    char line[128];
+
+    snprintf(line, sizeof(line), "frames: %u, dropped: %u, caught up: %u, worst lateness: %.2fms\n",
+      frames, dropped_frames, caught_up_frames, worst_lateness_us / 1000.0f);
+    result += line;
+
+    uint32_t total = 0;
+    uint32_t highest = 0;
+    for (auto count : histogram) {
+      total += count;
+      highest = std::max(highest, count);
+    }
+
+    if (total == 0) {
+      return result;
+    }
+
+    for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+      if (histogram[i] == 0) {
+        continue;
+      }
+
+      std::string bar(histogram[i] * 40 / highest, '#');
+      snprintf(line, sizeof(line), "%5.1fms%s %6u %5.1f%% %s\n",
+        i * BUCKET_US / 1000.0f, i == BUCKET_COUNT - 1 ? "+" : " ", histogram[i], histogram[i] * 100.0f / total, bar.c_str());
+      result += line;
+    }
+
+    return result;
+  }
+
+}
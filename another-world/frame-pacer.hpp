@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+  schedules VM frames without burning a core
+
+  the game sets register 0xff to the number of 20ms ticks the frame it has
+  just produced should stay on screen. rather than polling the clock the
+  pacer sleeps until shortly before the next deadline and then spins for
+  the remainder, which keeps the precision of a busy-wait at a fraction
+  of the cost.
+
+  how late each frame actually starts is recorded in a jitter histogram.
+  when the VM overruns by one or more whole frames the configured policy
+  decides whether those frames are dropped (the schedule is re-anchored
+  to now) or caught up by running several VM frames back to back.
+*/
+
+namespace another_world {
+
+  struct FramePacer {
+    using clock = std::chrono::steady_clock;
+
+    enum class DropPolicy { DROP, CATCH_UP };
+
+    static constexpr uint32_t TICK_US = 20000;          // one unit of the pause register
+    static constexpr uint32_t BUCKET_US = 100;          // width of each histogram bucket
+    static constexpr uint8_t  BUCKET_COUNT = 50;        // last bucket also counts anything later
+
+    DropPolicy policy = DropPolicy::DROP;
+    uint8_t max_catch_up = 4;                           // most extra frames run in one go
+    std::chrono::microseconds spin = std::chrono::microseconds(1500);
+
+    // statistics
+    uint32_t frames = 0;
+    uint32_t dropped_frames = 0;
+    uint32_t caught_up_frames = 0;
+    uint32_t histogram[BUCKET_COUNT] = { 0 };
+    uint32_t worst_lateness_us = 0;
+
+    // waits until the next frame is due given the value of the pause
+    // register and returns the number of VM frames the caller should run
+    // before presenting (more than one only when catching up)
+    uint32_t wait(int16_t pause);
+
+    // start a new schedule from the current time (for example after the
+    // game has been paused)
+    void reset();
+
+    // human readable summary of the statistics and jitter histogram
+    std::string report() const;
+
+  private:
+    bool started = false;
+    clock::time_point deadline;
+
+    void record(clock::duration lateness);
+  };
+
+}
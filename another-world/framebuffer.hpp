@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/*
+  framebuffer pixel formats
+
+  the original game works with 320 x 200 pages of 16 colours. we support
+  two ways of storing those pixels in memory, selected at build time by
+  defining (or not) AW_FRAMEBUFFER_CHUNKY:
+
+    packed (default) - two pixels per byte, the left pixel in the high
+                       nibble. each page is 32000 bytes.
+    chunky           - one pixel per byte. each page is 64000 bytes but
+                       every write is a plain store rather than a
+                       read-modify-write of a nibble.
+
+  both formats implement the same set of static raster kernels so the
+  virtual machine (and any benchmarks) can be written once against
+  either of them.
+*/
+
+namespace another_world {
+
+  // drawing colours with special meaning (see VirtualMachine::point())
+  constexpr uint8_t COLOR_BLEND = 0x10;   // set the high bit of the existing pixel
+                                          // anything above COLOR_BLEND copies from page 0
+
+  struct PackedFramebuffer {
+    static constexpr const char* name = "packed 4bpp";
+    static constexpr uint32_t bytes_per_row = 160;
+    static constexpr uint32_t page_size = bytes_per_row * 200;
+
+    static uint8_t get(const uint8_t* page, int16_t x, int16_t y) {
+      uint8_t v = page[y * bytes_per_row + (x >> 1)];
+      return x & 0b1 ? v & 0x0f : v >> 4;
+    }
+
+    static void plot(uint8_t* page, int16_t x, int16_t y, uint8_t color, const uint8_t* mask_page) {
+      uint32_t offset = y * bytes_per_row + (x >> 1);
+      uint8_t mask = x & 0b1 ? 0x0f : 0xf0;
+      uint8_t* pd = page + offset;
+
+      if (color == COLOR_BLEND) {
+        (*pd) |= 0x88 & mask;
+      } else if (color > COLOR_BLEND) {
+        (*pd) = ((*pd) & ~mask) | (mask_page[offset] & mask);
+      } else {
+        uint8_t c = color & 0x0f;
+        c |= c << 4;
+        (*pd) = ((*pd) & ~mask) | (c & mask);
+      }
+    }
+
+    // fill pixels x1 to x2 (inclusive) on row y, coordinates must already
+    // be clipped to the page
+    static void span(uint8_t* page, int16_t x1, int16_t x2, int16_t y, uint8_t color, const uint8_t* mask_page) {
+      // plot a lone left hand pixel if the span starts on an odd column
+      // and a lone right hand pixel if it ends on an even column, which
+      // leaves a run of whole bytes in between
+      if (x1 & 0b1) {
+        plot(page, x1, y, color, mask_page);
+        x1++;
+      }
+
+      if (x1 > x2) {
+        return;
+      }
+
+      if (!(x2 & 0b1)) {
+        plot(page, x2, y, color, mask_page);
+        x2--;
+      }
+
+      if (x1 > x2) {
+        return;
+      }
+
+      uint32_t offset = y * bytes_per_row + (x1 >> 1);
+      uint32_t count = (x2 - x1 + 1) >> 1;
+      uint8_t* pd = page + offset;
+
+      if (color == COLOR_BLEND) {
+        while (count--) {
+          *pd++ |= 0x88;
+        }
+      } else if (color > COLOR_BLEND) {
+        memcpy(pd, mask_page + offset, count);
+      } else {
+        uint8_t c = color & 0x0f;
+        memset(pd, c | (c << 4), count);
+      }
+    }
+
+    static void clear(uint8_t* page, uint8_t color) {
+      color &= 0x0f;
+      memset(page, color | (color << 4), page_size);
+    }
+
+    static void copy(uint8_t* destination, const uint8_t* source) {
+      memcpy(destination, source, page_size);
+    }
+
+    // IMAGE resources are stored as four bitplanes of 8000 bytes (a la
+    // Amiga/mode 9) so the pixels have to be gathered from each plane
+    static void from_planar(uint8_t* page, const uint8_t* planar) {
+      uint8_t* p = page;
+      for (uint16_t y = 0; y < 200; y++) {
+        for (uint16_t x = 0; x < 320; x += 8) {
+          uint8_t b1 = planar[y * 40 + x / 8 + 0];
+          uint8_t b2 = planar[y * 40 + x / 8 + 8000];
+          uint8_t b3 = planar[y * 40 + x / 8 + 16000];
+          uint8_t b4 = planar[y * 40 + x / 8 + 24000];
+
+          for (uint8_t i = 0; i < 4; i++) {
+            uint8_t v1 = (b1 & 0b10000000) >> 0;
+            uint8_t v2 = (b2 & 0b10000000) >> 1;
+            uint8_t v3 = (b3 & 0b10000000) >> 2;
+            uint8_t v4 = (b4 & 0b10000000) >> 3;
+
+            b1 <<= 1;
+            b2 <<= 1;
+            b3 <<= 1;
+            b4 <<= 1;
+
+            uint8_t v5 = (b1 & 0b10000000) >> 4;
+            uint8_t v6 = (b2 & 0b10000000) >> 5;
+            uint8_t v7 = (b3 & 0b10000000) >> 6;
+            uint8_t v8 = (b4 & 0b10000000) >> 7;
+
+            b1 <<= 1;
+            b2 <<= 1;
+            b3 <<= 1;
+            b4 <<= 1;
+
+            *p++ = v1 | v2 | v3 | v4 | v5 | v6 | v7 | v8;
+          }
+        }
+      }
+    }
+
+    // expand one row of the page into palette indices, one per byte
+    static void unpack_row(const uint8_t* page, int16_t y, uint8_t* indices) {
+      const uint8_t* ps = page + y * bytes_per_row;
+      for (uint16_t x = 0; x < 320; x += 2) {
+        uint8_t v = *ps++;
+        *indices++ = v >> 4;
+        *indices++ = v & 0x0f;
+      }
+    }
+  };
+
+  struct ChunkyFramebuffer {
+    static constexpr const char* name = "chunky 8bpp";
+    static constexpr uint32_t bytes_per_row = 320;
+    static constexpr uint32_t page_size = bytes_per_row * 200;
+
+    static uint8_t get(const uint8_t* page, int16_t x, int16_t y) {
+      return page[y * bytes_per_row + x];
+    }
+
+    static void plot(uint8_t* page, int16_t x, int16_t y, uint8_t color, const uint8_t* mask_page) {
+      uint32_t offset = y * bytes_per_row + x;
+
+      if (color == COLOR_BLEND) {
+        page[offset] |= 0x08;
+      } else if (color > COLOR_BLEND) {
+        page[offset] = mask_page[offset];
+      } else {
+        page[offset] = color & 0x0f;
+      }
+    }
+
+    static void span(uint8_t* page, int16_t x1, int16_t x2, int16_t y, uint8_t color, const uint8_t* mask_page) {
+      if (x1 > x2) {
+        return;
+      }
+
+      uint32_t offset = y * bytes_per_row + x1;
+      uint32_t count = x2 - x1 + 1;
+      uint8_t* pd = page + offset;
+
+      if (color == COLOR_BLEND) {
+        while (count--) {
+          *pd++ |= 0x08;
+        }
+      } else if (color > COLOR_BLEND) {
+        memcpy(pd, mask_page + offset, count);
+      } else {
+        memset(pd, color & 0x0f, count);
+      }
+    }
+
+    static void clear(uint8_t* page, uint8_t color) {
+      memset(page, color & 0x0f, page_size);
+    }
+
+    static void copy(uint8_t* destination, const uint8_t* source) {
+      memcpy(destination, source, page_size);
+    }
+
+    static void from_planar(uint8_t* page, const uint8_t* planar) {
+      uint8_t* p = page;
+      for (uint16_t y = 0; y < 200; y++) {
+        for (uint16_t x = 0; x < 320; x += 8) {
+          uint8_t b1 = planar[y * 40 + x / 8 + 0];
+          uint8_t b2 = planar[y * 40 + x / 8 + 8000];
+          uint8_t b3 = planar[y * 40 + x / 8 + 16000];
+          uint8_t b4 = planar[y * 40 + x / 8 + 24000];
+
+          for (uint8_t i = 0; i < 8; i++) {
+            *p++ = ((b1 & 0x80) >> 4) | ((b2 & 0x80) >> 5) | ((b3 & 0x80) >> 6) | ((b4 & 0x80) >> 7);
+
+            b1 <<= 1;
+            b2 <<= 1;
+            b3 <<= 1;
+            b4 <<= 1;
+          }
+        }
+      }
+    }
+
+    static void unpack_row(const uint8_t* page, int16_t y, uint8_t* indices) {
+      memcpy(indices, page + y * bytes_per_row, 320);
+    }
+  };
+
+#ifdef AW_FRAMEBUFFER_CHUNKY
+  using Framebuffer = ChunkyFramebuffer;
+#else
+  using Framebuffer = PackedFramebuffer;
+#endif
+
+  constexpr uint32_t VRAM_SIZE = Framebuffer::page_size;
+
+}
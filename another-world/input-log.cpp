@@ -0,0 +1,160 @@
+/*
+  input logs are stored little endian as:
+
+    "AWIL", version (16-bit), starting chapter (16-bit), frame count
+    (32-bit), final frame hash (64-bit)
+
+  followed by runs of identical frames, each a mask byte and the length of
+  the run as an unsigned LEB128 varint
+*/
+
+#include <cstring>
+
+#include "input-log.hpp"
+
+namespace another_world {
+
+  constexpr char INPUT_LOG_MAGIC[4] = { 'A', 'W', 'I', 'L' };
+
+  uint8_t input_to_mask(const Input& input) {
+    return (input.up ? INPUT_UP : 0) | (input.down ? INPUT_DOWN : 0) | (input.left ? INPUT_LEFT : 0) |
+      (input.right ? INPUT_RIGHT : 0) | (input.action ? INPUT_ACTION : 0);
+  }
+
+  Input mask_to_input(uint8_t mask) {
+    Input input;
+    input.up = (mask & INPUT_UP) != 0;
+    input.down = (mask & INPUT_DOWN) != 0;
+    input.left = (mask & INPUT_LEFT) != 0;
+    input.right = (mask & INPUT_RIGHT) != 0;
+    input.action = (mask & INPUT_ACTION) != 0;
+    return input;
+  }
+
+  uint64_t frame_hash(const VirtualMachine& vm) {
+    uint64_t hash = 0xcbf29ce484222325;
+
+    auto add = [&hash](const void* data, size_t size) {
+      const uint8_t* p = (const uint8_t*)data;
+      for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3;
+      }
+    };
+
+    for (uint8_t i = 0; i < 4; i++) {
+      add(vm.engine.vram[i], VRAM_SIZE);
+    }
+
+    add(vm.registers, sizeof(vm.registers));
+    for (auto& thread : vm.threads) {
+      add(&thread.pc, sizeof(thread.pc));
+      add(&thread.paused, sizeof(thread.paused));
+    }
+    for (auto pc : vm.call_stack) {
+      add(&pc, sizeof(pc));
+    }
+
+    return hash;
+  }
+
+  void InputLog::truncate(uint32_t frames) {
+    if (frames < masks.size()) {
+      masks.resize(frames);
+    }
+  }
+
+  std::vector<uint8_t> InputLog::encode() const {
+    std::vector<uint8_t> data(INPUT_LOG_MAGIC, INPUT_LOG_MAGIC + 4);
+
+    auto put = [&data](uint64_t v, uint8_t bytes) {
+      for (uint8_t i = 0; i < bytes; i++) {
+        data.push_back(uint8_t(v >> (i * 8)));
+      }
+    };
+
+    put(VERSION, 2);
+    put(chapter, 2);
+    put(masks.size(), 4);
+    put(final_hash, 8);
+
+    for (size_t i = 0; i < masks.size(); ) {
+      size_t run = 1;
+      while (i + run < masks.size() && masks[i + run] == masks[i]) {
+        run++;
+      }
+
+      data.push_back(masks[i]);
+      for (size_t v = run; ; v >>= 7) {
+        if (v < 0x80) {
+          data.push_back(uint8_t(v));
+          break;
+        }
+        data.push_back(uint8_t(v | 0x80));
+      }
+
+      i += run;
+    }
+
+    return data;
+  }
+
+  bool InputLog::decode(const uint8_t* data, uint32_t size) {
+    if (size < 20 || memcmp(data, INPUT_LOG_MAGIC, 4) != 0) {
+      return false;
+    }
+
+    auto get = [data](uint32_t offset, uint8_t bytes) {
+      uint64_t v = 0;
+      for (uint8_t i = 0; i < bytes; i++) {
+        v |= uint64_t(data[offset + i]) << (i * 8);
+      }
+      return v;
+    };
+
+    if (get(4, 2) != VERSION) {
+      return false;
+    }
+
+    uint16_t start_chapter = uint16_t(get(6, 2));
+    uint32_t frame_count = uint32_t(get(8, 4));
+    uint64_t hash = get(12, 8);
+
+    // not reserved up front, the frame count hasn't been checked against
+    // the runs yet and a long run takes only a few bytes, so nothing
+    // bounds it until they've been read
+    std::vector<uint8_t> decoded;
+
+    uint32_t position = 20;
+    while (position < size) {
+      uint8_t mask = data[position++];
+
+      uint64_t run = 0;
+      for (uint8_t shift = 0; ; shift += 7) {
+        if (position >= size || shift > 28) {
+          return false;
+        }
+
+        uint8_t b = data[position++];
+        run |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+          break;
+        }
+      }
+
+      if (decoded.size() + run > frame_count) {
+        return false;
+      }
+      decoded.insert(decoded.end(), size_t(run), mask);
+    }
+
+    if (decoded.size() != frame_count) {
+      return false;
+    }
+
+    chapter = start_chapter;
+    masks.swap(decoded);
+    final_hash = hash;
+    return true;
+  }
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "virtual-machine.hpp"
+
+/*
+  input recordings
+
+  the vm only looks at the input once per frame, so a play session can be
+  captured as one input mask per frame. replaying the masks from the same
+  starting point reproduces the session exactly, which turns it into a
+  repeatable test or benchmark.
+
+  a hash of the vm state taken at the end of the recording is stored with
+  it so a replay can confirm it ended up in the same place.
+*/
+
+namespace another_world {
+
+  enum InputMask : uint8_t {
+    INPUT_UP      = 0x01,
+    INPUT_DOWN    = 0x02,
+    INPUT_LEFT    = 0x04,
+    INPUT_RIGHT   = 0x08,
+    INPUT_ACTION  = 0x10
+  };
+
+  uint8_t input_to_mask(const Input& input);
+  Input mask_to_input(uint8_t mask);
+
+  // FNV-1a hash of the state that identifies a frame: the four video
+  // pages, registers, threads and call stack (flush the pages first when
+  // fast forwarding)
+  uint64_t frame_hash(const VirtualMachine& vm);
+
+  struct InputLog {
+    static constexpr uint16_t VERSION = 1;
+    static constexpr uint16_t FROM_SNAPSHOT = 0;     // `chapter` when the recording starts from a save state
+
+    uint16_t chapter = 16001;                        // chapter the recording starts from
+    std::vector<uint8_t> masks;                      // one per frame
+    uint64_t final_hash = 0;                         // frame_hash() after the last frame
+
+    void record(const Input& input) { masks.push_back(input_to_mask(input)); }
+    Input frame(uint32_t i) const { return mask_to_input(i < masks.size() ? masks[i] : 0); }
+    uint32_t frames() const { return uint32_t(masks.size()); }
+
+    // drop everything after the first `frames` frames (for example when
+    // the player rewinds)
+    void truncate(uint32_t frames);
+
+    // serialise with the masks run length encoded, a typical session takes
+    // a few bytes per second of play
+    std::vector<uint8_t> encode() const;
+
+    // returns false if the data isn't a valid recording
+    bool decode(const uint8_t* data, uint32_t size);
+  };
+
+}
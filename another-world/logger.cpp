@@ -0,0 +1,672 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cwchar>
+
+#include "logger.hpp"
+
+namespace another_world {
+
+  constexpr char LOG_MAGIC[4] = { 'A', 'W', 'L', 'G' };
+
+  // what a printf conversion takes from the argument list
+  enum class Argument : uint8_t { NONE, INT, UINT, CHAR, DOUBLE, STRING, WIDE_STRING, POINTER, COUNT };
+  enum class Length : uint8_t { DEFAULT, HH, H, L, LL, Z, J, T, LONG_DOUBLE };
+
+  struct Conversion {
+    const char* length_start;     // where the length modifier (if any) starts
+    const char* end;              // just past the conversion character
+    Argument argument = Argument::NONE;
+    Length length = Length::DEFAULT;
+    bool star_width = false;
+    bool star_precision = false;
+  };
+
+  // parses the conversion following a '%' (`p` points just after it),
+  // both the logger and format_log() go through here so they agree on
+  // what each conversion stores
+  static Conversion parse_conversion(const char* p) {
+    Conversion c;
+
+    while (*p && strchr("-+ #0'", *p)) {
+      p++;
+    }
+    if (*p == '*') {
+      c.star_width = true;
+      p++;
+    }
+    while (isdigit((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        c.star_precision = true;
+        p++;
+      }
+      while (isdigit((unsigned char)*p)) {
+        p++;
+      }
+    }
+
+    c.length_start = p;
+    if (p[0] == 'h' && p[1] == 'h') { c.length = Length::HH; p += 2; }
+    else if (p[0] == 'l' && p[1] == 'l') { c.length = Length::LL; p += 2; }
+    else if (strncmp(p, "I64", 3) == 0) { c.length = Length::LL; p += 3; }
+    else if (strncmp(p, "I32", 3) == 0) { p += 3; }
+    else if (*p == 'h') { c.length = Length::H; p++; }
+    else if (*p == 'l') { c.length = Length::L; p++; }
+    else if (*p == 'q') { c.length = Length::LL; p++; }
+    else if (*p == 'z' || *p == 'I') { c.length = Length::Z; p++; }
+    else if (*p == 'j') { c.length = Length::J; p++; }
+    else if (*p == 't') { c.length = Length::T; p++; }
+    else if (*p == 'L') { c.length = Length::LONG_DOUBLE; p++; }
+
+    switch (*p) {
+      case 'd': case 'i':
+        c.argument = Argument::INT; break;
+      case 'u': case 'o': case 'x': case 'X':
+        c.argument = Argument::UINT; break;
+      case 'c': case 'C':
+        c.argument = Argument::CHAR; break;
+      case 's':
+        c.argument = c.length == Length::L ? Argument::WIDE_STRING : Argument::STRING; break;
+      case 'S':
+        c.argument = Argument::WIDE_STRING; break;
+      case 'p':
+        c.argument = Argument::POINTER; break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        c.argument = Argument::DOUBLE; break;
+      case 'n':
+        c.argument = Argument::COUNT; break;
+      default:
+        break;
+    }
+
+    c.end = *p ? p + 1 : p;
+    return c;
+  }
+
+  static void put_u16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+  static void put_u32(uint8_t* p, uint32_t v) { put_u16(p, uint16_t(v)); put_u16(p + 2, uint16_t(v >> 16)); }
+  static void put_u64(uint8_t* p, uint64_t v) { put_u32(p, uint32_t(v)); put_u32(p + 4, uint32_t(v >> 32)); }
+
+  // the most one log() call can store across all of its records
+  constexpr uint32_t MAX_PAYLOAD = Logger::PAYLOAD_SIZE * Logger::MAX_RECORDS;
+
+  // collects a log() call's arguments, once one doesn't fit nothing more
+  // is written
+  struct PayloadWriter {
+    uint8_t data[MAX_PAYLOAD];
+    uint32_t size = 0;
+    bool overflow = false;
+
+    void number(uint64_t v) {
+      if (overflow || size + 8 > MAX_PAYLOAD) {
+        overflow = true;
+        return;
+      }
+      put_u64(data + size, v);
+      size += 8;
+    }
+
+    // strings that don't fit are cut short, anything after them is dropped
+    void text(const char* s) {
+      if (overflow || size + 2 > MAX_PAYLOAD) {
+        overflow = true;
+        return;
+      }
+      s = s ? s : "(null)";
+      size_t length = strlen(s);
+      size_t room = MAX_PAYLOAD - size - 2;
+      if (length > room) {
+        overflow = true;
+        length = room;
+      }
+      put_u16(data + size, uint16_t(length));
+      memcpy(data + size + 2, s, length);
+      size += 2 + uint32_t(length);
+    }
+
+    void wide_text(const wchar_t* s) {
+      // narrowed, anything outside of ascii becomes '?'
+      char narrow[MAX_PAYLOAD];
+      size_t i = 0;
+      for (; s && s[i] && i + 1 < sizeof(narrow); i++) {
+        narrow[i] = uint32_t(s[i]) < 0x80 ? char(s[i]) : '?';
+      }
+      narrow[i] = 0;
+      text(s ? narrow : nullptr);
+    }
+  };
+
+  static uint16_t get_u16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+  static uint32_t get_u32(const uint8_t* p) { return get_u16(p) | (uint32_t(get_u16(p + 2)) << 16); }
+  static uint64_t get_u64(const uint8_t* p) { return get_u32(p) | (uint64_t(get_u32(p + 4)) << 32); }
+
+  // the ring the calling thread last used, so only the first record a
+  // thread logs has to look its ring up
+  struct RingCache {
+    uint32_t logger = 0;
+    void* ring = nullptr;
+  };
+  static thread_local RingCache ring_cache;
+  static std::atomic<uint32_t> next_logger_id{ 1 };
+
+  Logger::Logger() {
+    id = next_logger_id++;
+  }
+
+  Logger::~Logger() {
+    close();
+    if (ring_cache.logger == id) {
+      ring_cache = RingCache();
+    }
+  }
+
+  bool Logger::open(const std::string& path) {
+    close();
+
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+
+    uint8_t header[6];
+    memcpy(header, LOG_MAGIC, 4);
+    put_u16(header + 4, VERSION);
+    fwrite(header, 1, sizeof(header), file);
+
+    // the new file needs every format string again
+    formats_written = 0;
+    epoch = std::chrono::steady_clock::now();
+
+    draining = true;
+    drainer = std::thread([this]() {
+      while (draining) {
+        if (!drain()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      drain();
+    });
+
+    accepting.store(true, std::memory_order_release);
+    return true;
+  }
+
+  void Logger::close() {
+    accepting.store(false, std::memory_order_release);
+
+    if (drainer.joinable()) {
+      draining = false;
+      drainer.join();
+    }
+
+    if (file) {
+      fclose(file);
+      file = nullptr;
+    }
+  }
+
+  Logger::Ring& Logger::ring() {
+    if (ring_cache.logger == id) {
+      return *(Ring*)ring_cache.ring;
+    }
+
+    std::lock_guard<std::mutex> guard(rings_lock);
+
+    Ring* found = nullptr;
+    for (auto& ring : rings) {
+      if (ring->owner == std::this_thread::get_id()) {
+        found = ring.get();
+      }
+    }
+
+    if (!found) {
+      rings.emplace_back(new Ring());
+      found = rings.back().get();
+      found->owner = std::this_thread::get_id();
+      found->thread = uint8_t(rings.size() - 1);
+      found->records.reset(new uint8_t[RING_RECORDS * RECORD_SIZE]);
+    }
+
+    ring_cache.logger = id;
+    ring_cache.ring = found;
+    return *found;
+  }
+
+  // lists what a format string takes from the argument list, one byte per
+  // argument: its Argument and Length, so vlog() only parses each format
+  // string once per thread
+  static void plan_arguments(const char* format, std::vector<uint8_t>& arguments) {
+    for (const char* p = format; *p; p++) {
+      if (*p != '%') {
+        continue;
+      }
+      if (p[1] == '%') {
+        p++;
+        continue;
+      }
+
+      Conversion c = parse_conversion(p + 1);
+      if (c.star_width) {
+        arguments.push_back(uint8_t(Argument::INT));
+      }
+      if (c.star_precision) {
+        arguments.push_back(uint8_t(Argument::INT));
+      }
+      if (c.argument != Argument::NONE) {
+        arguments.push_back(uint8_t(c.argument) | uint8_t(c.length) << 4);
+      }
+      p = c.end - 1;
+    }
+  }
+
+  const Logger::Format& Logger::find_format(Ring& ring, const char* format) {
+    auto cached = ring.formats.find(format);
+    if (cached != ring.formats.end()) {
+      return cached->second;
+    }
+
+    Format& entry = ring.formats[format];
+    plan_arguments(format, entry.arguments);
+
+    std::lock_guard<std::mutex> guard(formats_lock);
+    auto known = format_ids.find(format);
+    if (known != format_ids.end()) {
+      entry.id = known->second;
+    } else {
+      entry.id = uint16_t(format_table.size());
+      format_ids[format] = entry.id;
+      format_table.push_back(format);
+    }
+
+    return entry;
+  }
+
+  void Logger::log(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vlog(format, args);
+    va_end(args);
+  }
+
+  void Logger::vlog(const char* format, va_list args) {
+    if (!accepting.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    Ring& r = ring();
+    const Format& f = find_format(r, format);
+
+    PayloadWriter payload;
+    for (uint8_t argument : f.arguments) {
+      Length length = Length(argument >> 4);
+      switch (Argument(argument & 0x0f)) {
+        case Argument::INT: {
+          int64_t v;
+          switch (length) {
+            case Length::HH: v = (signed char)va_arg(args, int); break;
+            case Length::H:  v = (short)va_arg(args, int); break;
+            case Length::L:  v = va_arg(args, long); break;
+            case Length::LL: v = va_arg(args, long long); break;
+            case Length::Z:  v = int64_t(va_arg(args, size_t)); break;
+            case Length::J:  v = va_arg(args, intmax_t); break;
+            case Length::T:  v = va_arg(args, ptrdiff_t); break;
+            default:         v = va_arg(args, int); break;
+          }
+          payload.number(uint64_t(v));
+          break;
+        }
+
+        case Argument::UINT: {
+          uint64_t v;
+          switch (length) {
+            case Length::HH: v = (unsigned char)va_arg(args, unsigned int); break;
+            case Length::H:  v = (unsigned short)va_arg(args, unsigned int); break;
+            case Length::L:  v = va_arg(args, unsigned long); break;
+            case Length::LL: v = va_arg(args, unsigned long long); break;
+            case Length::Z:  v = va_arg(args, size_t); break;
+            case Length::J:  v = va_arg(args, uintmax_t); break;
+            case Length::T:  v = uint64_t(va_arg(args, ptrdiff_t)); break;
+            default:         v = va_arg(args, unsigned int); break;
+          }
+          payload.number(v);
+          break;
+        }
+
+        case Argument::CHAR:
+          payload.number(uint64_t(va_arg(args, int)));
+          break;
+
+        case Argument::DOUBLE: {
+          double v = length == Length::LONG_DOUBLE ? double(va_arg(args, long double)) : va_arg(args, double);
+          uint64_t bits;
+          memcpy(&bits, &v, sizeof(bits));
+          payload.number(bits);
+          break;
+        }
+
+        case Argument::STRING:
+          payload.text(va_arg(args, const char*));
+          break;
+
+        case Argument::WIDE_STRING:
+          payload.wide_text(va_arg(args, const wchar_t*));
+          break;
+
+        case Argument::POINTER:
+          payload.number(uint64_t(uintptr_t(va_arg(args, void*))));
+          break;
+
+        case Argument::COUNT:
+          va_arg(args, void*);
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    uint32_t count = std::max<uint32_t>(1, (payload.size + PAYLOAD_SIZE - 1) / PAYLOAD_SIZE);
+
+    uint32_t head = r.head.load(std::memory_order_relaxed);
+    while (head + count - r.tail.load(std::memory_order_acquire) > RING_RECORDS) {
+      if (!accepting.load(std::memory_order_acquire)) {
+        return;
+      }
+      waits++;
+      std::this_thread::yield();
+    }
+
+    uint64_t ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+    for (uint32_t i = 0; i < count; i++) {
+      uint8_t* record = &r.records[((head + i) & (RING_RECORDS - 1)) * RECORD_SIZE];
+      uint32_t offset = i * PAYLOAD_SIZE;
+      uint32_t length = std::min(payload.size - offset, PAYLOAD_SIZE);
+
+      put_u64(record, ns);
+      put_u32(record + 8, r.sequence++);
+      put_u16(record + 12, i == 0 ? f.id : CONTINUATION);
+      record[14] = r.thread;
+      record[15] = uint8_t(length);
+      memcpy(record + HEADER_SIZE, payload.data + offset, length);
+    }
+
+    r.head.store(head + count, std::memory_order_release);
+
+    records.fetch_add(1, std::memory_order_relaxed);
+    if (payload.overflow) {
+      truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool Logger::drain() {
+    std::vector<Ring*> current;
+    {
+      std::lock_guard<std::mutex> guard(rings_lock);
+      for (auto& ring : rings) {
+        current.push_back(ring.get());
+      }
+    }
+
+    // every record up to these heads was logged after its format string
+    // was added to the table, so writing the table out next covers them
+    std::vector<uint32_t> heads(current.size());
+    for (size_t i = 0; i < current.size(); i++) {
+      heads[i] = current[i]->head.load(std::memory_order_acquire);
+    }
+
+    bool drained = false;
+    {
+      std::lock_guard<std::mutex> guard(formats_lock);
+      for (; formats_written < format_table.size(); formats_written++) {
+        const std::string& format = format_table[formats_written];
+        uint8_t entry[5] = { 'F' };
+        put_u16(entry + 1, uint16_t(formats_written));
+        put_u16(entry + 3, uint16_t(std::min<size_t>(format.size(), 0xffff)));
+        fwrite(entry, 1, sizeof(entry), file);
+        fwrite(format.data(), 1, std::min<size_t>(format.size(), 0xffff), file);
+        drained = true;
+      }
+    }
+
+    for (size_t i = 0; i < current.size(); i++) {
+      Ring& ring = *current[i];
+      uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+      while (tail != heads[i]) {
+        // as many records as are in one piece in the ring
+        uint32_t start = tail & (RING_RECORDS - 1);
+        uint32_t count = std::min(heads[i] - tail, RING_RECORDS - start);
+
+        uint8_t entry[3] = { 'R' };
+        put_u16(entry + 1, uint16_t(count));
+        fwrite(entry, 1, sizeof(entry), file);
+        fwrite(&ring.records[start * RECORD_SIZE], RECORD_SIZE, count, file);
+
+        tail += count;
+        ring.tail.store(tail, std::memory_order_release);
+        drained = true;
+      }
+    }
+
+    if (drained) {
+      fflush(file);
+    }
+    return drained;
+  }
+
+  // reads a payload back in the order PayloadWriter wrote it, anything
+  // past the end reads as missing
+  struct PayloadReader {
+    std::vector<uint8_t> data;
+    size_t position = 0;
+
+    bool number(uint64_t& v) {
+      if (position + 8 > data.size()) {
+        return false;
+      }
+      v = get_u64(&data[position]);
+      position += 8;
+      return true;
+    }
+
+    bool text(std::string& s) {
+      if (position + 2 > data.size()) {
+        return false;
+      }
+      size_t length = std::min<size_t>(get_u16(&data[position]), data.size() - position - 2);
+      s.assign((const char*)&data[position + 2], length);
+      position += 2 + length;
+      return true;
+    }
+  };
+
+  template<typename T>
+  static void append_formatted(std::string& output, const std::string& spec, T value) {
+    int length = snprintf(nullptr, 0, spec.c_str(), value);
+    if (length > 0) {
+      size_t at = output.size();
+      output.resize(at + size_t(length) + 1);
+      snprintf(&output[at], size_t(length) + 1, spec.c_str(), value);
+      output.resize(at + size_t(length));
+    }
+  }
+
+  static void format_record(const std::string& format, PayloadReader& payload, std::string& output) {
+    for (size_t i = 0; i < format.size(); i++) {
+      const char* p = format.c_str() + i;
+      if (*p != '%') {
+        output += *p;
+        continue;
+      }
+      if (p[1] == '%') {
+        output += '%';
+        i++;
+        continue;
+      }
+
+      Conversion c = parse_conversion(p + 1);
+      size_t consumed = size_t(c.end - p);
+
+      // rebuild the conversion without its length modifier (every number
+      // is stored as 64 bits) and with any '*' replaced by its value
+      std::string spec = "%";
+      bool missing = false;
+      for (const char* s = p + 1; s < c.length_start; s++) {
+        if (*s == '*') {
+          uint64_t v = 0;
+          missing |= !payload.number(v);
+          spec += std::to_string(int64_t(v));
+        } else {
+          spec += *s;
+        }
+      }
+
+      char conversion = c.end[-1];
+      uint64_t v = 0;
+      std::string text;
+
+      switch (c.argument) {
+        case Argument::STRING:
+        case Argument::WIDE_STRING:
+          missing |= !payload.text(text);
+          break;
+        case Argument::COUNT:
+        case Argument::NONE:
+          break;
+        default:
+          missing |= !payload.number(v);
+          break;
+      }
+
+      if (missing) {
+        output += "?";
+      } else {
+        switch (c.argument) {
+          case Argument::INT:
+            append_formatted(output, spec + "ll" + conversion, (long long)v);
+            break;
+          case Argument::UINT:
+            append_formatted(output, spec + "ll" + conversion, (unsigned long long)v);
+            break;
+          case Argument::CHAR:
+            append_formatted(output, spec + "c", int(v));
+            break;
+          case Argument::DOUBLE: {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            append_formatted(output, spec + conversion, d);
+            break;
+          }
+          case Argument::STRING:
+          case Argument::WIDE_STRING:
+            append_formatted(output, spec + "s", text.c_str());
+            break;
+          case Argument::POINTER:
+            append_formatted(output, spec + "p", (void*)uintptr_t(v));
+            break;
+          case Argument::COUNT:
+            break;
+          default:
+            // not a conversion printf knows, shown as it was written
+            output.append(p, consumed);
+            break;
+        }
+      }
+
+      i += consumed - 1;
+    }
+  }
+
+  bool format_log(const uint8_t* data, size_t size, std::string& output, bool timestamps) {
+    if (size < 6 || memcmp(data, LOG_MAGIC, 4) != 0 || get_u16(data + 4) != Logger::VERSION) {
+      return false;
+    }
+
+    std::map<uint16_t, std::string> formats;
+    std::vector<const uint8_t*> records;
+    bool complete = true;
+
+    size_t position = 6;
+    while (position < size) {
+      uint8_t tag = data[position++];
+      if (tag == 'F' && position + 4 <= size) {
+        uint16_t id = get_u16(data + position);
+        uint16_t length = get_u16(data + position + 2);
+        position += 4;
+        if (position + length > size) {
+          complete = false;
+          break;
+        }
+        formats[id].assign((const char*)data + position, length);
+        position += length;
+      } else if (tag == 'R' && position + 2 <= size) {
+        uint16_t count = get_u16(data + position);
+        position += 2;
+        for (uint16_t i = 0; i < count; i++) {
+          if (position + Logger::RECORD_SIZE > size) {
+            complete = false;
+            break;
+          }
+          records.push_back(data + position);
+          position += Logger::RECORD_SIZE;
+        }
+        if (!complete) {
+          break;
+        }
+      } else {
+        complete = false;
+        break;
+      }
+    }
+
+    // each thread's records are in order, merge them by time
+    std::stable_sort(records.begin(), records.end(), [](const uint8_t* a, const uint8_t* b) {
+      uint64_t ta = get_u64(a), tb = get_u64(b);
+      return ta != tb ? ta < tb : (a[14] != b[14] ? a[14] < b[14] : get_u32(a + 8) < get_u32(b + 8));
+    });
+
+    for (size_t i = 0; i < records.size(); i++) {
+      const uint8_t* record = records[i];
+      if (get_u16(record + 12) == Logger::CONTINUATION) {
+        // the rest of a record that was cut off at the start of the log
+        continue;
+      }
+
+      // a record's payload carries on in the continuation records that
+      // follow it, they share its time so sort straight after it
+      PayloadReader payload;
+      const uint8_t* part = record;
+      while (true) {
+        const uint8_t* payload_start = part + Logger::HEADER_SIZE;
+        payload.data.insert(payload.data.end(), payload_start, payload_start + std::min<uint32_t>(part[15], Logger::PAYLOAD_SIZE));
+
+        const uint8_t* next = i + 1 < records.size() ? records[i + 1] : nullptr;
+        if (!next || get_u16(next + 12) != Logger::CONTINUATION || next[14] != part[14] || get_u32(next + 8) != get_u32(part + 8) + 1) {
+          break;
+        }
+        part = next;
+        i++;
+      }
+
+      if (timestamps) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "[%12.6f %3u] ", get_u64(record) / 1e9, record[14]);
+        output += prefix;
+      }
+
+      auto format = formats.find(get_u16(record + 12));
+      if (format != formats.end()) {
+        format_record(format->second, payload, output);
+      } else {
+        output += "(unknown format)";
+      }
+      output += "\n";
+    }
+
+    return complete;
+  }
+
+}
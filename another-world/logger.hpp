@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+  asynchronous binary logger
+
+  log() doesn't format anything, it copies the format string's arguments
+  into a fixed size binary record and appends that to a ring owned by the
+  calling thread. a background thread drains every thread's ring into the
+  log file, so the cost on the logging thread is well under a microsecond
+  rather than a formatted write (and the file open and close that went
+  with it). format_log() (and the logfmt tool) turns a log back into the
+  text printf would have produced, one line per record.
+
+  each ring has a single writer (its thread) and a single reader (the
+  drain thread) so needs no locks. when a thread logs faster than the
+  drain thread keeps up it waits for space rather than losing records.
+
+  format strings are identified by their address, they must be string
+  literals (or at least never change and outlive the logger). each is
+  written to the log once, the first time any thread uses it. arguments
+  are stored as 64-bit numbers and strings are copied in. arguments that
+  don't fit in one record carry on in the records that follow it (up to
+  MAX_RECORDS in all), anything beyond that is cut short.
+
+  log files are stored little endian as "AWLG", version (16-bit) followed
+  by entries that each start with a tag byte:
+
+    'F' : a format string, id (16-bit), length (16-bit) and the text
+    'R' : a count of records (16-bit) followed by that many records of
+          RECORD_SIZE bytes. each is the time since the logger started in
+          nanoseconds (64-bit), sequence number on its thread (32-bit),
+          format id (16-bit), thread (8-bit), payload length (8-bit) and
+          the payload (the arguments in the order the format uses them,
+          numbers as 64-bit values and strings as a 16-bit length and the
+          text). a format id of CONTINUATION marks a record that carries
+          on the payload of the one before it on the same thread
+
+  records from different threads aren't in time order in the file,
+  format_log() sorts them.
+*/
+
+namespace another_world {
+
+  struct Logger {
+    static constexpr uint16_t VERSION = 1;
+    static constexpr uint32_t RECORD_SIZE = 128;
+    static constexpr uint32_t HEADER_SIZE = 16;
+    static constexpr uint32_t PAYLOAD_SIZE = RECORD_SIZE - HEADER_SIZE;
+    static constexpr uint32_t MAX_RECORDS = 16;      // that one log() call can use
+    static constexpr uint32_t RING_RECORDS = 4096;   // per thread, must be a power of two
+    static constexpr uint16_t CONTINUATION = 0xffff; // format id of follow on records
+
+    // statistics
+    std::atomic<uint64_t> records{ 0 };      // logged so far
+    std::atomic<uint64_t> waits{ 0 };        // times a thread found its ring full
+    std::atomic<uint64_t> truncated{ 0 };    // records with arguments cut short
+
+    Logger();
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // start logging to `path` (replacing it), returns false if it can't be
+    // created. nothing is logged until this succeeds
+    bool open(const std::string& path);
+
+    // write out everything logged so far and close the file
+    void close();
+
+    void log(const char* format, ...);
+    void vlog(const char* format, va_list args);
+
+  private:
+    struct Format {
+      uint16_t id;
+      std::vector<uint8_t> arguments;         // what each argument is, see logger.cpp
+    };
+
+    struct Ring {
+      std::atomic<uint32_t> head{ 0 };        // written by the owning thread
+      std::atomic<uint32_t> tail{ 0 };        // written by the drain thread
+      std::thread::id owner;
+      uint8_t thread = 0;
+      uint32_t sequence = 0;
+      std::unique_ptr<uint8_t[]> records;
+
+      // formats this thread has already looked up
+      std::unordered_map<const char*, Format> formats;
+    };
+
+    uint32_t id;                              // tells loggers apart in the per thread cache
+    std::chrono::steady_clock::time_point epoch;
+
+    FILE* file = nullptr;
+    std::atomic<bool> accepting{ false };     // open and taking records
+    std::thread drainer;
+    std::atomic<bool> draining{ false };
+
+    std::mutex rings_lock;
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    std::mutex formats_lock;
+    std::map<std::string, uint16_t> format_ids;
+    std::vector<std::string> format_table;
+    size_t formats_written = 0;
+
+    Ring& ring();
+    const Format& find_format(Ring& ring, const char* format);
+    bool drain();
+  };
+
+  // formats the records in a log written by Logger back into text, one
+  // line per record in the order they were logged. with `timestamps`
+  // each line starts with the time it was logged and the thread that
+  // logged it. returns false if the data isn't a log (or is cut short,
+  // the lines up to that point are still output)
+  bool format_log(const uint8_t* data, size_t size, std::string& output, bool timestamps = false);
+
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+  byte oriented LZ77 (in the style of LZ4) for data that has to decode fast
+
+  the encoded stream is a sequence of blocks each starting with a token
+  byte t:
+
+    t >> 4  : number of literal bytes, if 15 it's followed by bytes that
+              are added on up to and including the first that isn't 255
+    literals
+    offset  : 16-bit little endian distance back to the match (1 - 65535)
+    t & 0x0f: match length less MIN_MATCH, extended like the literals
+
+  the last block has no offset or match, it's just the literals that end
+  the data. there's no entropy coding and nothing crosses a byte
+  boundary, so decoding is a loop of short copies: while there's room in
+  both buffers they're done sixteen bytes at a time (or eight for matches
+  close behind, however close) regardless of their length, which is
+  where the speed comes from. decoding is still bounds checked
+  throughout, malformed data is rejected rather than trusted.
+*/
+
+namespace another_world {
+
+  namespace lz {
+
+    constexpr uint32_t MIN_MATCH = 4;
+    constexpr uint32_t MAX_OFFSET = 0xffff;
+    constexpr uint32_t HASH_BITS = 15;
+    constexpr uint32_t MAX_CHAIN = 64;      // candidates tried per position when encoding
+
+    inline uint32_t read_u32(const uint8_t* p) {
+      uint32_t v;
+      memcpy(&v, p, 4);
+      return v;
+    }
+
+    inline void write_length(std::vector<uint8_t>& output, uint32_t length) {
+      for (; length >= 0xff; length -= 0xff) {
+        output.push_back(0xff);
+      }
+      output.push_back(uint8_t(length));
+    }
+
+    // append the encoding of `size` bytes from `source` to `output`
+    inline void encode(const uint8_t* source, uint32_t size, std::vector<uint8_t>& output) {
+      // hash chains over every position, the most recent first
+      std::vector<int32_t> head(1u << HASH_BITS, -1);
+      std::vector<int32_t> chain(size);
+      auto hash = [source](uint32_t i) { return (read_u32(source + i) * 2654435761u) >> (32 - HASH_BITS); };
+      auto insert = [&](uint32_t i) {
+        uint32_t h = hash(i);
+        chain[i] = head[h];
+        head[h] = int32_t(i);
+      };
+
+      auto emit = [&](uint32_t literal_start, uint32_t literals, uint32_t offset, uint32_t length) {
+        uint32_t match = length ? length - MIN_MATCH : 0;
+        output.push_back(uint8_t(((literals < 15 ? literals : 15) << 4) | (match < 15 ? match : 15)));
+        if (literals >= 15) {
+          write_length(output, literals - 15);
+        }
+        output.insert(output.end(), source + literal_start, source + literal_start + literals);
+        if (length) {
+          output.push_back(uint8_t(offset));
+          output.push_back(uint8_t(offset >> 8));
+          if (match >= 15) {
+            write_length(output, match - 15);
+          }
+        }
+      };
+
+      uint32_t i = 0;
+      uint32_t literal_start = 0;
+      while (i + MIN_MATCH <= size) {
+        // longest match among the most recent candidates
+        uint32_t best_length = 0, best_offset = 0;
+        int32_t candidate = head[hash(i)];
+        for (uint32_t tries = 0; candidate >= 0 && i - uint32_t(candidate) <= MAX_OFFSET && tries < MAX_CHAIN; tries++) {
+          uint32_t length = 0;
+          while (i + length < size && source[candidate + length] == source[i + length]) {
+            length++;
+          }
+          if (length > best_length) {
+            best_length = length;
+            best_offset = i - uint32_t(candidate);
+          }
+          candidate = chain[candidate];
+        }
+
+        if (best_length < MIN_MATCH) {
+          insert(i++);
+          continue;
+        }
+
+        emit(literal_start, i - literal_start, best_offset, best_length);
+        for (uint32_t end = i + best_length; i < end; i++) {
+          if (i + MIN_MATCH <= size) {
+            insert(i);
+          }
+        }
+        literal_start = i;
+      }
+
+      emit(literal_start, size - literal_start, 0, 0);
+    }
+
+    // decode into exactly `size` bytes at `destination`, returns the number
+    // of encoded bytes consumed or zero if the data is malformed
+    inline uint32_t decode(const uint8_t* source, uint32_t source_size, uint8_t* destination, uint32_t size) {
+      const uint8_t* in = source;
+      const uint8_t* in_end = source + source_size;
+      uint8_t* out = destination;
+      uint8_t* out_end = destination + size;
+
+      auto read_length = [&](uint32_t& length) {
+        uint8_t b;
+        do {
+          if (in >= in_end) {
+            return false;
+          }
+          b = *in++;
+          length += b;
+        } while (b == 0xff);
+        return true;
+      };
+
+      while (true) {
+        if (in >= in_end) {
+          return 0;
+        }
+        uint32_t token = *in++;
+
+        uint32_t literals = token >> 4;
+        if (literals == 15 && !read_length(literals)) {
+          return 0;
+        }
+        if (literals > uint32_t(in_end - in) || literals > uint32_t(out_end - out)) {
+          return 0;
+        }
+
+        // sixteen bytes at a time when there's room to overrun
+        if (uint32_t(in_end - in) >= literals + 16 && uint32_t(out_end - out) >= literals + 16) {
+          for (uint32_t i = 0; i < literals; i += 16) {
+            memcpy(out + i, in + i, 16);
+          }
+        } else {
+          memcpy(out, in, literals);
+        }
+        in += literals;
+        out += literals;
+
+        if (out == out_end) {
+          // only the last block can end the data
+          return (token & 0x0f) == 0 ? uint32_t(in - source) : 0;
+        }
+
+        if (in_end - in < 2) {
+          return 0;
+        }
+        uint32_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        uint32_t length = (token & 0x0f) + MIN_MATCH;
+        if ((token & 0x0f) == 15 && !read_length(length)) {
+          return 0;
+        }
+        if (offset == 0 || offset > uint32_t(out - destination) || length > uint32_t(out_end - out)) {
+          return 0;
+        }
+
+        // chunks can't overlap what they're copying as long as the match
+        // is at least a chunk behind. a closer match repeats a pattern
+        // shorter than a chunk (runs of one colour are offset 1), the
+        // pattern is the same any whole number of repeats back so once the
+        // first few bytes are out one at a time the rest is copied in
+        // chunks from the nearest repeat a chunk or more behind. only the
+        // bytes too close to the end of the data for a chunk are left
+        const uint8_t* match = out - offset;
+        uint32_t room = uint32_t(out_end - out);
+        if (offset >= 16 && room >= length + 16) {
+          for (uint32_t i = 0; i < length; i += 16) {
+            memcpy(out + i, match + i, 16);
+          }
+        } else {
+          uint32_t behind = offset >= 8 ? offset : offset * ((offset + 7) / offset);
+          uint32_t i = 0;
+          for (; i < behind - offset && i < length; i++) {
+            out[i] = match[i];
+          }
+          for (; i < length && i + 8 <= room; i += 8) {
+            memcpy(out + i, out + i - behind, 8);
+          }
+          for (; i < length; i++) {
+            out[i] = match[i];
+          }
+        }
+        out += length;
+      }
+    }
+
+  }
+
+}
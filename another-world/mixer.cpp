@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstring>
+
+#include "mixer.hpp"
+#include "sequencer.hpp"
+#include "virtual-machine.hpp"
+
+// SSE2 is part of the x64 baseline and the default for 32-bit MSVC, NEON
+// is always present on AArch64
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define AW_SIMD_SSE2
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+  #define AW_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+namespace another_world {
+
+  // channels are rendered and summed in blocks of this many samples
+  constexpr uint32_t MIX_BLOCK = 256;
+
+  const uint16_t Mixer::frequencies[40] = {
+    0x0cff, 0x0dc3, 0x0e91, 0x0f6f, 0x1056, 0x114e, 0x1259, 0x136c,
+    0x149f, 0x15d9, 0x1726, 0x1888, 0x19fd, 0x1b86, 0x1d21, 0x1ede,
+    0x20ab, 0x229c, 0x24b3, 0x26d7, 0x293f, 0x2bb2, 0x2e4c, 0x3110,
+    0x33fb, 0x370d, 0x3a43, 0x3ddf, 0x4157, 0x4538, 0x4998, 0x4dae,
+    0x5240, 0x5764, 0x5c9a, 0x61c8, 0x6793, 0x6e19, 0x7485, 0x7bbd
+  };
+
+  Mixer::Mixer(uint32_t sample_rate) : sample_rate(sample_rate) {
+  }
+
+  void Mixer::play(uint8_t channel, const Sample& sample, uint32_t frequency, uint8_t volume) {
+    MixerChannel& c = channels[channel & (CHANNEL_COUNT - 1)];
+
+    c.sample = sample;
+    c.position = 0;
+    c.step = uint32_t((uint64_t(frequency) << 16) / sample_rate);
+    c.volume = std::min<uint8_t>(volume, 63);
+    c.active = sample.data != nullptr && sample.length > 0;
+  }
+
+  Sample Mixer::sound_sample(const uint8_t* resource, uint32_t size) {
+    // a SOUND resource starts with an eight byte header:
+    //
+    //  0 - 1: length of the sample in words
+    //  2 - 3: length of the looping section in words (zero if none)
+    //  4 - 7: unused
+    //
+    // the looping section, if there is one, follows straight after the
+    // first part of the sample and repeats until the channel is stopped
+    Sample sample;
+    if (!resource || size < 8) {
+      return sample;
+    }
+
+    // a header that claims more than the resource holds is cut down to
+    // what's there, the loop first
+    uint32_t available = size - 8;
+    sample.data = (const int8_t*)(resource + 8);
+    sample.length = std::min<uint32_t>(read_uint16_bigendian(resource) * 2, available);
+    sample.loop_length = std::min<uint32_t>(read_uint16_bigendian(resource + 2) * 2, available - sample.length);
+
+    if (sample.loop_length) {
+      sample.loop_start = sample.length;
+      sample.length += sample.loop_length;
+    }
+
+    return sample;
+  }
+
+  void Mixer::play_sound(uint8_t channel, const uint8_t* resource, uint32_t size, uint8_t frequency, uint8_t volume) {
+    play(channel, sound_sample(resource, size), frequencies[std::min<uint8_t>(frequency, 39)], volume);
+  }
+
+  void Mixer::set_volume(uint8_t channel, uint8_t volume) {
+    channels[channel & (CHANNEL_COUNT - 1)].volume = std::min<uint8_t>(volume, 63);
+  }
+
+  void Mixer::stop(uint8_t channel) {
+    channels[channel & (CHANNEL_COUNT - 1)].active = false;
+  }
+
+  void Mixer::stop_all() {
+    for (auto& channel : channels) {
+      channel.active = false;
+    }
+  }
+
+  void Mixer::render_channel(MixerChannel& channel, int16_t* output, uint32_t count) {
+    const Sample& sample = channel.sample;
+    uint64_t end = uint64_t(sample.length) << 16;
+    uint32_t i = 0;
+
+    while (i < count) {
+      uint32_t index = uint32_t(channel.position >> 16);
+
+      // the point we interpolate towards wraps back to the start of the
+      // loop (or just holds the last value) at the end of the sample
+      uint32_t next = index + 1;
+      if (next >= sample.length) {
+        next = sample.loop_length ? sample.loop_start : index;
+      }
+
+      int32_t a = sample.data[index];
+      int32_t b = sample.data[next];
+      int32_t fraction = int32_t(channel.position >> 8) & 0xff;
+
+      // interpolated value scaled up to 16 bits then attenuated by volume
+      int32_t value = (a << 8) + (b - a) * fraction;
+      output[i++] = int16_t((value * channel.volume) >> 6);
+
+      channel.position += channel.step;
+      if (channel.position >= end) {
+        if (!sample.loop_length) {
+          channel.active = false;
+          break;
+        }
+
+        while (channel.position >= end) {
+          channel.position -= uint64_t(sample.loop_length) << 16;
+        }
+      }
+    }
+
+    memset(output + i, 0, (count - i) * sizeof(int16_t));
+  }
+
+  // output[i] = saturate(output[i] + input[i])
+  static void accumulate(int16_t* output, const int16_t* input, uint32_t count) {
+    uint32_t i = 0;
+
+#if defined(AW_SIMD_SSE2)
+    for (; i + 8 <= count; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(output + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(input + i));
+      _mm_storeu_si128((__m128i*)(output + i), _mm_adds_epi16(a, b));
+    }
+#elif defined(AW_SIMD_NEON)
+    for (; i + 8 <= count; i += 8) {
+      vst1q_s16(output + i, vqaddq_s16(vld1q_s16(output + i), vld1q_s16(input + i)));
+    }
+#endif
+
+    for (; i < count; i++) {
+      int32_t sum = output[i] + input[i];
+      output[i] = int16_t(std::min(std::max(sum, -32768), 32767));
+    }
+  }
+
+  void Mixer::mix_channels(int16_t* output, uint32_t count) {
+    int16_t scratch[MIX_BLOCK];
+
+    while (count > 0) {
+      uint32_t block = std::min(count, MIX_BLOCK);
+      memset(output, 0, block * sizeof(int16_t));
+
+      for (auto& channel : channels) {
+        if (channel.active) {
+          render_channel(channel, scratch, block);
+          accumulate(output, scratch, block);
+        }
+      }
+
+      output += block;
+      count -= block;
+    }
+  }
+
+  void Mixer::mix(int16_t* output, uint32_t count) {
+    // without music playing there's nothing to stop for
+    if (!sequencer || !sequencer->playing) {
+      mix_channels(output, count);
+      return;
+    }
+
+    // otherwise mix up to each row boundary in turn so that notes start
+    // on exactly the right sample
+    while (count > 0) {
+      uint32_t until_row = sequencer->advance();
+      uint32_t block = std::min(count, until_row);
+      mix_channels(output, block);
+      sequencer->elapsed(block);
+
+      output += block;
+      count -= block;
+    }
+  }
+
+  uint32_t Mixer::produce(uint32_t count) {
+    int16_t block[MIX_BLOCK];
+    uint32_t kept = 0;
+
+    while (count > 0) {
+      uint32_t size = std::min(count, MIX_BLOCK);
+      mix(block, size);
+      kept += ring.push(block, size);
+      count -= size;
+    }
+
+    return kept;
+  }
+
+  uint32_t Mixer::consume(int16_t* output, uint32_t count) {
+    uint32_t copied = ring.pop(output, count);
+    memset(output + copied, 0, (count - copied) * sizeof(int16_t));
+    return copied;
+  }
+
+  const char* Mixer::simd_name() {
+#if defined(AW_SIMD_SSE2)
+    return "sse2";
+#elif defined(AW_SIMD_NEON)
+    return "neon";
+#else
+    return "none";
+#endif
+  }
+
+  std::string encode_wav(const int16_t* samples, uint32_t count, uint32_t sample_rate) {
+    uint32_t data_size = count * sizeof(int16_t);
+    std::string wav(44 + data_size, '\0');
+    uint8_t* p = (uint8_t*)&wav[0];
+
+    // all header fields are little endian
+    auto put16 = [&p](uint16_t v) { p[0] = v; p[1] = v >> 8; p += 2; };
+    auto put32 = [&p](uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; p += 4; };
+    auto tag = [&p](const char* t) { memcpy(p, t, 4); p += 4; };
+
+    tag("RIFF");
+    put32(36 + data_size);
+    tag("WAVE");
+
+    tag("fmt ");
+    put32(16);                    // size of the format chunk
+    put16(1);                     // PCM
+    put16(1);                     // mono
+    put32(sample_rate);
+    put32(sample_rate * 2);       // bytes per second
+    put16(2);                     // bytes per sample frame
+    put16(16);                    // bits per sample
+
+    tag("data");
+    put32(data_size);
+
+    for (uint32_t i = 0; i < count; i++) {
+      put16(uint16_t(samples[i]));
+    }
+
+    return wav;
+  }
+
+}
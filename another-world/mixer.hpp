@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "spsc-ring.hpp"
+
+/*
+  four channel software mixer for the game's 8-bit sound effects
+
+  each channel steps through a signed 8-bit sample at its own playback
+  rate using a 16.16 fixed point position, linearly interpolating between
+  neighbouring sample points. channels are rendered into a scratch buffer
+  and then summed with saturating 16-bit adds (SSE2 or NEON where the host
+  has them) to produce mono 16-bit output.
+
+  the mixer is driven from the thread running the VM: after each frame
+  the VM produce()s exactly the samples covering that frame's duration
+  (so music timing, which the game scripts can observe, depends only on
+  the frames run and never on the host) into a lock-free ring of mixed
+  samples which the host audio callback drains with consume() from its
+  own thread. because the ring only ever has one producer and one consumer
+  neither side ever waits on the other.
+*/
+
+namespace another_world {
+
+  // a signed 8-bit sample, a loop_length of zero means play once
+  struct Sample {
+    const int8_t* data = nullptr;
+    uint32_t length = 0;
+    uint32_t loop_start = 0;
+    uint32_t loop_length = 0;
+  };
+
+  struct MixerChannel {
+    Sample   sample;
+    uint64_t position = 0;    // 16.16 fixed point offset into the sample (64-bit
+                              // as sample lengths can exceed 16 bits)
+    uint32_t step = 0;        // 16.16 fixed point advance per output sample
+    uint8_t  volume = 0;      // 0 - 63
+    bool     active = false;
+  };
+
+  struct Sequencer;
+
+  struct Mixer {
+    static constexpr uint8_t  CHANNEL_COUNT = 4;
+    static constexpr uint32_t RING_SIZE = 16384;        // samples, must be a power of two
+
+    // playback rates in Hz for each of the forty frequency values the snd
+    // opcode accepts
+    static const uint16_t frequencies[40];
+
+    uint32_t sample_rate;
+    MixerChannel channels[CHANNEL_COUNT];
+
+    // music sequencer stepped in time with the output while mixing (if
+    // any), see sequencer.hpp
+    Sequencer* sequencer = nullptr;
+
+    Mixer(uint32_t sample_rate = 44100);
+
+    // describe the sample held in a SOUND resource of `size` bytes, the
+    // lengths in its header are clamped to the data that's there (an
+    // empty sample if there isn't even a header)
+    static Sample sound_sample(const uint8_t* resource, uint32_t size);
+
+    // start playing a sample on a channel at the given rate (in Hz) and
+    // volume (0 - 63), replacing anything already playing there
+    void play(uint8_t channel, const Sample& sample, uint32_t frequency, uint8_t volume);
+
+    // start playing a SOUND resource of `size` bytes, `frequency` is an
+    // index into the frequencies table as passed to the snd opcode
+    void play_sound(uint8_t channel, const uint8_t* resource, uint32_t size, uint8_t frequency, uint8_t volume);
+
+    void set_volume(uint8_t channel, uint8_t volume);
+    void stop(uint8_t channel);
+    void stop_all();
+
+    // render `count` samples straight into `output` without touching the
+    // ring (used for offline rendering)
+    void mix(int16_t* output, uint32_t count);
+
+    // producer side: mix exactly `count` samples into the ring, anything
+    // that doesn't fit is dropped. returns the number of samples kept
+    uint32_t produce(uint32_t count);
+
+    // consumer side: pop up to `count` samples into `output`, if the ring
+    // runs dry the remainder is filled with silence. returns the number of
+    // real samples copied
+    uint32_t consume(int16_t* output, uint32_t count);
+
+    // number of samples waiting in the ring
+    uint32_t buffered() const { return ring.size(); }
+
+    // name of the SIMD instruction set used for mixing (or "none")
+    static const char* simd_name();
+
+  private:
+    SpscRing<int16_t, RING_SIZE> ring;
+
+    void render_channel(MixerChannel& channel, int16_t* output, uint32_t count);
+    void mix_channels(int16_t* output, uint32_t count);
+  };
+
+  // mono 16-bit WAV file header followed by the samples, suitable for
+  // passing to write_file()
+  std::string encode_wav(const int16_t* samples, uint32_t count, uint32_t sample_rate);
+
+}
@@ -0,0 +1,338 @@
+#include <cstring>
+
+#include "presenter.hpp"
+#include "virtual-machine.hpp"
+
+// SSSE3 intrinsics are always available with MSVC on x86 (we check the
+// cpu supports them at runtime), other compilers need to be building
+// for a target that includes them
+#if defined(__SSSE3__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+  #define AW_SIMD_SSSE3
+  #include <tmmintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #define AW_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+namespace another_world {
+
+  Presenter::Presenter(HostFormat format) : format(format) {
+    bytes_per_pixel = format == HostFormat::RGB24 ? 3 : (format == HostFormat::XRGB32 ? 4 : 2);
+
+    memset(colors, 0, sizeof(colors));
+    memset(planes, 0, sizeof(planes));
+    build_pairs();
+  }
+
+  void Presenter::set_palette(const uint16_t* palette) {
+    uint8_t rgb[16][3];
+
+    for (uint8_t i = 0; i < 16; i++) {
+      // palette entries are big endian in the format 0x0RGB
+      uint16_t color = read_uint16_bigendian(&palette[i]);
+
+      uint8_t r = (color >> 8) & 0x0f;
+      uint8_t g = (color >> 4) & 0x0f;
+      uint8_t b = (color >> 0) & 0x0f;
+
+      rgb[i][0] = (r << 4) | r;
+      rgb[i][1] = (g << 4) | g;
+      rgb[i][2] = (b << 4) | b;
+    }
+
+    set_colors(rgb);
+  }
+
+  void Presenter::set_colors(const uint8_t rgb[16][3]) {
+    for (uint8_t i = 0; i < 16; i++) {
+      uint8_t r = rgb[i][0], g = rgb[i][1], b = rgb[i][2];
+
+      planes[0][i] = b;
+      planes[1][i] = g;
+      planes[2][i] = r;
+
+      if (format == HostFormat::RGB565) {
+        colors[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+      } else {
+        colors[i] = (r << 16) | (g << 8) | b;
+      }
+    }
+
+    build_pairs();
+  }
+
+  void Presenter::build_pairs() {
+    for (uint16_t i = 0; i < 256; i++) {
+      // lay the two pixels out byte by byte so the table entry has the
+      // right memory layout whatever the endianness of the host
+      uint8_t bytes[8] = { 0 };
+      uint32_t left = colors[i >> 4];
+      uint32_t right = colors[i & 0x0f];
+
+      for (uint8_t b = 0; b < bytes_per_pixel; b++) {
+        bytes[b] = left >> (b * 8);
+        bytes[b + bytes_per_pixel] = right >> (b * 8);
+      }
+
+      memcpy(&pairs[i], bytes, sizeof(uint64_t));
+    }
+  }
+
+  // `stride` is the number of bytes in a pair of host pixels and `store`
+  // the width of the write used to store them. RGB24 pairs are six bytes
+  // but are written with an eight byte store that overlaps the next pair,
+  // so the last pair of each row is stored separately to avoid writing
+  // past the end of the row
+  template<uint8_t stride, uint8_t store>
+  void present_pairs(const uint64_t* pairs, const uint8_t* page, uint8_t* destination, int32_t pitch) {
+    constexpr uint16_t count = stride == store ? 160 : 159;
+
+    for (uint16_t y = 0; y < 200; y++) {
+      const uint8_t* ps = page + y * Framebuffer::bytes_per_row;
+      uint8_t* pd = destination + y * pitch;
+
+      for (uint16_t x = 0; x < count; x++) {
+#ifdef AW_FRAMEBUFFER_CHUNKY
+        uint8_t v = (ps[0] << 4) | ps[1];
+        ps += 2;
+#else
+        uint8_t v = *ps++;
+#endif
+        memcpy(pd, &pairs[v], store);
+        pd += stride;
+      }
+
+      if (count != 160) {
+#ifdef AW_FRAMEBUFFER_CHUNKY
+        uint8_t v = (ps[0] << 4) | ps[1];
+#else
+        uint8_t v = *ps;
+#endif
+        memcpy(pd, &pairs[v], stride);
+      }
+    }
+  }
+
+  void Presenter::present(const uint8_t* page, uint8_t* destination, int32_t pitch) const {
+    switch (format) {
+      case HostFormat::RGB24:   present_pairs<6, 8>(pairs, page, destination, pitch); break;
+      case HostFormat::XRGB32:  present_pairs<8, 8>(pairs, page, destination, pitch); break;
+      case HostFormat::RGB565:  present_pairs<4, 4>(pairs, page, destination, pitch); break;
+    }
+  }
+
+  void Presenter::present_scaled_generic(const uint8_t* page, uint8_t* destination, int32_t pitch, uint8_t scale) const {
+    uint32_t xrgb[16];
+    for (uint8_t i = 0; i < 16; i++) {
+      xrgb[i] = (planes[2][i] << 16) | (planes[1][i] << 8) | planes[0][i];
+    }
+
+    uint8_t indices[320];
+
+    for (uint16_t y = 0; y < 200; y++) {
+      uint8_t* row = destination + y * scale * pitch;
+      uint32_t* pd = (uint32_t*)row;
+
+      Framebuffer::unpack_row(page, y, indices);
+
+      for (uint16_t x = 0; x < 320; x++) {
+        uint32_t c = xrgb[indices[x]];
+        for (uint8_t i = 0; i < scale; i++) {
+          *pd++ = c;
+        }
+      }
+
+      // the remaining rows of this scaled line are identical
+      for (uint8_t i = 1; i < scale; i++) {
+        memcpy(row + i * pitch, row, 320 * scale * sizeof(uint32_t));
+      }
+    }
+  }
+
+#ifdef AW_SIMD_SSSE3
+  static bool has_ssse3() {
+  #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+  #else
+    return true;
+  #endif
+  }
+
+  // store four XRGB32 pixels each repeated `scale` times
+  template<uint8_t scale>
+  inline uint32_t* store_scaled(uint32_t* pd, __m128i px) {
+    __m128i* p = (__m128i*)pd;
+
+    if (scale == 1) {
+      _mm_storeu_si128(p + 0, px);
+    }
+
+    if (scale == 2) {
+      _mm_storeu_si128(p + 0, _mm_shuffle_epi32(px, _MM_SHUFFLE(1, 1, 0, 0)));
+      _mm_storeu_si128(p + 1, _mm_shuffle_epi32(px, _MM_SHUFFLE(3, 3, 2, 2)));
+    }
+
+    if (scale == 3) {
+      _mm_storeu_si128(p + 0, _mm_shuffle_epi32(px, _MM_SHUFFLE(1, 0, 0, 0)));
+      _mm_storeu_si128(p + 1, _mm_shuffle_epi32(px, _MM_SHUFFLE(2, 2, 1, 1)));
+      _mm_storeu_si128(p + 2, _mm_shuffle_epi32(px, _MM_SHUFFLE(3, 3, 3, 2)));
+    }
+
+    if (scale == 4) {
+      _mm_storeu_si128(p + 0, _mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 0)));
+      _mm_storeu_si128(p + 1, _mm_shuffle_epi32(px, _MM_SHUFFLE(1, 1, 1, 1)));
+      _mm_storeu_si128(p + 2, _mm_shuffle_epi32(px, _MM_SHUFFLE(2, 2, 2, 2)));
+      _mm_storeu_si128(p + 3, _mm_shuffle_epi32(px, _MM_SHUFFLE(3, 3, 3, 3)));
+    }
+
+    return pd + 4 * scale;
+  }
+
+  // look up sixteen palette indices and store the resulting pixels
+  template<uint8_t scale>
+  inline uint32_t* convert_ssse3(uint32_t* pd, __m128i indices, const __m128i planes[3]) {
+    const __m128i zero = _mm_setzero_si128();
+
+    // pshufb uses each index to pick a byte out of the sixteen entry
+    // channel table
+    __m128i b = _mm_shuffle_epi8(planes[0], indices);
+    __m128i g = _mm_shuffle_epi8(planes[1], indices);
+    __m128i r = _mm_shuffle_epi8(planes[2], indices);
+
+    // then interleave the channels into blue, green, red, zero pixels
+    __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+    __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+    __m128i r0_lo = _mm_unpacklo_epi8(r, zero);
+    __m128i r0_hi = _mm_unpackhi_epi8(r, zero);
+
+    pd = store_scaled<scale>(pd, _mm_unpacklo_epi16(bg_lo, r0_lo));
+    pd = store_scaled<scale>(pd, _mm_unpackhi_epi16(bg_lo, r0_lo));
+    pd = store_scaled<scale>(pd, _mm_unpacklo_epi16(bg_hi, r0_hi));
+    pd = store_scaled<scale>(pd, _mm_unpackhi_epi16(bg_hi, r0_hi));
+
+    return pd;
+  }
+
+  template<uint8_t scale>
+  void present_scaled_simd(const uint8_t (&channels)[3][16], const uint8_t* page, uint8_t* destination, int32_t pitch) {
+    const __m128i planes[3] = {
+      _mm_load_si128((const __m128i*)channels[0]),
+      _mm_load_si128((const __m128i*)channels[1]),
+      _mm_load_si128((const __m128i*)channels[2])
+    };
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    for (uint16_t y = 0; y < 200; y++) {
+      const uint8_t* ps = page + y * Framebuffer::bytes_per_row;
+      uint8_t* row = destination + y * scale * pitch;
+      uint32_t* pd = (uint32_t*)row;
+
+      for (uint16_t x = 0; x < Framebuffer::bytes_per_row; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(ps + x));
+#ifdef AW_FRAMEBUFFER_CHUNKY
+        pd = convert_ssse3<scale>(pd, v, planes);
+#else
+        // split each byte into its two pixels, left pixel first
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i lo = _mm_and_si128(v, nibble);
+        pd = convert_ssse3<scale>(pd, _mm_unpacklo_epi8(hi, lo), planes);
+        pd = convert_ssse3<scale>(pd, _mm_unpackhi_epi8(hi, lo), planes);
+#endif
+      }
+
+      for (uint8_t i = 1; i < scale; i++) {
+        memcpy(row + i * pitch, row, 320 * scale * sizeof(uint32_t));
+      }
+    }
+  }
+#endif
+
+#ifdef AW_SIMD_NEON
+  template<uint8_t scale>
+  inline uint32_t* convert_neon(uint32_t* pd, uint8x16_t indices, const uint8x16_t planes[3]) {
+    // tbl uses each index to pick a byte out of the sixteen entry
+    // channel table, vst4 then interleaves the channels into pixels
+    uint8x16x4_t px;
+    px.val[0] = vqtbl1q_u8(planes[0], indices);
+    px.val[1] = vqtbl1q_u8(planes[1], indices);
+    px.val[2] = vqtbl1q_u8(planes[2], indices);
+    px.val[3] = vdupq_n_u8(0);
+
+    if (scale == 1) {
+      vst4q_u8((uint8_t*)pd, px);
+      return pd + 16;
+    }
+
+    uint32_t pixels[16];
+    vst4q_u8((uint8_t*)pixels, px);
+    for (uint8_t i = 0; i < 16; i++) {
+      for (uint8_t s = 0; s < scale; s++) {
+        *pd++ = pixels[i];
+      }
+    }
+    return pd;
+  }
+
+  template<uint8_t scale>
+  void present_scaled_simd(const uint8_t (&channels)[3][16], const uint8_t* page, uint8_t* destination, int32_t pitch) {
+    const uint8x16_t planes[3] = { vld1q_u8(channels[0]), vld1q_u8(channels[1]), vld1q_u8(channels[2]) };
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
+
+    for (uint16_t y = 0; y < 200; y++) {
+      const uint8_t* ps = page + y * Framebuffer::bytes_per_row;
+      uint8_t* row = destination + y * scale * pitch;
+      uint32_t* pd = (uint32_t*)row;
+
+      for (uint16_t x = 0; x < Framebuffer::bytes_per_row; x += 16) {
+        uint8x16_t v = vld1q_u8(ps + x);
+#ifdef AW_FRAMEBUFFER_CHUNKY
+        pd = convert_neon<scale>(pd, v, planes);
+#else
+        uint8x16x2_t split = vzipq_u8(vshrq_n_u8(v, 4), vandq_u8(v, nibble));
+        pd = convert_neon<scale>(pd, split.val[0], planes);
+        pd = convert_neon<scale>(pd, split.val[1], planes);
+#endif
+      }
+
+      for (uint8_t i = 1; i < scale; i++) {
+        memcpy(row + i * pitch, row, 320 * scale * sizeof(uint32_t));
+      }
+    }
+  }
+#endif
+
+  void Presenter::present_scaled(const uint8_t* page, uint8_t* destination, int32_t pitch, uint8_t scale) const {
+#if defined(AW_SIMD_SSSE3) || defined(AW_SIMD_NEON)
+  #ifdef AW_SIMD_SSSE3
+    static const bool simd = has_ssse3();
+  #else
+    const bool simd = true;
+  #endif
+    if (simd) {
+      switch (scale) {
+        case 1: present_scaled_simd<1>(planes, page, destination, pitch); return;
+        case 2: present_scaled_simd<2>(planes, page, destination, pitch); return;
+        case 3: present_scaled_simd<3>(planes, page, destination, pitch); return;
+        case 4: present_scaled_simd<4>(planes, page, destination, pitch); return;
+      }
+    }
+#endif
+    present_scaled_generic(page, destination, pitch, scale);
+  }
+
+  const char* Presenter::simd_name() {
+#if defined(AW_SIMD_SSSE3)
+    return has_ssse3() ? "ssse3" : "none";
+#elif defined(AW_SIMD_NEON)
+    return "neon";
+#else
+    return "none";
+#endif
+  }
+
+}
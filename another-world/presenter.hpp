@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+#include "framebuffer.hpp"
+
+/*
+  converts video pages into host pixels for display
+
+  rather than looking up the palette once per pixel the presenter keeps a
+  256 entry table that maps every possible pair of palette indices (which
+  is exactly one byte of a packed page) to two finished host pixels. the
+  table is only rebuilt when the palette changes, so presenting a page is
+  one load and one store for every two pixels.
+
+  host formats are named after the integer value of a pixel and stored
+  little endian, so XRGB32 is 0x00RRGGBB in memory as blue, green, red,
+  unused - which is also what a 24 or 32-bit Windows DIB expects.
+
+  present_scaled() goes straight from a page to an integer upscaled XRGB32
+  surface in one pass. where the host supports it (SSSE3 or AArch64 NEON)
+  the palette lookups are done sixteen pixels at a time with byte shuffles.
+*/
+
+namespace another_world {
+
+  enum class HostFormat { RGB24, XRGB32, RGB565 };
+
+  struct Presenter {
+    HostFormat format;
+    uint8_t bytes_per_pixel;
+
+    // host colour for each of the sixteen palette entries
+    uint32_t colors[16];
+
+    // two host pixels (left pixel first in memory) for every pair of
+    // palette indices, indexed by (left << 4) | right
+    uint64_t pairs[256];
+
+    // blue, green and red channels of the palette as separate sixteen
+    // byte tables for the SIMD shuffle lookups
+    alignas(16) uint8_t planes[3][16];
+
+    Presenter(HostFormat format = HostFormat::XRGB32);
+
+    // sixteen palette entries as stored in a PALETTE resource (big
+    // endian 0x0RGB)
+    void set_palette(const uint16_t* palette);
+
+    // sixteen colours with eight bits per channel
+    void set_colors(const uint8_t rgb[16][3]);
+
+    // write a 320 x 200 page to `destination`, each row starting `pitch`
+    // bytes after the previous one
+    void present(const uint8_t* page, uint8_t* destination, int32_t pitch) const;
+
+    // write a page to an XRGB32 surface with each pixel scaled up to
+    // `scale` x `scale` host pixels, `destination` must have room for
+    // 320 * scale by 200 * scale pixels. uses SIMD for scales 1 to 4 where
+    // available, otherwise falls back to present_scaled_generic()
+    void present_scaled(const uint8_t* page, uint8_t* destination, int32_t pitch, uint8_t scale) const;
+    void present_scaled_generic(const uint8_t* page, uint8_t* destination, int32_t pitch, uint8_t scale) const;
+
+    // name of the SIMD instruction set used by present_scaled() (or
+    // "none" if only the generic path is available)
+    static const char* simd_name();
+
+  private:
+    void build_pairs();
+  };
+
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "profiler.hpp"
+#include "virtual-machine.hpp"
+
+namespace another_world {
+
+  static std::string opcode_name(uint8_t opcode) {
+    if (opcode <= 0x1a) {
+      return opcode_names[opcode];
+    }
+    return opcode < 0x40 ? "----" : (opcode < 0x80 ? "plyl" : "plys");
+  }
+
+  Profiler::OpcodeClass Profiler::classify(uint8_t opcode) {
+    if (opcode >= 0x40) {
+      return POLYGON;
+    }
+
+    switch (opcode) {
+      case 0x00: case 0x01: case 0x02: case 0x03: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+        return ALU;
+      case 0x04: case 0x05: case 0x07: case 0x09: case 0x0a:
+        return BRANCH;
+      case 0x06: case 0x08: case 0x0c: case 0x11:
+        return THREAD;
+      case 0x0d: case 0x0e: case 0x0f: case 0x10:
+        return PAGE;
+      case 0x0b:
+        return PALETTE;
+      case 0x12:
+        return TEXT;
+      case 0x19:
+        return RESOURCE;
+      case 0x18: case 0x1a:
+        return SOUND;
+      default:
+        return INVALID;
+    }
+  }
+
+  const char* Profiler::class_name(OpcodeClass c) {
+    static const char* names[CLASS_COUNT] = { "alu", "branch", "thread", "polygon", "page", "palette", "text", "resource", "sound", "invalid" };
+    return c < CLASS_COUNT ? names[c] : "?";
+  }
+
+  void Profiler::frame(const VirtualMachine& vm) {
+    chapters[16000 + vm.chapter_id].frames++;
+  }
+
+  void Profiler::begin(const VirtualMachine& vm, uint8_t thread, uint16_t pc, uint8_t opcode) {
+    uint16_t chapter = 16000 + vm.chapter_id;
+    current = &chapters[chapter];
+    site = &current->sites[uint32_t(thread) << 16 | pc];
+    site->opcode = opcode;
+
+    // the call stack holds return addresses, each call instruction is
+    // three bytes before the address it returns to
+    stack.clear();
+    stack.push_back(chapter);
+    stack.push_back(thread);
+    for (auto address : vm.call_stack) {
+      stack.push_back(uint16_t(address - 3));
+    }
+    stack.push_back(pc);
+
+    pixels = 0;
+    start = clock::now();
+  }
+
+  void Profiler::end() {
+    uint64_t ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+
+    site->count++;
+    site->ns += ns;
+    site->pixels += pixels;
+
+    Totals& totals = current->classes[classify(site->opcode)];
+    totals.count++;
+    totals.ns += ns;
+    totals.pixels += pixels;
+
+    stacks[stack] += ns;
+  }
+
+  void Profiler::clear() {
+    chapters.clear();
+    stacks.clear();
+    current = nullptr;
+    site = nullptr;
+  }
+
+  std::string Profiler::folded_stacks() const {
+    std::string output;
+    char frame[64];
+
+    for (auto& entry : stacks) {
+      const std::vector<uint16_t>& key = entry.first;
+      uint16_t thread = key[1], pc = key.back();
+
+      snprintf(frame, sizeof(frame), "chapter %u;thread %02u", key[0], thread);
+      output += frame;
+      for (size_t i = 2; i + 1 < key.size(); i++) {
+        snprintf(frame, sizeof(frame), ";call@%04x", key[i]);
+        output += frame;
+      }
+
+      uint8_t opcode = 0;
+      auto chapter = chapters.find(key[0]);
+      if (chapter != chapters.end()) {
+        auto site = chapter->second.sites.find(uint32_t(thread) << 16 | pc);
+        opcode = site != chapter->second.sites.end() ? site->second.opcode : 0;
+      }
+      snprintf(frame, sizeof(frame), ";%s@%04x %llu\n", opcode_name(opcode).c_str(), pc, (unsigned long long)entry.second);
+      output += frame;
+    }
+
+    return output;
+  }
+
+  std::string Profiler::report(uint32_t top) const {
+    std::string output;
+    char line[256];
+
+    for (auto& entry : chapters) {
+      const Chapter& chapter = entry.second;
+
+      Totals total;
+      for (auto& totals : chapter.classes) {
+        total.count += totals.count;
+        total.ns += totals.ns;
+        total.pixels += totals.pixels;
+      }
+
+      double ms = total.ns / 1e6;
+      snprintf(line, sizeof(line), "chapter %u: %u frames, %llu instructions, %.3fms (%.1fus per frame)\n\n",
+        entry.first, chapter.frames, (unsigned long long)total.count, ms, chapter.frames ? total.ns / 1e3 / chapter.frames : 0.0);
+      output += line;
+
+      snprintf(line, sizeof(line), "  %-10s %12s %10s %7s %12s\n", "class", "instructions", "time", "", "pixels");
+      output += line;
+      for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        const Totals& totals = chapter.classes[c];
+        if (!totals.count) {
+          continue;
+        }
+        snprintf(line, sizeof(line), "  %-10s %12llu %8.3fms %6.1f%% %12llu\n", class_name(OpcodeClass(c)),
+          (unsigned long long)totals.count, totals.ns / 1e6, total.ns ? totals.ns * 100.0 / total.ns : 0.0, (unsigned long long)totals.pixels);
+        output += line;
+      }
+
+      std::vector<std::pair<uint32_t, const Site*>> sites;
+      for (auto& site : chapter.sites) {
+        sites.emplace_back(site.first, &site.second);
+      }
+      std::sort(sites.begin(), sites.end(), [](const std::pair<uint32_t, const Site*>& a, const std::pair<uint32_t, const Site*>& b) {
+        return a.second->ns > b.second->ns;
+      });
+      if (sites.size() > top) {
+        sites.resize(top);
+      }
+
+      snprintf(line, sizeof(line), "\n  %-6s %-6s %-6s %10s %10s %7s %10s %12s\n", "thread", "pc", "opcode", "count", "time", "", "per call", "pixels");
+      output += line;
+      for (auto& site : sites) {
+        const Site& s = *site.second;
+        snprintf(line, sizeof(line), "  %-6u %04x   %-6s %10llu %8.3fms %6.1f%% %8.0fns %12llu\n", site.first >> 16, site.first & 0xffff,
+          opcode_name(s.opcode).c_str(), (unsigned long long)s.count, s.ns / 1e6, total.ns ? s.ns * 100.0 / total.ns : 0.0,
+          s.count ? double(s.ns) / s.count : 0.0, (unsigned long long)s.pixels);
+        output += line;
+      }
+      output += "\n";
+    }
+
+    return output;
+  }
+
+}
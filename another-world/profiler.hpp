@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+  bytecode profiler
+
+  only built into the vm when AW_PROFILER is defined, otherwise the hooks
+  in execute_threads() and the rasteriser compile away to nothing. with it
+  defined a profiler is attached by pointing VirtualMachine::profiler at
+  one.
+
+  every instruction executed is counted against the chapter, thread and
+  pc it was fetched from along with the time it took and the polygon
+  pixels it filled. time is also totalled per opcode class and per call
+  stack (the chapter, the thread, each call site leading to the
+  instruction and the instruction itself), which is what folded_stacks()
+  exports for flame graph tools (flamegraph.pl, speedscope, inferno, etc.)
+
+  reading the clock around every instruction inflates the absolute times,
+  the proportions between them are what's worth looking at. while fast
+  forwarding draws are deferred so their pixels (and time) land on the
+  instruction that forces them out, usually a vcpy or vshw.
+*/
+
+namespace another_world {
+
+  struct VirtualMachine;
+
+  struct Profiler {
+    using clock = std::chrono::steady_clock;
+
+    enum OpcodeClass : uint8_t { ALU, BRANCH, THREAD, POLYGON, PAGE, PALETTE, TEXT, RESOURCE, SOUND, INVALID, CLASS_COUNT };
+
+    struct Totals {
+      uint64_t count = 0;         // instructions executed
+      uint64_t ns = 0;
+      uint64_t pixels = 0;        // polygon pixels filled
+    };
+
+    struct Site : Totals {
+      uint8_t opcode = 0;
+    };
+
+    struct Chapter {
+      uint32_t frames = 0;
+      Totals classes[CLASS_COUNT];
+      std::map<uint32_t, Site> sites;     // keyed by thread << 16 | pc
+    };
+
+    std::map<uint16_t, Chapter> chapters;
+
+    // time per call stack, each key is the chapter, the thread, the pc of
+    // every call leading to the instruction and the instruction's pc
+    std::map<std::vector<uint16_t>, uint64_t> stacks;
+
+    // pixels filled by the instruction being executed, added to by the
+    // rasteriser
+    uint64_t pixels = 0;
+
+    static OpcodeClass classify(uint8_t opcode);
+    static const char* class_name(OpcodeClass c);
+
+    // called by the vm at the start of each frame and around each
+    // instruction
+    void frame(const VirtualMachine& vm);
+    void begin(const VirtualMachine& vm, uint8_t thread, uint16_t pc, uint8_t opcode);
+    void end();
+
+    void clear();
+
+    // one line per call stack in the folded format, e.g.
+    //
+    //   chapter 16001;thread 00;call@00a2;plys@0f3c 182633
+    //
+    // weighted by nanoseconds
+    std::string folded_stacks() const;
+
+    // instruction counts and time per opcode class followed by the `top`
+    // most expensive sites, for each chapter that was run
+    std::string report(uint32_t top = 20) const;
+
+  private:
+    Chapter* current = nullptr;
+    Site* site = nullptr;
+    std::vector<uint16_t> stack;
+    clock::time_point start;
+  };
+
+  // profiles one instruction for as long as it's in scope so every way out
+  // of the interpreter loop's body ends it
+  struct ProfiledInstruction {
+    Profiler* profiler;
+
+    ProfiledInstruction(Profiler* profiler, const VirtualMachine& vm, uint8_t thread, uint16_t pc, uint8_t opcode) : profiler(profiler) {
+      if (profiler) {
+        profiler->begin(vm, thread, pc, opcode);
+      }
+    }
+
+    ~ProfiledInstruction() {
+      if (profiler) {
+        profiler->end();
+      }
+    }
+  };
+
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <chrono>
+
+#include "resource-store.hpp"
+#include "asset-pack.hpp"
+
+namespace another_world {
+
+  ResourceStore::ResourceStore(const Engine& engine) {
+    user = engine.user;
+    read_file = engine.read_file;
+    pack = engine.pack;
+
+    resource_count = engine.resources.size();
+    entries.reset(new Entry[resource_count]);
+    for (uint16_t i = 0; i < resource_count; i++) {
+      entries[i].definition = engine.resources.definition(i);
+    }
+  }
+
+  const uint8_t* ResourceStore::get(uint16_t id) {
+    if (id >= resource_count) {
+      return nullptr;
+    }
+
+    Entry& entry = entries[id];
+    std::call_once(entry.once, &ResourceStore::unpack, this, std::ref(entry));
+    return entry.data.get();
+  }
+
+  void ResourceStore::unpack(Entry& entry) {
+    using clock = std::chrono::steady_clock;
+    clock::time_point start = clock::now();
+
+    // bank data is unpacked in place, so the buffer must be big enough for
+    // whichever of the two sizes is larger
+    const Resource& definition = entry.definition;
+    uint32_t size = std::max<uint32_t>(definition.size, definition.packed_size);
+    entry.data.reset(new uint8_t[size]());
+
+    // images are kept as bitplanes (engines convert them as they copy them
+    // into page 0), anything else can be decoded from a pack
+    uint16_t id = uint16_t(&entry - entries.get());
+    bool packed = definition.type != Resource::Type::IMAGE && pack && pack->unpack(id, entry.data.get());
+
+    if (!packed) {
+      static const char hex[] = "0123456789abcdef";
+      std::string bank_filename = std::string("bank0") + hex[definition.bank_id & 0x0f];
+      bool read = read_file(user, bank_filename, definition.bank_offset, definition.packed_size, (char*)entry.data.get());
+
+      ByteKiller bk;
+      if (!read || (definition.packed_size != definition.size &&
+        !bk.unpack(entry.data.get(), definition.packed_size, entry.data.get(), definition.size))) {
+        // left empty rather than handing every engine corrupt data, get()
+        // returns nullptr for it from now on
+        entry.data.reset();
+        failed++;
+        return;
+      }
+    }
+
+    unpacked++;
+    unpacked_bytes += size;
+    unpack_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+  }
+
+}
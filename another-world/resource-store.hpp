@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "virtual-machine.hpp"
+
+/*
+  unpacked resources shared between engines
+
+  every engine running from the same game data would otherwise read and
+  unpack the same banks into its own 600KB resource heap. a store unpacks
+  each resource at most once for the whole process, the first time any
+  engine needs it, and from then on every engine points at that one read
+  only copy. an engine using a store never allocates its heap, so running
+  many games side by side costs little more than each one's vm state and
+  video pages.
+
+  engines hold the store through a shared_ptr so it lives until the last
+  engine using it is gone. get() can be called from any number of threads
+  at once, only one of them unpacks a given resource while the others
+  wait for it.
+
+  resources are never evicted, at most the whole game's data (a few MB)
+  ends up resident.
+*/
+
+namespace another_world {
+
+  struct ResourceStore {
+    // statistics
+    std::atomic<uint32_t> unpacked{ 0 };           // resources unpacked so far
+    std::atomic<uint64_t> unpacked_bytes{ 0 };     // memory held by them
+    std::atomic<uint64_t> unpack_ns{ 0 };          // total time spent reading and unpacking
+    std::atomic<uint32_t> failed{ 0 };             // resources that couldn't be read or unpacked
+
+    // takes the resource definitions from `engine` (which must have called
+    // init_resources()) along with its read_file callback, user pointer
+    // and asset pack, if any. they're used from whichever thread first
+    // needs a resource so must be safe to call from any thread for as long
+    // as the store exists
+    ResourceStore(const Engine& engine);
+
+    ResourceStore(const ResourceStore&) = delete;
+    ResourceStore& operator=(const ResourceStore&) = delete;
+
+    // unpacked contents of resource `id`, read and unpacked first if no
+    // engine has needed it before. nullptr if there is no such resource or
+    // it couldn't be read or unpacked
+    const uint8_t* get(uint16_t id);
+
+    uint16_t count() const { return resource_count; }
+
+  private:
+    struct Entry {
+      Resource definition;
+      std::once_flag once;
+      std::unique_ptr<uint8_t[]> data;
+    };
+
+    void* user;
+    bool (*read_file)(void* user, std::string filename, uint32_t offset, uint32_t length, char* buffer);
+    std::shared_ptr<AssetPack> pack;          // compressed resources are decoded from here rather than the banks
+
+    uint16_t resource_count;
+    std::unique_ptr<Entry[]> entries;
+
+    void unpack(Entry& entry);
+  };
+
+}
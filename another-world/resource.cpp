@@ -2,7 +2,8 @@
   resource definitions are stored in MEMLIST.BIN
 
   each record is twenty bytes long and numbers are stored as
-  big endian
+  big endian, the list ends at a record with a state of 0xff or at
+  the end of the file
 */
 
 #include <cassert>
@@ -11,14 +12,12 @@
 #include <ctime>
 
 #include "virtual-machine.hpp"
+#include "resource-store.hpp"
+#include "asset-pack.hpp"
 
 namespace another_world {
 
-  uint8_t resource_heap[HEAP_SIZE];
-  uint32_t resource_heap_offset = 0;
-  std::vector<Resource *> resources;
-
-  ChapterResources chapter_resources[10] = {
+  const ChapterResources chapter_resources[10] = {
   {0x14, 0x15, 0x16, 0x00},
   {0x17, 0x18, 0x19, 0x00},
   {0x1a, 0x1b, 0x1c, 0x11},
@@ -32,20 +31,106 @@ namespace another_world {
   };
 
 
-  // load the resource definitions from MEMLIST.BIN
-  // you must provide a pointer to a buffer than contains the
-  // file contents
-  void init_resources() {
+  void ResourceTable::set_state(uint16_t id, Resource::State state) {
+    std::vector<uint16_t>& from = lists[uint8_t(states[id])];
+    std::vector<uint16_t>& to = lists[uint8_t(state)];
+    if (&from == &to) {
+      return;
+    }
+
+    // swap the last entry on the old list into this one's place
+    uint16_t moved = from.back();
+    from[positions[id]] = moved;
+    positions[moved] = positions[id];
+    from.pop_back();
+
+    positions[id] = uint16_t(to.size());
+    to.push_back(id);
+    states[id] = state;
+  }
+
+  uint16_t ResourceTable::add(const Resource& definition) {
+    uint16_t id = size();
+    types.push_back(definition.type);
+    bank_ids.push_back(definition.bank_id);
+    bank_offsets.push_back(definition.bank_offset);
+    packed_sizes.push_back(definition.packed_size);
+    sizes.push_back(definition.size);
+    data.push_back(nullptr);
+
+    states.push_back(Resource::State::NOT_NEEDED);
+    positions.push_back(uint16_t(lists[0].size()));
+    lists[0].push_back(id);
+    return id;
+  }
+
+  Resource ResourceTable::definition(uint16_t id) const {
+    return { types[id], bank_ids[id], bank_offsets[id], packed_sizes[id], sizes[id] };
+  }
+
+  void ResourceTable::clear() {
+    types.clear();
+    bank_ids.clear();
+    bank_offsets.clear();
+    packed_sizes.clear();
+    sizes.clear();
+    data.clear();
+    states.clear();
+    positions.clear();
+    for (auto& list : lists) {
+      list.clear();
+    }
+  }
+
+  size_t ResourceTable::memory_used() const {
+    size_t used = types.capacity() * sizeof(Resource::Type) + bank_ids.capacity() + bank_offsets.capacity() * sizeof(uint32_t) +
+      (packed_sizes.capacity() + sizes.capacity()) * sizeof(uint16_t) + data.capacity() * sizeof(const uint8_t*) +
+      states.capacity() * sizeof(Resource::State) + positions.capacity() * sizeof(uint16_t);
+    for (auto& list : lists) {
+      used += list.capacity() * sizeof(uint16_t);
+    }
+    return used;
+  }
+
+  // load the resource definitions from MEMLIST.BIN, the number of records
+  // is taken from the size of the file
+  void Engine::init_resources() {
+    resources.clear();
+
+    // hosts that can't tell how big a file is get the size of the DOS
+    // release's memlist (146 records and the end marker)
+    uint32_t size = file_size ? file_size(user, "memlist.bin") : 2940;
+    std::vector<uint8_t> memlist(size);
+    if (size == 0 || !read_file(user, "memlist.bin", 0, size, (char*)memlist.data())) {
+      if (file_size) {
+        size = 0;
+      }
 
-    // TODO: move file access out of here by requiring a basic set
-    // of system calls to be provided
-    uint8_t memlist[2940];
-    uint8_t* p = memlist;
+      // a pack carries the definitions it was made with
+      if (size == 0 && pack) {
+        for (uint16_t id = 0; id < pack->count(); id++) {
+          resources.add(pack->definition(id));
+        }
+        return;
+      }
 
-    read_file("memlist.bin", 0, 2940, (char*)memlist);
+      if (debug) {
+        debug(user, "memlist.bin could not be read");
+      }
+    }
 
-    while (static_cast<Resource::State>(p[0]) != Resource::State::END_OF_MEMLIST) {
-      Resource* resource = new Resource();
+    uint32_t count = size / 20;
+    resources.types.reserve(count);
+    resources.bank_ids.reserve(count);
+    resources.bank_offsets.reserve(count);
+    resources.packed_sizes.reserve(count);
+    resources.sizes.reserve(count);
+    resources.data.reserve(count);
+
+    for (const uint8_t* p = memlist.data(); p + 20 <= memlist.data() + size; p += 20) {
+      if (static_cast<Resource::State>(p[0]) == Resource::State::END_OF_MEMLIST) {
+        break;
+      }
 
       // each memlist entry (resource) contains 20 bytes:
       //
@@ -57,120 +142,183 @@ namespace another_world {
       // 12 - 15: packed size
       // 16 - 19: unpacked size
 
-      resource->state = (Resource::State)p[0];
-      resource->type = (Resource::Type)p[1];
-      resource->bank_id = p[7];
-      resource->bank_offset = read_uint32_bigendian(p + 8);
-      resource->packed_size = read_uint32_bigendian(p + 12);
-      resource->size = read_uint32_bigendian(p + 16);
-
-      resources.push_back(resource);
-
-      p += 20;
+      Resource resource;
+      resource.type = (Resource::Type)p[1];
+      resource.bank_id = p[7];
+      resource.bank_offset = read_uint32_bigendian(p + 8);
+      resource.packed_size = read_uint32_bigendian(p + 12);
+      resource.size = read_uint32_bigendian(p + 16);
+
+      // nothing is loaded yet, whatever the record says
+      uint16_t id = resources.add(resource);
+      if (static_cast<Resource::State>(p[0]) == Resource::State::NEEDS_LOADING) {
+        resources.set_state(id, Resource::State::NEEDS_LOADING);
+      }
     }
-  }
-
-  void load_chapter_resources(uint16_t id) {
 
+    if (pack && (pack->count() != resources.size() || pack->definitions != AssetPack::definitions_checksum(resources))) {
+      if (debug) {
+        debug(user, "Asset pack doesn't match memlist.bin, loading from the banks");
+      }
+      pack.reset();
+    }
   }
 
   // loads all resources that are currently in the NEEDS_LOADING state
-  void load_needed_resources() {
-    for (auto resource : resources) {
-      if (resource->state == Resource::State::NEEDS_LOADING/* || resource->type == Resource::Type::BANK*/) {
+  void Engine::load_needed_resources() {
+    // loading changes the list as we go. it's loaded in id order so
+    // resources land in the heap where they always have
+    std::vector<uint16_t> needed = resources.with_state(Resource::State::NEEDS_LOADING);
+    std::sort(needed.begin(), needed.end());
+
+    for (uint16_t id : needed) {
+      Resource::Type type = resources.types[id];
+
+      // resources in the pack are used where they are, images are already
+      // in the framebuffer format and just copied into page 0
+      if (const uint8_t* data = pack ? pack->get(id) : nullptr) {
+        if (type == Resource::Type::IMAGE) {
+          memcpy(vram[0], data, VRAM_SIZE);
+          resources.set_state(id, Resource::State::NOT_NEEDED);
+        } else {
+          resources.data[id] = data;
+          resources.set_state(id, Resource::State::LOADED);
+        }
+        continue;
+      }
+
+      // images compressed in the pack are decoded straight into page 0
+      if (type == Resource::Type::IMAGE && pack && pack->unpack(id, vram[0])) {
+        resources.set_state(id, Resource::State::NOT_NEEDED);
+        continue;
+      }
 
-        if (resource->type == Resource::Type::SOUND || resource->type == Resource::Type::MUSIC) {
-          // TODO: we're not currently supporting audio so no point in loading the
-          // resources just yet...
+      // shared resources are used where they are, only images are still
+      // copied out into page 0
+      if (store) {
+        const uint8_t* data = store->get(id);
+        if (!data) {
+          if (debug) {
+            debug(user, "Resource %u is not in the shared store", id);
+          }
+          // it won't turn up later, so it isn't asked for again every frame
+          resources.set_state(id, Resource::State::NOT_NEEDED);
           continue;
         }
 
-        uint8_t* destination;
-        if (resource->type == Resource::Type::IMAGE) {
-          destination = vram[0];
-        }
-        else {
-          destination = resource_heap + resource_heap_offset;
-          resource_heap_offset += resource->size;
+        if (type == Resource::Type::IMAGE) {
+          Framebuffer::from_planar(vram[0], data);
+          resources.set_state(id, Resource::State::NOT_NEEDED);
+        } else {
+          resources.data[id] = data;
+          resources.set_state(id, Resource::State::LOADED);
         }
+        continue;
+      }
 
-        //std::string debug_message = "Loading resource of type " + std::to_string(int(resource->type)) + " at offset " + std::to_string(resource_heap_offset);
-        //debug(debug_message.c_str());
-        resource->load(destination);
-
-        // TODO: if the resource was an image then it's encoded as 4 bitplanes a la mode 9
-        // we need to shuffle the pixels around to get it into our buffer format
-        if (resource->type == Resource::Type::IMAGE) {
-          uint8_t temp[320 * 200 / 2];
-          memcpy(temp, destination, 320 * 200 / 2);
-          uint8_t* p = destination;
-          for (uint16_t y = 0; y < 200; y++) {
-            for (uint16_t x = 0; x < 320; x += 8) {
-              uint8_t b1 = temp[y * 40 + x / 8 + 0];
-              uint8_t b2 = temp[y * 40 + x / 8 + 8000];
-              uint8_t b3 = temp[y * 40 + x / 8 + 16000];
-              uint8_t b4 = temp[y * 40 + x / 8 + 24000];
-
-              for (uint8_t i = 0; i < 4; i++) {
-                uint8_t v1 = (b1 & 0b10000000) >> 0;
-                uint8_t v2 = (b2 & 0b10000000) >> 1;
-                uint8_t v3 = (b3 & 0b10000000) >> 2;
-                uint8_t v4 = (b4 & 0b10000000) >> 3;
-
-                b1 <<= 1;
-                b2 <<= 1;
-                b3 <<= 1;
-                b4 <<= 1;
-
-                uint8_t v5 = (b1 & 0b10000000) >> 4;
-                uint8_t v6 = (b2 & 0b10000000) >> 5;
-                uint8_t v7 = (b3 & 0b10000000) >> 6;
-                uint8_t v8 = (b4 & 0b10000000) >> 7;
-
-                b1 <<= 1;
-                b2 <<= 1;
-                b3 <<= 1;
-                b4 <<= 1;
-
-                *p++ = v1 | v2 | v3 | v4 | v5 | v6 | v7 | v8;
-              }
-            }
+      uint8_t* destination;
+      if (type == Resource::Type::IMAGE) {
+        destination = vram[0];
+      }
+      else {
+        if (resource_heap_offset + resources.sizes[id] > HEAP_SIZE) {
+          if (debug) {
+            debug(user, "Resource heap exhausted, cannot load resource of %u bytes", resources.sizes[id]);
           }
+          continue;
         }
 
-        if (resource->type == Resource::Type::IMAGE) {
-          resource->state = Resource::State::NOT_NEEDED;
-        }
-        else {
-          resource->state = Resource::State::LOADED;
+        destination = heap(resource_heap_offset);
+        resource_heap_offset += resources.sizes[id];
+      }
+
+      // a resource that can't be read gives its room in the heap back and
+      // isn't asked for again, as with one missing from the store
+      if (!load_resource(id, destination)) {
+        if (type != Resource::Type::IMAGE) {
+          resource_heap_offset -= resources.sizes[id];
         }
+        resources.set_state(id, Resource::State::NOT_NEEDED);
+        continue;
+      }
+
+      if (type == Resource::Type::IMAGE) {
+        resources.set_state(id, Resource::State::NOT_NEEDED);
+      }
+      else {
+        resources.set_state(id, Resource::State::LOADED);
       }
     }
   }
 
-  bool Resource::load(uint8_t* destination) {
-    static std::string hex[16] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "a", "b", "c", "d", "e", "f" };
+  const uint8_t* Engine::shared_resource(uint16_t id) {
+    const uint8_t* data = pack ? pack->get(id) : nullptr;
+    if (!data && store) {
+      data = store->get(id);
+    }
+    return data;
+  }
+
+  uint8_t* Engine::heap(uint32_t offset) {
+    if (resource_heap.empty()) {
+      resource_heap.resize(HEAP_SIZE);
+    }
+    return resource_heap.data() + offset;
+  }
+
+  bool Engine::load_resource(uint16_t id, uint8_t* destination) {
+    static const std::string hex[16] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "a", "b", "c", "d", "e", "f" };
+
+    // the pack has it ready to use once decoded
+    if (pack && pack->unpack(id, destination)) {
+      resources.data[id] = destination;
+      return true;
+    }
 
-    // TODO: move file access out of here by requiring a basic set
-    // of system calls to be provided
-    std::string bank_filename = "bank0" + hex[this->bank_id];
-    read_file(bank_filename, this->bank_offset, this->packed_size, (char*)destination);
+    uint16_t packed_size = resources.packed_sizes[id];
+    uint16_t size = resources.sizes[id];
+    uint32_t bank_offset = resources.bank_offsets[id];
+
+    std::string bank_filename = "bank0" + hex[resources.bank_ids[id]];
 
     bool success = false;
 
-    if (this->packed_size != this->size) {
+    // packed data is unpacked straight out of a mapped bank, otherwise it's
+    // read into the destination and unpacked in place
+    uint32_t bank_size = 0;
+    const uint8_t* bank = packed_size != size && map_file ? map_file(user, bank_filename, &bank_size) : nullptr;
+    if (bank) {
       ByteKiller bk;
+      success = bank_offset + packed_size <= bank_size && bk.unpack(bank + bank_offset, packed_size, destination, size);
+      unmap_file(user, bank, bank_size);
+    }
+    else {
+      success = read_file(user, bank_filename, bank_offset, packed_size, (char*)destination);
 
-      uint32_t unpacked_size = bk.unpacked_size(destination, this->packed_size);
+      if (success && packed_size != size) {
+        ByteKiller bk;
+        success = bk.unpack(destination, packed_size, destination, size);
+      }
+    }
+
+    if (!success) {
+      if (debug) {
+        debug(user, "Resource %u couldn't be read or unpacked from %s", id, bank_filename.c_str());
+      }
+      return false;
+    }
 
-      success = bk.unpack(destination, this->packed_size);
-      
-      write_file(bank_filename + "." + std::to_string(this->bank_offset) + ".unpacked", unpacked_size, (char*)destination);
+    // if the resource was an image then it's encoded as 4 bitplanes a la mode 9
+    // we need to shuffle the pixels around to get it into our buffer format
+    if (resources.types[id] == Resource::Type::IMAGE) {
+      uint8_t temp[320 * 200 / 2];
+      memcpy(temp, destination, 320 * 200 / 2);
+      Framebuffer::from_planar(destination, temp);
     }
 
-    this->data = destination;
+    resources.data[id] = destination;
 
-    return success;
+    return true;
   }
 
 }
\ No newline at end of file
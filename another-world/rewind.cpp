@@ -0,0 +1,239 @@
+#include <cstdio>
+#include <cstring>
+
+#include "rewind.hpp"
+#include "rle.hpp"
+#include "snapshot.hpp"
+
+namespace another_world {
+
+  constexpr uint32_t DIRTY_BYTES = (4 * Rewind::PAGE_ROWS + 7) / 8;
+
+  Rewind::Rewind() {
+    previous_pages.resize(VRAM_SIZE * 4);
+  }
+
+  void Rewind::clear() {
+    history.clear();
+    used = 0;
+    since_keyframe = 0;
+  }
+
+  void Rewind::capture(const VirtualMachine& vm, uint32_t vm_frames) {
+    clock::time_point start = clock::now();
+
+    save_snapshot(vm, state, false);
+
+    history.emplace_back();
+    Frame& frame = history.back();
+    frame.vm_frames = vm_frames;
+    frame.state_size = uint32_t(state.size());
+
+    // a keyframe is forced if there's nothing to take a delta against
+    if (history.size() == 1 || since_keyframe + 1 >= keyframe_interval) {
+      encode_keyframe(vm, frame);
+      since_keyframe = 0;
+    } else {
+      encode_delta(vm, frame);
+      since_keyframe++;
+    }
+
+    previous_state.swap(state);
+
+    size_t size = frame.size();
+    used += size;
+    enforce_budget();
+
+    last_capture_ns = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    capture_ns += last_capture_ns;
+    encoded_bytes += size;
+    captured_frames++;
+  }
+
+  void Rewind::encode_keyframe(const VirtualMachine& vm, Frame& frame) {
+    frame.keyframe = true;
+
+    scratch.clear();
+    rle::encode(state.data(), uint32_t(state.size()), scratch);
+    frame.state.assign(scratch.begin(), scratch.end());
+
+    scratch.clear();
+    for (uint8_t i = 0; i < 4; i++) {
+      rle::encode(vm.engine.vram[i], VRAM_SIZE, scratch);
+      memcpy(&previous_pages[i * VRAM_SIZE], vm.engine.vram[i], VRAM_SIZE);
+    }
+    frame.pages.assign(scratch.begin(), scratch.end());
+  }
+
+  void Rewind::encode_delta(const VirtualMachine& vm, Frame& frame) {
+    frame.keyframe = false;
+
+    // the state can change size (the call stack grows and shrinks), bytes
+    // past the end of the previous state are xor'd against zero
+    difference.resize(state.size());
+    for (size_t i = 0; i < state.size(); i++) {
+      difference[i] = state[i] ^ (i < previous_state.size() ? previous_state[i] : 0);
+    }
+
+    scratch.clear();
+    rle::encode(difference.data(), uint32_t(difference.size()), scratch);
+    frame.state.assign(scratch.begin(), scratch.end());
+
+    // only rows that changed are stored
+    frame.dirty.assign(DIRTY_BYTES, 0);
+    difference.clear();
+
+    for (uint8_t page = 0; page < 4; page++) {
+      for (uint32_t row = 0; row < PAGE_ROWS; row++) {
+        const uint8_t* current = vm.engine.vram[page] + row * ROW_SIZE;
+        uint8_t* previous = &previous_pages[page * VRAM_SIZE + row * ROW_SIZE];
+
+        if (memcmp(current, previous, ROW_SIZE) == 0) {
+          continue;
+        }
+
+        uint32_t bit = page * PAGE_ROWS + row;
+        frame.dirty[bit >> 3] |= 1 << (bit & 7);
+
+        for (uint32_t i = 0; i < ROW_SIZE; i++) {
+          difference.push_back(current[i] ^ previous[i]);
+        }
+        memcpy(previous, current, ROW_SIZE);
+      }
+    }
+
+    scratch.clear();
+    rle::encode(difference.data(), uint32_t(difference.size()), scratch);
+    frame.pages.assign(scratch.begin(), scratch.end());
+  }
+
+  bool Rewind::decode(const Frame& frame, std::vector<uint8_t>& state, std::vector<uint8_t>& pages) {
+    if (frame.keyframe) {
+      state.resize(frame.state_size);
+      if (!rle::decode(frame.state.data(), uint32_t(frame.state.size()), state.data(), frame.state_size)) {
+        return false;
+      }
+
+      uint32_t offset = 0;
+      for (uint8_t i = 0; i < 4; i++) {
+        uint32_t consumed = rle::decode(frame.pages.data() + offset, uint32_t(frame.pages.size()) - offset, &pages[i * VRAM_SIZE], VRAM_SIZE);
+        if (!consumed) {
+          return false;
+        }
+        offset += consumed;
+      }
+
+      return true;
+    }
+
+    // undo the xor against the previous state
+    scratch.resize(frame.state_size);
+    if (!rle::decode(frame.state.data(), uint32_t(frame.state.size()), scratch.data(), frame.state_size)) {
+      return false;
+    }
+
+    state.resize(frame.state_size, 0);
+    for (uint32_t i = 0; i < frame.state_size; i++) {
+      state[i] ^= scratch[i];
+    }
+
+    // and the changed rows
+    uint32_t dirty_rows = 0;
+    for (uint32_t bit = 0; bit < 4 * PAGE_ROWS; bit++) {
+      dirty_rows += (frame.dirty[bit >> 3] >> (bit & 7)) & 1;
+    }
+
+    scratch.resize(dirty_rows * ROW_SIZE);
+    if (dirty_rows && !rle::decode(frame.pages.data(), uint32_t(frame.pages.size()), scratch.data(), uint32_t(scratch.size()))) {
+      return false;
+    }
+
+    const uint8_t* difference = scratch.data();
+    for (uint32_t bit = 0; bit < 4 * PAGE_ROWS; bit++) {
+      if ((frame.dirty[bit >> 3] >> (bit & 7)) & 1) {
+        uint8_t* row = &pages[(bit / PAGE_ROWS) * VRAM_SIZE + (bit % PAGE_ROWS) * ROW_SIZE];
+        for (uint32_t i = 0; i < ROW_SIZE; i++) {
+          row[i] ^= *difference++;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  uint32_t Rewind::rewind(VirtualMachine& vm, uint32_t frames) {
+    if (frames >= history.size()) {
+      return 0;
+    }
+
+    size_t target = history.size() - 1 - frames;
+
+    // find the keyframe the target frame was built on
+    size_t keyframe = target;
+    while (!history[keyframe].keyframe) {
+      keyframe--;
+    }
+
+    std::vector<uint8_t> rebuilt_state;
+    std::vector<uint8_t> rebuilt_pages(VRAM_SIZE * 4);
+    for (size_t i = keyframe; i <= target; i++) {
+      if (!decode(history[i], rebuilt_state, rebuilt_pages)) {
+        return 0;
+      }
+    }
+
+    if (!restore_snapshot(vm, rebuilt_state.data(), uint32_t(rebuilt_state.size()))) {
+      return 0;
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+      memcpy(vm.engine.vram[i], &rebuilt_pages[i * VRAM_SIZE], VRAM_SIZE);
+    }
+
+    // the restored frame becomes the newest
+    uint32_t undone = 0;
+    while (history.size() > target + 1) {
+      undone += history.back().vm_frames;
+      used -= history.back().size();
+      history.pop_back();
+    }
+
+    since_keyframe = uint32_t(target - keyframe);
+    previous_state.swap(rebuilt_state);
+    previous_pages.swap(rebuilt_pages);
+
+    return undone;
+  }
+
+  void Rewind::enforce_budget() {
+    // frames are dropped a whole keyframe group at a time since the deltas
+    // can't be decoded without the keyframe before them, the newest group
+    // is always kept
+    while (used > memory_budget) {
+      size_t next_keyframe = 1;
+      while (next_keyframe < history.size() && !history[next_keyframe].keyframe) {
+        next_keyframe++;
+      }
+
+      if (next_keyframe >= history.size()) {
+        break;
+      }
+
+      for (size_t i = 0; i < next_keyframe; i++) {
+        used -= history.front().size();
+        history.pop_front();
+      }
+    }
+  }
+
+  std::string Rewind::report() const {
+    char line[256];
+    snprintf(line, sizeof(line),
+      "frames: %u, memory: %.2fMB of %.2fMB, average frame: %.0f bytes, capture: %.1fus average %.1fus last\n",
+      available(), used / 1048576.0f, memory_budget / 1048576.0f,
+      captured_frames ? double(encoded_bytes) / captured_frames : 0.0,
+      captured_frames ? capture_ns / 1000.0 / captured_frames : 0.0, last_capture_ns / 1000.0);
+    return line;
+  }
+
+}
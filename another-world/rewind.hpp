@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "virtual-machine.hpp"
+
+/*
+  rewind history
+
+  capture() is called once per frame and records the vm's state into a
+  ring of frames bounded by a memory budget. every keyframe_interval
+  frames a keyframe holds the complete state, the frames in between only
+  hold what changed since the frame before:
+
+    - the vm state (registers, threads, etc. as serialised by
+      save_snapshot() without the pages) xor'd with the previous frame's
+    - the rows of each video page that changed, xor'd with the previous
+      frame's rows
+
+  both are run length encoded, since the xor of unchanged bytes is zero
+  a typical frame costs a few hundred bytes.
+
+  rewind(n) rebuilds the state n frames back by decoding the nearest
+  keyframe before it and applying the deltas that follow in order, then
+  discards the newer frames so capturing continues from there.
+*/
+
+namespace another_world {
+
+  struct Rewind {
+    using clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t PAGE_ROWS = 200;
+    static constexpr uint32_t ROW_SIZE = VRAM_SIZE / PAGE_ROWS;
+
+    // settings
+    uint32_t memory_budget = 16 * 1024 * 1024;      // bytes, oldest frames are dropped beyond this
+    uint32_t keyframe_interval = 120;               // frames between keyframes
+
+    // statistics
+    uint32_t captured_frames = 0;
+    uint64_t capture_ns = 0;                        // total time spent in capture()
+    uint32_t last_capture_ns = 0;
+    uint64_t encoded_bytes = 0;                     // total size of every frame captured
+
+    Rewind();
+
+    // record the current state as the newest frame, `vm_frames` is how
+    // many vm frames were run since the last capture (fast forward only
+    // captures once per batch of frames)
+    void capture(const VirtualMachine& vm, uint32_t vm_frames = 1);
+
+    // restore the state from `frames` frames before the newest (zero for
+    // the newest itself) and forget everything after it. returns the
+    // number of vm frames undone, zero if the history doesn't go back that
+    // far
+    uint32_t rewind(VirtualMachine& vm, uint32_t frames);
+
+    // forget all history (for example after loading a save state)
+    void clear();
+
+    // number of frames that can currently be rewound
+    uint32_t available() const { return uint32_t(history.size()); }
+
+    // memory currently used by the history
+    size_t memory_used() const { return used; }
+
+    // human readable summary of memory use and cost per frame
+    std::string report() const;
+
+  private:
+    struct Frame {
+      bool keyframe;
+      uint32_t vm_frames;                           // run since the frame before
+      uint32_t state_size;                          // size of the decoded state
+      std::vector<uint8_t> state;                   // encoded (and for deltas xor'd) state
+      std::vector<uint8_t> dirty;                   // bitmask of changed rows, deltas only
+      std::vector<uint8_t> pages;                   // encoded pages, or changed rows for deltas
+
+      size_t size() const { return sizeof(Frame) + state.capacity() + dirty.capacity() + pages.capacity(); }
+    };
+
+    std::deque<Frame> history;
+    size_t used = 0;
+    uint32_t since_keyframe = 0;
+
+    // state of the newest frame, what the next delta is taken against
+    std::vector<uint8_t> previous_state;
+    std::vector<uint8_t> previous_pages;
+
+    // scratch buffers reused between frames
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> difference;
+
+    void encode_keyframe(const VirtualMachine& vm, Frame& frame);
+    void encode_delta(const VirtualMachine& vm, Frame& frame);
+    bool decode(const Frame& frame, std::vector<uint8_t>& state, std::vector<uint8_t>& pages);
+    void enforce_budget();
+  };
+
+}
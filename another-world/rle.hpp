@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+  byte oriented run length encoding (in the style of PackBits)
+
+  the encoded stream is a sequence of blocks each starting with a control
+  byte c:
+
+    c < 0x80 : c + 1 literal bytes follow
+    c >= 0x80: the next byte is repeated c - 0x80 + 3 times
+
+  video pages are mostly large flat areas (and deltas between frames are
+  mostly zero) so this shrinks them a lot for very little cost.
+*/
+
+namespace another_world {
+
+  namespace rle {
+
+    constexpr uint32_t MIN_RUN = 3;
+    constexpr uint32_t MAX_RUN = 0x7f + MIN_RUN;
+    constexpr uint32_t MAX_LITERALS = 0x80;
+
+    // append the encoding of `size` bytes from `source` to `output`
+    inline void encode(const uint8_t* source, uint32_t size, std::vector<uint8_t>& output) {
+      uint32_t i = 0;
+      uint32_t literal_start = 0;
+
+      auto flush_literals = [&](uint32_t end) {
+        while (literal_start < end) {
+          uint32_t count = end - literal_start < MAX_LITERALS ? end - literal_start : MAX_LITERALS;
+          output.push_back(uint8_t(count - 1));
+          output.insert(output.end(), source + literal_start, source + literal_start + count);
+          literal_start += count;
+        }
+      };
+
+      while (i < size) {
+        // measure the run starting here
+        uint32_t run = 1;
+        while (i + run < size && run < MAX_RUN && source[i + run] == source[i]) {
+          run++;
+        }
+
+        if (run >= MIN_RUN) {
+          flush_literals(i);
+          output.push_back(uint8_t(0x80 + run - MIN_RUN));
+          output.push_back(source[i]);
+          i += run;
+          literal_start = i;
+        } else {
+          i += run;
+        }
+      }
+
+      flush_literals(size);
+    }
+
+    // decode into exactly `size` bytes at `destination`, returns the number
+    // of encoded bytes consumed or zero if the data is malformed
+    inline uint32_t decode(const uint8_t* source, uint32_t source_size, uint8_t* destination, uint32_t size) {
+      uint32_t in = 0;
+      uint32_t out = 0;
+
+      while (out < size) {
+        if (in >= source_size) {
+          return 0;
+        }
+
+        uint8_t control = source[in++];
+        if (control < 0x80) {
+          uint32_t count = control + 1;
+          if (in + count > source_size || out + count > size) {
+            return 0;
+          }
+
+          memcpy(destination + out, source + in, count);
+          in += count;
+          out += count;
+        } else {
+          uint32_t count = control - 0x80 + MIN_RUN;
+          if (in >= source_size || out + count > size) {
+            return 0;
+          }
+
+          memset(destination + out, source[in++], count);
+          out += count;
+        }
+      }
+
+      return in;
+    }
+
+  }
+
+}
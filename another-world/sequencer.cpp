@@ -0,0 +1,187 @@
+/*
+  MUSIC resources are laid out as:
+
+    0x00 - 0x01: default period between rows
+    0x02 - 0x3d: fifteen instruments, each a SOUND resource id and a
+                 volume (both 16-bit)
+    0x3e - 0x3f: number of orders
+    0x40 - 0xbf: order table, one pattern number per order (so no more
+                 than 128 orders)
+    0xc0 -     : patterns, 1024 bytes each
+
+  each pattern row is sixteen bytes, four bytes per channel made up of
+  two 16-bit words:
+
+    first word : the Amiga period of the note to play, zero for no new
+                 note, 0xfffe to stop the channel or 0xfffd for a SYNC
+    second word: bits 12-15 instrument (1 - 15, zero for none)
+                 bits  8-11 effect (5 = volume up, 6 = volume down)
+                 bits  0- 7 effect amount
+
+                 for a SYNC the whole word is written to register 0xf4
+
+  all values are big endian
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "sequencer.hpp"
+#include "virtual-machine.hpp"
+
+namespace another_world {
+
+  constexpr uint16_t NOTE_SYNC = 0xfffd;
+  constexpr uint16_t NOTE_STOP = 0xfffe;
+
+  // notes are Amiga periods, the Paula sound chip plays samples at its
+  // clock rate (NTSC here) divided by the period
+  constexpr uint32_t PAULA_CLOCK = 7159092 / 2;
+
+  // the period is converted to milliseconds per row as period * 60 / 7050
+  constexpr uint32_t PERIOD_SCALE = 60;
+  constexpr uint32_t PERIOD_DIVISOR = 7050 * 1000;
+
+  Sequencer::Sequencer(Mixer& mixer, int16_t* registers) : mixer(mixer), registers(registers) {
+    // the mixer steps us in time with its output
+    mixer.sequencer = this;
+  }
+
+  uint16_t Sequencer::instrument_resource(const uint8_t* module, uint8_t i) {
+    return read_uint16_bigendian(module + 2 + i * 4);
+  }
+
+  void Sequencer::load(const uint8_t* module, uint32_t size, const uint8_t* const sounds[INSTRUMENT_COUNT],
+    const uint32_t sound_sizes[INSTRUMENT_COUNT], uint16_t period, uint8_t order) {
+    patterns = nullptr;
+    order_table = nullptr;
+    order_count = 0;
+    pattern_count = 0;
+    if (!module || size < HEADER_SIZE) {
+      return;
+    }
+
+    for (uint8_t i = 0; i < INSTRUMENT_COUNT; i++) {
+      instruments[i].sound = sounds[i];
+      instruments[i].size = sounds[i] ? sound_sizes[i] : 0;
+      instruments[i].volume = uint8_t(std::min<uint16_t>(read_uint16_bigendian(module + 4 + i * 4), 63));
+    }
+
+    // a pattern that doesn't fit in the resource stops the music when its
+    // order comes round, see play_row()
+    order_count = std::min(read_uint16_bigendian(module + 0x3e), MAX_ORDERS);
+    order_table = module + 0x40;
+    patterns = module + HEADER_SIZE;
+    pattern_count = uint16_t(std::min<uint32_t>((size - HEADER_SIZE) / PATTERN_SIZE, 256));
+
+    this->order = order;
+    this->row = 0;
+    this->period = period ? period : read_uint16_bigendian(module);
+  }
+
+  void Sequencer::start() {
+    if (!patterns || order >= order_count) {
+      return;
+    }
+
+    playing = true;
+    samples_until_row = 0;
+    row_remainder = 0;
+  }
+
+  void Sequencer::stop() {
+    if (playing) {
+      playing = false;
+      mixer.stop_all();
+    }
+  }
+
+  void Sequencer::set_period(uint16_t period) {
+    this->period = period;
+  }
+
+  uint32_t Sequencer::advance() {
+    while (playing && samples_until_row == 0) {
+      play_row();
+      schedule_row();
+    }
+
+    return playing ? samples_until_row : NOT_PLAYING;
+  }
+
+  void Sequencer::elapsed(uint32_t count) {
+    if (playing) {
+      samples_until_row -= std::min(count, samples_until_row);
+    }
+  }
+
+  void Sequencer::schedule_row() {
+    // keep the fractional part of each row's length so rounding doesn't
+    // drift the tempo over the course of a song
+    uint64_t total = uint64_t(mixer.sample_rate) * period * PERIOD_SCALE + row_remainder;
+    samples_until_row = std::max<uint32_t>(uint32_t(total / PERIOD_DIVISOR), 1);
+    row_remainder = uint32_t(total % PERIOD_DIVISOR);
+  }
+
+  void Sequencer::play_row() {
+    if (!patterns || order >= order_count || order_table[order] >= pattern_count) {
+      stop();
+      return;
+    }
+
+    const uint8_t* notes = patterns + order_table[order] * PATTERN_SIZE + row * 16;
+
+    for (uint8_t channel = 0; channel < Mixer::CHANNEL_COUNT; channel++) {
+      play_note(channel, notes + channel * 4);
+    }
+
+    row++;
+    if (row == ROWS_PER_PATTERN) {
+      row = 0;
+      order++;
+
+      if (order >= order_count) {
+        stop();
+      }
+    }
+  }
+
+  void Sequencer::play_note(uint8_t channel, const uint8_t* note) {
+    uint16_t note_period = read_uint16_bigendian(note);
+    uint16_t parameters = read_uint16_bigendian(note + 2);
+
+    if (note_period == NOTE_SYNC) {
+      // lets the game script follow the music
+      registers[SYNC_REGISTER] = int16_t(parameters);
+      return;
+    }
+
+    // an instrument with a volume effect changes the channel volume even
+    // if no new note is started
+    const Instrument* instrument = nullptr;
+    uint8_t volume = 0;
+
+    uint8_t instrument_id = parameters >> 12;
+    if (instrument_id != 0 && instruments[instrument_id - 1].sound) {
+      instrument = &instruments[instrument_id - 1];
+
+      int16_t v = instrument->volume;
+      uint8_t effect = (parameters >> 8) & 0x0f;
+      if (effect == 5) {
+        v = std::min<int16_t>(v + (parameters & 0xff), 63);
+      } else if (effect == 6) {
+        v = std::max<int16_t>(v - (parameters & 0xff), 0);
+      }
+
+      volume = uint8_t(v);
+      mixer.set_volume(channel, volume);
+    }
+
+    if (note_period == NOTE_STOP) {
+      mixer.stop(channel);
+    } else if (note_period != 0 && instrument) {
+      mixer.play(channel, Mixer::sound_sample(instrument->sound, instrument->size), PAULA_CLOCK / note_period, volume);
+    }
+  }
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "mixer.hpp"
+
+/*
+  plays MUSIC resources (four channel modules) through the mixer
+
+  a module is a list of orders, each naming one of its patterns. a pattern
+  is 64 rows and each row holds one note for each of the four channels.
+  rows advance at a rate given by the module or overridden by the music
+  opcode, the sequencer is stepped by the mixer so that every row starts
+  on exactly the right output sample.
+
+  a special note value lets the music signal the game script by writing
+  to a register, the script uses this to synchronise events with the
+  soundtrack.
+*/
+
+namespace another_world {
+
+  struct VirtualMachine;
+
+  struct Sequencer {
+    static constexpr uint8_t  INSTRUMENT_COUNT = 15;
+    static constexpr uint8_t  SYNC_REGISTER = 0xf4;     // written by SYNC notes
+    static constexpr uint32_t NOT_PLAYING = 0xffffffff;
+
+    // layout of a MUSIC resource, see sequencer.cpp
+    static constexpr uint32_t HEADER_SIZE = 0xc0;
+    static constexpr uint16_t MAX_ORDERS = 128;
+    static constexpr uint16_t PATTERN_SIZE = 1024;
+    static constexpr uint8_t  ROWS_PER_PATTERN = 64;
+
+    struct Instrument {
+      const uint8_t* sound = nullptr;     // SOUND resource
+      uint32_t size = 0;                  // of the SOUND resource
+      uint8_t volume = 0;
+    };
+
+    Mixer& mixer;
+    int16_t* registers;                   // the VM's registers (for SYNC notes)
+
+    bool playing = false;
+
+    // module currently loaded
+    const uint8_t* patterns = nullptr;
+    const uint8_t* order_table = nullptr;
+    uint16_t order_count = 0;
+    uint16_t pattern_count = 0;           // whole patterns in the resource
+    Instrument instruments[INSTRUMENT_COUNT];
+
+    // position within the module
+    uint8_t order = 0;
+    uint8_t row = 0;
+
+    // time between rows, as passed to the music opcode
+    uint16_t period = 0;
+
+    // attaches itself to `mixer`
+    Sequencer(Mixer& mixer, int16_t* registers);
+
+    // prepare a MUSIC resource of `size` bytes to play from `order`,
+    // `sounds` are the SOUND resources for each of the module's fifteen
+    // instruments (nullptr if not loaded) and `sound_sizes` their sizes. a
+    // period of zero uses the module's own tempo. a resource too short to
+    // hold the header and order table won't start()
+    void load(const uint8_t* module, uint32_t size, const uint8_t* const sounds[INSTRUMENT_COUNT],
+      const uint32_t sound_sizes[INSTRUMENT_COUNT], uint16_t period, uint8_t order);
+
+    void start();
+    void stop();
+
+    // change the tempo of the playing module
+    void set_period(uint16_t period);
+
+    // instrument resource id used by instrument `i` of a MUSIC resource
+    static uint16_t instrument_resource(const uint8_t* module, uint8_t i);
+
+    // called by the mixer: plays any row that is due and returns the number
+    // of samples until the next one (or NOT_PLAYING)
+    uint32_t advance();
+
+    // called by the mixer after it has produced `count` samples
+    void elapsed(uint32_t count);
+
+  private:
+    // save states need the exact timing of the next row
+    friend void save_snapshot(const VirtualMachine& vm, std::vector<uint8_t>& output, bool include_pages);
+    friend bool restore_snapshot(VirtualMachine& vm, const uint8_t* data, uint32_t size);
+
+    uint32_t samples_until_row = 0;
+    uint32_t row_remainder = 0;           // fraction of a sample carried between rows
+
+    void play_row();
+    void play_note(uint8_t channel, const uint8_t* note);
+    void schedule_row();
+  };
+
+}
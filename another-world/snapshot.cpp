@@ -0,0 +1,473 @@
+/*
+  snapshots are stored little endian as:
+
+    header   : "AWSS", version (16-bit), framebuffer format (8-bit, 1 if
+               chunky), flags (8-bit, bit 0 set if the pages are left out)
+    vm       : ticks, chapter id, registers, threads, call stack, chapter
+               resource ids, working and visible page ids, palette and
+               palette fade
+    resources: resource count, heap offset, then for each resource its
+               state and offset in the heap (0xffffffff if none, or if
+               it's shared from a ResourceStore or AssetPack)
+    audio    : mixer channels and sequencer position with sample data
+               stored as the id of the resource it lies in (0xffff if
+               none) and the offset into it
+    pages    : for each of the four video pages the run length encoded
+               size followed by the encoded page (unless left out)
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "snapshot.hpp"
+#include "resource-store.hpp"
+#include "rle.hpp"
+
+namespace another_world {
+
+  constexpr char     SNAPSHOT_MAGIC[4] = { 'A', 'W', 'S', 'S' };
+  constexpr uint32_t NO_OFFSET = 0xffffffff;
+  constexpr uint8_t  FLAG_NO_PAGES = 0x01;
+
+#ifdef AW_FRAMEBUFFER_CHUNKY
+  constexpr uint8_t FRAMEBUFFER_FORMAT = 1;
+#else
+  constexpr uint8_t FRAMEBUFFER_FORMAT = 0;
+#endif
+
+  struct SnapshotWriter {
+    std::vector<uint8_t>& output;
+
+    void u8(uint8_t v) { output.push_back(v); }
+    void u16(uint16_t v) { u8(uint8_t(v)); u8(uint8_t(v >> 8)); }
+    void u32(uint32_t v) { u16(uint16_t(v)); u16(uint16_t(v >> 16)); }
+    void u64(uint64_t v) { u32(uint32_t(v)); u32(uint32_t(v >> 32)); }
+    void bytes(const void* p, uint32_t n) { output.insert(output.end(), (const uint8_t*)p, (const uint8_t*)p + n); }
+  };
+
+  // reads fail safe: once the end of the data is passed every read
+  // returns zero and `ok` is cleared
+  struct SnapshotReader {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t position = 0;
+    bool ok = true;
+
+    bool available(uint32_t n) {
+      if (!ok || size - position < n) {
+        ok = false;
+        return false;
+      }
+      return true;
+    }
+
+    uint8_t u8() { return available(1) ? data[position++] : 0; }
+    uint16_t u16() { uint16_t lo = u8(); return uint16_t(lo | (u8() << 8)); }
+    uint32_t u32() { uint32_t lo = u16(); return lo | (uint32_t(u16()) << 16); }
+    uint64_t u64() { uint64_t lo = u32(); return lo | (uint64_t(u32()) << 32); }
+    const uint8_t* bytes(uint32_t n) {
+      if (!available(n)) {
+        return nullptr;
+      }
+      position += n;
+      return data + position - n;
+    }
+  };
+
+  static uint32_t heap_offset(const Engine& engine, const void* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    const uint8_t* heap = engine.resource_heap.data();
+    return (heap && b >= heap && b < heap + engine.resource_heap.size()) ? uint32_t(b - heap) : NO_OFFSET;
+  }
+
+  // a pointer into resource data as the resource it lies in and the
+  // offset into it, this holds whether the data is in the heap or shared
+  static void write_resource_pointer(SnapshotWriter& w, const Engine& engine, const void* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    for (uint16_t i : engine.resources.with_state(Resource::State::LOADED)) {
+      const uint8_t* data = engine.resources.data[i];
+      if (b && b >= data && b < data + engine.resources.sizes[i]) {
+        w.u16(i);
+        w.u32(uint32_t(b - data));
+        return;
+      }
+    }
+    w.u16(NO_RESOURCE);
+    w.u32(0);
+  }
+
+  struct ResourcePointer {
+    uint16_t id;
+    uint32_t offset;
+
+    // true if this points into a resource that'll be resident once the
+    // snapshot is restored
+    bool valid(const Engine& engine, const std::vector<Resource::State>& states) const {
+      return id < engine.resources.size() && states[id] == Resource::State::LOADED && offset < engine.resources.sizes[id];
+    }
+
+    const uint8_t* resolve(const Engine& engine) const {
+      return engine.resources.data[id] + offset;
+    }
+
+    // bytes from the pointer to the end of its resource
+    uint32_t size(const Engine& engine) const {
+      return engine.resources.sizes[id] - offset;
+    }
+  };
+
+  static uint8_t page_id(const Engine& engine, const uint8_t* page) {
+    for (uint8_t i = 0; i < 4; i++) {
+      if (engine.vram[i] == page) {
+        return i;
+      }
+    }
+    return 0;
+  }
+
+  void save_snapshot(const VirtualMachine& vm, std::vector<uint8_t>& output, bool include_pages) {
+    const Engine& engine = vm.engine;
+
+    output.clear();
+    SnapshotWriter w{ output };
+
+    w.bytes(SNAPSHOT_MAGIC, 4);
+    w.u16(SNAPSHOT_VERSION);
+    w.u8(FRAMEBUFFER_FORMAT);
+    w.u8(include_pages ? 0 : FLAG_NO_PAGES);
+
+    // vm
+    w.u32(vm.ticks);
+    w.u8(vm.chapter_id);
+    for (auto r : vm.registers) {
+      w.u16(uint16_t(r));
+    }
+    for (auto& thread : vm.threads) {
+      w.u16(thread.pc);
+      w.u8(thread.paused);
+    }
+    w.u16(uint16_t(vm.call_stack.size()));
+    for (auto pc : vm.call_stack) {
+      w.u16(pc);
+    }
+    w.u16(vm.palette);
+    w.u16(vm.code);
+    w.u16(vm.background);
+    w.u16(vm.characters);
+    w.u8(page_id(engine, vm.working_vram));
+    w.u8(page_id(engine, vm.visible_vram));
+
+    for (auto c : vm.current_palette) {
+      w.u16(c);
+    }
+    w.u8(vm.current_palette_valid);
+    for (uint8_t i = 0; i < 16; i++) {
+      w.u16(vm.palette_fade.from[i]);
+      w.u16(vm.palette_fade.to[i]);
+    }
+    w.u8(vm.palette_fade.step);
+    w.u8(vm.palette_fade.steps);
+
+    // resources
+    w.u16(engine.resources.size());
+    w.u32(engine.resource_heap_offset);
+    for (uint16_t i = 0; i < engine.resources.size(); i++) {
+      Resource::State state = engine.resources.state(i);
+      w.u8(uint8_t(state));
+      w.u32(state == Resource::State::LOADED ? heap_offset(engine, engine.resources.data[i]) : NO_OFFSET);
+    }
+
+    // audio
+    for (auto& channel : vm.mixer.channels) {
+      write_resource_pointer(w, engine, channel.active ? channel.sample.data : nullptr);
+      w.u32(channel.sample.length);
+      w.u32(channel.sample.loop_start);
+      w.u32(channel.sample.loop_length);
+      w.u64(channel.position);
+      w.u32(channel.step);
+      w.u8(channel.volume);
+    }
+
+    const Sequencer& sequencer = vm.sequencer;
+    w.u8(sequencer.playing);
+    write_resource_pointer(w, engine, sequencer.playing ? sequencer.patterns - 0xc0 : nullptr);
+    for (auto& instrument : sequencer.instruments) {
+      write_resource_pointer(w, engine, instrument.sound);
+    }
+    w.u8(sequencer.order);
+    w.u8(sequencer.row);
+    w.u16(sequencer.period);
+    w.u32(sequencer.samples_until_row);
+    w.u32(sequencer.row_remainder);
+
+    // video pages
+    for (uint8_t i = 0; i < 4 && include_pages; i++) {
+      size_t size_position = output.size();
+      w.u32(0);
+      rle::encode(engine.vram[i], VRAM_SIZE, output);
+
+      uint32_t encoded_size = uint32_t(output.size() - size_position - 4);
+      for (uint8_t b = 0; b < 4; b++) {
+        output[size_position + b] = uint8_t(encoded_size >> (b * 8));
+      }
+    }
+  }
+
+  bool restore_snapshot(VirtualMachine& vm, const uint8_t* data, uint32_t size) {
+    Engine& engine = vm.engine;
+    SnapshotReader r{ data, size };
+
+    // header
+    const uint8_t* magic = r.bytes(4);
+    if (!magic || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0 || r.u16() != SNAPSHOT_VERSION || r.u8() != FRAMEBUFFER_FORMAT) {
+      return false;
+    }
+    bool include_pages = !(r.u8() & FLAG_NO_PAGES);
+
+    // everything is read into locals first so that a bad snapshot can't
+    // leave the vm half restored
+    uint32_t ticks = r.u32();
+    uint8_t chapter_id = r.u8();
+
+    int16_t registers[REGISTER_COUNT];
+    for (auto& reg : registers) {
+      reg = int16_t(r.u16());
+    }
+
+    std::array<Thread, THREAD_COUNT> threads;
+    for (auto& thread : threads) {
+      thread.pc = r.u16();
+      thread.paused = r.u8() != 0;
+    }
+
+    std::vector<uint16_t> call_stack(r.u16());
+    for (auto& pc : call_stack) {
+      pc = r.u16();
+    }
+
+    uint16_t chapter_resource_ids[4];
+    for (auto& id : chapter_resource_ids) {
+      id = r.u16();
+    }
+    uint8_t working_page = r.u8() & 3;
+    uint8_t visible_page = r.u8() & 3;
+
+    uint16_t current_palette[16];
+    for (auto& c : current_palette) {
+      c = r.u16();
+    }
+    bool current_palette_valid = r.u8() != 0;
+    PaletteFade palette_fade;
+    for (uint8_t i = 0; i < 16; i++) {
+      palette_fade.from[i] = r.u16();
+      palette_fade.to[i] = r.u16();
+    }
+    palette_fade.step = r.u8();
+    palette_fade.steps = r.u8();
+
+    // resources must match the data we're running with
+    if (r.u16() != engine.resources.size()) {
+      return false;
+    }
+    uint32_t heap_top = r.u32();
+
+    // resources that were shared when the snapshot was made have no place
+    // in the heap, unless a pack or store has them they're loaded above
+    // everything else
+    std::vector<Resource::State> states(engine.resources.size());
+    std::vector<uint32_t> offsets(engine.resources.size());
+    if (heap_top > HEAP_SIZE) {
+      return false;
+    }
+
+    // sizes are checked against the room left rather than added to the
+    // offsets, which a malformed snapshot could make wrap around
+    uint32_t unplaced_top = heap_top;
+    for (uint16_t i = 0; i < engine.resources.size(); i++) {
+      states[i] = Resource::State(r.u8());
+      offsets[i] = r.u32();
+
+      if (states[i] > Resource::State::NEEDS_LOADING) {
+        return false;
+      }
+
+      if (offsets[i] != NO_OFFSET && (offsets[i] > HEAP_SIZE || engine.resources.sizes[i] > HEAP_SIZE - offsets[i])) {
+        return false;
+      }
+
+      if (offsets[i] == NO_OFFSET && states[i] == Resource::State::LOADED && !engine.shared_resource(i)) {
+        if (engine.resources.sizes[i] > HEAP_SIZE - unplaced_top) {
+          return false;
+        }
+        offsets[i] = unplaced_top;
+        unplaced_top += engine.resources.sizes[i];
+      }
+    }
+
+    // the vm runs straight out of the chapter's resources, so they have to
+    // be the right types and resident once restored (a chapter without
+    // characters has none)
+    if (chapter_id >= sizeof(chapter_resources) / sizeof(chapter_resources[0])) {
+      return false;
+    }
+    const Resource::Type chapter_types[4] = {
+      Resource::Type::PALETTE, Resource::Type::BYTECODE, Resource::Type::POLYGON, Resource::Type::POLYGON
+    };
+    for (uint8_t i = 0; i < 4; i++) {
+      uint16_t id = chapter_resource_ids[i];
+      if (i == 3 && id == NO_RESOURCE) {
+        continue;
+      }
+      if (!engine.resources.is(id, chapter_types[i]) || states[id] != Resource::State::LOADED) {
+        return false;
+      }
+    }
+
+    // every sample playing starts just after the header of a SOUND
+    // resource. the lengths saved with it are only what the resource's
+    // header gave, the sample is described again from the resource itself
+    // once it's back (see Mixer::sound_sample()) so they can't be trusted
+    // to run past it, but the position has to lie within it
+    MixerChannel channels[Mixer::CHANNEL_COUNT];
+    ResourcePointer channel_samples[Mixer::CHANNEL_COUNT];
+    for (uint8_t i = 0; i < Mixer::CHANNEL_COUNT; i++) {
+      channel_samples[i].id = r.u16();
+      channel_samples[i].offset = r.u32();
+      uint32_t length = r.u32();
+      r.u32();    // loop start
+      r.u32();    // loop length
+      channels[i].position = r.u64();
+      channels[i].step = r.u32();
+      channels[i].volume = std::min<uint8_t>(r.u8(), 63);
+      channels[i].active = channel_samples[i].valid(engine, states);
+
+      if (channels[i].active && (!engine.resources.is(channel_samples[i].id, Resource::Type::SOUND) ||
+        channel_samples[i].offset != 8 || (channels[i].position >> 16) >= length)) {
+        return false;
+      }
+    }
+
+    bool music_playing = r.u8() != 0;
+    ResourcePointer module = { r.u16(), r.u32() };
+    ResourcePointer instruments[Sequencer::INSTRUMENT_COUNT];
+    for (auto& instrument : instruments) {
+      instrument.id = r.u16();
+      instrument.offset = r.u32();
+    }
+    uint8_t order = r.u8();
+    uint8_t row = r.u8();
+    uint16_t period = r.u16();
+    uint32_t samples_until_row = r.u32();
+    uint32_t row_remainder = r.u32();
+
+    // the module is used from its start, whole patterns past the header
+    // are counted from its size by Sequencer::load() and the row has to
+    // be within one
+    if (music_playing && (!module.valid(engine, states) || !engine.resources.is(module.id, Resource::Type::MUSIC) ||
+      module.offset != 0 || engine.resources.sizes[module.id] < Sequencer::HEADER_SIZE || row >= Sequencer::ROWS_PER_PATTERN)) {
+      return false;
+    }
+
+    // decode the pages into a scratch area so a truncated page can't
+    // corrupt the live ones
+    std::vector<uint8_t> pages(include_pages ? VRAM_SIZE * 4 : 0);
+    for (uint8_t i = 0; i < 4 && include_pages; i++) {
+      uint32_t encoded_size = r.u32();
+      const uint8_t* encoded = r.bytes(encoded_size);
+      if (!encoded || rle::decode(encoded, encoded_size, &pages[i * VRAM_SIZE], VRAM_SIZE) != encoded_size) {
+        return false;
+      }
+    }
+
+    if (!r.ok) {
+      return false;
+    }
+
+    // the snapshot is good, anything still waiting to be drawn (see
+    // VirtualMachine::set_fast_forward()) belongs to the state it replaces
+    for (auto& page : vm.deferred_pages) {
+      page.clear();
+    }
+
+    // bring the resources back first. anything that is already resident
+    // at the same place in the heap is left alone
+    for (uint16_t i = 0; i < engine.resources.size(); i++) {
+      const uint8_t* shared = states[i] == Resource::State::LOADED ? engine.shared_resource(i) : nullptr;
+      if (shared) {
+        engine.resources.data[i] = shared;
+      } else if (states[i] == Resource::State::LOADED && offsets[i] != NO_OFFSET) {
+        uint8_t* destination = engine.heap(offsets[i]);
+        if ((engine.resources.state(i) != Resource::State::LOADED || engine.resources.data[i] != destination) &&
+          !engine.load_resource(i, destination)) {
+          // the heap no longer holds what the vm was running with, so
+          // nothing in it is kept
+          for (uint16_t j = 0; j < engine.resources.size(); j++) {
+            engine.resources.set_state(j, Resource::State::NOT_NEEDED);
+          }
+          engine.resource_heap_offset = 0;
+          return false;
+        }
+      }
+      engine.resources.set_state(i, states[i]);
+    }
+    engine.resource_heap_offset = unplaced_top;
+
+    vm.ticks = ticks;
+    vm.chapter_id = chapter_id;
+    memcpy(vm.registers, registers, sizeof(registers));
+    vm.threads = threads;
+    vm.call_stack = call_stack;
+
+    vm.palette = chapter_resource_ids[0];
+    vm.code = chapter_resource_ids[1];
+    vm.background = chapter_resource_ids[2];
+    vm.characters = chapter_resource_ids[3];
+    vm.working_vram = engine.vram[working_page];
+    vm.visible_vram = engine.vram[visible_page];
+
+    memcpy(vm.current_palette, current_palette, sizeof(current_palette));
+    vm.current_palette_valid = current_palette_valid;
+    vm.palette_fade = palette_fade;
+
+    for (uint8_t i = 0; i < 4 && include_pages; i++) {
+      memcpy(engine.vram[i], &pages[i * VRAM_SIZE], VRAM_SIZE);
+    }
+
+    // audio, a position past the end of the sample as the resource
+    // describes it stops the channel
+    for (uint8_t i = 0; i < Mixer::CHANNEL_COUNT; i++) {
+      if (channels[i].active) {
+        uint16_t id = channel_samples[i].id;
+        channels[i].sample = Mixer::sound_sample(engine.resources.data[id], engine.resources.sizes[id]);
+        channels[i].active = (channels[i].position >> 16) < channels[i].sample.length;
+      }
+      vm.mixer.channels[i] = channels[i];
+    }
+
+    Sequencer& sequencer = vm.sequencer;
+    sequencer.playing = false;
+    if (music_playing) {
+      const uint8_t* sounds[Sequencer::INSTRUMENT_COUNT];
+      uint32_t sound_sizes[Sequencer::INSTRUMENT_COUNT];
+      for (uint8_t i = 0; i < Sequencer::INSTRUMENT_COUNT; i++) {
+        bool valid = instruments[i].valid(engine, states);
+        sounds[i] = valid ? instruments[i].resolve(engine) : nullptr;
+        sound_sizes[i] = valid ? instruments[i].size(engine) : 0;
+      }
+
+      sequencer.load(module.resolve(engine), module.size(engine), sounds, sound_sizes, period, order);
+      sequencer.row = row;
+      sequencer.playing = true;
+      sequencer.samples_until_row = samples_until_row;
+      sequencer.row_remainder = row_remainder;
+    }
+
+    // make sure the host is showing the restored palette
+    if (current_palette_valid) {
+      vm.apply_palette(current_palette);
+    }
+
+    return true;
+  }
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "virtual-machine.hpp"
+
+/*
+  save states
+
+  a snapshot captures everything needed to resume the game at a frame
+  boundary: the vm's registers, threads and call stack, its palette and
+  audio state, the four video pages and which resources are resident and
+  where they live in the resource heap.
+
+  resource contents are not stored, only references to them, they are
+  reloaded from the game data on restore if they aren't already resident
+  at the right place (or taken from the engine's ResourceStore if it has
+  one, snapshots move freely between engines with and without a store). together with run length encoding of the video
+  pages this keeps snapshots to a few tens of KB.
+*/
+
+namespace another_world {
+
+  constexpr uint16_t SNAPSHOT_VERSION = 2;
+
+  // serialise the current state of `vm` into `output` (replacing anything
+  // already in it). the video pages can be left out for callers that keep
+  // track of them some other way (see rewind.hpp), restoring such a
+  // snapshot leaves the pages as they are. when fast forwarding call
+  // vm.flush_pages() first so the pages are complete
+  void save_snapshot(const VirtualMachine& vm, std::vector<uint8_t>& output, bool include_pages = true);
+
+  // restore a snapshot made by save_snapshot(), returns false and leaves
+  // everything untouched if the snapshot is malformed, from a different
+  // version or framebuffer format, or was made against different data.
+  // it also returns false if a resource can't be read back from the game
+  // data, by then the heap has been written over so every resource is
+  // left NOT_NEEDED and the vm has to start a chapter again
+  bool restore_snapshot(VirtualMachine& vm, const uint8_t* data, uint32_t size);
+
+}
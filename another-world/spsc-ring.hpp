@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/*
+  lock-free single producer, single consumer ring buffer
+
+  one thread pushes and one (other) thread pops, neither ever blocks.
+  `capacity` must be a power of two so the free running head and tail
+  counters can be wrapped with a mask.
+*/
+
+namespace another_world {
+
+  template<typename T, uint32_t capacity>
+  struct SpscRing {
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    // number of items waiting to be popped
+    uint32_t size() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // producer side, returns the number of items actually pushed
+    uint32_t push(const T* items, uint32_t count) {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      uint32_t t = tail.load(std::memory_order_acquire);
+      count = smaller(count, capacity - (h - t));
+
+      copy_in(h, items, count);
+
+      head.store(h + count, std::memory_order_release);
+      return count;
+    }
+
+    // consumer side, returns the number of items actually popped
+    uint32_t pop(T* items, uint32_t count) {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      uint32_t h = head.load(std::memory_order_acquire);
+      count = smaller(count, h - t);
+
+      copy_out(t, items, count);
+
+      tail.store(t + count, std::memory_order_release);
+      return count;
+    }
+
+  private:
+    static constexpr uint32_t MASK = capacity - 1;
+
+    // (not std::min, windows.h may have defined a min macro by the time
+    // this header is included)
+    static uint32_t smaller(uint32_t a, uint32_t b) {
+      return a < b ? a : b;
+    }
+
+    // copies are split in two where they wrap around the end of the buffer
+    void copy_in(uint32_t position, const T* items, uint32_t count) {
+      uint32_t start = position & MASK;
+      uint32_t first = smaller(count, capacity - start);
+      memcpy(&buffer[start], items, first * sizeof(T));
+      memcpy(&buffer[0], items + first, (count - first) * sizeof(T));
+    }
+
+    void copy_out(uint32_t position, T* items, uint32_t count) const {
+      uint32_t start = position & MASK;
+      uint32_t first = smaller(count, capacity - start);
+      memcpy(items, &buffer[start], first * sizeof(T));
+      memcpy(items + first, &buffer[0], (count - first) * sizeof(T));
+    }
+
+    T buffer[capacity];
+
+    // kept on separate cache lines so the two threads don't fight over them
+    alignas(64) std::atomic<uint32_t> head{ 0 };
+    alignas(64) std::atomic<uint32_t> tail{ 0 };
+  };
+
+}
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "trace.hpp"
+
+namespace another_world {
+
+  // the innermost scope open on this thread, scopes nest so each one can
+  // take its children's time off its own
+  static thread_local TraceScope* current_scope = nullptr;
+
+  static uint32_t thread_index() {
+    static std::atomic<uint32_t> next{ 0 };
+    static thread_local uint32_t index = next++;
+    return index;
+  }
+
+  Trace::Trace() {
+    epoch = clock::now();
+    events.reset(new Event[CAPACITY]);
+    window.reset(new std::atomic<uint32_t>[PHASE_COUNT * WINDOW]);
+    clear();
+  }
+
+  const char* Trace::phase_name(Phase phase) {
+    static const char* names[PHASE_COUNT] = { "frame", "interpret", "rasterise", "page copy", "present", "display", "audio", "rewind" };
+    return phase < PHASE_COUNT ? names[phase] : "?";
+  }
+
+  void Trace::record(Phase phase, clock::time_point start, clock::time_point end, uint64_t self_ns) {
+    uint64_t duration = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+    // claim a slot and publish it seqlock style, a reader that sees the
+    // sequence change while it reads the slot throws the copy away
+    uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+    Event& event = events[index & (CAPACITY - 1)];
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.start_ns.store(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count()), std::memory_order_relaxed);
+    event.duration_ns.store(uint32_t(std::min<uint64_t>(duration, UINT32_MAX)), std::memory_order_relaxed);
+    event.phase_thread.store(uint32_t(phase) << 24 | (thread_index() & 0xffffff), std::memory_order_relaxed);
+    event.sequence.store(index + 1, std::memory_order_release);
+
+    frame_ns[phase].fetch_add(self_ns, std::memory_order_relaxed);
+    if (phase == FRAME) {
+      end_frame(duration);
+    }
+  }
+
+  void Trace::end_frame(uint64_t duration) {
+    uint32_t slot = uint32_t(frames.load(std::memory_order_relaxed) % WINDOW);
+    for (uint8_t phase = 0; phase < PHASE_COUNT; phase++) {
+      uint64_t ns = frame_ns[phase].exchange(0, std::memory_order_relaxed);
+      ns = phase == FRAME ? duration : ns;
+      window[phase * WINDOW + slot].store(uint32_t(std::min<uint64_t>(ns, UINT32_MAX)), std::memory_order_relaxed);
+    }
+    frames.fetch_add(1, std::memory_order_release);
+  }
+
+  void Trace::name_thread(const std::string& name) {
+    std::lock_guard<std::mutex> guard(names_lock);
+    thread_names[thread_index()] = name;
+  }
+
+  void Trace::clear() {
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+      events[i].sequence.store(0, std::memory_order_relaxed);
+    }
+    for (auto& ns : frame_ns) {
+      ns.store(0, std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < PHASE_COUNT * WINDOW; i++) {
+      window[i].store(0, std::memory_order_relaxed);
+    }
+    frames.store(0, std::memory_order_relaxed);
+    head.store(0, std::memory_order_release);
+  }
+
+  Trace::Stats Trace::stats(Phase phase) const {
+    Stats stats;
+    stats.frames = uint32_t(std::min<uint64_t>(frames.load(std::memory_order_acquire), WINDOW));
+    if (!stats.frames) {
+      return stats;
+    }
+
+    std::vector<uint32_t> ns(stats.frames);
+    double total = 0;
+    for (uint32_t i = 0; i < stats.frames; i++) {
+      ns[i] = window[phase * WINDOW + i].load(std::memory_order_relaxed);
+      total += ns[i];
+    }
+    std::sort(ns.begin(), ns.end());
+
+    auto percentile = [&ns](double p) {
+      return ns[std::min<size_t>(ns.size() - 1, size_t(p * ns.size()))] / 1000.0;
+    };
+
+    stats.mean_us = total / stats.frames / 1000.0;
+    stats.p50_us = percentile(0.50);
+    stats.p95_us = percentile(0.95);
+    stats.p99_us = percentile(0.99);
+    stats.max_us = ns.back() / 1000.0;
+    return stats;
+  }
+
+  std::string Trace::report() const {
+    std::string output;
+    char line[256];
+
+    Stats frame = stats(FRAME);
+    snprintf(line, sizeof(line), "%u frames\n  %-10s %10s %7s %10s %10s %10s %10s\n", frame.frames, "phase", "mean", "", "p50", "p95", "p99", "max");
+    output += line;
+
+    for (uint8_t phase = 0; phase < PHASE_COUNT; phase++) {
+      Stats s = stats(Phase(phase));
+      if (phase != FRAME && s.max_us == 0) {
+        continue;
+      }
+      snprintf(line, sizeof(line), "  %-10s %8.1fus %6.1f%% %8.1fus %8.1fus %8.1fus %8.1fus\n", phase_name(Phase(phase)),
+        s.mean_us, frame.mean_us > 0 ? s.mean_us * 100.0 / frame.mean_us : 0.0, s.p50_us, s.p95_us, s.p99_us, s.max_us);
+      output += line;
+    }
+
+    return output;
+  }
+
+  std::string Trace::chrome_json() const {
+    std::string output = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    char line[256];
+    bool first = true;
+
+    {
+      std::lock_guard<std::mutex> guard(names_lock);
+      for (auto& name : thread_names) {
+        snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+          first ? "" : ",\n", name.first, name.second.c_str());
+        output += line;
+        first = false;
+      }
+    }
+
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+    for (uint64_t index = begin; index < end; index++) {
+      const Event& event = events[index & (CAPACITY - 1)];
+      if (event.sequence.load(std::memory_order_acquire) != index + 1) {
+        continue;
+      }
+
+      uint64_t start_ns = event.start_ns.load(std::memory_order_relaxed);
+      uint32_t duration_ns = event.duration_ns.load(std::memory_order_relaxed);
+      uint32_t phase_thread = event.phase_thread.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (event.sequence.load(std::memory_order_relaxed) != index + 1) {
+        continue;
+      }
+
+      snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"aw\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+        first ? "" : ",\n", phase_name(Phase(phase_thread >> 24)), start_ns / 1000.0, duration_ns / 1000.0, phase_thread & 0xffffff);
+      output += line;
+      first = false;
+    }
+
+    output += "\n]}\n";
+    return output;
+  }
+
+  TraceScope::TraceScope(Trace* trace, Trace::Phase phase) : trace(trace), phase(phase), parent(nullptr) {
+    if (trace) {
+      parent = current_scope;
+      current_scope = this;
+      start = Trace::clock::now();
+    }
+  }
+
+  TraceScope::~TraceScope() {
+    if (!trace) {
+      return;
+    }
+
+    Trace::clock::time_point end = Trace::clock::now();
+    uint64_t ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+    current_scope = parent;
+    if (parent) {
+      parent->children_ns += ns;
+    }
+
+    trace->record(phase, start, end, ns - std::min(children_ns, ns));
+  }
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+  frame phase tracing
+
+  scoped timers in the vm and the host mark out where a frame's time goes:
+  interpreting bytecode, rasterising, clearing and copying pages, handing
+  frames to the host, mixing audio and so on. they're only built when
+  AW_TRACE is defined, otherwise AW_TRACE_SCOPE() expands to nothing and
+  the disabled build is exactly the same code as before.
+
+  with AW_TRACE defined a trace is attached by pointing Engine::trace at
+  one. each scope that ends writes an event into a fixed size ring that
+  any number of threads can write to at once without locking (a slot is
+  claimed with a single atomic increment and published with a sequence
+  number), the oldest events are overwritten once it's full.
+
+  scopes nest, a scope's time less that of the scopes inside it (its self
+  time) is added to a running total for the current frame. when a FRAME
+  scope ends those totals are kept for the last WINDOW frames, which is
+  what the p50/p95/p99 figures are taken from. the FRAME figures are the
+  whole frame, every other phase is the time spent in that phase itself.
+  frames should only be ended from one thread (the one running the vm),
+  other threads' phases are counted towards whichever frame is open.
+
+  chrome_json() exports the events in the ring in the trace event format
+  read by chrome://tracing, Perfetto and speedscope.
+*/
+
+namespace another_world {
+
+  struct Trace {
+    using clock = std::chrono::steady_clock;
+
+    enum Phase : uint8_t { FRAME, INTERPRET, RASTERISE, PAGE_COPY, PRESENT, DISPLAY, AUDIO, REWIND, PHASE_COUNT };
+
+    static constexpr uint32_t CAPACITY = 1 << 16;   // events, must be a power of two
+    static constexpr uint32_t WINDOW = 512;         // frames the percentiles are taken over
+
+    struct Stats {
+      uint32_t frames = 0;      // frames in the window
+      double mean_us = 0;       // per frame
+      double p50_us = 0;
+      double p95_us = 0;
+      double p99_us = 0;
+      double max_us = 0;
+    };
+
+    Trace();
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    static const char* phase_name(Phase phase);
+
+    // called as each scope ends, safe from any thread
+    void record(Phase phase, clock::time_point start, clock::time_point end, uint64_t self_ns);
+
+    // name the calling thread in the exported trace (takes a lock, call it
+    // once when the thread starts rather than per event)
+    void name_thread(const std::string& name);
+
+    // forget every event and frame recorded so far
+    void clear();
+
+    // per frame figures for `phase` over the last WINDOW frames
+    Stats stats(Phase phase) const;
+
+    // time per phase for the frames in the window
+    std::string report() const;
+
+    // the events currently in the ring in the chrome trace event format
+    std::string chrome_json() const;
+
+  private:
+    struct Event {
+      std::atomic<uint64_t> sequence{ 0 };    // index + 1 once written, zero while being written
+      std::atomic<uint64_t> start_ns{ 0 };    // since the trace was created
+      std::atomic<uint32_t> duration_ns{ 0 };
+      std::atomic<uint32_t> phase_thread{ 0 };  // phase << 24 | thread
+    };
+
+    clock::time_point epoch;
+
+    std::unique_ptr<Event[]> events;
+    std::atomic<uint64_t> head{ 0 };
+
+    // self time per phase for the frame in progress and for the last
+    // WINDOW frames (only written when a FRAME scope ends)
+    std::atomic<uint64_t> frame_ns[PHASE_COUNT];
+    std::unique_ptr<std::atomic<uint32_t>[]> window;    // WINDOW entries per phase
+    std::atomic<uint64_t> frames{ 0 };
+
+    mutable std::mutex names_lock;
+    std::map<uint32_t, std::string> thread_names;
+
+    void end_frame(uint64_t frame_ns);
+  };
+
+  // times the scope it's declared in, see AW_TRACE_SCOPE()
+  struct TraceScope {
+    Trace* trace;
+    Trace::Phase phase;
+    Trace::clock::time_point start;
+    TraceScope* parent;
+    uint64_t children_ns = 0;
+
+    TraceScope(Trace* trace, Trace::Phase phase);
+    ~TraceScope();
+  };
+
+}
+
+#ifdef AW_TRACE
+#define AW_TRACE_CONCAT_(a, b) a##b
+#define AW_TRACE_CONCAT(a, b) AW_TRACE_CONCAT_(a, b)
+#define AW_TRACE_SCOPE(trace, phase) ::another_world::TraceScope AW_TRACE_CONCAT(trace_scope_, __LINE__)(trace, ::another_world::Trace::phase)
+#else
+#define AW_TRACE_SCOPE(trace, phase)
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+  lock-free triple buffer for passing frames from one producer thread to
+  one consumer thread
+
+  the writer always has a buffer of its own to fill and the reader always
+  has a buffer of its own to read, the third buffer sits in the middle.
+  publishing swaps the writer's buffer with the middle one and acquiring
+  swaps the reader's buffer with the middle one, so neither side ever
+  blocks or sees a half written frame and the reader always gets the
+  newest complete frame.
+
+  frames that are replaced before the reader collects them are counted as
+  dropped, acquires that find nothing new are counted as repeated.
+*/
+
+namespace another_world {
+
+  template<typename T>
+  struct TripleBuffer {
+    T buffers[3];
+
+    // writer side
+
+    T& write_buffer() {
+      return buffers[back];
+    }
+
+    void publish() {
+      uint8_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+      if (previous & FRESH) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+      back = previous & INDEX;
+    }
+
+    // reader side
+
+    // returns true if a new frame has been published since the last call,
+    // either way read_buffer() then holds the newest complete frame
+    bool acquire() {
+      if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+        repeated++;
+        return false;
+      }
+
+      uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);
+      front = previous & INDEX;
+      return true;
+    }
+
+    const T& read_buffer() const {
+      return buffers[front];
+    }
+
+    uint32_t dropped_frames() const {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+    uint32_t repeated_frames() const {
+      return repeated;
+    }
+
+  private:
+    static constexpr uint8_t INDEX = 0b011;
+    static constexpr uint8_t FRESH = 0b100;   // middle buffer hasn't been read yet
+
+    uint8_t back = 0;                         // owned by the writer
+    uint8_t front = 2;                        // owned by the reader
+    std::atomic<uint8_t> middle{ 1 };
+
+    std::atomic<uint32_t> dropped{ 0 };
+    uint32_t repeated = 0;
+  };
+
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "verifier.hpp"
+#include "virtual-machine.hpp"
+
+namespace another_world {
+
+  static_assert(REGISTER_COUNT == 256, "register operands are only in range because a byte can't index past the registers");
+
+  VerifiedCode verify_code(const uint8_t* code, uint32_t size) {
+    using Flow = Instruction::Flow;
+
+    VerifiedCode result;
+    result.data = code;
+    result.size = size;
+
+    CodeAnalysis analysis = analyse_code(code, size);
+
+    // everything the analysis found that the interpreter can't cope with
+    for (auto& problem : analysis.problems) {
+      if (!problem.warning) {
+        result.problems.push_back(problem);
+      }
+    }
+
+    // the call depths each instruction can be reached at, one bit per
+    // depth from zero to MAX_CALL_DEPTH
+    static_assert(VerifiedCode::MAX_CALL_DEPTH < 64, "call depths are tracked in a 64-bit mask");
+    std::vector<uint64_t> depths(size, 0);
+    std::vector<std::pair<uint16_t, uint32_t>> pending;
+
+    result.starts.assign(size, false);
+    auto start = [&](uint16_t address) {
+      if (address < size) {
+        result.starts[address] = true;
+        pending.push_back({ address, 0 });
+      }
+    };
+    for (auto& entry : analysis.entries) {
+      start(entry.first);
+    }
+
+    char message[128];
+    while (!pending.empty()) {
+      uint16_t address = pending.back().first;
+      uint32_t depth = pending.back().second;
+      pending.pop_back();
+
+      const Instruction* instruction = analysis.instruction(address);
+      if (!instruction || (depths[address] & (1ull << depth))) {
+        continue;
+      }
+      depths[address] |= 1ull << depth;
+      result.max_call_depth = std::max(result.max_call_depth, depth);
+
+      auto reach = [&](uint32_t to, uint32_t to_depth) {
+        if (to < size) {
+          pending.push_back({ uint16_t(to), to_depth });
+        }
+      };
+
+      switch (instruction->flow) {
+        case Flow::NEXT:
+          reach(instruction->next(), depth);
+          break;
+
+        case Flow::JUMP:
+          reach(instruction->target, depth);
+          break;
+
+        case Flow::BRANCH:
+          reach(instruction->target, depth);
+          reach(instruction->next(), depth);
+          break;
+
+        case Flow::CALL:
+          if (depth + 1 > VerifiedCode::MAX_CALL_DEPTH) {
+            snprintf(message, sizeof(message), "calls can nest more than %u deep", VerifiedCode::MAX_CALL_DEPTH);
+            result.problems.push_back({ address, message, false });
+          } else {
+            reach(instruction->target, depth + 1);
+          }
+          // assume the call returns, this is only ever more cautious
+          reach(instruction->next(), depth);
+          break;
+
+        case Flow::RETURN:
+          if (depth == 0) {
+            result.problems.push_back({ address, "ret can run with an empty call stack", false });
+          }
+          break;
+
+        case Flow::YIELD:
+          // the call stack is emptied before the thread carries on next frame
+          start(instruction->next());
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    result.verified = result.problems.empty();
+    return result;
+  }
+
+}
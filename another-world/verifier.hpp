@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "disassembler.hpp"
+
+/*
+  load time verification of bytecode
+
+  the interpreter trusts the code it runs: an svec of a thread that
+  doesn't exist, a ret with nothing on the call stack or a jump past the
+  end of the resource all read or write outside of the vm's state.
+  checking for those as each instruction runs would slow down every
+  instruction of every frame, so instead verify_code() proves ahead of
+  time that they can't happen, and the vm only runs the checks on code
+  that couldn't be verified.
+
+  starting from every thread entry point found by analyse_code() it
+  follows every path through the code tracking how deep in calls each
+  instruction can be reached, and verifies that:
+
+    - every reachable instruction lies within the resource, as does
+      every jump, branch, call and svec target
+    - svec and the thread lock/unlock/kill opcode only name threads that
+      exist
+    - no ret can run with an empty call stack and calls nest no more than
+      MAX_CALL_DEPTH deep
+
+  register operands are a byte and there are 256 registers so they're
+  always in range.
+
+  the call stack is emptied at the start of every frame, so the proof
+  only holds for a thread starting a frame at an entry point or just
+  after a brk, can_start() tells whether a thread can run unchecked from
+  where it is.
+*/
+
+namespace another_world {
+
+  struct VerifiedCode {
+    static constexpr uint32_t MAX_CALL_DEPTH = 32;
+
+    const uint8_t* data = nullptr;              // the code this is for
+    uint32_t size = 0;
+
+    bool verified = false;
+    uint32_t max_call_depth = 0;                // deepest call nesting reached
+    std::vector<CodeAnalysis::Problem> problems;  // why it couldn't be verified
+
+    // true if a thread starting a frame at `pc` can run unchecked
+    bool can_start(uint16_t pc) const {
+      return verified && pc < starts.size() && starts[pc];
+    }
+
+  private:
+    friend VerifiedCode verify_code(const uint8_t* code, uint32_t size);
+
+    std::vector<bool> starts;                   // entry points and the instructions after a brk
+  };
+
+  VerifiedCode verify_code(const uint8_t* code, uint32_t size);
+
+}
@@ -33,30 +33,8 @@ namespace another_world {
     return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
   }
 
-  bool (*read_file)(std::string filename, uint32_t offset, uint32_t length, char* buffer) = nullptr;
-  bool (*write_file)(std::string filename, uint32_t length, char* buffer);
-  void (*debug)(const char *fmt, ...) = nullptr;
-  void (*debug_display_update)() = nullptr;
-  void (*update_screen)(uint8_t* buffer) = nullptr;
-  void (*set_palette)(uint16_t* palette) = nullptr;
-
-
-  uint8_t vram0[320 * 200 / 2];
-  uint8_t vram1[320 * 200 / 2];
-  uint8_t vram2[320 * 200 / 2];
-  uint8_t vram3[320 * 200 / 2];
-
-  Input input;
-
-  uint8_t* vram[4] = {
-    vram0,  // background 1 (also used for clone drawing operations)
-    vram1,  // framebuffer 1
-    vram2,  // framebuffer 2
-    vram3   // background 2
-  };
-
   void VirtualMachine::init() {
-    init_resources();
+    engine.init_resources();
 
     memset(registers, 0, REGISTER_COUNT * sizeof(int16_t));
 
@@ -75,10 +53,18 @@ namespace another_world {
   }
 
   void VirtualMachine::initialise_chapter(uint16_t id) {
-    // reset the heap and resource states
-    for(auto resource : resources) {
-      resource->state = Resource::State::NOT_NEEDED;
+    // reset the heap and resource states, only the resources that aren't
+    // already NOT_NEEDED are visited
+    for (auto state : { Resource::State::LOADED, Resource::State::NEEDS_LOADING }) {
+      while (!engine.resources.with_state(state).empty()) {
+        engine.resources.set_state(engine.resources.with_state(state).back(), Resource::State::NOT_NEEDED);
+      }
     }
+    engine.resource_heap_offset = 0;
+
+    // any sounds still playing belong to the old chapter's data
+    sequencer.stop();
+    mixer.stop_all();
 
     // according to Eric Chahi's original notes the chapters are:
     //
@@ -97,21 +83,25 @@ namespace another_world {
 
     registers[0xE4] = 0x14; // TODO: erm?
 
-    palette = resources[chapter_resources[chapter_id].palette];
-    code = resources[chapter_resources[chapter_id].code];
-    background = resources[chapter_resources[chapter_id].background];
+    palette = chapter_resources[chapter_id].palette;
+    code = chapter_resources[chapter_id].code;
+    background = chapter_resources[chapter_id].background;
 
     // load the chapter resources
-    palette->state = Resource::State::NEEDS_LOADING;
-    code->state = Resource::State::NEEDS_LOADING;
-    background->state = Resource::State::NEEDS_LOADING;
+    engine.resources.set_state(palette, Resource::State::NEEDS_LOADING);
+    engine.resources.set_state(code, Resource::State::NEEDS_LOADING);
+    engine.resources.set_state(background, Resource::State::NEEDS_LOADING);
 
+    // the last chapter's characters are gone along with everything else
+    characters = NO_RESOURCE;
     if(chapter_resources[chapter_id].characters) {
-      characters = resources[chapter_resources[chapter_id].characters];
-      characters->state = Resource::State::NEEDS_LOADING;
+      characters = chapter_resources[chapter_id].characters;
+      engine.resources.set_state(characters, Resource::State::NEEDS_LOADING);
     }
 
-    load_needed_resources();
+    // IMAGE resources are loaded straight into page 0
+    flush_mask_readers();
+    engine.load_needed_resources();
 
     // set all thread program counters to 0xffff (inactive)
     for (auto thread : threads) {
@@ -123,13 +113,13 @@ namespace another_world {
     threads[0].pc = 0;
   }
 
-  uint8_t VirtualMachine::fetch_byte(uint8_t *b, uint32_t *c) {
+  uint8_t VirtualMachine::fetch_byte(const uint8_t *b, uint32_t *c) {
     uint8_t v = b[*c];
     (*c)++;
     return v;
   }
 
-  uint16_t VirtualMachine::fetch_word(uint8_t *b, uint32_t *c) {
+  uint16_t VirtualMachine::fetch_word(const uint8_t *b, uint32_t *c) {
     uint16_t v = read_uint16_bigendian(&b[*c]);
     (*c)++;
     (*c)++;
@@ -137,50 +127,61 @@ namespace another_world {
   }
 
   uint8_t VirtualMachine::fetch_byte(uint16_t *pc) {
-    uint8_t v = code->data[*pc];
+    uint8_t v = engine.resources.data[code][*pc];
     (*pc)++;
     return v;
   }
 
   uint16_t VirtualMachine::fetch_word(uint16_t *pc) {
-    uint16_t v = read_uint16_bigendian(&code->data[*pc]);
+    uint16_t v = read_uint16_bigendian(&engine.resources.data[code][*pc]);
     (*pc)++;
     (*pc)++;
     return v;
   }
 
   void VirtualMachine::point(uint8_t* target, uint8_t color, Point* p) {
-    uint32_t offset = (p->y * 160) + (p->x / 2);
-    uint8_t* pd = target + offset;
-    uint8_t mask = p->x & 0b1 ? 0x0f : 0xf0;
-
     if (p->x < 0 || p->x >= 320 || p->y < 0 || p->y >= 200) {
       return;
     }
 
-    if (color == 0x10) {
-      // special blend mode, set the high bit of the colour to offset the drawn color
-      // palette index by 8. This is used to overlay colours (like the headlights of
-      // the car during the intro animation) and requires the palettes to be carefully
-      // setup to achieve the effect.
-      (*pd) |= 0x88 & mask;  // set the high bit in the masked nibble
-    } else if (color > 0x10) {
-      // this mode only draws the pixel if the equivalent pixel in the background
-      // has the high bit set, effectively allowing the masking of shapes
-      (*pd) &= (~mask); // clear the nibble in the target
-      uint8_t* ps = get_vram_from_id(0) + offset; // get same offset in copy from buffer
-      (*pd) |= (*ps) & mask; // copy the nibble from visible vram
-    } else {
-      // draw in the colour requested
-      uint8_t c = color & 0x0f;
-      c = c | (c << 4);
-      (*pd) &= (~mask);  // clear the nibble in the target
-      (*pd) |= c & mask; // mask in the new colour
+    // color 0x10 is a special blend mode, it sets the high bit of the colour
+    // to offset the drawn color palette index by 8. This is used to overlay
+    // colours (like the headlights of the car during the intro animation) and
+    // requires the palettes to be carefully setup to achieve the effect.
+    //
+    // colours above 0x10 only draw the pixel if the equivalent pixel in the
+    // background has the high bit set, effectively allowing the masking of
+    // shapes (the pixel is copied from page 0)
+    Framebuffer::plot(target, p->x, p->y, color, get_vram_from_id(0));
+#ifdef AW_PROFILER
+    if (profiler) {
+      profiler->pixels++;
     }
+#endif
   }
 
   void VirtualMachine::polygon(uint8_t *target, uint8_t color, Point *points, uint8_t point_count) {
-    static int32_t nodes[256]; // maximum allowed number of nodes per scanline for polygon rendering
+    int32_t nodes[256]; // maximum allowed number of nodes per scanline for polygon rendering
+
+    if (fast_forward) {
+      DeferredPage* deferred = deferred_page(target);
+      if (deferred) {
+        if (point_count) {
+          deferred->draws.push_back({ color, point_count, uint32_t(deferred->points.size()), { 0, 0 }, nullptr });
+          deferred->points.insert(deferred->points.end(), points, points + point_count);
+          deferred->reads_mask |= color > COLOR_BLEND;
+          if (deferred->draws.size() >= DeferredPage::MAX_DRAWS) {
+            flush_page(target);
+          }
+        }
+        return;
+      }
+
+      // drawing into page 0 changes what any deferred masked draws would copy
+      flush_mask_readers();
+    }
+
+    AW_TRACE_SCOPE(engine.trace, RASTERISE);
 
     Rect clip = { 0, 0, 320, 200 };
     int16_t miny = points[0].y, maxy = points[0].y;
@@ -193,7 +194,9 @@ namespace another_world {
     // for each scanline within the polygon bounds (clipped to clip rect)
     Point p;
 
-    for (p.y = std::max(clip.y, miny); p.y <= std::min(int16_t(clip.y + clip.h), maxy); p.y++) {
+    const uint8_t* mask_page = get_vram_from_id(0);
+
+    for (p.y = std::max(clip.y, miny); p.y <= std::min(int16_t(clip.y + clip.h - 1), maxy); p.y++) {
       uint8_t n = 0;
       for (uint16_t i = 0; i < point_count; i++) {
         uint16_t j = (i + 1) % point_count;
@@ -220,19 +223,24 @@ namespace another_world {
         }
       }
 
-      for (uint16_t i = 0; i < n; i += 2) {
-        for (p.x = nodes[i]; p.x <= nodes[i + 1]; p.x++) {
-          point(target, color, &p);
+      // nodes are already clipped so each pair can be filled as a
+      // single span rather than pixel by pixel
+      for (uint16_t i = 0; i + 1 < n; i += 2) {
+        Framebuffer::span(target, nodes[i], nodes[i + 1], p.y, color, mask_page);
+#ifdef AW_PROFILER
+        if (profiler) {
+          profiler->pixels += nodes[i + 1] - nodes[i] + 1;
         }
+#endif
       }
     }
 
-    if (debug_display_update) {
-      debug_display_update();
+    if (engine.debug_display_update) {
+      engine.debug_display_update(engine.user);
     }
   }
 
-  void VirtualMachine::draw_shape(uint8_t color, Point pos, int16_t zoom, uint8_t *buffer, uint32_t *offset) {
+  void VirtualMachine::draw_shape(uint8_t color, Point pos, int16_t zoom, const uint8_t *buffer, uint32_t *offset) {
     uint8_t shape_header = fetch_byte(buffer, offset);
 
     // the top two bits of the shape header determine what to draw
@@ -268,8 +276,8 @@ namespace another_world {
 
   }
 
-  void VirtualMachine::draw_polygon(uint8_t color, Point pos, int16_t zoom, uint8_t *buffer, uint32_t *offset) {
-    static Point points[256];
+  void VirtualMachine::draw_polygon(uint8_t color, Point pos, int16_t zoom, const uint8_t *buffer, uint32_t *offset) {
+    Point points[256];
 
     // polygons are drawn offset by the centre of their bounding box
     Rect bounds;
@@ -294,7 +302,7 @@ namespace another_world {
     polygon(working_vram, color, points, point_count);
   }
 
-  void VirtualMachine::draw_shape_group(uint8_t color, Point pos, int16_t zoom, uint8_t* buffer, uint32_t *offset) {
+  void VirtualMachine::draw_shape_group(uint8_t color, Point pos, int16_t zoom, const uint8_t* buffer, uint32_t *offset) {
     pos.x -= fetch_byte(buffer, offset) * zoom / 64;
     pos.y -= fetch_byte(buffer, offset) * zoom / 64;
 
@@ -326,7 +334,23 @@ namespace another_world {
     }
   }
 
-  void VirtualMachine::draw_text(uint8_t color, Point pos, std::string text) {
+  void VirtualMachine::draw_text(uint8_t color, Point pos, const std::string& text) {
+    if (fast_forward) {
+      DeferredPage* deferred = deferred_page(working_vram);
+      if (deferred) {
+        deferred->draws.push_back({ color, 0, 0, pos, &text });
+        deferred->reads_mask |= color > COLOR_BLEND;
+        if (deferred->draws.size() >= DeferredPage::MAX_DRAWS) {
+          flush_page(working_vram);
+        }
+        return;
+      }
+
+      flush_mask_readers();
+    }
+
+    AW_TRACE_SCOPE(engine.trace, RASTERISE);
+
     Point p = pos;
 
     for (auto c : text) {
@@ -375,7 +399,7 @@ namespace another_world {
     }*/
 
     if (id >= 0 && id <= 3) {
-      return vram[id];
+      return engine.vram[id];
     }
 
     if (id == 254) {
@@ -386,12 +410,189 @@ namespace another_world {
 
     if (id == 255) {
       // invisible screen "ecran invisible"
-      return visible_vram == vram[1] ? vram[2] : vram[1];
+      return visible_vram == engine.vram[1] ? engine.vram[2] : engine.vram[1];
     }
 
     return nullptr;
   }
 
+  void VirtualMachine::change_palette(uint8_t id, uint8_t speed) {
+    // the first 32 palettes are for the Amiga/VGA version, the
+    // following 32 palettes are for the MSDOS version
+    uint16_t offset = id * 32;
+
+    uint16_t colors[16];
+    for (uint8_t i = 0; i < 16; i++) {
+      colors[i] = read_uint16_bigendian(&engine.resources.data[palette][offset + i * 2]);
+    }
+
+    if (speed == 0 || !current_palette_valid) {
+      palette_fade.steps = 0;
+      apply_palette(colors);
+      return;
+    }
+
+    // fade from whatever is on screen right now, which may itself be
+    // part way through an earlier fade
+    memcpy(palette_fade.from, current_palette, sizeof(current_palette));
+    memcpy(palette_fade.to, colors, sizeof(colors));
+    palette_fade.step = 0;
+    palette_fade.steps = speed;
+  }
+
+  void VirtualMachine::step_palette_fade() {
+    if (palette_fade.steps == 0) {
+      return;
+    }
+
+    palette_fade.step++;
+
+    // interpolate each 4-bit channel towards the target palette
+    uint16_t colors[16];
+    for (uint8_t i = 0; i < 16; i++) {
+      uint16_t color = 0;
+      for (uint8_t shift = 0; shift < 12; shift += 4) {
+        uint16_t from = (palette_fade.from[i] >> shift) & 0x0f;
+        uint16_t to = (palette_fade.to[i] >> shift) & 0x0f;
+        uint16_t remaining = palette_fade.steps - palette_fade.step;
+        uint16_t c = (from * remaining + to * palette_fade.step + palette_fade.steps / 2) / palette_fade.steps;
+        color |= c << shift;
+      }
+      colors[i] = color;
+    }
+
+    if (palette_fade.step == palette_fade.steps) {
+      palette_fade.steps = 0;
+    }
+
+    // with only sixteen levels per channel a slow fade will produce the
+    // same palette for several frames in a row, only pass on changes
+    if (memcmp(colors, current_palette, sizeof(colors)) != 0) {
+      apply_palette(colors);
+    }
+  }
+
+  void VirtualMachine::apply_palette(const uint16_t* colors) {
+    memcpy(current_palette, colors, sizeof(current_palette));
+    current_palette_valid = true;
+
+    // when fast forwarding the host only hears about the palette along
+    // with the next frame it's given
+    if (fast_forward) {
+      palette_pending = true;
+      return;
+    }
+
+    send_palette();
+  }
+
+  void VirtualMachine::send_palette() {
+    // set_palette() expects the palette resource format (big endian)
+    uint16_t data[16];
+    uint8_t* p = (uint8_t*)data;
+    for (uint8_t i = 0; i < 16; i++) {
+      *p++ = current_palette[i] >> 8;
+      *p++ = current_palette[i] & 0xff;
+    }
+
+    palette_pending = false;
+    engine.set_palette(engine.user, data);
+  }
+
+  void VirtualMachine::set_fast_forward(bool enabled, uint32_t interval) {
+    present_interval = interval ? interval : 1;
+
+    if (enabled == fast_forward) {
+      return;
+    }
+
+    frames_since_present = 0;
+    if (enabled) {
+      fast_forward = true;
+      return;
+    }
+
+    // bring the pages and the host back up to date
+    flush_pages();
+    fast_forward = false;
+    present();
+  }
+
+  DeferredPage* VirtualMachine::deferred_page(uint8_t* page) {
+    // page 0 is never deferred since masked draws into the other pages
+    // copy from it
+    for (uint8_t i = 1; i < 4; i++) {
+      if (engine.vram[i] == page) {
+        return &deferred_pages[i];
+      }
+    }
+    return nullptr;
+  }
+
+  void VirtualMachine::flush_page(uint8_t* page) {
+    DeferredPage* deferred = deferred_page(page);
+    if (!deferred || deferred->draws.empty()) {
+      return;
+    }
+
+    // replay the draws in the order they were made
+    bool enabled = fast_forward;
+    uint8_t* working = working_vram;
+    fast_forward = false;
+    working_vram = page;
+
+    for (auto& draw : deferred->draws) {
+      if (draw.text) {
+        draw_text(draw.color, draw.pos, *draw.text);
+      } else {
+        polygon(page, draw.color, &deferred->points[draw.first_point], draw.point_count);
+      }
+    }
+
+    fast_forward = enabled;
+    working_vram = working;
+    deferred->clear();
+  }
+
+  void VirtualMachine::flush_pages() {
+    for (uint8_t i = 1; i < 4; i++) {
+      flush_page(engine.vram[i]);
+    }
+  }
+
+  void VirtualMachine::flush_mask_readers() {
+    for (uint8_t i = 1; i < 4; i++) {
+      if (deferred_pages[i].reads_mask) {
+        flush_page(engine.vram[i]);
+      }
+    }
+  }
+
+  void VirtualMachine::discard_page(uint8_t* page) {
+    // the page is about to be completely overwritten so anything waiting
+    // to be drawn into it never needs to be
+    DeferredPage* deferred = deferred_page(page);
+    if (deferred) {
+      skipped_draws += uint32_t(deferred->draws.size());
+      deferred->clear();
+    } else if (fast_forward) {
+      flush_mask_readers();
+    }
+  }
+
+  void VirtualMachine::present() {
+    AW_TRACE_SCOPE(engine.trace, PRESENT);
+
+    flush_page(visible_vram);
+
+    if (palette_pending) {
+      send_palette();
+    }
+
+    frames_since_present = 0;
+    engine.update_screen(engine.user, visible_vram);
+  }
+
   void VirtualMachine::process_input() {
     uint8_t input_mask = 0;
 
@@ -400,31 +601,31 @@ namespace another_world {
     registers[0xFC] = 0;
     registers[0xFA] = 0;
 
-    if (input.up && !input.down) {
+    if (engine.input.up && !engine.input.down) {
       input_mask |= 0b00001000;
       // TODO: why both?
       registers[0xE5] = -1;
       registers[0xFB] = -1;
     }
 
-    if (input.down && !input.up) {
+    if (engine.input.down && !engine.input.up) {
       input_mask |= 0b00000100;
       // TODO: why both?
       registers[0xE5] = 1;
       registers[0xFB] = 1;
     }
 
-    if (input.left && !input.right) {
+    if (engine.input.left && !engine.input.right) {
       input_mask |= 0b00000010;
       registers[0xFC] = -1;
     }
 
-    if (input.right && !input.left) {
+    if (engine.input.right && !engine.input.left) {
       input_mask |= 0b00000001;
       registers[0xFC] = 1;
     }
 
-    if (input.action) {
+    if (engine.input.action) {
       input_mask |= 0b10000000;
       registers[0xFA] = 1;
     }
@@ -435,8 +636,10 @@ namespace another_world {
   }
 
   void VirtualMachine::execute_threads() {
-    if (debug) {
-      debug("--- execute threads ---");
+    AW_TRACE_SCOPE(engine.trace, INTERPRET);
+
+    if (engine.debug) {
+      engine.debug(engine.user, "--- execute threads ---");
     }
 
     // TODO: switch part if needed (can't this be done in the op code processing?)
@@ -454,8 +657,18 @@ namespace another_world {
     // ensure the call stack is empty before starting
     call_stack.clear();
 
+    step_palette_fade();
+
     process_input();
 
+    frames_since_present++;
+
+#ifdef AW_PROFILER
+    if (profiler) {
+      profiler->frame(*this);
+    }
+#endif
+
     // during thread execution the svec opcode allows a thread
     // to be given a new program counter for the next cycle of
     // execution, we store those here and update the program
@@ -480,630 +693,756 @@ namespace another_world {
         continue;
       }
 
-      uint16_t* pc = &thread.pc;
-
-      bool next_thread = false;
-      while(!next_thread) {
-        uint8_t opcode = fetch_byte(pc);
-
-        std::string opcode_name = "----";
-        if (opcode <= 0x1a) {
-          opcode_name = opcode_names[opcode];
-        } else if (opcode < 0x40) {
-          // invalid
-        } else if (opcode < 0x80) {
-          opcode_name = "plyl";
+      // verified code runs without any checks, anything else (including
+      // a thread that doesn't start the frame where the verifier expects)
+      // takes the checked path. a thread that switches chapter carries on
+      // under whatever the new chapter's code needs
+      bool chapter_changed = true;
+      while (chapter_changed) {
+        update_verified_code();
+        if (verified_code.can_start(thread.pc)) {
+          chapter_changed = run_thread<false>(uint8_t(thread_id), requested_thread_state);
         } else {
-          opcode_name = "plys";
+          checked_thread_runs++;
+          chapter_changed = run_thread<true>(uint8_t(thread_id), requested_thread_state);
         }
+      }
+    }
+
+    // set thread program counters and pause states if new values
+    // have been requested
+    for (auto const& p : requested_thread_state) {
+      threads[p.first] = p.second;
+    }
 
-        if(debug) {
-          debug("%6i)  %2i [%05u] > %02x:%-6s", ticks, thread_id, *(pc)-1, opcode, opcode_name.c_str());
+    // mix the audio that plays while this frame is on screen, the pause
+    // register holds how many 20ms ticks that is
+    int16_t pause = registers[0xff];
+    if (pause > 0) {
+      AW_TRACE_SCOPE(engine.trace, AUDIO);
+      mixer.produce(mixer.sample_rate * uint32_t(pause) / 50);
+    }
+
+    /*
+    for (uint8_t i = 0; i < THREAD_COUNT; i++) {
+      if (new_program_counter[i] == 0xfffe) {
+        program_counter[i] = THREAD_INACTIVE;
+        new_program_counter[i] = THREAD_INACTIVE;
+      } else {
+        if (new_program_counter[i] != NO_UPDATE) {
+          program_counter[i] = new_program_counter[i];
         }
+      }
 
-        // opcodes come in three different flavours depending on the status
-        // of the two highest bits
-        //
-        // 00xxxxxx = standard opcode instruction number in bits 0-5
-        // 01xxxxxx = polygon opcode long format (translated from Eric Chahi's "different format de donnees pour spr.l")
-        // 1xxxxxxx = polygon opcode short format (high part of address in bits 0-6)
+      if (new_paused_threads[i] == THREAD_LOCK) {
+        paused_thread[i] = true;
+      }
 
-        if (ticks == 48) {
-            uint8_t a = 0;
+      if (new_paused_threads[i] == THREAD_UNLOCK) {
+        paused_thread[i] = false;
+      }
+    }*/
+  }
+
+  // runs a thread until it yields, returns true if it loaded a new chapter
+  // part way through. with CHECKED every instruction is checked before it
+  // runs, otherwise the code must have been verified (see verifier.hpp)
+  template<bool CHECKED>
+  bool VirtualMachine::run_thread(uint8_t thread_id, std::map<uint8_t, Thread>& requested_thread_state) {
+    uint16_t* pc = &threads[thread_id].pc;
+
+    bool next_thread = false;
+    while(!next_thread) {
+      uint16_t address = *pc;
+      if (CHECKED) {
+        Instruction instruction;
+        if (!decode_instruction(engine.resources.data[code], engine.resources.sizes[code], address, instruction)) {
+          stop_thread(thread_id, address, "instruction runs past the end of the code");
+          break;
         }
+      }
 
-        if (opcode & 0x80) {
-          // contains offset for polygon data in cinematic data resource
-          // the high bits of the address are 0-6 from the opcode
-          uint32_t offset = (((opcode & 0x7f) << 8) | fetch_byte(pc)) * 2;
+      uint8_t opcode = fetch_byte(pc);
 
-          uint8_t* polygon_data = background->data;
+#ifdef AW_PROFILER
+      ProfiledInstruction profiled(profiler, *this, uint8_t(thread_id), uint16_t(*pc - 1), opcode);
+#endif
 
-          // absolute position of shape (added to relative positions later)
-          Point pos;
-          pos.x = fetch_byte(pc);
-          pos.y = fetch_byte(pc);
+      std::string opcode_name = "----";
+      if (opcode <= 0x1a) {
+        opcode_name = opcode_names[opcode];
+      } else if (opcode < 0x40) {
+        // invalid
+      } else if (opcode < 0x80) {
+        opcode_name = "plyl";
+      } else {
+        opcode_name = "plys";
+      }
 
-          // slightly weird one this. if the y value is greater than 199
-          // then the extra is added onto the x value. i assume this is because
-          // the screen resolution is 320 pixels but a byte can only hold
-          // numbers up to 255. this "hack" allows bigger numbers (up to 311) to
-          // be represented in the x byte (at the cost that it can only happen
-          // when y is greater than 199 (so is effectively clamped to the
-          // bottom of the screen).
-          if (pos.y > 199) {
-            pos.x += pos.y - 199;
-            pos.y = 199;
-          }
+      if (engine.debug) {
+        engine.debug(engine.user, "%6i)  %2i [%05u] > %02x:%-6s", ticks, thread_id, *(pc)-1, opcode, opcode_name.c_str());
+      }
+
+      // opcodes come in three different flavours depending on the status
+      // of the two highest bits
+      //
+      // 00xxxxxx = standard opcode instruction number in bits 0-5
+      // 01xxxxxx = polygon opcode long format (translated from Eric Chahi's "different format de donnees pour spr.l")
+      // 1xxxxxxx = polygon opcode short format (high part of address in bits 0-6)
 
-          draw_shape(0xff, pos, 64, polygon_data, &offset);
+      if (ticks == 48) {
+          uint8_t a = 0;
+      }
 
-          ticks++;
-          continue;
+      if (opcode & 0x80) {
+        // contains offset for polygon data in cinematic data resource
+        // the high bits of the address are 0-6 from the opcode
+        uint32_t offset = (((opcode & 0x7f) << 8) | fetch_byte(pc)) * 2;
+
+        const uint8_t* polygon_data = engine.resources.data[background];
+
+        // absolute position of shape (added to relative positions later)
+        Point pos;
+        pos.x = fetch_byte(pc);
+        pos.y = fetch_byte(pc);
+
+        // slightly weird one this. if the y value is greater than 199
+        // then the extra is added onto the x value. i assume this is because
+        // the screen resolution is 320 pixels but a byte can only hold
+        // numbers up to 255. this "hack" allows bigger numbers (up to 311) to
+        // be represented in the x byte (at the cost that it can only happen
+        // when y is greater than 199 (so is effectively clamped to the
+        // bottom of the screen).
+        if (pos.y > 199) {
+          pos.x += pos.y - 199;
+          pos.y = 199;
         }
 
-        if(opcode & 0x40) {
-          // contains offset for polygon data in cinematic data resource
-          // the offset is contained in the next two bytes in the bytecode
-          uint32_t offset = fetch_word(pc) * 2;
+        draw_shape(0xff, pos, 64, polygon_data, &offset);
 
-          uint8_t* polygon_data = background->data;
+        ticks++;
+        continue;
+      }
 
-          Point pos;
+      if(opcode & 0x40) {
+        // contains offset for polygon data in cinematic data resource
+        // the offset is contained in the next two bytes in the bytecode
+        uint32_t offset = fetch_word(pc) * 2;
 
-          // bits 0-5 of the opcode have special meaning that manipulate the
-          // x and y coordinates for this polygon.
-          //
-          // the bits 0-5 are laid out aabbcc with each pair of bits (e.g "aa")
-          // selecting an operation to perform.
-
-          if ((opcode & 0b00110000) == 0b00110000) {
-            // if xx == 11 then add 256 to x (essentially x gains an extra
-            // bit of resolution)
-            pos.x = fetch_byte(pc) + 256;
-          } else if ((opcode & 0b00110000) == 0b00010000)  {
-            // if xx == 01 then the x value is selected from the specified register
-            pos.x = registers[fetch_byte(pc)];
-          } else if ((opcode & 0b00110000) == 0b00000000) {
-            // if xx == 00 then the x value is read from the next two bytes of
-            // bytecode
-            pos.x = fetch_word(pc);
-          }
-          else {
-            // otherwise the x value is simply the next byte of bytecode
-            pos.x = fetch_byte(pc);
-          }
+        const uint8_t* polygon_data = engine.resources.data[background];
 
-          if ((opcode & 0b00001100) == 0b00001100) {
-            // if yy == 11 then add 256 to y (essentially y gains an extra
-            // bit of resolution)
-            pos.y = fetch_byte(pc) + 256;
-          }
-          else if ((opcode & 0b00001100) == 0b00000100) {
-            // if yy == 01 then the y value is selected from the specified register
-            pos.y = registers[fetch_byte(pc)];
-          }
-          else if ((opcode & 0b00001100) == 0b00000000) {
-            // if yy == 00 then the y value is read from the next two bytes of
-            // bytecode
-            pos.y = fetch_word(pc);
-          }
-          else {
-            // otherwise the y value is simply the next byte of bytecode
-            pos.y = fetch_byte(pc);
-          }
+        Point pos;
 
-          int16_t zoom = 64;
+        // bits 0-5 of the opcode have special meaning that manipulate the
+        // x and y coordinates for this polygon.
+        //
+        // the bits 0-5 are laid out aabbcc with each pair of bits (e.g "aa")
+        // selecting an operation to perform.
+
+        if ((opcode & 0b00110000) == 0b00110000) {
+          // if xx == 11 then add 256 to x (essentially x gains an extra
+          // bit of resolution)
+          pos.x = fetch_byte(pc) + 256;
+        } else if ((opcode & 0b00110000) == 0b00010000)  {
+          // if xx == 01 then the x value is selected from the specified register
+          pos.x = registers[fetch_byte(pc)];
+        } else if ((opcode & 0b00110000) == 0b00000000) {
+          // if xx == 00 then the x value is read from the next two bytes of
+          // bytecode
+          pos.x = fetch_word(pc);
+        }
+        else {
+          // otherwise the x value is simply the next byte of bytecode
+          pos.x = fetch_byte(pc);
+        }
 
-          if ((opcode & 0b00000011) == 0b00000011) {
-            // if zz == 11 then something special happens...
-            // why? we don't know, but it does! the notes in Eric
-            // Chahi's document are not really legible, perhaps
-            // something like... "11 si Z utiliser Z~~~~ Banque et Z = 64"?
-            // Fabien Sanglard has this special case change the source of
-            // polygon data to "SegVideo2" which I think is meant to be the
-            // character data, anyway, let's try that...
-            polygon_data = characters->data;
+        if ((opcode & 0b00001100) == 0b00001100) {
+          // if yy == 11 then add 256 to y (essentially y gains an extra
+          // bit of resolution)
+          pos.y = fetch_byte(pc) + 256;
+        }
+        else if ((opcode & 0b00001100) == 0b00000100) {
+          // if yy == 01 then the y value is selected from the specified register
+          pos.y = registers[fetch_byte(pc)];
+        }
+        else if ((opcode & 0b00001100) == 0b00000000) {
+          // if yy == 00 then the y value is read from the next two bytes of
+          // bytecode
+          pos.y = fetch_word(pc);
+        }
+        else {
+          // otherwise the y value is simply the next byte of bytecode
+          pos.y = fetch_byte(pc);
+        }
 
-    //         assert(false); // i don't think we should end up here...
-          }
-          else if ((opcode & 0b00000011) == 0b00000001) {
-            // if zz == 01 then the z value is selected from the specified register
-            zoom = registers[fetch_byte(pc)];
-          }
-          else if ((opcode & 0b00000011) == 0b00000000) {
-            // default zoom level, already set above
-          }
-          else {
-            // otherwise the z value is simply the next byte of bytecode
-            zoom = fetch_byte(pc);
+        int16_t zoom = 64;
+
+        if ((opcode & 0b00000011) == 0b00000011) {
+          // if zz == 11 then something special happens...
+          // why? we don't know, but it does! the notes in Eric
+          // Chahi's document are not really legible, perhaps
+          // something like... "11 si Z utiliser Z~~~~ Banque et Z = 64"?
+          // Fabien Sanglard has this special case change the source of
+          // polygon data to "SegVideo2" which I think is meant to be the
+          // character data, anyway, let's try that...
+          // (a chapter without characters has nothing to draw)
+          if (characters == NO_RESOURCE) {
+            ticks++;
+            continue;
           }
+          polygon_data = engine.resources.data[characters];
 
-          draw_shape(0xff, pos, zoom, polygon_data, &offset);
+  //         assert(false); // i don't think we should end up here...
+        }
+        else if ((opcode & 0b00000011) == 0b00000001) {
+          // if zz == 01 then the z value is selected from the specified register
+          zoom = registers[fetch_byte(pc)];
+        }
+        else if ((opcode & 0b00000011) == 0b00000000) {
+          // default zoom level, already set above
+        }
+        else {
+          // otherwise the z value is simply the next byte of bytecode
+          zoom = fetch_byte(pc);
+        }
 
-          ticks++;
-          continue;}
+        draw_shape(0xff, pos, zoom, polygon_data, &offset);
 
-        switch(opcode) {
-          case 0x00: {
-            // movi   d0, #1234
-            // copy immediate word to register d0
-            uint8_t d0 = fetch_byte(pc);
-            int16_t w = fetch_word(pc);
-            registers[d0] = w;
-            break;
-          }
+        ticks++;
+        continue;}
 
-          case 0x01: {
-            // mov    d0, d1
-            // copy value in register d1 into register d0
-            uint8_t d0 = fetch_byte(pc);
-            uint8_t d1 = fetch_byte(pc);
-            registers[d0] = registers[d1];
-            break;
-          }
+      switch(opcode) {
+        case 0x00: {
+          // movi   d0, #1234
+          // copy immediate word to register d0
+          uint8_t d0 = fetch_byte(pc);
+          int16_t w = fetch_word(pc);
+          registers[d0] = w;
+          break;
+        }
 
-          case 0x02: {
-            // add    d0, d1
-            // add value in register d1 to to register d0
-            uint8_t d0 = fetch_byte(pc);
-            uint8_t d1 = fetch_byte(pc);
-            registers[d0] += registers[d1];
-            break;
-          }
+        case 0x01: {
+          // mov    d0, d1
+          // copy value in register d1 into register d0
+          uint8_t d0 = fetch_byte(pc);
+          uint8_t d1 = fetch_byte(pc);
+          registers[d0] = registers[d1];
+          break;
+        }
 
-          case 0x03: {
-            // addi   d0, #1234
-            // add immediate word to register d0
-            uint8_t d0 = fetch_byte(pc);
-            int16_t w = fetch_word(pc);
-            registers[d0] += w;
-            break;
-          }
+        case 0x02: {
+          // add    d0, d1
+          // add value in register d1 to to register d0
+          uint8_t d0 = fetch_byte(pc);
+          uint8_t d1 = fetch_byte(pc);
+          registers[d0] += registers[d1];
+          break;
+        }
 
-          case 0x04: {
-            // call   #1234
-            // push current program counter onto stack then jump to specified address
-            int16_t w = fetch_word(pc);
-            call_stack.push_back(*pc);
-            *pc = w;
-            break;
-          }
+        case 0x03: {
+          // addi   d0, #1234
+          // add immediate word to register d0
+          uint8_t d0 = fetch_byte(pc);
+          int16_t w = fetch_word(pc);
+          registers[d0] += w;
+          break;
+        }
 
-          case 0x05: {
-            // ret
-            // pop last address off the stack and jump there (return from a call)
-            *pc = call_stack.back();
-            call_stack.pop_back();
-            break;
-          }
+        case 0x04: {
+          // call   #1234
+          // push current program counter onto stack then jump to specified address
+          int16_t w = fetch_word(pc);
+          call_stack.push_back(*pc);
+          *pc = w;
+          break;
+        }
 
-          case 0x06: {
-            // brk
-            // stop execution of this thread and switch execution to the next thread
+        case 0x05: {
+          // ret
+          // pop last address off the stack and jump there (return from a call)
+          if (CHECKED && call_stack.empty()) {
+            stop_thread(thread_id, address, "ret with an empty call stack");
             next_thread = true;
             break;
           }
+          *pc = call_stack.back();
+          call_stack.pop_back();
+          break;
+        }
 
-          case 0x07: {
-            // jmp    #1234
-            // jump to specified address
-            int16_t w = fetch_word(pc);
-            *pc = w;
-            break;
-          }
+        case 0x06: {
+          // brk
+          // stop execution of this thread and switch execution to the next thread
+          next_thread = true;
+          break;
+        }
 
-          case 0x08: {
-            // svec   #12, #1234
-            // request the change of a program counter of a thread to be applied after
-            // the current execution cycle has completed
-            uint8_t thread_id = fetch_byte(pc);
-            int16_t new_pc = fetch_word(pc);
+        case 0x07: {
+          // jmp    #1234
+          // jump to specified address
+          int16_t w = fetch_word(pc);
+          *pc = w;
+          break;
+        }
 
-            Thread new_thread_state = threads[thread_id];
-            new_thread_state.pc = new_pc;
-            requested_thread_state[thread_id] = new_thread_state;
+        case 0x08: {
+          // svec   #12, #1234
+          // request the change of a program counter of a thread to be applied after
+          // the current execution cycle has completed
+          uint8_t target_thread = fetch_byte(pc);
+          int16_t new_pc = fetch_word(pc);
 
+          if (CHECKED && target_thread >= THREAD_COUNT) {
+            stop_thread(thread_id, address, "svec of a thread that doesn't exist");
+            next_thread = true;
             break;
           }
 
-          case 0x09: {
-            // djnz   d0, #1234
-            // decrement register and jump to specified address if not zero
-            uint8_t d0 = fetch_byte(pc);
-            int16_t w = fetch_word(pc);
+          Thread new_thread_state = threads[target_thread];
+          new_thread_state.pc = new_pc;
+          requested_thread_state[target_thread] = new_thread_state;
 
-            registers[d0]--;
+          break;
+        }
 
-            if(registers[d0] != 0) {
-              *pc = w;
-            }
-            break;
+        case 0x09: {
+          // djnz   d0, #1234
+          // decrement register and jump to specified address if not zero
+          uint8_t d0 = fetch_byte(pc);
+          int16_t w = fetch_word(pc);
+
+          registers[d0]--;
+
+          if(registers[d0] != 0) {
+            *pc = w;
           }
+          break;
+        }
 
-          case 0x0a: {
-            // cjmp   #12, d0, d1 or #1234, #1234
-            // conditional jump for expression when d0 compared to either
-            // d1 or an immediate byte or word value if expression result
-            // is true then jump to specified address
-            uint8_t t = fetch_byte(pc);
-            int16_t a = registers[fetch_byte(pc)];
-            int16_t b = fetch_byte(pc);
-
-            if(t & 0x80) {
-              // register to register comparison
-              b = registers[b];
-            } else if (t & 0x40) {
-              // register to 16-bit literal comparison
-              b = (b << 8) | fetch_byte(pc);
-            }
+        case 0x0a: {
+          // cjmp   #12, d0, d1 or #1234, #1234
+          // conditional jump for expression when d0 compared to either
+          // d1 or an immediate byte or word value if expression result
+          // is true then jump to specified address
+          uint8_t t = fetch_byte(pc);
+          int16_t a = registers[fetch_byte(pc)];
+          int16_t b = fetch_byte(pc);
+
+          if(t & 0x80) {
+            // register to register comparison
+            b = registers[b];
+          } else if (t & 0x40) {
+            // register to 16-bit literal comparison
+            b = (b << 8) | fetch_byte(pc);
+          }
 
-            int16_t w = fetch_word(pc);
+          int16_t w = fetch_word(pc);
 
-            bool result = false;
+          bool result = false;
 
-            // mask out just the expression bits
-            t &= 0b111;
-            if(t == 0) { result = a == b; }
-            if(t == 1) { result = a != b; }
-            if(t == 2) { result = a  > b; }
-            if(t == 3) { result = a >= b; }
-            if(t == 4) { result = a  < b; }
-            if(t == 5) { result = a <= b; }
+          // mask out just the expression bits
+          t &= 0b111;
+          if(t == 0) { result = a == b; }
+          if(t == 1) { result = a != b; }
+          if(t == 2) { result = a  > b; }
+          if(t == 3) { result = a >= b; }
+          if(t == 4) { result = a  < b; }
+          if(t == 5) { result = a <= b; }
 
-            if(result) {
-              *pc = w;
-            }
-            break;
+          if(result) {
+            *pc = w;
           }
+          break;
+        }
 
-          case 0x0b: {
-            // pal    #12, #12
-            // specify the index of the palette to use
-            uint8_t id = fetch_byte(pc);
-
-            // TODO: from Eric Chahi's original notes the second byte of
-            // this instruction appears to be a speed ("a la vitesse")
-            // for the palette change - but then parts of the notes are
-            // crossed out suggesting it was never implemented?
-            uint8_t speed = fetch_byte(pc);
-
-            if (id != 0xff) {
-              // calculate the offset for the requested palette
-              uint16_t offset = id * 32;
-
-              // the first 32 palettes are for the Amiga/VGA version, the
-              // following 32 palettes are for the MSDOS version
-              //offset += (32 * 32); // offset to EGA/TGA
-              set_palette((uint16_t*)&palette->data[offset]);
-            }
+        case 0x0b: {
+          // pal    #12, #12
+          // specify the index of the palette to use
+          uint8_t id = fetch_byte(pc);
 
-            break;
+          // from Eric Chahi's original notes the second byte of
+          // this instruction is a speed ("a la vitesse") for the
+          // palette change - we treat it as the number of frames the
+          // transition from the current palette takes
+          uint8_t speed = fetch_byte(pc);
+
+          if (id != 0xff) {
+            change_palette(id, speed);
           }
 
-          case 0x0c: {
-            // ???    #12, #12, #12
-            // this one is a bit cryptic with Eric Chahi's notes
-            // referring  to the first "1st affecte"/"start" and last
-            // "dernier affecte"/"end" vectors affected along with a
-            // "type" of action (unlock, lock, clear)
-            // it suggests that this opcode should affect a range of
-            // threads, perhaps updating their state in bulk?
-
-            uint8_t first = fetch_byte(pc);
-            uint8_t last = fetch_byte(pc);
-            uint8_t type = fetch_byte(pc);
-
-            for (uint8_t thread_id = first; thread_id <= last; thread_id++) {
-              Thread new_thread_state = threads[thread_id];
-
-              if (type == 0) {
-                // unlock
-                new_thread_state.paused = false;
-                requested_thread_state[thread_id] = new_thread_state;
-              }
-              if (type == 1) {
-                // lock
-                new_thread_state.paused = true;
-                requested_thread_state[thread_id] = new_thread_state;
-              }
-              if (type == 2) {
-                // kill threads
-                new_thread_state.pc = THREAD_INACTIVE;
-                requested_thread_state[thread_id] = new_thread_state;
-              }
-            }
+          break;
+        }
+
+        case 0x0c: {
+          // ???    #12, #12, #12
+          // this one is a bit cryptic with Eric Chahi's notes
+          // referring  to the first "1st affecte"/"start" and last
+          // "dernier affecte"/"end" vectors affected along with a
+          // "type" of action (unlock, lock, clear)
+          // it suggests that this opcode should affect a range of
+          // threads, perhaps updating their state in bulk?
+
+          uint8_t first = fetch_byte(pc);
+          uint8_t last = fetch_byte(pc);
+          uint8_t type = fetch_byte(pc);
+
+          if (CHECKED && last >= THREAD_COUNT) {
+            stop_thread(thread_id, address, "thread range past the last thread");
+            next_thread = true;
             break;
           }
 
-          // framebuffer manipulation op codes
-          //
-          case 0x0d: {
-            // setws    #12
-            // set the working screen for drawing operations
-            uint8_t id = fetch_byte(pc);
-            uint8_t *b = get_vram_from_id(id);
-
-            if(b) {
-              // TODO: why would we ever be given an invalid screen id?
-              // that doesn't seem right...
+          for (uint8_t target_thread = first; target_thread <= last; target_thread++) {
+            Thread new_thread_state = threads[target_thread];
 
-              working_vram = b;
+            if (type == 0) {
+              // unlock
+              new_thread_state.paused = false;
+              requested_thread_state[target_thread] = new_thread_state;
             }
-            else {
-              assert(false);
+            if (type == 1) {
+              // lock
+              new_thread_state.paused = true;
+              requested_thread_state[target_thread] = new_thread_state;
+            }
+            if (type == 2) {
+              // kill threads
+              new_thread_state.pc = THREAD_INACTIVE;
+              requested_thread_state[target_thread] = new_thread_state;
             }
-            break;
           }
+          break;
+        }
 
-          case 0x0e: {
-            // vclr   #12, #12
-            // clears an entire backbuffer with the specified palette
-            // colour
-            uint8_t id = fetch_byte(pc);
-            uint8_t* d = get_vram_from_id(id);
-
-            uint8_t color = fetch_byte(pc);
-            color |= color << 4;
-
-            if(d) {
-              // TODO: why would we ever be given an invalid screen id?
-              // that doesn't seem right...
-              memset(d, color, 320 * 200 / 2);
-            }
+        // framebuffer manipulation op codes
+        //
+        case 0x0d: {
+          // setws    #12
+          // set the working screen for drawing operations
+          uint8_t id = fetch_byte(pc);
+          uint8_t *b = get_vram_from_id(id);
 
-            if (debug_display_update) {
-              debug_display_update();
-            }
+          if(b) {
+            // TODO: why would we ever be given an invalid screen id?
+            // that doesn't seem right...
 
-            break;
+            working_vram = b;
+          }
+          else {
+            assert(false);
           }
+          break;
+        }
 
-          case 0x0f: {
-            // vcpy   #12, #12
-            // copy contents of one backbuffer into another
+        case 0x0e: {
+          // vclr   #12, #12
+          // clears an entire backbuffer with the specified palette
+          // colour
+          AW_TRACE_SCOPE(engine.trace, PAGE_COPY);
+          uint8_t id = fetch_byte(pc);
+          uint8_t* d = get_vram_from_id(id);
 
-            uint8_t src_id = fetch_byte(pc);
-            uint8_t dest_id = fetch_byte(pc);
+          uint8_t color = fetch_byte(pc);
 
-            if (src_id >= 0xFE || ((src_id &= ~0x40) & 0x80) == 0) {
+          if(d) {
+            // TODO: why would we ever be given an invalid screen id?
+            // that doesn't seem right...
+            discard_page(d);
+            Framebuffer::clear(d, color);
+          }
 
-            }
-            else {
-              // assert(false); // TODO: vscroll?
-            }
+          if (engine.debug_display_update) {
+            engine.debug_display_update(engine.user);
+          }
 
+          break;
+        }
 
-            //src_id &= ~0x40;
-            uint8_t* s = get_vram_from_id(src_id);
-            uint8_t* d = get_vram_from_id(dest_id);
+        case 0x0f: {
+          // vcpy   #12, #12
+          // copy contents of one backbuffer into another
+          AW_TRACE_SCOPE(engine.trace, PAGE_COPY);
 
-            if (s && d) {
-              // TODO: why would we ever be given an invalid screen id?
-              // that doesn't seem right...
-              memcpy(d, s, 320 * 200 / 2);
-            }
+          uint8_t src_id = fetch_byte(pc);
+          uint8_t dest_id = fetch_byte(pc);
 
-            /*
-            uint8_t src_id = fetch_byte(pc);
-            uint8_t dest_id = fetch_byte(pc);
+          if (src_id >= 0xFE || ((src_id &= ~0x40) & 0x80) == 0) {
 
-            debug("Copy buffer %d to %d", src_id, dest_id);
+          }
+          else {
+            // assert(false); // TODO: vscroll?
+          }
 
-            //src_id &= ~0x40;
-            uint8_t* s = get_vram_from_id(src_id);
-            uint8_t* d = get_vram_from_id(dest_id);
 
+          //src_id &= ~0x40;
+          uint8_t* s = get_vram_from_id(src_id);
+          uint8_t* d = get_vram_from_id(dest_id);
 
+          if (s && d) {
             // TODO: why would we ever be given an invalid screen id?
             // that doesn't seem right...
-            if (s && d) {
-              int16_t v_scroll = registers[0xF9];
-              uint16_t h = 200;
+            flush_page(s);
+            if (s != d) {
+              discard_page(d);
+            }
+            Framebuffer::copy(d, s);
+          }
 
-              if (v_scroll != 0) {
-                uint8_t a = 0;
-              }
-              h -= abs(v_scroll);
-              s -= v_scroll < 0 ? (v_scroll * 160) : 0;
-              d += v_scroll > 0 ? (v_scroll * 160) : 0;
+          /*
+          uint8_t src_id = fetch_byte(pc);
+          uint8_t dest_id = fetch_byte(pc);
+
+          debug("Copy buffer %d to %d", src_id, dest_id);
+
+          //src_id &= ~0x40;
+          uint8_t* s = get_vram_from_id(src_id);
+          uint8_t* d = get_vram_from_id(dest_id);
 
-              memcpy(d, s, 320 * h / 2);
-            }*/
 
+          // TODO: why would we ever be given an invalid screen id?
+          // that doesn't seem right...
+          if (s && d) {
+            int16_t v_scroll = registers[0xF9];
+            uint16_t h = 200;
 
-            if (debug_display_update) {
-              debug_display_update();
+            if (v_scroll != 0) {
+              uint8_t a = 0;
             }
+            h -= abs(v_scroll);
+            s -= v_scroll < 0 ? (v_scroll * 160) : 0;
+            d += v_scroll > 0 ? (v_scroll * 160) : 0;
 
-            // TODO: this should support vertical scrolling by looking the
-            // value in register VM_VARIABLE_SCROLL_Y
-            // e.g. video->copyPage(srcPageId, dstPageId, vmVariables[VM_VARIABLE_SCROLL_Y]);
-            break;
-          }
+            memcpy(d, s, 320 * h / 2);
+          }*/
 
-          case 0x10: {
-            // vshw   #12
-            // copy specified backbuffer to screen
-            uint8_t id = fetch_byte(pc);
 
-            registers[0xF7] = 0; // TODO:  why?
+          if (engine.debug_display_update) {
+            engine.debug_display_update(engine.user);
+          }
 
-            if(id == 0xff) {
-              // from Eric Chahi's notes:
-              // "si n == 255 on flip invisi et visi" so in case the
-              // id specified is 255 we swap which of the backbuffers
-              // is the woring framebuffer
-              visible_vram = visible_vram == vram[1] ? vram[2] : vram[1];
-            }
+          // TODO: this should support vertical scrolling by looking the
+          // value in register VM_VARIABLE_SCROLL_Y
+          // e.g. video->copyPage(srcPageId, dstPageId, vmVariables[VM_VARIABLE_SCROLL_Y]);
+          break;
+        }
 
-            update_screen(visible_vram);
+        case 0x10: {
+          // vshw   #12
+          // copy specified backbuffer to screen
+          uint8_t id = fetch_byte(pc);
 
-            if (debug_display_update) {
-              debug_display_update();
-            }
+          registers[0xF7] = 0; // TODO:  why?
 
-            break;
+          if(id == 0xff) {
+            // from Eric Chahi's notes:
+            // "si n == 255 on flip invisi et visi" so in case the
+            // id specified is 255 we swap which of the backbuffers
+            // is the woring framebuffer
+            visible_vram = visible_vram == engine.vram[1] ? engine.vram[2] : engine.vram[1];
           }
 
-          case 0x11: {
-            // kill
-            // set current threads program counter to 0xffff (inactive) and
-            // moveto the next thread
-            *pc = THREAD_INACTIVE;
-            next_thread = true;
-            break;
+          if (!fast_forward || frames_since_present >= present_interval) {
+            present();
+          } else {
+            skipped_presents++;
           }
 
-          case 0x12: {
-            // text   #1234, #12, #12, #12
-            uint16_t string_id = fetch_word(pc);
-            uint8_t x = fetch_byte(pc);
-            uint8_t y = fetch_byte(pc);
-            uint8_t colour = fetch_byte(pc);
+          if (engine.debug_display_update) {
+            engine.debug_display_update(engine.user);
+          }
 
-            Point pos;
-            pos.x = x * 8;
-            pos.y = y;
+          break;
+        }
 
-            // find string in string table
-            const std::string &text = string_table.at(string_id);
-            draw_text(colour, pos, text);
+        case 0x11: {
+          // kill
+          // set current threads program counter to 0xffff (inactive) and
+          // moveto the next thread
+          *pc = THREAD_INACTIVE;
+          next_thread = true;
+          break;
+        }
 
-            break;
-          }
+        case 0x12: {
+          // text   #1234, #12, #12, #12
+          uint16_t string_id = fetch_word(pc);
+          uint8_t x = fetch_byte(pc);
+          uint8_t y = fetch_byte(pc);
+          uint8_t colour = fetch_byte(pc);
 
-          case 0x13: {
-            // sub  d0, d1
-            // subtract value in register d1 from register d0
-            uint8_t d = fetch_byte(pc);
-            uint8_t s = fetch_byte(pc);
-            registers[d] -= registers[s];
-            break;
-          }
+          Point pos;
+          pos.x = x * 8;
+          pos.y = y;
 
-          case 0x14: {
-            // andi  d0, #1234
-            // bitwise AND register d0 with the value provided
-            uint8_t r = fetch_byte(pc);
-            int16_t v = fetch_word(pc);
-            registers[r] = (uint16_t)registers[r] & v;
-            break;
-          }
+          // find string in string table
+          const std::string &text = string_table.at(string_id);
+          draw_text(colour, pos, text);
 
-          case 0x15: {
-            // andi  d0, #1234
-            // bitwise OR register d0 with the value provided
-            uint8_t r = fetch_byte(pc);
-            int16_t v = fetch_word(pc);
-            registers[r] = (uint16_t)registers[r] | v;
-            break;
-          }
+          break;
+        }
 
-          case 0x16: {
-            // shli  d0, #1234
-            // shift value in register d0 left by value provided
+        case 0x13: {
+          // sub  d0, d1
+          // subtract value in register d1 from register d0
+          uint8_t d = fetch_byte(pc);
+          uint8_t s = fetch_byte(pc);
+          registers[d] -= registers[s];
+          break;
+        }
 
-            // TODO: seems odd the shift value is 16-bit since
-            // shifting by anything more than 16 will zero out the
-            // register
-            uint8_t r = fetch_byte(pc);
-            int16_t v = fetch_word(pc);
-            registers[r] = (uint16_t)registers[r] << v;
-            break;
-          }
+        case 0x14: {
+          // andi  d0, #1234
+          // bitwise AND register d0 with the value provided
+          uint8_t r = fetch_byte(pc);
+          int16_t v = fetch_word(pc);
+          registers[r] = (uint16_t)registers[r] & v;
+          break;
+        }
+
+        case 0x15: {
+          // andi  d0, #1234
+          // bitwise OR register d0 with the value provided
+          uint8_t r = fetch_byte(pc);
+          int16_t v = fetch_word(pc);
+          registers[r] = (uint16_t)registers[r] | v;
+          break;
+        }
+
+        case 0x16: {
+          // shli  d0, #1234
+          // shift value in register d0 left by value provided
+
+          // TODO: seems odd the shift value is 16-bit since
+          // shifting by anything more than 16 will zero out the
+          // register
+          uint8_t r = fetch_byte(pc);
+          int16_t v = fetch_word(pc);
+          registers[r] = (uint16_t)registers[r] << v;
+          break;
+        }
 
-          case 0x17: {
-            // shri  d0, #1234
-            // shift value in register d0 right by value provided
-            // note: this shift is intentionally unsigned so new bits
-            // are zero filled
-
-            // TODO: seems odd the shift value is 16-bit since
-            // shifting by anything more than 16 will zero out the
-            // register
-            uint8_t r = fetch_byte(pc);
-            int16_t v = fetch_word(pc);
-            registers[r] = (uint16_t)registers[r] >> v;
+        case 0x17: {
+          // shri  d0, #1234
+          // shift value in register d0 right by value provided
+          // note: this shift is intentionally unsigned so new bits
+          // are zero filled
+
+          // TODO: seems odd the shift value is 16-bit since
+          // shifting by anything more than 16 will zero out the
+          // register
+          uint8_t r = fetch_byte(pc);
+          int16_t v = fetch_word(pc);
+          registers[r] = (uint16_t)registers[r] >> v;
+          break;
+        }
+
+        case 0x18: {
+          // snd  #1234, #12, #12, #12
+          uint16_t num = fetch_word(pc);
+          uint8_t frequency = fetch_byte(pc);
+          uint8_t volume = fetch_byte(pc);
+          uint8_t channel = fetch_byte(pc);
+
+          // a volume of zero silences the channel
+          if (volume == 0) {
+            mixer.stop(channel);
             break;
           }
 
-          case 0x18: {
-            // snd  #1234, #12, #12, #12
-            uint16_t num = fetch_word(pc);
-            uint8_t frequency = fetch_byte(pc);
-            uint8_t volume = fetch_byte(pc);
-            uint8_t channel = fetch_byte(pc);
-            break;
+          // only play sounds that have actually been loaded
+          if (engine.resources.is(num, Resource::Type::SOUND) && engine.resources.state(num) == Resource::State::LOADED) {
+            mixer.play_sound(channel, engine.resources.data[num], engine.resources.sizes[num], frequency, volume);
           }
+          break;
+        }
 
-          case 0x19: {
-            // load   #1234
-            // loads either a resource or the next chapter of the
-            // game.
-            uint16_t i = fetch_word(pc);
-
-            if (i == 0) {
-              // TODO: Eric Chahi's notes are hard to read here but say
-              // something like "libere la memoire annuler"
-              // sounds like perhaps this is "free memory and exit the game"?
-              // not sure - let's leave an assert here and see if it
-              // ever happens...
-              assert(false);
+        case 0x19: {
+          // load   #1234
+          // loads either a resource or the next chapter of the
+          // game.
+          uint16_t i = fetch_word(pc);
+
+          if (i == 0) {
+            // TODO: Eric Chahi's notes are hard to read here but say
+            // something like "libere la memoire annuler"
+            // sounds like perhaps this is "free memory and exit the game"?
+            // not sure - let's leave an assert here and see if it
+            // ever happens...
+            assert(false);
+          } else {
+            if (i < engine.resources.size()) {
+              // load a resource
+              engine.resources.set_state(i, Resource::State::NEEDS_LOADING);
+              flush_mask_readers();
+              engine.load_needed_resources();
             } else {
-              if (i <= resources.size()) {
-                // load a resource
-                resources[i]->state = Resource::State::NEEDS_LOADING;
-                load_needed_resources();
-              } else {
-                // switch to a new chapter
-                initialise_chapter(i);
-              }
+              // switch to a new chapter, the thread carries on running
+              // the new chapter's code (see execute_threads())
+              initialise_chapter(i);
+              return true;
             }
-
-            break;
           }
 
-          case 0x1a: {
-            // music #1234, #1234, #12
-            uint16_t num = fetch_word(pc);
-            uint16_t period = fetch_word(pc);
-            uint16_t position = fetch_byte(pc);
-            break;
-          }
+          break;
+        }
 
-          default: {
-            // debug("- Invalid opcode " + std::to_string(opcode) + " on thread " + std::to_string(i));
-            break;
+        case 0x1a: {
+          // music #1234, #1234, #12
+          uint16_t num = fetch_word(pc);
+          uint16_t period = fetch_word(pc);
+          uint16_t position = fetch_byte(pc);
+
+          if (num != 0) {
+            // start a new piece of music, instruments that haven't been
+            // loaded are left silent
+            if (engine.resources.is(num, Resource::Type::MUSIC) && engine.resources.state(num) == Resource::State::LOADED) {
+              const uint8_t* module = engine.resources.data[num];
+              const uint8_t* sounds[Sequencer::INSTRUMENT_COUNT];
+              uint32_t sound_sizes[Sequencer::INSTRUMENT_COUNT];
+              for (uint8_t i = 0; i < Sequencer::INSTRUMENT_COUNT; i++) {
+                uint16_t id = Sequencer::instrument_resource(module, i);
+                bool loaded = id != 0 && engine.resources.is(id, Resource::Type::SOUND) &&
+                  engine.resources.state(id) == Resource::State::LOADED;
+                sounds[i] = loaded ? engine.resources.data[id] : nullptr;
+                sound_sizes[i] = loaded ? engine.resources.sizes[id] : 0;
+              }
+
+              sequencer.load(module, engine.resources.sizes[num], sounds, sound_sizes, period, uint8_t(position));
+              sequencer.start();
+            }
+          } else if (period != 0) {
+            // change the tempo of the music already playing
+            sequencer.set_period(period);
+          } else {
+            sequencer.stop();
           }
+          break;
         }
-      }
-    }
-
-    // set thread program counters and pause states if new values
-    // have been requested
-    for (auto const& p : requested_thread_state) {
-      threads[p.first] = p.second;
-    }
 
-    /*
-    for (uint8_t i = 0; i < THREAD_COUNT; i++) {
-      if (new_program_counter[i] == 0xfffe) {
-        program_counter[i] = THREAD_INACTIVE;
-        new_program_counter[i] = THREAD_INACTIVE;
-      } else {
-        if (new_program_counter[i] != NO_UPDATE) {
-          program_counter[i] = new_program_counter[i];
+        default: {
+          // debug("- Invalid opcode " + std::to_string(opcode) + " on thread " + std::to_string(i));
+          break;
         }
       }
+    }
 
-      if (new_paused_threads[i] == THREAD_LOCK) {
-        paused_thread[i] = true;
-      }
+    return false;
+  }
 
-      if (new_paused_threads[i] == THREAD_UNLOCK) {
-        paused_thread[i] = false;
-      }
-    }*/
+  void VirtualMachine::stop_thread(uint8_t thread_id, uint16_t address, const char* reason) {
+    if (engine.debug) {
+      engine.debug(engine.user, "thread %u stopped at [%05u]: %s", thread_id, address, reason);
+    }
+    threads[thread_id].pc = THREAD_INACTIVE;
   }
+
+  void VirtualMachine::update_verified_code() {
+    const uint8_t* data = engine.resources.data[code];
+    uint16_t size = engine.resources.sizes[code];
+    if (verified_resource != code || verified_code.data != data || verified_code.size != size) {
+      verified_code = verify_code(data, size);
+      verified_resource = code;
+    }
+  }
+
 }
\ No newline at end of file
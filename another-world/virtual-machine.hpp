@@ -3,41 +3,34 @@
 #include <vector>
 #include <array>
 #include <map>
+#include <memory>
 #include <string>
 #include <cstdint>
 #include <cstdarg>
 
 
 #include "byte-killer.hpp"
+#include "framebuffer.hpp"
+#include "mixer.hpp"
+#include "sequencer.hpp"
+
+#include "trace.hpp"
+#include "verifier.hpp"
+
+#ifdef AW_PROFILER
+#include "profiler.hpp"
+#endif
 
 namespace another_world {
 
 	constexpr uint32_t	HEAP_SIZE		= 600000;
 	constexpr uint16_t	REGISTER_COUNT	= 256;
 	constexpr uint16_t	THREAD_COUNT	= 64;
+	constexpr uint16_t	NO_RESOURCE		= 0xffff;
 
 	extern uint16_t read_uint16_bigendian(const void* p);
 	extern uint32_t read_uint32_bigendian(const void* p);
 
-	extern bool (*read_file)(std::string filename, uint32_t offset, uint32_t length, char* buffer);
-	extern bool (*write_file)(std::string filename, uint32_t length, char* buffer);
-	extern void (*debug)(const char *fmt, ...);
-	extern void (*update_screen)(uint8_t *buffer);
-	extern void (*set_palette)(uint16_t* palette);
-	extern void (*debug_display_update)();
-
-	void init_resources();
-	void load_chapter_resources();
-	void load_needed_resources();
-
-	// three buffers for 320 x 200 (4 bits per pixel)
-	extern uint8_t vram0[320 * 200 / 2];
-	extern uint8_t vram1[320 * 200 / 2];
-	extern uint8_t vram2[320 * 200 / 2];
-	extern uint8_t vram3[320 * 200 / 2];
-
-	extern uint8_t* vram[4];
-
 	// each chapter of the game has a set of fixed resources related to it.
 	// these include the vm code, video 1, video 2, and palette
 	struct ChapterResources {
@@ -51,8 +44,6 @@ namespace another_world {
 		bool up, down, left, right, action;
 	};
 
-	extern Input input;
-
 	struct Point {
 		int16_t x, y;
 	};
@@ -61,32 +52,176 @@ namespace another_world {
 		int16_t x, y, w, h;
 	};
 
+  struct Engine;
+  struct ResourceStore;
+  struct AssetPack;
+
+  // where a resource lives in the bank files, one memlist record
   struct Resource {
-    enum class State { NOT_NEEDED = 0, LOADED = 1, NEEDS_LOADING = 2, END_OF_MEMLIST = 0xff };
-    enum class Type { SOUND = 0, MUSIC = 1, IMAGE = 2, PALETTE = 3, BYTECODE = 4, POLYGON = 5, BANK = 6 };
+    enum class State : uint8_t { NOT_NEEDED = 0, LOADED = 1, NEEDS_LOADING = 2, END_OF_MEMLIST = 0xff };
+    enum class Type : uint8_t { SOUND = 0, MUSIC = 1, IMAGE = 2, PALETTE = 3, BYTECODE = 4, POLYGON = 5, BANK = 6 };
 
-    State     state;
     Type      type;
     uint8_t   bank_id;
     uint32_t  bank_offset;
     uint16_t  packed_size;
     uint16_t  size;
-    uint8_t  *data;
+  };
 
-    bool load(uint8_t* destination);
+  // every resource's definition and state kept in parallel arrays indexed
+  // by resource id. each resource is also on the list for its state, so
+  // passes that only care about, say, the resources waiting to be loaded
+  // visit just those rather than the whole table. states must be changed
+  // through set_state() to keep the lists in step
+  struct ResourceTable {
+    std::vector<Resource::Type> types;
+    std::vector<uint8_t>        bank_ids;
+    std::vector<uint32_t>       bank_offsets;
+    std::vector<uint16_t>       packed_sizes;
+    std::vector<uint16_t>       sizes;
+    std::vector<const uint8_t*> data;       // contents while LOADED
+
+    uint16_t size() const { return uint16_t(types.size()); }
+
+    // true if `id` is a resource of type `type`
+    bool is(uint16_t id, Resource::Type type) const { return id < size() && types[id] == type; }
+
+    Resource::State state(uint16_t id) const { return states[id]; }
+    void set_state(uint16_t id, Resource::State state);
+
+    // ids of the resources in `state` (anything but END_OF_MEMLIST), in no
+    // particular order
+    const std::vector<uint16_t>& with_state(Resource::State state) const { return lists[uint8_t(state)]; }
+
+    // appends a resource, returning its id
+    uint16_t add(const Resource& definition);
+    Resource definition(uint16_t id) const;
+    void clear();
+
+    // bytes allocated by the table
+    size_t memory_used() const;
+
+  private:
+    std::vector<Resource::State> states;
+    std::vector<uint16_t> positions;        // where each resource is on its state's list
+    std::vector<uint16_t> lists[3];
   };
 
+	// everything a game runs against other than the vm's own state: the
+	// host callbacks, the video pages, the input and the resources. every
+	// VirtualMachine owns one so any number of games can run side by side
+	// in one process without sharing anything
+	struct Engine {
+		// host callbacks, each is handed `user` so a host running several
+		// games can tell which one is calling
+		void* user = nullptr;
+		bool (*read_file)(void* user, std::string filename, uint32_t offset, uint32_t length, char* buffer) = nullptr;
+		uint32_t (*file_size)(void* user, std::string filename) = nullptr;   // zero if the file doesn't exist
+		// optional, maps a whole file read only (nullptr if it can't) until
+		// it's unmapped again
+		const uint8_t* (*map_file)(void* user, std::string filename, uint32_t* size) = nullptr;
+		void (*unmap_file)(void* user, const uint8_t* data, uint32_t size) = nullptr;
+		bool (*write_file)(void* user, std::string filename, uint32_t length, char* buffer) = nullptr;
+		void (*debug)(void* user, const char *fmt, ...) = nullptr;
+		void (*update_screen)(void* user, uint8_t *buffer) = nullptr;
+		void (*set_palette)(void* user, uint16_t* palette) = nullptr;
+		void (*debug_display_update)(void* user) = nullptr;
+
+		// four buffers for 320 x 200 (pixel format depends on Framebuffer)
+		//
+		//   0 - background 1 (also used for clone drawing operations)
+		//   1 - framebuffer 1
+		//   2 - framebuffer 2
+		//   3 - background 2
+		uint8_t vram[4][VRAM_SIZE] = {};
+
+		Input input = {};
+
+#ifdef AW_TRACE
+		// the vm's phases are timed into this if set (see trace.hpp)
+		Trace* trace = nullptr;
+#endif
+
+		ResourceTable resources;
+		uint32_t resource_heap_offset = 0;
+		std::vector<uint8_t> resource_heap;   // HEAP_SIZE bytes once anything is loaded into it
+
+		// when set resources are taken from the store (see resource-store.hpp)
+		// instead of being unpacked into the heap, which is then never
+		// allocated
+		std::shared_ptr<ResourceStore> store;
+
+		// when set resources are used where they lie in the pack (see
+		// asset-pack.hpp), only those it doesn't have come from the store or
+		// the banks. dropped by init_resources() if it doesn't match the data
+		std::shared_ptr<AssetPack> pack;
+
+		Engine() = default;
+		Engine(const Engine&) = delete;
+		Engine& operator=(const Engine&) = delete;
+
+		// load the resource definitions from memlist.bin
+		void init_resources();
+
+		// loads all resources that are currently in the NEEDS_LOADING state
+		void load_needed_resources();
+
+		// read resource `id` from the pack or its bank into `destination`
+		// and unpack it there ready to use (images in the framebuffer
+		// format), which must have room for the larger of its packed and
+		// unpacked sizes
+		bool load_resource(uint16_t id, uint8_t* destination);
+
+		// contents of resource `id` from the pack or store, nullptr if it has
+		// to be loaded into the heap
+		const uint8_t* shared_resource(uint16_t id);
+
+		// address of `offset` in the resource heap, allocating the heap the
+		// first time it's needed
+		uint8_t* heap(uint32_t offset);
+	};
+
 	struct Thread {
 		uint16_t pc;
 		bool paused;
 	};
 
-	extern std::vector<Resource*> resources;
-	extern uint32_t resource_heap_offset;
-	extern uint8_t resource_heap[HEAP_SIZE];
-	extern ChapterResources chapter_resources[10];
+	// an in progress transition between two palettes, colours are stored
+	// in the format 0x0RGB
+	struct PaletteFade {
+		uint16_t from[16];
+		uint16_t to[16];
+		uint8_t  step = 0;
+		uint8_t  steps = 0;   // zero when no fade is in progress
+	};
+
+	// drawing into a page that is waiting to be rasterised, only used while
+	// fast forwarding (see VirtualMachine::set_fast_forward())
+	struct DeferredPage {
+		// a page that is drawn into but never cleared or copied over is
+		// rasterised once this many draws are waiting
+		static constexpr uint32_t MAX_DRAWS = 2048;
+
+		struct Draw {
+			uint8_t color;
+			uint8_t point_count;
+			uint32_t first_point;       // index into points
+			Point pos;                  // text only
+			const std::string* text;    // nullptr for polygons
+		};
+
+		std::vector<Draw> draws;
+		std::vector<Point> points;
+		bool reads_mask = false;      // some draws copy pixels from page 0
+
+		void clear() { draws.clear(); points.clear(); reads_mask = false; }
+	};
+
+	extern const ChapterResources chapter_resources[10];
 
   struct VirtualMachine {
+		Engine engine;
+
 		uint32_t ticks = 0;
 
 		uint8_t   chapter_id;
@@ -95,31 +230,88 @@ namespace another_world {
     int16_t   registers[REGISTER_COUNT];
     std::vector<uint16_t> call_stack;
 
-    Resource *palette;
-    Resource *code;
-    Resource *background;
-    Resource *characters;
-
-    uint8_t *working_vram = vram[0];
-		uint8_t *visible_vram = vram[0];
+    // ids of the chapter's resources
+    uint16_t palette = NO_RESOURCE;
+    uint16_t code = NO_RESOURCE;
+    uint16_t background = NO_RESOURCE;
+    uint16_t characters = NO_RESOURCE;
+
+    uint8_t *working_vram = engine.vram[0];
+		uint8_t *visible_vram = engine.vram[0];
+
+		// palette currently displayed (0x0RGB) and any fade towards a new one
+		uint16_t current_palette[16];
+		bool current_palette_valid = false;
+		PaletteFade palette_fade;
+
+		// sound effects started by the snd opcode and music started by the
+		// music opcode
+		Mixer mixer;
+		Sequencer sequencer{ mixer, registers };
+
+		// fast forward: only every `present_interval`th frame that shows a
+		// page is passed to update_screen() (along with any palette change
+		// since the last one) and drawing is deferred until a page's
+		// contents are actually needed, so frames that are cleared or
+		// copied over before they're shown are never rasterised
+		bool fast_forward = false;
+		uint32_t present_interval = 1;
+		uint32_t frames_since_present = 0;
+		bool palette_pending = false;
+		DeferredPage deferred_pages[4];
+
+		// verification of `code`, redone whenever the code changes. threads
+		// only run unchecked where it allows (see verifier.hpp)
+		VerifiedCode verified_code;
+		uint16_t verified_resource = NO_RESOURCE;
+
+		// statistics
+		uint32_t skipped_presents = 0;
+		uint32_t skipped_draws = 0;   // deferred draws that were never rasterised
+		uint32_t checked_thread_runs = 0;   // times a thread ran with every instruction checked
+
+#ifdef AW_PROFILER
+		// every instruction executed is recorded here if set (see profiler.hpp)
+		Profiler* profiler = nullptr;
+#endif
 
     void init();
     void initialise_chapter(uint16_t id);
     void execute_threads();
+		template<bool CHECKED> bool run_thread(uint8_t thread_id, std::map<uint8_t, Thread>& requested_thread_state);
+		void stop_thread(uint8_t thread_id, uint16_t address, const char* reason);
+		void update_verified_code();
 		void process_input();
 
+		// anything reading vram directly (snapshots, hashes, etc.) while
+		// fast forwarding must call flush_pages() first. turning fast
+		// forward off flushes and presents the visible page
+		void set_fast_forward(bool enabled, uint32_t interval = 8);
+		void flush_pages();
+		void flush_page(uint8_t* page);
+		void flush_mask_readers();
+		void discard_page(uint8_t* page);
+		DeferredPage* deferred_page(uint8_t* page);
+		void present();
+
     uint8_t fetch_byte(uint16_t* pc);
-		uint8_t fetch_byte(uint8_t* b, uint32_t* c);
+		uint8_t fetch_byte(const uint8_t* b, uint32_t* c);
     uint16_t fetch_word(uint16_t* pc);
-		uint16_t fetch_word(uint8_t* b, uint32_t* c);
+		uint16_t fetch_word(const uint8_t* b, uint32_t* c);
 
 		uint8_t* get_vram_from_id(uint8_t id);
 
+		// palette changes
+		void change_palette(uint8_t id, uint8_t speed);
+		void step_palette_fade();
+		void apply_palette(const uint16_t* colors);
+		void send_palette();
+
 		// vm drawing routines
-		void draw_shape(uint8_t color, Point pos, int16_t zoom, uint8_t* buffer, uint32_t *offset);
-		void draw_shape_group(uint8_t color, Point pos, int16_t zoom, uint8_t* buffer, uint32_t* offset);
-		void draw_polygon(uint8_t color, Point pos, int16_t zoom, uint8_t* buffer, uint32_t *offset);
-		void draw_text(uint8_t color, Point pos, std::string text);
+		void draw_shape(uint8_t color, Point pos, int16_t zoom, const uint8_t* buffer, uint32_t *offset);
+		void draw_shape_group(uint8_t color, Point pos, int16_t zoom, const uint8_t* buffer, uint32_t* offset);
+		void draw_polygon(uint8_t color, Point pos, int16_t zoom, const uint8_t* buffer, uint32_t *offset);
+		void draw_text(uint8_t color, Point pos, const std::string& text);
 
 		// primitive drawing routines
 		void polygon(uint8_t* target, uint8_t color, Point* points, uint8_t point_count);
@@ -0,0 +1,311 @@
+/*
+  replays many recorded sessions in parallel, one engine per session
+
+  usage: batch <data directory> <session>... [options]
+
+    <session>           an input log written by run --record, or a
+                        directory to replay every .awil file in
+    --threads <n>       worker threads (default one per core)
+    --fast-forward <n>  as for run
+    --csv <file>        also write the per session results as CSV
+    --private-heaps     unpack the resources into every engine's own heap
+                        rather than sharing them between all the engines
+    --pack <file>       use the asset pack <file> in the data directory
+                        (see pack), shared by every engine
+
+  a session recorded from a save state (run --load) is started from the
+  save state with the same name and the extension .awss, e.g. boss.awil
+  starts from boss.awss.
+
+  the engines share one ResourceStore, so each resource is unpacked once
+  for the whole batch and an engine needs little more than its vm state
+  and video pages. the memory per engine and the start up cost are
+  reported with the results.
+
+  sessions are run longest first across a work stealing pool. each one
+  reports its final frame hash against the recording and how long its
+  frames took, then the batch reports the throughput across all threads.
+  exits with 1 if any session fails or doesn't match its recording
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "work-pool.hpp"
+#include "../another-world/asset-pack.hpp"
+#include "../another-world/input-log.hpp"
+#include "../another-world/resource-store.hpp"
+#include "../another-world/snapshot.hpp"
+
+using namespace another_world;
+
+struct Session {
+  std::string path;
+  InputLog log;
+  std::vector<uint8_t> snapshot;        // only for sessions starting from a save state
+
+  // results
+  enum class Status { PENDING, MATCH, MISMATCH, FAILED } status = Status::PENDING;
+  uint64_t hash = 0;
+  double ms = 0;                        // time spent running frames
+  double load_ms = 0;                   // time spent starting the engine
+  size_t memory = 0;                    // allocated by the engine for itself
+};
+
+static const char* status_name(Session::Status status) {
+  switch (status) {
+    case Session::Status::MATCH:    return "match";
+    case Session::Status::MISMATCH: return "MISMATCH";
+    case Session::Status::FAILED:   return "FAILED";
+    default:                        return "pending";
+  }
+}
+
+static bool load_session(const std::string& path, std::vector<Session>& sessions) {
+  Session session;
+  session.path = path;
+
+  std::vector<uint8_t> data;
+  if (!read_input(path, data)) {
+    return false;
+  }
+  if (!session.log.decode(data.data(), uint32_t(data.size()))) {
+    printf("'%s' is not a valid input log\n", path.c_str());
+    return false;
+  }
+
+  if (session.log.chapter == InputLog::FROM_SNAPSHOT) {
+    std::string state = std::filesystem::path(path).replace_extension(".awss").string();
+    if (!read_input(state, session.snapshot)) {
+      return false;
+    }
+  }
+
+  sessions.push_back(std::move(session));
+  return true;
+}
+
+static void run_session(Session& session, uint32_t fast_forward, std::shared_ptr<ResourceStore> store, std::shared_ptr<AssetPack> pack) {
+  using clock = std::chrono::steady_clock;
+  clock::time_point load_start = clock::now();
+
+  std::unique_ptr<VirtualMachine> vm(new VirtualMachine());
+  use_data_files(vm->engine);
+  use_null_display(vm->engine);
+  vm->engine.store = store;
+  vm->engine.pack = pack;
+
+  vm->init();
+  if (session.log.chapter == InputLog::FROM_SNAPSHOT) {
+    if (!restore_snapshot(*vm, session.snapshot.data(), uint32_t(session.snapshot.size()))) {
+      session.status = Session::Status::FAILED;
+      return;
+    }
+  } else {
+    vm->initialise_chapter(session.log.chapter);
+  }
+
+  session.load_ms = std::chrono::duration<double, std::milli>(clock::now() - load_start).count();
+  session.memory = sizeof(VirtualMachine) + vm->engine.resource_heap.capacity() +
+    vm->engine.resources.memory_used();
+
+  if (fast_forward) {
+    vm->set_fast_forward(true, fast_forward);
+  }
+
+  clock::time_point start = clock::now();
+
+  for (uint32_t frame = 0; frame < session.log.frames(); frame++) {
+    vm->engine.input = session.log.frame(frame);
+    vm->execute_threads();
+  }
+
+  vm->flush_pages();
+  session.hash = frame_hash(*vm);
+  session.ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  session.status = session.hash == session.log.final_hash ? Session::Status::MATCH : Session::Status::MISMATCH;
+}
+
+static bool write_csv(const std::string& path, const std::vector<Session>& sessions) {
+  std::string csv = "session,status,frames,ms,frames_per_second,hash,expected_hash\n";
+  for (auto& session : sessions) {
+    char line[512];
+    snprintf(line, sizeof(line), "%s,%s,%u,%.3f,%.0f,%016llx,%016llx\n", session.path.c_str(), status_name(session.status),
+      session.log.frames(), session.ms, session.ms > 0 ? session.log.frames() * 1000.0 / session.ms : 0.0,
+      (unsigned long long)session.hash, (unsigned long long)session.log.final_hash);
+    csv += line;
+  }
+  return write_output(path, csv);
+}
+
+int batch(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("usage: batch <data directory> <session>... [--threads <n>] [--fast-forward <n>] [--csv <file>] [--private-heaps] [--pack <file>]\n");
+    return 1;
+  }
+
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t fast_forward = 0;
+  bool private_heaps = false;
+  std::string csv_path, pack_path;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--private-heaps") {
+      private_heaps = true;
+    } else if (arg.rfind("--", 0) == 0) {
+      if (i + 1 >= argc) {
+        printf("missing value for '%s'\n", argv[i]);
+        return 1;
+      }
+
+      if (arg == "--threads") {
+        threads = std::max(1, atoi(argv[++i]));
+      } else if (arg == "--fast-forward") {
+        fast_forward = uint32_t(atoi(argv[++i]));
+      } else if (arg == "--csv") {
+        csv_path = argv[++i];
+      } else if (arg == "--pack") {
+        pack_path = argv[++i];
+      } else {
+        printf("unknown option '%s'\n", argv[i]);
+        return 1;
+      }
+    } else if (std::filesystem::is_directory(arg)) {
+      // sorted so the order (and the csv) doesn't depend on the file system
+      std::vector<std::string> found;
+      for (auto& entry : std::filesystem::directory_iterator(arg)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".awil") {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      paths.insert(paths.end(), found.begin(), found.end());
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  // check the data directory once up front, each worker then installs the
+  // same callbacks into its own engines
+  std::unique_ptr<Engine> probe(new Engine());
+  if (!use_data_directory(*probe, argv[0])) {
+    return 1;
+  }
+
+  std::shared_ptr<AssetPack> pack;
+  if (!pack_path.empty()) {
+    probe->pack = AssetPack::open(*probe, pack_path);
+    if (!probe->pack) {
+      printf("no usable asset pack '%s', loading from the banks\n", pack_path.c_str());
+    }
+  }
+
+  // the probe drops a pack that doesn't match the data
+  probe->init_resources();
+  pack = probe->pack;
+
+  std::shared_ptr<ResourceStore> store;
+  if (!private_heaps) {
+    store = std::make_shared<ResourceStore>(*probe);
+  }
+  probe.reset();
+
+  std::vector<Session> sessions;
+  for (auto& path : paths) {
+    if (!load_session(path, sessions)) {
+      return 1;
+    }
+  }
+
+  if (sessions.empty()) {
+    printf("no sessions to run\n");
+    return 1;
+  }
+
+  // hand out the longest sessions first so the short ones fill in the gaps
+  // at the end of the batch
+  std::vector<uint32_t> order(sessions.size());
+  for (uint32_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&sessions](uint32_t a, uint32_t b) {
+    return sessions[a].log.frames() > sessions[b].log.frames();
+  });
+
+  threads = std::min(threads, uint32_t(sessions.size()));
+  printf("running %zu sessions on %u threads\n", sessions.size(), threads);
+
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now();
+
+  std::mutex output;
+  uint32_t completed = 0;
+
+  WorkPool pool;
+  pool.run(order, threads, [&](uint32_t task, uint32_t worker) {
+    Session& session = sessions[task];
+    run_session(session, fast_forward, store, pack);
+
+    std::lock_guard<std::mutex> guard(output);
+    completed++;
+    printf("[%u/%zu] %-8s %8u frames %9.1fms  %016llx  %s\n", completed, sessions.size(), status_name(session.status),
+      session.log.frames(), session.ms, (unsigned long long)session.hash, session.path.c_str());
+  });
+
+  double wall_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  uint64_t frames = 0;
+  double busy_ms = 0;
+  double load_ms = 0, max_load_ms = 0;
+  size_t memory = 0;
+  uint32_t failed = 0;
+  for (auto& session : sessions) {
+    frames += session.log.frames();
+    busy_ms += session.ms;
+    load_ms += session.load_ms;
+    max_load_ms = std::max(max_load_ms, session.load_ms);
+    memory = std::max(memory, session.memory);
+    failed += session.status != Session::Status::MATCH;
+  }
+
+  printf("\n%llu frames in %.2fs, %.0f frames per second across %u threads (%.0f per thread)\n",
+    (unsigned long long)frames, wall_ms / 1000.0, wall_ms > 0 ? frames * 1000.0 / wall_ms : 0.0, threads,
+    busy_ms > 0 ? frames * 1000.0 / busy_ms : 0.0);
+  printf("threads busy running frames %.0f%% of the time, %u sessions stolen\n",
+    wall_ms > 0 ? busy_ms * 100.0 / (wall_ms * threads) : 0.0, pool.steals.load());
+  printf("%.1fKB per engine, engines started in %.3fms on average (slowest %.3fms)\n",
+    memory / 1024.0, load_ms / sessions.size(), max_load_ms);
+  if (pack) {
+    printf("resources taken from the asset pack where it has them\n");
+  }
+  if (store) {
+    printf("%u resources shared between the engines, %.1fKB unpacked once in %.3fms\n",
+      store->unpacked.load(), store->unpacked_bytes / 1024.0, store->unpack_ns / 1e6);
+    if (store->failed) {
+      printf("%u resources couldn't be read or unpacked into the store\n", store->failed.load());
+    }
+  }
+
+  if (!csv_path.empty() && !write_csv(csv_path, sessions)) {
+    return 1;
+  }
+
+  if (failed) {
+    printf("%u of %zu sessions FAILED or didn't match their recording\n", failed, sessions.size());
+    return 1;
+  }
+
+  printf("all %zu sessions matched\n", sessions.size());
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+  framebuffer benchmarks
+
+  runs every raster kernel against both pixel formats so the speed and
+  memory trade-off between them can be compared on the same machine,
+  regardless of which format the engine itself was built with
+*/
+
+#include <cstdio>
+#include <vector>
+
+#include "bench.hpp"
+#include "../another-world/framebuffer.hpp"
+
+using namespace another_world;
+
+namespace {
+
+  struct Span {
+    int16_t x1, x2, y;
+    uint8_t color;
+  };
+
+  // deterministic xorshift so both formats see the same workload
+  uint32_t random(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // a spread of span lengths roughly matching the polygons in the game,
+  // mostly solid colours with a sprinkling of blend and mask spans
+  std::vector<Span> make_spans(uint32_t count) {
+    std::vector<Span> spans(count);
+    uint32_t state = 0x12345678;
+
+    for (auto& span : spans) {
+      int16_t length = random(state) % 4 == 0 ? random(state) % 320 : random(state) % 48;
+      span.x1 = random(state) % (320 - length);
+      span.x2 = span.x1 + length;
+      span.y = random(state) % 200;
+
+      uint32_t c = random(state) % 16;
+      span.color = c == 0 ? COLOR_BLEND : (c == 1 ? COLOR_BLEND + 1 : uint8_t(c));
+    }
+
+    return spans;
+  }
+
+  template<typename F>
+  void run_format() {
+    std::vector<uint8_t> pages(F::page_size * 4, 0);
+    uint8_t* page = &pages[0];
+    uint8_t* mask = &pages[F::page_size];
+    uint8_t* other = &pages[F::page_size * 2];
+
+    std::vector<uint8_t> planar(32000);
+    uint32_t state = 0xcafef00d;
+    for (auto& b : planar) {
+      b = random(state);
+    }
+
+    auto spans = make_spans(4096);
+
+    uint64_t span_pixels = 0;
+    for (auto& span : spans) {
+      span_pixels += span.x2 - span.x1 + 1;
+    }
+
+    printf("%s: %u bytes per page, %u bytes for all four pages\n", F::name, F::page_size, F::page_size * 4);
+
+    double ns = measure_ns([&]() {
+      for (auto& span : spans) {
+        for (int16_t x = span.x1; x <= span.x2; x++) {
+          F::plot(page, x, span.y, span.color, mask);
+        }
+      }
+      keep(page);
+    });
+    printf("  %-24s %8.2f ns/pixel\n", "plot (per pixel)", ns / span_pixels);
+
+    ns = measure_ns([&]() {
+      for (auto& span : spans) {
+        F::span(page, span.x1, span.x2, span.y, span.color, mask);
+      }
+      keep(page);
+    });
+    printf("  %-24s %8.2f ns/pixel\n", "span fill", ns / span_pixels);
+
+    ns = measure_ns([&]() { F::clear(page, 7); keep(page); });
+    printf("  %-24s %8.2f us/page\n", "clear", ns / 1000.0);
+
+    ns = measure_ns([&]() { F::copy(other, page); keep(other); });
+    printf("  %-24s %8.2f us/page\n", "copy", ns / 1000.0);
+
+    ns = measure_ns([&]() { F::from_planar(page, &planar[0]); keep(page); });
+    printf("  %-24s %8.2f us/image\n", "planar image decode", ns / 1000.0);
+
+    uint8_t indices[320];
+    ns = measure_ns([&]() {
+      for (int16_t y = 0; y < 200; y++) {
+        F::unpack_row(page, y, indices);
+        keep(indices);
+      }
+    });
+    printf("  %-24s %8.2f us/page\n", "unpack to indices", ns / 1000.0);
+  }
+
+}
+
+int bench_framebuffer(int argc, char* argv[]) {
+  run_format<PackedFramebuffer>();
+  printf("\n");
+  run_format<ChunkyFramebuffer>();
+  printf("\nengine built with: %s\n", Framebuffer::name);
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+  logging benchmarks
+
+  compares the cost of logging one instruction trace line (the format the
+  vm uses when tracing) by opening the log, formatting, writing a line and
+  closing it again against handing the same arguments to the asynchronous
+  logger, both flat out (where writing the log file is the limit) and in
+  bursts that fit in its ring. the log files are written to the system's temporary directory
+*/
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "bench.hpp"
+#include "../another-world/logger.hpp"
+
+using namespace another_world;
+
+static const char* TRACE_FORMAT = "%6i)  %2i [%05u] > %02x:%-6s";
+
+// what the game's debug callback did before the logger, one open, format,
+// write and close per line
+static void log_line(const char* path, const char* fmt, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, fmt);
+  int length = vsnprintf(line, sizeof(line) - 1, fmt, args);
+  va_end(args);
+  line[length] = '\n';
+
+  FILE* file = fopen(path, "ab");
+  fwrite(line, 1, length + 1, file);
+  fclose(file);
+}
+
+int bench_log(int argc, char* argv[]) {
+  std::string text_path = std::string(P_tmpdir) + "/aw-bench.log";
+  std::string binary_path = std::string(P_tmpdir) + "/aw-bench.awlog";
+
+  uint32_t i = 0;
+  remove(text_path.c_str());
+  double per_line_ns = measure_ns([&]() {
+    i++;
+    log_line(text_path.c_str(), TRACE_FORMAT, i, i & 63, i & 0xffff, i & 0x1a, "mov");
+  });
+  remove(text_path.c_str());
+
+  Logger logger;
+  if (!logger.open(binary_path)) {
+    printf("unable to create '%s'\n", binary_path.c_str());
+    return 1;
+  }
+  double logger_ns = measure_ns([&]() {
+    i++;
+    logger.log(TRACE_FORMAT, i, i & 63, i & 0xffff, i & 0x1a, "mov");
+  });
+  uint64_t waits = logger.waits;
+
+  // bursts that fit in the ring, so the drain thread never holds the
+  // logging thread up (how the vm logs, a frame's instructions at a time)
+  const uint32_t burst = Logger::RING_RECORDS / 2;
+  double burst_ns = 0;
+  for (uint32_t b = 0; b < 20; b++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t j = 0; j < burst; j++) {
+      i++;
+      logger.log(TRACE_FORMAT, i, i & 63, i & 0xffff, i & 0x1a, "mov");
+    }
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) / burst;
+    burst_ns = b == 0 ? ns : std::min(burst_ns, ns);
+  }
+  logger.close();
+  remove(binary_path.c_str());
+
+  printf("  %-28s %10.1fns per line\n", "open, format, write, close", per_line_ns);
+  printf("  %-28s %10.1fns per line (%.0fx faster, %llu waits for the drain thread)\n", "asynchronous, sustained", logger_ns,
+    per_line_ns / logger_ns, (unsigned long long)waits);
+  printf("  %-28s %10.1fns per line (%.0fx faster)\n", "asynchronous, bursts", burst_ns, per_line_ns / burst_ns);
+
+  return 0;
+}
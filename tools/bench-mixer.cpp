@@ -0,0 +1,84 @@
+/*
+  mixer benchmarks
+
+  mixes four looping synthetic samples at different playback rates and
+  reports the cost of producing one second of audio. passing --wav <path>
+  also writes ten seconds of the mixed output for listening to
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/mixer.hpp"
+
+using namespace another_world;
+
+int bench_mixer(int argc, char* argv[]) {
+  const char* wav_path = nullptr;
+  for (int i = 0; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--wav") == 0) {
+      wav_path = argv[i + 1];
+    }
+  }
+
+  // one cycle of a sine wave, a sawtooth, a square wave and some noise
+  std::vector<int8_t> data[4];
+  uint32_t state = 0x2545f491;
+  for (uint32_t i = 0; i < 64; i++) {
+    data[0].push_back(int8_t(std::sin(i * 6.2831853f / 64.0f) * 127.0f));
+    data[1].push_back(int8_t(i * 4 - 128));
+    data[2].push_back(i < 32 ? 100 : -100);
+    state = state * 1664525 + 1013904223;
+    data[3].push_back(int8_t(state >> 24));
+  }
+
+  Mixer mixer;
+  const uint16_t rates[4] = { 8000, 11025, 16000, 22050 };
+  auto start = [&]() {
+    for (uint8_t c = 0; c < Mixer::CHANNEL_COUNT; c++) {
+      Sample sample;
+      sample.data = data[c].data();
+      sample.length = uint32_t(data[c].size());
+      sample.loop_length = sample.length;
+      mixer.play(c, sample, rates[c], 48);
+    }
+  };
+
+  printf("  simd: %s\n", Mixer::simd_name());
+
+  std::vector<int16_t> output(mixer.sample_rate);
+  start();
+  double ns = measure_ns([&]() {
+    mixer.mix(&output[0], mixer.sample_rate);
+    keep(&output[0]);
+  });
+  printf("  %-24s %8.2f us/second %8.0fx realtime\n", "mix (4 channels)", ns / 1000.0, 1e9 / ns);
+
+  // the same through the ring as the frontend uses it, a frame's worth of
+  // samples produced and consumed at a time
+  uint32_t frame = mixer.sample_rate / 50;
+  ns = measure_ns([&]() {
+    for (uint32_t i = 0; i < 50; i++) {
+      mixer.produce(frame);
+      mixer.consume(&output[0], frame);
+    }
+    keep(&output[0]);
+  });
+  printf("  %-24s %8.2f us/second %8.0fx realtime\n", "produce + consume", ns / 1000.0, 1e9 / ns);
+
+  if (wav_path) {
+    std::vector<int16_t> samples(mixer.sample_rate * 10);
+    start();
+    mixer.mix(&samples[0], uint32_t(samples.size()));
+    if (!write_output(wav_path, encode_wav(samples.data(), uint32_t(samples.size()), mixer.sample_rate))) {
+      return 1;
+    }
+    printf("  wrote %s\n", wav_path);
+  }
+
+  return 0;
+}
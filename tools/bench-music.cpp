@@ -0,0 +1,104 @@
+/*
+  music sequencer benchmark
+
+  plays a synthetic module with a new note on every channel on every row
+  (far busier than any of the game's music) and reports the cost of
+  rendering one second at 44.1kHz as a share of one core. passing
+  --wav <path> also writes thirty seconds of the output
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/sequencer.hpp"
+
+using namespace another_world;
+
+static void put16(std::vector<uint8_t>& data, size_t offset, uint16_t value) {
+  data[offset] = value >> 8;
+  data[offset + 1] = value & 0xff;
+}
+
+int bench_music(int argc, char* argv[]) {
+  const char* wav_path = nullptr;
+  for (int i = 0; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--wav") == 0) {
+      wav_path = argv[i + 1];
+    }
+  }
+
+  // four instruments in the SOUND resource format, a short decaying
+  // attack followed by a looped single cycle
+  std::vector<uint8_t> sounds[4];
+  const uint8_t* instruments[Sequencer::INSTRUMENT_COUNT] = { nullptr };
+  uint32_t instrument_sizes[Sequencer::INSTRUMENT_COUNT] = { 0 };
+  for (uint8_t s = 0; s < 4; s++) {
+    const uint16_t attack = 512, loop = 32;
+    std::vector<uint8_t>& sound = sounds[s];
+    sound.assign(8 + attack + loop, 0);
+    put16(sound, 0, attack / 2);
+    put16(sound, 2, loop / 2);
+    for (uint16_t i = 0; i < attack + loop; i++) {
+      float phase = (i % loop) * 6.2831853f / loop;
+      float shape = s == 0 ? std::sin(phase) : (s == 1 ? (i % loop) / 16.0f - 1.0f : (s == 2 ? (i % loop < 16 ? 1.0f : -1.0f) : std::sin(phase * 2.0f)));
+      float envelope = i < attack ? 1.0f - i / float(attack) * 0.5f : 0.5f;
+      sound[8 + i] = uint8_t(int8_t(shape * envelope * 120.0f));
+    }
+    instruments[s] = sound.data();
+    instrument_sizes[s] = uint32_t(sound.size());
+  }
+
+  // one pattern played over and over
+  const uint16_t order_count = 128;
+  std::vector<uint8_t> module(0xc0 + 1024, 0);
+  put16(module, 0, 0x0f00);
+  for (uint8_t i = 0; i < 4; i++) {
+    put16(module, 2 + i * 4, i + 1);
+    put16(module, 4 + i * 4, 48);
+  }
+  put16(module, 0x3e, order_count);
+
+  const uint16_t scale[8] = { 428, 381, 339, 320, 285, 254, 226, 214 };
+  for (uint8_t row = 0; row < 64; row++) {
+    for (uint8_t channel = 0; channel < 4; channel++) {
+      size_t note = 0xc0 + row * 16 + channel * 4;
+      put16(module, note, scale[(row + channel * 3) % 8] >> (channel & 1));
+      put16(module, note + 2, uint16_t((channel + 1) << 12));
+    }
+  }
+
+  int16_t registers[256] = { 0 };
+  Mixer mixer(44100);
+  Sequencer sequencer(mixer, registers);
+
+  std::vector<int16_t> output(mixer.sample_rate);
+  sequencer.load(module.data(), uint32_t(module.size()), instruments, instrument_sizes, 0, 0);
+  sequencer.start();
+
+  double ns = measure_ns([&]() {
+    if (!sequencer.playing) {
+      sequencer.load(module.data(), uint32_t(module.size()), instruments, instrument_sizes, 0, 0);
+      sequencer.start();
+    }
+    mixer.mix(&output[0], mixer.sample_rate);
+    keep(&output[0]);
+  });
+  printf("  %-24s %8.2f us/second %6.3f%% of a core\n", "sequencer + mixer", ns / 1000.0, ns / 1e7);
+
+  if (wav_path) {
+    std::vector<int16_t> samples(mixer.sample_rate * 30);
+    sequencer.load(module.data(), uint32_t(module.size()), instruments, instrument_sizes, 0, 0);
+    sequencer.start();
+    mixer.mix(&samples[0], uint32_t(samples.size()));
+    if (!write_output(wav_path, encode_wav(samples.data(), uint32_t(samples.size()), mixer.sample_rate))) {
+      return 1;
+    }
+    printf("  wrote %s\n", wav_path);
+  }
+
+  return 0;
+}
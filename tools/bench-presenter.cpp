@@ -0,0 +1,120 @@
+/*
+  presentation benchmarks
+
+  compares converting a page to host pixels one palette lookup at a time
+  (how the Win32 frontend used to do it) against the presenter's two pixel
+  lookup table for each host format
+*/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "../another-world/presenter.hpp"
+
+using namespace another_world;
+
+int bench_presenter(int argc, char* argv[]) {
+  std::vector<uint8_t> page(VRAM_SIZE);
+  uint32_t state = 0x2545f491;
+  for (auto& b : page) {
+    state = state * 1664525 + 1013904223;
+    b = state >> 24;
+#ifdef AW_FRAMEBUFFER_CHUNKY
+    b &= 0x0f;
+#endif
+  }
+
+  // palette resource data is big endian 0x0RGB
+  uint16_t palette[16];
+  for (uint8_t i = 0; i < 16; i++) {
+    uint16_t c = i * 0x111;
+    palette[i] = uint16_t((c >> 8) | (c << 8));
+  }
+
+  std::vector<uint8_t> host(320 * 200 * 4);
+
+  Presenter reference(HostFormat::RGB24);
+  reference.set_palette(palette);
+
+  double ns = measure_ns([&]() {
+    uint8_t indices[320];
+    for (int16_t y = 0; y < 200; y++) {
+      Framebuffer::unpack_row(&page[0], y, indices);
+      uint8_t* pd = &host[y * 320 * 3];
+      for (uint16_t x = 0; x < 320; x++) {
+        uint32_t c = reference.colors[indices[x]];
+        *pd++ = c;
+        *pd++ = c >> 8;
+        *pd++ = c >> 16;
+      }
+    }
+    keep(&host[0]);
+  });
+  printf("  %-24s %8.2f us/frame\n", "per pixel (RGB24)", ns / 1000.0);
+
+  const struct { HostFormat format; const char* name; } formats[] = {
+    { HostFormat::RGB24, "RGB24" }, { HostFormat::XRGB32, "XRGB32" }, { HostFormat::RGB565, "RGB565" }
+  };
+
+  for (auto& format : formats) {
+    Presenter presenter(format.format);
+
+    ns = measure_ns([&]() { presenter.set_palette(palette); keep(presenter.pairs); });
+    printf("  %-24s %8.2f us/palette\n", (std::string("table rebuild (") + format.name + ")").c_str(), ns / 1000.0);
+
+    ns = measure_ns([&]() {
+      presenter.present(&page[0], &host[0], 320 * presenter.bytes_per_pixel);
+      keep(&host[0]);
+    });
+    printf("  %-24s %8.2f us/frame\n", (std::string("pair table (") + format.name + ")").c_str(), ns / 1000.0);
+  }
+
+  return 0;
+}
+
+int bench_scale(int argc, char* argv[]) {
+  std::vector<uint8_t> page(VRAM_SIZE);
+  uint32_t state = 0x9e3779b9;
+  for (auto& b : page) {
+    state = state * 1664525 + 1013904223;
+    b = state >> 24;
+#ifdef AW_FRAMEBUFFER_CHUNKY
+    b &= 0x0f;
+#endif
+  }
+
+  uint16_t palette[16];
+  for (uint8_t i = 0; i < 16; i++) {
+    uint16_t c = i * 0x111;
+    palette[i] = uint16_t((c >> 8) | (c << 8));
+  }
+
+  Presenter presenter(HostFormat::XRGB32);
+  presenter.set_palette(palette);
+
+  printf("  simd: %s\n", Presenter::simd_name());
+
+  const uint8_t scales[] = { 1, 3, 4 };
+  for (auto scale : scales) {
+    int32_t pitch = 320 * scale * 4;
+    std::vector<uint8_t> surface(pitch * 200 * scale);
+
+    double generic = measure_ns([&]() {
+      presenter.present_scaled_generic(&page[0], &surface[0], pitch, scale);
+      keep(&surface[0]);
+    });
+
+    double simd = measure_ns([&]() {
+      presenter.present_scaled(&page[0], &surface[0], pitch, scale);
+      keep(&surface[0]);
+    });
+
+    double megapixels = 320.0 * 200.0 * scale * scale / 1000000.0;
+    printf("  %ux  generic %8.2f us/frame   simd %8.2f us/frame (%6.0f Mpixels/s)\n",
+      scale, generic / 1000.0, simd / 1000.0, megapixels / (simd / 1000000000.0));
+  }
+
+  return 0;
+}
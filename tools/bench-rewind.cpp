@@ -0,0 +1,91 @@
+/*
+  rewind benchmarks
+
+  usage: bench rewind [data directory] [frames]
+
+  captures `frames` frames (default 1000) into the rewind history and
+  reports the cost per frame, then times seeking back various distances.
+  with a data directory the frames come from running the game headless,
+  otherwise a few synthetic shapes are moved around the pages each frame
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/rewind.hpp"
+
+using namespace another_world;
+
+int bench_rewind(int argc, char* argv[]) {
+  std::unique_ptr<VirtualMachine> vm(new VirtualMachine());
+  use_null_display(vm->engine);
+
+  bool game = argc > 0;
+  uint32_t frames = argc > 1 ? uint32_t(atoi(argv[1])) : 1000;
+
+  if (game) {
+    if (!use_data_directory(vm->engine, argv[0])) {
+      return 1;
+    }
+    vm->init();
+    vm->initialise_chapter(16001);
+  }
+
+  uint32_t state = 0x2545f491;
+  auto synthetic_frame = [&]() {
+    // redraw a handful of shapes into the working page and bump some
+    // registers, a rough stand in for a frame of the game
+    uint8_t* page = vm->engine.vram[1 + (vm->ticks & 1)];
+    for (uint32_t shape = 0; shape < 8; shape++) {
+      state = state * 1664525 + 1013904223;
+      int16_t x = (state >> 8) % 280, y = (state >> 20) % 160;
+      for (int16_t row = y; row < y + 40; row++) {
+        Framebuffer::span(page, x, x + 40, row, (state >> 28) & 0x0f, vm->engine.vram[0]);
+      }
+    }
+    vm->registers[state & 0xff] = int16_t(state >> 16);
+    vm->ticks++;
+  };
+
+  Rewind rewind;
+  for (uint32_t i = 0; i < frames; i++) {
+    if (game) {
+      vm->execute_threads();
+    } else {
+      synthetic_frame();
+    }
+    rewind.capture(*vm);
+  }
+
+  printf("  %s\n", rewind.report().c_str());
+
+  const uint32_t distances[] = { 1, 60, rewind.keyframe_interval - 1, frames / 2 };
+  for (auto distance : distances) {
+    if (distance >= rewind.available()) {
+      continue;
+    }
+
+    // seeking discards history so every run seeks in a fresh copy, the
+    // time taken to make the copy is measured separately and subtracted
+    Rewind copy = rewind;
+    double ns = measure_ns([&]() {
+      Rewind seek = copy;
+      seek.rewind(*vm, distance);
+      keep(vm->engine.vram[0]);
+    }, 100);
+    double copy_ns = measure_ns([&]() {
+      Rewind seek = copy;
+      keep(&seek);
+    }, 100);
+
+    char label[64];
+    snprintf(label, sizeof(label), "seek back %u frames", distance);
+    printf("  %-24s %8.2f us\n", label, std::max(ns - copy_ns, 0.0) / 1000.0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+  save state benchmarks
+
+  usage: bench snapshot [data directory] [frames]
+
+  with a data directory the game is run headless for `frames` frames
+  (default 500) to build up a realistic state, otherwise the video pages
+  are filled with synthetic polygons. reports the snapshot size and the
+  time taken to save and restore it
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/snapshot.hpp"
+
+using namespace another_world;
+
+int bench_snapshot(int argc, char* argv[]) {
+  std::unique_ptr<VirtualMachine> vm(new VirtualMachine());
+  use_null_display(vm->engine);
+
+  if (argc > 0) {
+    uint32_t frames = argc > 1 ? uint32_t(atoi(argv[1])) : 500;
+
+    if (!use_data_directory(vm->engine, argv[0])) {
+      return 1;
+    }
+    vm->init();
+    vm->initialise_chapter(16001);
+    for (uint32_t i = 0; i < frames; i++) {
+      vm->execute_threads();
+    }
+
+    printf("  state after %u frames of chapter %u\n", frames, vm->chapter_id);
+  } else {
+    // a scatter of flat coloured shapes, roughly what the game's scenes
+    // look like
+    uint32_t state = 0x2545f491;
+    for (uint8_t page = 0; page < 4; page++) {
+      for (uint32_t shape = 0; shape < 150; shape++) {
+        state = state * 1664525 + 1013904223;
+        int16_t x = (state >> 8) % 300, y = (state >> 20) % 180;
+        int16_t w = 4 + (state >> 4) % 60, h = 4 + (state >> 12) % 40;
+        uint8_t color = (state >> 28) & 0x0f;
+        for (int16_t row = y; row < std::min<int16_t>(y + h, 200); row++) {
+          Framebuffer::span(vm->engine.vram[page], x, std::min<int16_t>(x + w, 319), row, color, vm->engine.vram[0]);
+        }
+      }
+    }
+
+    printf("  synthetic pages\n");
+  }
+
+  std::vector<uint8_t> snapshot;
+  save_snapshot(*vm, snapshot);
+  printf("  %-24s %8zu bytes (%u bytes of raw pages)\n", "snapshot size", snapshot.size(), VRAM_SIZE * 4);
+
+  double ns = measure_ns([&]() {
+    save_snapshot(*vm, snapshot);
+    keep(snapshot.data());
+  });
+  printf("  %-24s %8.2f us\n", "save", ns / 1000.0);
+
+  ns = measure_ns([&]() {
+    restore_snapshot(*vm, snapshot.data(), uint32_t(snapshot.size()));
+    keep(vm->engine.vram[0]);
+  });
+  printf("  %-24s %8.2f us\n", "restore (resident)", ns / 1000.0);
+
+  return 0;
+}
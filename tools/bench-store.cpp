@@ -0,0 +1,111 @@
+/*
+  shared resource store benchmarks
+
+  usage: bench store <data directory> [instances] [chapter]
+
+  starts `instances` engines (default 8) on `chapter` (default 16001)
+  first each unpacking its own resources into its own heap, then all
+  sharing one ResourceStore, then (if the data directory has one, see the
+  pack tool) all using the asset pack. reports the memory each engine
+  needs and how long starting one takes, cold (the first engine, which
+  has to unpack everything) and warm (the average of the rest)
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/asset-pack.hpp"
+#include "../another-world/resource-store.hpp"
+
+using namespace another_world;
+
+// everything an engine allocates for itself, the resource store isn't
+// included as it's shared
+static size_t instance_memory(const VirtualMachine& vm) {
+  return sizeof(VirtualMachine) + vm.engine.resource_heap.capacity() +
+    vm.engine.resources.memory_used() + vm.call_stack.capacity() * sizeof(uint16_t);
+}
+
+struct StartupResult {
+  double cold_ms = 0;
+  double warm_ms = 0;       // mean of every instance after the first
+  size_t memory = 0;        // per instance
+};
+
+static StartupResult start_instances(uint32_t instances, uint16_t chapter, std::shared_ptr<ResourceStore> store,
+  bool use_pack = false) {
+  using clock = std::chrono::steady_clock;
+
+  StartupResult result;
+  std::vector<std::unique_ptr<VirtualMachine>> vms;
+  for (uint32_t i = 0; i < instances; i++) {
+    clock::time_point start = clock::now();
+
+    std::unique_ptr<VirtualMachine> vm(new VirtualMachine());
+    use_data_files(vm->engine);
+    use_null_display(vm->engine);
+    vm->engine.store = store;
+    if (use_pack) {
+      vm->engine.pack = AssetPack::open(vm->engine);
+    }
+    vm->init();
+    vm->initialise_chapter(chapter);
+
+    double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    if (i == 0) {
+      result.cold_ms = ms;
+    } else {
+      result.warm_ms += ms / (instances - 1);
+    }
+
+    result.memory = instance_memory(*vm);
+    vms.push_back(std::move(vm));
+  }
+
+  return result;
+}
+
+int bench_store(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("  skipped, needs a data directory (bench store <data directory> [instances] [chapter])\n");
+    return 0;
+  }
+
+  uint32_t instances = argc > 1 ? std::max(2, atoi(argv[1])) : 8;
+  uint16_t chapter = argc > 2 ? uint16_t(atoi(argv[2])) : 16001;
+
+  std::unique_ptr<Engine> probe(new Engine());
+  if (!use_data_directory(*probe, argv[0])) {
+    return 1;
+  }
+  probe->init_resources();
+
+  printf("  %u instances of chapter %u\n\n", instances, chapter);
+  printf("  %-16s %14s %14s %14s %14s\n", "", "per instance", "shared", "cold start", "warm start");
+
+  StartupResult own = start_instances(instances, chapter, nullptr);
+  printf("  %-16s %12.1fKB %12.1fKB %12.3fms %12.3fms\n", "own heap", own.memory / 1024.0, 0.0, own.cold_ms, own.warm_ms);
+
+  std::shared_ptr<ResourceStore> store = std::make_shared<ResourceStore>(*probe);
+  StartupResult shared = start_instances(instances, chapter, store);
+  printf("  %-16s %12.1fKB %12.1fKB %12.3fms %12.3fms\n", "shared store", shared.memory / 1024.0,
+    store->unpacked_bytes / 1024.0, shared.cold_ms, shared.warm_ms);
+
+  // each engine maps the pack itself, as separate processes would
+  if (AssetPack::open(*probe)) {
+    StartupResult packed = start_instances(instances, chapter, nullptr, true);
+    printf("  %-16s %12.1fKB %12.1fKB %12.3fms %12.3fms\n", "asset pack", packed.memory / 1024.0, 0.0, packed.cold_ms, packed.warm_ms);
+  }
+
+  printf("\n  %u resources unpacked into the store in %.3fms, %u instances need %.1fKB rather than %.1fKB\n",
+    store->unpacked.load(), store->unpack_ns / 1e6, instances,
+    (shared.memory * instances + store->unpacked_bytes) / 1024.0, own.memory * instances / 1024.0);
+
+  return 0;
+}
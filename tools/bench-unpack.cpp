@@ -0,0 +1,140 @@
+/*
+  ByteKiller unpacking benchmarks
+
+  usage: bench unpack <data directory> [chunk bytes]
+
+  every packed resource in the banks is unpacked three ways: in place, as
+  the engine does when it reads a resource into its heap, out of place
+  straight from the bank's bytes as the engine does when it can map the
+  bank, and incrementally `chunk bytes` (default 4096) at a time as a
+  resource spread across several frames would be. the banks are read
+  into memory up front so only the unpacking is timed. reports the total
+  time for each and, for the incremental unpacking, the longest single
+  step, which is what a frame would have to absorb
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "bench.hpp"
+#include "host.hpp"
+#include "../another-world/byte-killer.hpp"
+
+using namespace another_world;
+
+struct PackedData {
+  uint16_t id;
+  std::vector<uint8_t> packed;
+  uint32_t size;
+};
+
+int bench_unpack(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("  skipped, needs a data directory (bench unpack <data directory> [chunk bytes])\n");
+    return 0;
+  }
+
+  uint32_t chunk = argc > 1 ? std::max(1, atoi(argv[1])) : 4096;
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  static const char hex[] = "0123456789abcdef";
+  ResourceTable& resources = engine->resources;
+  std::vector<PackedData> items;
+  uint64_t packed_bytes = 0, unpacked_bytes = 0;
+  uint32_t largest = 0;
+  for (uint16_t id = 0; id < resources.size(); id++) {
+    if (resources.packed_sizes[id] == resources.sizes[id]) {
+      continue;
+    }
+
+    PackedData item = { id, std::vector<uint8_t>(resources.packed_sizes[id]), resources.sizes[id] };
+    std::string bank_filename = std::string("bank0") + hex[resources.bank_ids[id] & 0x0f];
+    if (!engine->read_file(engine->user, bank_filename, resources.bank_offsets[id], uint32_t(item.packed.size()), (char*)item.packed.data())) {
+      printf("  unable to read resource %u from %s\n", id, bank_filename.c_str());
+      return 1;
+    }
+
+    packed_bytes += item.packed.size();
+    unpacked_bytes += item.size;
+    largest = std::max(largest, item.size);
+    items.push_back(std::move(item));
+  }
+
+  if (items.empty()) {
+    printf("  skipped, no packed resources in the banks\n");
+    return 0;
+  }
+
+  std::vector<uint8_t> buffer(std::max<size_t>(largest, 0xffff));
+  uint32_t failed = 0;
+
+  double in_place_ns = measure_ns([&]() {
+    for (auto& item : items) {
+      memcpy(buffer.data(), item.packed.data(), item.packed.size());
+      ByteKiller bk;
+      failed += bk.unpack(buffer.data(), uint32_t(item.packed.size()), buffer.data(), item.size) ? 0 : 1;
+    }
+    keep(buffer.data());
+  });
+
+  double out_of_place_ns = measure_ns([&]() {
+    for (auto& item : items) {
+      ByteKiller bk;
+      failed += bk.unpack(item.packed.data(), uint32_t(item.packed.size()), buffer.data(), item.size) ? 0 : 1;
+    }
+    keep(buffer.data());
+  });
+
+  // the longest step is taken from a single pass, the total from the
+  // measured mean
+  using clock = std::chrono::steady_clock;
+  double longest_step_ns = 0;
+  uint32_t steps = 0;
+  auto incremental = [&](bool timed) {
+    for (auto& item : items) {
+      ByteKiller bk;
+      if (!bk.begin(item.packed.data(), uint32_t(item.packed.size()), buffer.data(), item.size)) {
+        failed++;
+        continue;
+      }
+
+      ByteKiller::Status status;
+      do {
+        clock::time_point start = clock::now();
+        status = bk.step(chunk);
+        if (timed) {
+          longest_step_ns = std::max(longest_step_ns, double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()));
+          steps++;
+        }
+      } while (status == ByteKiller::Status::RUNNING);
+      failed += status == ByteKiller::Status::DONE ? 0 : 1;
+    }
+    keep(buffer.data());
+  };
+  double incremental_ns = measure_ns([&]() { incremental(false); });
+  incremental(true);
+
+  printf("  %zu packed resources, %.1fKB unpacking to %.1fKB (largest %.1fKB)\n\n", items.size(),
+    packed_bytes / 1024.0, unpacked_bytes / 1024.0, largest / 1024.0);
+  printf("  %-24s %12s %12s\n", "", "total", "MB/s");
+  printf("  %-24s %10.3fms %12.1f\n", "in place", in_place_ns / 1e6, unpacked_bytes * 1000.0 / in_place_ns);
+  printf("  %-24s %10.3fms %12.1f\n", "out of place", out_of_place_ns / 1e6, unpacked_bytes * 1000.0 / out_of_place_ns);
+  printf("  %-24s %10.3fms %12.1f\n", "incremental", incremental_ns / 1e6, unpacked_bytes * 1000.0 / incremental_ns);
+  printf("\n  %u incremental steps of at least %u bytes, the longest took %.1fus\n", steps, chunk, longest_step_ns / 1000.0);
+
+  if (failed) {
+    printf("  %u unpacks FAILED\n", failed);
+    return 1;
+  }
+  return 0;
+}
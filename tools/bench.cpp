@@ -0,0 +1,55 @@
+/*
+  benchmark suite runner
+
+  usage: bench [suite] [suite arguments]
+
+  with no suite given every suite is run
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hpp"
+#include "commands.hpp"
+
+const BenchmarkSuite suites[] = {
+  { "framebuffer", "raster kernels for the packed and chunky pixel formats", bench_framebuffer },
+  { "presenter", "page to host pixel conversion", bench_presenter },
+  { "scale", "page to upscaled XRGB32 surface at 1x, 3x and 4x", bench_scale },
+  { "mixer", "four channel sound mixing (--wav <path> to save the output)", bench_mixer },
+  { "music", "music sequencer at 44.1kHz (--wav <path> to save the output)", bench_music },
+  { "snapshot", "save state size and speed (optionally [data directory] [frames])", bench_snapshot },
+  { "rewind", "rewind capture cost and seek time (optionally [data directory] [frames])", bench_rewind },
+  { "store", "memory and start up time with a shared resource store (needs <data directory>)", bench_store },
+  { "unpack", "ByteKiller in place, out of place and incremental (needs <data directory>)", bench_unpack },
+  { "log", "per line log file writes against the asynchronous logger", bench_log }
+};
+
+int bench(int argc, char* argv[]) {
+  if (argc > 0 && (strcmp(argv[0], "--help") == 0 || strcmp(argv[0], "-h") == 0)) {
+    printf("usage: bench [suite] [suite arguments]\n\n");
+    for (auto& suite : suites) {
+      printf("  %-12s %s\n", suite.name, suite.description);
+    }
+    return 0;
+  }
+
+  if (argc == 0) {
+    int result = 0;
+    for (auto& suite : suites) {
+      printf("== %s ==\n", suite.name);
+      result |= suite.run(0, nullptr);
+      printf("\n");
+    }
+    return result;
+  }
+
+  for (auto& suite : suites) {
+    if (strcmp(argv[0], suite.name) == 0) {
+      return suite.run(argc - 1, argv + 1);
+    }
+  }
+
+  printf("unknown benchmark suite '%s'\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/*
+  tiny benchmarking helpers shared by the benchmark suites
+*/
+
+// calls `fn` repeatedly for at least `min_ms` milliseconds and returns the
+// mean time taken per call in nanoseconds
+template<typename F>
+double measure_ns(F fn, uint32_t min_ms = 250) {
+  using clock = std::chrono::steady_clock;
+
+  // warm up caches and branch predictors before timing
+  fn();
+
+  uint64_t calls = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (elapsed < std::chrono::milliseconds(min_ms)) {
+    fn();
+    calls++;
+    elapsed = clock::now() - start;
+  }
+
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(calls);
+}
+
+// written by keep(), the pointer itself is volatile so every store to it
+// has to happen
+inline const void* volatile bench_sink = nullptr;
+
+// stops the optimiser from discarding results that are otherwise unused
+inline void keep(const void* p) {
+  bench_sink = p;
+}
+
+struct BenchmarkSuite {
+  const char* name;
+  const char* description;
+  int (*run)(int argc, char* argv[]);
+};
+
+int bench_framebuffer(int argc, char* argv[]);
+int bench_log(int argc, char* argv[]);
+int bench_mixer(int argc, char* argv[]);
+int bench_music(int argc, char* argv[]);
+int bench_presenter(int argc, char* argv[]);
+int bench_rewind(int argc, char* argv[]);
+int bench_scale(int argc, char* argv[]);
+int bench_snapshot(int argc, char* argv[]);
+int bench_store(int argc, char* argv[]);
+int bench_unpack(int argc, char* argv[]);
@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+  headless command line tools built on top of the portable engine code
+
+  each command receives the arguments that follow its name on the command
+  line and returns the process exit code
+*/
+
+int batch(int argc, char* argv[]);
+int bench(int argc, char* argv[]);
+int disasm(int argc, char* argv[]);
+int logfmt(int argc, char* argv[]);
+int pack(int argc, char* argv[]);
+int repack(int argc, char* argv[]);
+int sound(int argc, char* argv[]);
+int music(int argc, char* argv[]);
+int run(int argc, char* argv[]);
@@ -0,0 +1,132 @@
+/*
+  disassembles bytecode resources and builds their control flow graphs
+
+  usage: disasm <data directory> [chapter or resource id] [--bytes] [--dot <file>]
+
+  with no chapter (16000 - 16009) or resource id every chapter's code is
+  analysed, verified and summarised, otherwise the reachable code is
+  listed block by block along with anything that would trip up the
+  interpreter and whether the vm can run it unchecked.
+  --bytes shows each instruction's encoding and --dot writes the control
+  flow graph in graphviz format
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/disassembler.hpp"
+#include "../another-world/verifier.hpp"
+#include "../another-world/virtual-machine.hpp"
+
+using namespace another_world;
+
+// problems that stop the code being verified, warnings don't count
+static size_t count_problems(const std::vector<CodeAnalysis::Problem>& problems) {
+  size_t count = 0;
+  for (auto& problem : problems) {
+    count += problem.warning ? 0 : 1;
+  }
+  return count;
+}
+
+// loads code resource `id`, returns nullptr and prints a message if it
+// isn't one
+static const uint8_t* load_code(Engine& engine, uint16_t id) {
+  if (!engine.resources.is(id, Resource::Type::BYTECODE)) {
+    printf("resource %u is not bytecode\n", id);
+    return nullptr;
+  }
+
+  engine.resources.set_state(id, Resource::State::NEEDS_LOADING);
+  engine.load_needed_resources();
+  return engine.resources.state(id) == Resource::State::LOADED ? engine.resources.data[id] : nullptr;
+}
+
+int disasm(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("usage: disasm <data directory> [chapter or resource id] [--bytes] [--dot <file>]\n");
+    return 1;
+  }
+
+  int32_t id = -1;
+  bool bytes = false;
+  std::string dot_path;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bytes") == 0) {
+      bytes = true;
+    } else if (strcmp(argv[i], "--dot") == 0 && i + 1 < argc) {
+      dot_path = argv[++i];
+    } else {
+      id = int32_t(strtoul(argv[i], nullptr, 0));
+    }
+  }
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  if (id < 0) {
+    printf("%-8s %-8s %8s %12s %8s %8s %12s %9s %9s %9s\n", "chapter", "resource", "bytes", "instructions", "blocks", "entries", "subroutines", "problems",
+      "warnings", "verified");
+
+    int result = 0;
+    for (uint16_t chapter = 0; chapter < 10; chapter++) {
+      uint16_t resource = chapter_resources[chapter].code;
+      if (!engine->resources.is(resource, Resource::Type::BYTECODE)) {
+        continue;
+      }
+
+      const uint8_t* code = load_code(*engine, resource);
+      if (!code) {
+        result = 1;
+        continue;
+      }
+
+      CodeAnalysis analysis = analyse_code(code, engine->resources.sizes[resource]);
+      VerifiedCode verified = verify_code(code, engine->resources.sizes[resource]);
+      size_t problems = count_problems(analysis.problems);
+      printf("%-8u %-8u %8u %12zu %8zu %8zu %12zu %9zu %9zu %9s\n", 16000 + chapter, resource, analysis.size, analysis.instructions.size(),
+        analysis.blocks.size(), analysis.entries.size(), analysis.subroutines.size(), problems, analysis.problems.size() - problems,
+        verified.verified ? "yes" : "no");
+      result |= verified.verified ? 0 : 1;
+    }
+    return result;
+  }
+
+  // chapters are given by their load id, anything else is a resource
+  uint16_t resource = id >= 16000 && id < 16010 ? chapter_resources[id - 16000].code : uint16_t(id);
+  const uint8_t* code = load_code(*engine, resource);
+  if (!code) {
+    return 1;
+  }
+
+  CodeAnalysis analysis = analyse_code(code, engine->resources.sizes[resource]);
+  size_t problems = count_problems(analysis.problems);
+  printf("resource %u: %u bytes, %zu reachable instructions in %zu blocks, %zu entry points, %zu subroutines, %zu problems, %zu warnings\n",
+    resource, analysis.size, analysis.instructions.size(), analysis.blocks.size(), analysis.entries.size(), analysis.subroutines.size(),
+    problems, analysis.problems.size() - problems);
+  printf("%s", analysis.listing(bytes ? code : nullptr).c_str());
+
+  VerifiedCode verified = verify_code(code, engine->resources.sizes[resource]);
+  if (verified.verified) {
+    printf("verified: runs unchecked, calls nest at most %u deep\n", verified.max_call_depth);
+  } else {
+    printf("not verified: runs checked\n");
+    for (auto& problem : verified.problems) {
+      printf("  [%05u] %s\n", problem.address, problem.message.c_str());
+    }
+  }
+
+  if (!dot_path.empty() && !write_output(dot_path, analysis.dot())) {
+    return 1;
+  }
+
+  return verified.verified ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "host.hpp"
+
+static std::string data_directory;
+
+static std::string data_path(const std::string& filename) {
+  if (data_directory.empty()) {
+    return filename;
+  }
+
+  char last = data_directory.back();
+  return (last == '/' || last == '\\') ? data_directory + filename : data_directory + "/" + filename;
+}
+
+bool use_data_directory(another_world::Engine& engine, const std::string& directory) {
+  data_directory = directory;
+  use_data_files(engine);
+
+  char c;
+  if (!engine.read_file(engine.user, "memlist.bin", 0, 1, &c)) {
+    printf("no game data (memlist.bin) found in '%s'\n", directory.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void use_data_files(another_world::Engine& engine) {
+  engine.read_file = [](void* user, std::string filename, uint32_t offset, uint32_t length, char* buffer) {
+    FILE* file = fopen(data_path(filename).c_str(), "rb");
+    if (!file) {
+      return false;
+    }
+
+    bool result = fseek(file, offset, SEEK_SET) == 0 && fread(buffer, 1, length, file) == length;
+    fclose(file);
+    return result;
+  };
+
+  engine.file_size = [](void* user, std::string filename) {
+    FILE* file = fopen(data_path(filename).c_str(), "rb");
+    if (!file) {
+      return uint32_t(0);
+    }
+
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : 0;
+    fclose(file);
+    return size > 0 ? uint32_t(size) : uint32_t(0);
+  };
+
+  engine.map_file = [](void* user, std::string filename, uint32_t* size) -> const uint8_t* {
+    std::string path = data_path(filename);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      return nullptr;
+    }
+
+    // the view keeps the mapping alive once the handles are closed
+    *size = GetFileSize(file, NULL);
+    HANDLE mapping = *size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return (const uint8_t*)data;
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+      return nullptr;
+    }
+
+    struct stat status;
+    void* data = MAP_FAILED;
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+      *size = uint32_t(status.st_size);
+      data = mmap(nullptr, *size, PROT_READ, MAP_SHARED, file, 0);
+    }
+    close(file);
+    return data != MAP_FAILED ? (const uint8_t*)data : nullptr;
+#endif
+  };
+
+  engine.unmap_file = [](void* user, const uint8_t* data, uint32_t size) {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+  };
+
+  engine.write_file = [](void* user, std::string filename, uint32_t length, char* buffer) {
+    FILE* file = fopen(data_path(filename).c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+
+    bool result = fwrite(buffer, 1, length, file) == length;
+    fclose(file);
+    return result;
+  };
+}
+
+bool write_output(const std::string& path, const std::string& data) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file || fwrite(data.data(), 1, data.size(), file) != data.size()) {
+    printf("unable to write '%s'\n", path.c_str());
+    if (file) {
+      fclose(file);
+    }
+    return false;
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool read_input(const std::string& path, std::vector<uint8_t>& data) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    printf("unable to read '%s'\n", path.c_str());
+    return false;
+  }
+
+  data.clear();
+  uint8_t buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + count);
+  }
+
+  fclose(file);
+  return true;
+}
+
+void use_null_display(another_world::Engine& engine) {
+  engine.update_screen = [](void* user, uint8_t* buffer) {};
+  engine.set_palette = [](void* user, uint16_t* palette) {};
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../another-world/virtual-machine.hpp"
+
+/*
+  host callbacks for running the engine headless from the command line
+
+  the engine reads its data through its read_file, file_size and
+  map_file (and write_file) callbacks, these implementations use the C
+  standard library (and the platform's file mapping) to access files in
+  a data directory given on the command line. the directory is shared by
+  every engine the callbacks are installed into.
+*/
+
+// install the file callbacks, all engine file names are relative to
+// `directory`. returns false and prints a message if the directory doesn't
+// contain the game data
+bool use_data_directory(another_world::Engine& engine, const std::string& directory);
+
+// install the file callbacks for the directory already chosen with
+// use_data_directory(), safe to call from several threads at once
+void use_data_files(another_world::Engine& engine);
+
+// write `data` to `path` (not relative to the data directory), returns
+// false and prints a message if the file couldn't be written
+bool write_output(const std::string& path, const std::string& data);
+
+// read the whole of `path` (not relative to the data directory) into
+// `data`, returns false and prints a message if the file couldn't be read
+bool read_input(const std::string& path, std::vector<uint8_t>& data);
+
+// install display callbacks that discard frames and palette changes
+void use_null_display(another_world::Engine& engine);
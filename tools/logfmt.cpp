@@ -0,0 +1,66 @@
+/*
+  formats a binary log written by the asynchronous logger back into text
+
+  usage: logfmt <log file> [--timestamps] [--output <file>]
+
+  prints the lines the game would have written to vm.log, in the order
+  they were logged. --timestamps starts each line with the time since the
+  logger was opened (in seconds) and the thread that logged it. the text
+  goes to standard output unless --output is given
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/logger.hpp"
+
+using namespace another_world;
+
+int logfmt(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("usage: logfmt <log file> [--timestamps] [--output <file>]\n");
+    return 1;
+  }
+
+  bool timestamps = false;
+  std::string output_path;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--timestamps") == 0) {
+      timestamps = true;
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      output_path = argv[++i];
+    } else {
+      printf("unknown argument '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<uint8_t> data;
+  if (!read_input(argv[0], data)) {
+    return 1;
+  }
+
+  std::string text;
+  bool complete = format_log(data.data(), data.size(), text, timestamps);
+  if (!complete && text.empty()) {
+    printf("'%s' is not a log written by the logger (or is a different version)\n", argv[0]);
+    return 1;
+  }
+
+  if (!output_path.empty()) {
+    if (!write_output(output_path, text)) {
+      return 1;
+    }
+  } else {
+    fwrite(text.data(), 1, text.size(), stdout);
+  }
+
+  if (!complete) {
+    fprintf(stderr, "'%s' ends part way through an entry, it was formatted up to that point\n", argv[0]);
+  }
+  return 0;
+}
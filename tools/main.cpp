@@ -0,0 +1,49 @@
+// main.cpp : headless tools for the engine (benchmarks, etc.)
+//
+
+#include <cstdio>
+#include <cstring>
+
+#include "commands.hpp"
+
+struct Command {
+  const char* name;
+  const char* description;
+  int (*run)(int argc, char* argv[]);
+};
+
+const Command commands[] = {
+  { "batch", "replay many recorded sessions in parallel", batch },
+  { "bench", "run benchmark suites (bench --help for a list)", bench },
+  { "disasm", "disassemble bytecode and build its control flow graph", disasm },
+  { "logfmt", "format a binary log from the game as text", logfmt },
+  { "pack", "build an asset pack of the game data ready to use", pack },
+  { "repack", "repack the banks with the ByteKiller packer", repack },
+  { "run", "run the game headless, recording or replaying input", run },
+  { "sound", "render a SOUND resource to a WAV file", sound },
+  { "music", "render a MUSIC resource to a WAV file", music }
+};
+
+void usage() {
+  printf("usage: AnotherWorldTools <command> [arguments]\n\n");
+  for (auto& command : commands) {
+    printf("  %-10s %s\n", command.name, command.description);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+
+  for (auto& command : commands) {
+    if (strcmp(argv[1], command.name) == 0) {
+      return command.run(argc - 2, argv + 2);
+    }
+  }
+
+  printf("unknown command '%s'\n\n", argv[1]);
+  usage();
+  return 1;
+}
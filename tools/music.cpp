@@ -0,0 +1,82 @@
+/*
+  renders a MUSIC resource to a WAV file through the sequencer and mixer
+
+  usage: music <data directory> <resource id> <output.wav> [seconds] [period] [order]
+
+  the whole module is rendered unless it runs for longer than `seconds`
+  (default 300). period and order take the same values as the music
+  opcode
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/virtual-machine.hpp"
+
+using namespace another_world;
+
+int music(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: music <data directory> <resource id> <output.wav> [seconds] [period] [order]\n");
+    return 1;
+  }
+
+  uint16_t id = uint16_t(strtoul(argv[1], nullptr, 0));
+  uint32_t seconds = argc > 3 ? uint32_t(atoi(argv[3])) : 300;
+  uint16_t period = argc > 4 ? uint16_t(atoi(argv[4])) : 0;
+  uint8_t order = argc > 5 ? uint8_t(atoi(argv[5])) : 0;
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  if (!engine->resources.is(id, Resource::Type::MUSIC)) {
+    printf("resource %u is not music\n", id);
+    return 1;
+  }
+
+  // load the module along with all of its instruments
+  engine->resources.set_state(id, Resource::State::NEEDS_LOADING);
+  engine->load_needed_resources();
+
+  const uint8_t* module = engine->resources.data[id];
+  for (uint8_t i = 0; i < Sequencer::INSTRUMENT_COUNT; i++) {
+    uint16_t instrument = Sequencer::instrument_resource(module, i);
+    if (instrument != 0 && instrument < engine->resources.size()) {
+      engine->resources.set_state(instrument, Resource::State::NEEDS_LOADING);
+    }
+  }
+  engine->load_needed_resources();
+
+  const uint8_t* sounds[Sequencer::INSTRUMENT_COUNT];
+  uint32_t sound_sizes[Sequencer::INSTRUMENT_COUNT];
+  for (uint8_t i = 0; i < Sequencer::INSTRUMENT_COUNT; i++) {
+    uint16_t instrument = Sequencer::instrument_resource(module, i);
+    bool loaded = instrument != 0 && engine->resources.is(instrument, Resource::Type::SOUND);
+    sounds[i] = loaded ? engine->resources.data[instrument] : nullptr;
+    sound_sizes[i] = loaded ? engine->resources.sizes[instrument] : 0;
+  }
+
+  int16_t registers[REGISTER_COUNT] = { 0 };
+  Mixer mixer;
+  Sequencer sequencer(mixer, registers);
+  sequencer.load(module, engine->resources.sizes[id], sounds, sound_sizes, period, order);
+  sequencer.start();
+
+  std::vector<int16_t> samples;
+  for (uint32_t s = 0; s < seconds && sequencer.playing; s++) {
+    size_t start = samples.size();
+    samples.resize(start + mixer.sample_rate);
+    mixer.mix(&samples[start], mixer.sample_rate);
+  }
+
+  printf("%.2f seconds, %u orders, period %u\n", samples.size() / float(mixer.sample_rate), sequencer.order_count, sequencer.period);
+
+  return write_output(argv[2], encode_wav(samples.data(), uint32_t(samples.size()), mixer.sample_rate)) ? 0 : 1;
+}
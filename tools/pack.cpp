@@ -0,0 +1,111 @@
+/*
+  builds an asset pack from the original game data
+
+  usage: pack <data directory> [--min-speed <MB/s>]
+
+  every resource is read out of the banks, unpacked and (for images)
+  converted to the framebuffer format, then written to another-world.awpk
+  in the data directory where run --pack, batch --pack and the game pick
+  it up (see asset-pack.hpp). the pack is then reopened and every resource in
+  it decoded and checked against its checksum. the pack depends on the
+  framebuffer format the tools are built with
+
+  by default everything is stored raw, ready to use in place. with
+  --min-speed each resource is stored with whichever codec makes it
+  smallest while still decoding at least that fast (0 for the smallest
+  regardless). the size and decode time of each resource with each codec
+  is listed along with the one chosen
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/asset-pack.hpp"
+
+using namespace another_world;
+
+static const char* type_name(Resource::Type type) {
+  static const char* names[] = { "sound", "music", "image", "palette", "bytecode", "polygon", "bank" };
+  return uint8_t(type) < 7 ? names[uint8_t(type)] : "?";
+}
+
+int pack(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("usage: pack <data directory> [--min-speed <MB/s>]\n");
+    return 1;
+  }
+
+  PackOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if (option == "--min-speed" && i + 1 < argc) {
+      options.min_speed = atof(argv[++i]);
+    } else {
+      printf("unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now();
+
+  std::vector<PackedResource> report;
+  std::vector<uint8_t> data = build_asset_pack(*engine, options, &report);
+  double build_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  printf("%-5s %-9s %8s   %-21s %-21s %-21s %s\n", "id", "type", "bytes", "raw", "lz", "bytekiller", "chosen");
+  uint64_t decoded_bytes = 0, stored_bytes = 0;
+  double decode_ns = 0;
+  for (auto& resource : report) {
+    printf("%-5u %-9s %8u", resource.id, type_name(resource.type), resource.length);
+    for (uint8_t codec = 0; codec < 3; codec++) {
+      char column[32] = "-";
+      if (resource.sizes[codec]) {
+        snprintf(column, sizeof(column), "%u %.1fus", resource.sizes[codec], resource.decode_ns[codec] / 1000.0);
+      }
+      printf("   %-21s", column);
+    }
+    printf(" %s\n", AssetPack::codec_name(resource.codec));
+
+    decoded_bytes += resource.length;
+    stored_bytes += resource.sizes[uint8_t(resource.codec)];
+    decode_ns += resource.decode_ns[uint8_t(resource.codec)];
+  }
+
+  if (!engine->write_file(engine->user, AssetPack::FILENAME, uint32_t(data.size()), (char*)data.data())) {
+    printf("unable to write %s\n", AssetPack::FILENAME);
+    return 1;
+  }
+
+  // check the pack reads back as the engine will see it
+  start = clock::now();
+  std::shared_ptr<AssetPack> pack = AssetPack::open(*engine);
+  uint32_t verified = 0;
+  for (auto& resource : report) {
+    std::vector<uint8_t> contents(resource.length);
+    verified += pack && pack->unpack(resource.id, contents.data()) ? 1 : 0;
+  }
+  double verify_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  printf("\n%s: %.1fKB (%.1fKB of resources stored in %.1fKB), %u of %u resources built in %.3fms\n", AssetPack::FILENAME,
+    data.size() / 1024.0, decoded_bytes / 1024.0, stored_bytes / 1024.0, uint32_t(report.size()), engine->resources.size(), build_ms);
+  printf("decoding everything takes %.3fms, %u verified in %.3fms\n", decode_ns / 1e6, verified, verify_ms);
+
+  if (!pack || verified != report.size()) {
+    printf("the pack didn't read back correctly\n");
+    return 1;
+  }
+  return 0;
+}
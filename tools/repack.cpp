@@ -0,0 +1,200 @@
+/*
+  rebuilds the banks and memlist.bin, repacking every resource
+
+  usage: repack <data directory> <output directory> [options]
+
+    --threads <n>            threads to search for matches with (default
+                             one per core)
+    --replace <id> <file>    use the contents of <file> for resource <id>
+                             (decimal or 0x hex) in place of the original,
+                             e.g. an edited palette. images are 4
+                             bitplanes as in the banks
+
+  every resource is unpacked and packed again with byte_killer_pack(),
+  keeping whichever of the original and the new packing is smaller (a
+  replaced resource is always packed anew). each packed resource is
+  unpacked again, out of place and in place, and checked before it's
+  written. the banks are written to the output directory in the original
+  format with each resource in its original bank and order, along with a
+  memlist.bin pointing at them, ready for the game to load.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/byte-killer.hpp"
+#include "../another-world/byte-killer-packer.hpp"
+
+using namespace another_world;
+
+static void write_uint32_bigendian(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v >> 24);
+  p[1] = uint8_t(v >> 16);
+  p[2] = uint8_t(v >> 8);
+  p[3] = uint8_t(v);
+}
+
+static std::string bank_filename(uint8_t bank_id) {
+  static const char hex[] = "0123456789abcdef";
+  return std::string("bank0") + hex[bank_id & 0x0f];
+}
+
+// true if `packed` unpacks to `data` both out of place and in place
+static bool round_trips(const std::vector<uint8_t>& packed, const std::vector<uint8_t>& data) {
+  uint32_t size = uint32_t(data.size());
+  std::vector<uint8_t> unpacked(std::max(packed.size(), data.size()));
+
+  ByteKiller bk;
+  if (!bk.unpack(packed.data(), uint32_t(packed.size()), unpacked.data(), size) || memcmp(unpacked.data(), data.data(), size) != 0) {
+    return false;
+  }
+
+  memcpy(unpacked.data(), packed.data(), packed.size());
+  return bk.unpack(unpacked.data(), uint32_t(packed.size()), unpacked.data(), size) &&
+    memcmp(unpacked.data(), data.data(), size) == 0;
+}
+
+int repack(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("usage: repack <data directory> <output directory> [--threads <n>] [--replace <id> <file>]...\n");
+    return 1;
+  }
+
+  std::string output = argv[1];
+  uint32_t threads = 0;
+  std::map<uint16_t, std::vector<uint8_t>> replacements;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    if (option == "--threads" && i + 1 < argc) {
+      threads = uint32_t(std::max(1, atoi(argv[++i])));
+    } else if (option == "--replace" && i + 2 < argc) {
+      uint16_t id = uint16_t(strtoul(argv[++i], nullptr, 0));
+      if (!read_input(argv[++i], replacements[id])) {
+        return 1;
+      }
+    } else {
+      printf("unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  // the records are rewritten in place, so anything in them that isn't
+  // understood survives
+  uint32_t memlist_size = engine->file_size(engine->user, "memlist.bin");
+  std::vector<uint8_t> memlist(memlist_size);
+  if (!memlist_size || !engine->read_file(engine->user, "memlist.bin", 0, memlist_size, (char*)memlist.data())) {
+    printf("unable to read memlist.bin\n");
+    return 1;
+  }
+
+  ResourceTable& resources = engine->resources;
+  for (auto& replacement : replacements) {
+    uint16_t id = replacement.first;
+    if (id >= resources.size() || replacement.second.empty() || replacement.second.size() > 0xffff) {
+      printf("can't replace resource 0x%x with %zu bytes\n", id, replacement.second.size());
+      return 1;
+    }
+  }
+
+  // each bank's resources in the order they were in
+  std::vector<uint16_t> order(resources.size());
+  for (uint16_t id = 0; id < order.size(); id++) {
+    order[id] = id;
+  }
+  std::stable_sort(order.begin(), order.end(), [&resources](uint16_t a, uint16_t b) {
+    return resources.bank_ids[a] != resources.bank_ids[b] ? resources.bank_ids[a] < resources.bank_ids[b] :
+      resources.bank_offsets[a] < resources.bank_offsets[b];
+  });
+
+  using clock = std::chrono::steady_clock;
+  double pack_ms = 0;
+  uint32_t repacked = 0;
+  uint64_t original_bytes = 0;
+  std::map<uint8_t, std::vector<uint8_t>> banks;
+
+  for (uint16_t id : order) {
+    uint8_t bank_id = resources.bank_ids[id];
+    uint32_t packed_size = resources.packed_sizes[id];
+    uint32_t size = resources.sizes[id];
+    if (size == 0) {
+      continue;
+    }
+
+    std::vector<uint8_t> packed(packed_size), data(size);
+    if (!engine->read_file(engine->user, bank_filename(bank_id), resources.bank_offsets[id], packed_size, (char*)packed.data())) {
+      printf("unable to read resource 0x%x from %s\n", id, bank_filename(bank_id).c_str());
+      return 1;
+    }
+    original_bytes += packed_size;
+
+    ByteKiller bk;
+    if (packed_size != size && !bk.unpack(packed.data(), packed_size, data.data(), size)) {
+      printf("resource 0x%x doesn't unpack\n", id);
+      return 1;
+    }
+    if (packed_size == size) {
+      data = packed;
+    }
+
+    auto replacement = replacements.find(id);
+    bool replaced = replacement != replacements.end();
+    if (replaced) {
+      data = replacement->second;
+      size = uint32_t(data.size());
+      packed = data;
+    }
+
+    clock::time_point start = clock::now();
+    std::vector<uint8_t> repacked_data = byte_killer_pack(data.data(), size, threads);
+    pack_ms += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    if (!repacked_data.empty() && !round_trips(repacked_data, data)) {
+      printf("resource 0x%x doesn't unpack to what was packed\n", id);
+      return 1;
+    }
+    if (!repacked_data.empty() && (replaced || repacked_data.size() < packed.size())) {
+      packed.swap(repacked_data);
+      repacked++;
+    }
+
+    std::vector<uint8_t>& bank = banks[bank_id];
+    uint8_t* record = &memlist[id * 20];
+    write_uint32_bigendian(record + 8, uint32_t(bank.size()));
+    write_uint32_bigendian(record + 12, uint32_t(packed.size()));
+    write_uint32_bigendian(record + 16, size);
+    bank.insert(bank.end(), packed.begin(), packed.end());
+  }
+
+  std::filesystem::create_directories(output);
+  uint64_t written_bytes = 0;
+  for (auto& bank : banks) {
+    std::string path = (std::filesystem::path(output) / bank_filename(bank.first)).string();
+    if (!write_output(path, std::string(bank.second.begin(), bank.second.end()))) {
+      return 1;
+    }
+    written_bytes += bank.second.size();
+  }
+  if (!write_output((std::filesystem::path(output) / "memlist.bin").string(), std::string(memlist.begin(), memlist.end()))) {
+    return 1;
+  }
+
+  printf("%u of %u resources repacked smaller in %.1fms, %zu banks %.1fKB (originally %.1fKB)\n", repacked,
+    resources.size(), pack_ms, banks.size(), written_bytes / 1024.0, original_bytes / 1024.0);
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+  runs the game headless as fast as possible
+
+  usage: run <data directory> [options]
+
+    --frames <n>        number of frames to run (default 1000, or the
+                        length of the recording when replaying)
+    --chapter <id>      chapter to start from (default 16001)
+    --load <file>       start from a save state instead of a chapter
+    --save <file>       write a save state after the last frame
+    --record <file>     write the input of the run (always idle headless)
+                        along with the final frame hash
+    --replay <file>     feed a recorded input log to the vm and check the
+                        final frame hash matches the recording
+    --fast-forward <n>  only present every nth frame and skip drawing into
+                        pages that are never shown
+    --profile <file>    profile the bytecode (see profiler.hpp), print the
+                        hot spots of each chapter and write the time per
+                        call stack to <file> in the folded format read by
+                        flame graph tools (needs AW_PROFILER)
+    --trace <file>      time each frame's phases (see trace.hpp), print
+                        their percentiles and write the most recent events
+                        to <file> as a chrome trace (needs AW_TRACE)
+    --pack <file>       use the asset pack <file> in the data directory
+                        (see pack), falling back to the banks without it
+
+  the game's frame pacing is ignored. reports the time taken per frame and
+  how many times faster than real time the game ran, so replaying a
+  recorded session gives a repeatable benchmark. exits with 1 if a replay
+  doesn't match
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/asset-pack.hpp"
+#include "../another-world/input-log.hpp"
+#include "../another-world/snapshot.hpp"
+
+using namespace another_world;
+
+int run(int argc, char* argv[]) {
+  if (argc < 1) {
+    printf("usage: run <data directory> [--frames <n>] [--chapter <id>] [--load <file>] [--save <file>] [--record <file>] [--replay <file>] [--fast-forward <n>] [--profile <file>] [--trace <file>] [--pack <file>]\n");
+    return 1;
+  }
+
+  uint32_t frames = 1000;
+  bool frames_given = false;
+  uint16_t chapter = 16001;
+  uint32_t fast_forward = 0;
+  std::string load_path, save_path, record_path, replay_path, profile_path, trace_path, pack_path;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i];
+    if (option == "--frames") {
+      frames = uint32_t(atoi(argv[i + 1]));
+      frames_given = true;
+    } else if (option == "--chapter") {
+      chapter = uint16_t(atoi(argv[i + 1]));
+    } else if (option == "--load") {
+      load_path = argv[i + 1];
+    } else if (option == "--save") {
+      save_path = argv[i + 1];
+    } else if (option == "--record") {
+      record_path = argv[i + 1];
+    } else if (option == "--replay") {
+      replay_path = argv[i + 1];
+    } else if (option == "--fast-forward") {
+      fast_forward = uint32_t(atoi(argv[i + 1]));
+    } else if (option == "--profile") {
+      profile_path = argv[i + 1];
+    } else if (option == "--trace") {
+      trace_path = argv[i + 1];
+    } else if (option == "--pack") {
+      pack_path = argv[i + 1];
+    } else {
+      printf("unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+#ifndef AW_PROFILER
+  if (!profile_path.empty()) {
+    printf("--profile needs the tools built with AW_PROFILER defined (the Profile configuration)\n");
+    return 1;
+  }
+#endif
+#ifndef AW_TRACE
+  if (!trace_path.empty()) {
+    printf("--trace needs the tools built with AW_TRACE defined (the Profile configuration)\n");
+    return 1;
+  }
+#endif
+
+  std::unique_ptr<VirtualMachine> vm(new VirtualMachine());
+  if (!use_data_directory(vm->engine, argv[0])) {
+    return 1;
+  }
+  use_null_display(vm->engine);
+  if (!pack_path.empty()) {
+    vm->engine.pack = AssetPack::open(vm->engine, pack_path);
+    if (!vm->engine.pack) {
+      printf("no usable asset pack '%s', loading from the banks\n", pack_path.c_str());
+    }
+  }
+  vm->init();
+
+  InputLog replay;
+  if (!replay_path.empty()) {
+    std::vector<uint8_t> data;
+    if (!read_input(replay_path, data)) {
+      return 1;
+    }
+    if (!replay.decode(data.data(), uint32_t(data.size()))) {
+      printf("'%s' is not a valid input log\n", replay_path.c_str());
+      return 1;
+    }
+    if (replay.chapter == InputLog::FROM_SNAPSHOT && load_path.empty()) {
+      printf("'%s' starts from a save state, use --load to provide it\n", replay_path.c_str());
+      return 1;
+    }
+
+    chapter = replay.chapter;
+    if (!frames_given) {
+      frames = replay.frames();
+    }
+  }
+
+  if (!load_path.empty()) {
+    std::vector<uint8_t> data;
+    if (!read_input(load_path, data)) {
+      return 1;
+    }
+    if (!restore_snapshot(*vm, data.data(), uint32_t(data.size()))) {
+      printf("'%s' is not a compatible save state\n", load_path.c_str());
+      return 1;
+    }
+    chapter = InputLog::FROM_SNAPSHOT;
+  } else {
+    vm->initialise_chapter(chapter);
+  }
+
+  InputLog record;
+  record.chapter = chapter;
+
+  if (fast_forward) {
+    vm->set_fast_forward(true, fast_forward);
+  }
+
+#ifdef AW_PROFILER
+  std::unique_ptr<Profiler> profiler;
+  if (!profile_path.empty()) {
+    profiler.reset(new Profiler());
+    vm->profiler = profiler.get();
+  }
+#endif
+
+#ifdef AW_TRACE
+  std::unique_ptr<Trace> trace;
+  if (!trace_path.empty()) {
+    trace.reset(new Trace());
+    trace->name_thread("vm");
+    vm->engine.trace = trace.get();
+  }
+#endif
+
+  using clock = std::chrono::steady_clock;
+  clock::duration elapsed = clock::duration::zero();
+  uint64_t game_ticks = 0;
+
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    vm->engine.input = replay.frame(frame);
+    record.record(vm->engine.input);
+
+    clock::time_point start = clock::now();
+    {
+      AW_TRACE_SCOPE(vm->engine.trace, FRAME);
+      vm->execute_threads();
+    }
+    elapsed += clock::now() - start;
+
+    // each frame stays on screen for as many 20ms ticks as the pause
+    // register asks for
+    game_ticks += vm->registers[0xff] > 0 ? vm->registers[0xff] : 0;
+  }
+
+  vm->flush_pages();
+
+  uint64_t hash = frame_hash(*vm);
+  double ms = std::chrono::duration<double, std::milli>(elapsed).count();
+  double game_ms = game_ticks * 20.0;
+  printf("%u frames in %.1fms, %.3fms per frame, %.0f frames per second\n", frames, ms, frames ? ms / frames : 0.0, ms > 0 ? frames * 1000.0 / ms : 0.0);
+  printf("%.1fs of game time, %.0fx real time\n", game_ms / 1000.0, ms > 0 ? game_ms / ms : 0.0);
+  if (fast_forward) {
+    printf("fast forward: %u presents and %u draws skipped\n", vm->skipped_presents, vm->skipped_draws);
+  }
+  printf("final frame hash %016llx\n", (unsigned long long)hash);
+
+#ifdef AW_PROFILER
+  if (profiler) {
+    printf("\n%s", profiler->report().c_str());
+    if (!write_output(profile_path, profiler->folded_stacks())) {
+      return 1;
+    }
+  }
+#endif
+
+#ifdef AW_TRACE
+  if (trace) {
+    printf("\n%s", trace->report().c_str());
+    if (!write_output(trace_path, trace->chrome_json())) {
+      return 1;
+    }
+  }
+#endif
+
+  if (!save_path.empty()) {
+    std::vector<uint8_t> snapshot;
+    save_snapshot(*vm, snapshot);
+    if (!write_output(save_path, std::string(snapshot.begin(), snapshot.end()))) {
+      return 1;
+    }
+  }
+
+  if (!record_path.empty()) {
+    record.final_hash = hash;
+    std::vector<uint8_t> data = record.encode();
+    if (!write_output(record_path, std::string(data.begin(), data.end()))) {
+      return 1;
+    }
+  }
+
+  if (!replay_path.empty()) {
+    if (frames != replay.frames()) {
+      printf("replay: ran %u of %u recorded frames, hash not checked\n", frames, replay.frames());
+    } else if (hash != replay.final_hash) {
+      printf("replay: MISMATCH, recording ended with hash %016llx\n", (unsigned long long)replay.final_hash);
+      return 1;
+    } else {
+      printf("replay: match\n");
+    }
+  }
+
+  return 0;
+}
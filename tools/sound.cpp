@@ -0,0 +1,61 @@
+/*
+  renders a SOUND resource to a WAV file through the mixer
+
+  usage: sound <data directory> <resource id> <output.wav> [frequency] [volume] [seconds]
+
+  frequency (0 - 39) and volume (0 - 63) take the same values as the snd
+  opcode. samples that loop are rendered for `seconds` (default 5)
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "commands.hpp"
+#include "host.hpp"
+#include "../another-world/virtual-machine.hpp"
+
+using namespace another_world;
+
+int sound(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("usage: sound <data directory> <resource id> <output.wav> [frequency] [volume] [seconds]\n");
+    return 1;
+  }
+
+  uint16_t id = uint16_t(strtoul(argv[1], nullptr, 0));
+  uint8_t frequency = argc > 3 ? uint8_t(atoi(argv[3])) : 20;
+  uint8_t volume = argc > 4 ? uint8_t(atoi(argv[4])) : 63;
+  uint32_t seconds = argc > 5 ? uint32_t(atoi(argv[5])) : 5;
+
+  std::unique_ptr<Engine> engine(new Engine());
+  if (!use_data_directory(*engine, argv[0])) {
+    return 1;
+  }
+  engine->init_resources();
+
+  if (!engine->resources.is(id, Resource::Type::SOUND)) {
+    printf("resource %u is not a sound\n", id);
+    return 1;
+  }
+
+  engine->resources.set_state(id, Resource::State::NEEDS_LOADING);
+  engine->load_needed_resources();
+
+  Mixer mixer;
+  mixer.play_sound(0, engine->resources.data[id], engine->resources.sizes[id], frequency, volume);
+
+  // render a second at a time until the sound finishes or we hit the limit
+  std::vector<int16_t> samples;
+  for (uint32_t s = 0; s < seconds && mixer.channels[0].active; s++) {
+    size_t start = samples.size();
+    samples.resize(start + mixer.sample_rate);
+    mixer.mix(&samples[start], mixer.sample_rate);
+  }
+
+  printf("%.2f seconds at %u Hz\n", samples.size() / float(mixer.sample_rate), Mixer::frequencies[std::min<uint8_t>(frequency, 39)]);
+
+  return write_output(argv[2], encode_wav(samples.data(), uint32_t(samples.size()), mixer.sample_rate)) ? 0 : 1;
+}
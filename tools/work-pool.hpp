@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  work stealing thread pool for batches of independent tasks
+
+  the tasks are dealt out round robin into one queue per worker before
+  anything starts. each worker runs tasks from the front of its own queue
+  and once that is empty steals from the back of the other workers'
+  queues, so a few long tasks landing on the same worker don't leave the
+  rest of the cores idle at the end of a batch. dealing the longest tasks
+  out first gives the best balance.
+
+  tasks can't add more tasks, so once every queue is empty the batch is
+  done.
+*/
+
+struct WorkPool {
+  // statistics
+  std::atomic<uint32_t> steals{ 0 };
+
+  // calls fn(task, worker) for every entry of `tasks` across `workers`
+  // threads (the calling thread is one of them) and returns once all of
+  // them have finished
+  template<typename F>
+  void run(const std::vector<uint32_t>& tasks, uint32_t workers, F fn) {
+    workers = workers < 1 ? 1 : workers;
+
+    std::vector<Queue> queues(workers);
+    for (size_t i = 0; i < tasks.size(); i++) {
+      queues[i % workers].tasks.push_back(tasks[i]);
+    }
+
+    auto work = [&](uint32_t worker) {
+      uint32_t task;
+      while (next(queues, worker, task)) {
+        fn(task, worker);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t worker = 1; worker < workers; worker++) {
+      threads.emplace_back(work, worker);
+    }
+    work(0);
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<uint32_t> tasks;
+  };
+
+  bool next(std::vector<Queue>& queues, uint32_t worker, uint32_t& task) {
+    {
+      Queue& own = queues[worker];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.tasks.empty()) {
+        task = own.tasks.front();
+        own.tasks.pop_front();
+        return true;
+      }
+    }
+
+    for (uint32_t i = 1; i < queues.size(); i++) {
+      Queue& victim = queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tasks.empty()) {
+        task = victim.tasks.back();
+        victim.tasks.pop_back();
+        steals++;
+        return true;
+      }
+    }
+
+    return false;
+  }
+};